@@ -3,11 +3,13 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "audio.h"
 #include "audio_lua.h"
 #include "audio_private.h"
 #include "../console/console.h"
+#include "../profile/profile.h"
 #include "../scene/scene.h"
 #include "../script/script.h"
 #include "../wrap/wrap.h"
@@ -16,198 +18,562 @@ namespace aud
 {
 	con::Option
 		masterVolume("aud_master_volume", 1.0f),
-		maxAttenuation("aud_max_attenuation", 10.0f);
+		maxAttenuation("aud_max_attenuation", 10.0f),
+		mixThread("aud_mix_thread", true), // Applied on init
+		minLatency("aud_min_latency", 0.005f, con::PositiveOnly), // Seconds mixed ahead
+		maxLatency("aud_max_latency", 0.1f, con::PositiveOnly),
+		latencyShrinkTime("aud_latency_shrink_time", 2.0f), // Seconds without underruns
+		maxVoices("aud_max_voices", 64.0f, con::PositiveIntegerOnly), // Others are virtual
+		cullLoudnessTime("aud_cull_loudness_time", 0.05f); // Seconds ahead to rank voices by
 
 	// FIXME: struct
 	static const float EXP1 = exp(1.0f);
-	float *mix, *mixWrite, *mixEnd;
+	float *mix, *mixWrite, *mixEnd; // mixWrite is only touched by the mixer
 	float* mixRead; // Only library-dependent code may read/set this between LibInit and LibCleanUp
 	unsigned numMixFrames, numMixSamples, mixFrameRate;
-	__declspec(align(8)) volatile uint32_t numReadyFrames; // Atomic operations only
+	volatile uint32_t numReadyFrames; // wrp::Atomic* only
+	volatile uint32_t numUnderruns; // wrp::Atomic* only
+	bool libActive = false;
+
+	// Latency controller
+	const float			MIN_LATENCY = 0.001f, MAX_LATENCY = 1.0f; // Ring buffer holds max
+	const float			REFILL_MARGIN = 1.5f;
+	volatile uint32_t	mixWindow; // Frames the mixer keeps ready, wrp::Atomic* only
+	float				latency; // Seconds, main thread's copy of mixWindow
+	float				calmTime = 0.0f; // Seconds since the last underrun or shrink
+	uint32_t			lastAdaptUnderruns = 0;
+	unsigned long long	lastAdaptTime = 0;
+
+	// Snapshot queue, main thread produces and mixer consumes
+	const size_t NUM_MIX_SNAPSHOTS = 4;
+
+	struct mix_snapshot
+	{
+		com::Arr<mix_voice>	voices;
+		size_t				numVoices;
+		uint32_t			stamp; // mixedFrames when voices' curFrame was taken
+	};
+
+	mix_snapshot		mixSnapshots[NUM_MIX_SNAPSHOTS];
+	volatile uint32_t	snapHead = 0, snapTail = 0; // wrp::Atomic* only
+	uint32_t			snapReleased = 0; // Main thread; slots before this had their sounds unlocked
+	uint32_t			numSnapshots = 0, numDroppedSnapshots = 0;
+
+	// Mixer
+	void*				mixer = 0; // Thread, 0 if mixing inline in Update
+	volatile uint32_t	mixerQuit = 0;
+	volatile uint32_t	mixedFrames = 0; // Total frames clipped into mix, wrp::Atomic* only
+	uint32_t			lastMixedFrames = 0; // Main thread's copy at last Update
+	mixer_stats			mixerStats = {0};
+
+	// Per-block mix times and times between the ends of consecutive blocks in microseconds,
+	// indexed by numBlocks, written by the mixer
+	const size_t		NUM_MIX_TIMES = 256;
+	uint32_t			mixTimes[NUM_MIX_TIMES], refillTimes[NUM_MIX_TIMES];
+	unsigned long long	lastMixStart = 0;
+
+	// Virtualization; voices that aren't mixed still advance in Update
+	struct cull_voice
+	{
+		Voice*	voice;
+		float	score;
+		size_t	index; // In snapshot
+	};
+
+	com::Arr<cull_voice>	cullVoices;
+
+	struct voice_stats
+	{
+		uint32_t			numUpdates, lastReal, lastVirtual;
+		unsigned long long	numReal, numVirtual;
+	} voiceStats = {0};
+
+	// Frames the mixer got ahead between updates
+	struct update_stats
+	{
+		uint32_t			numUpdates, maxFrames;
+		unsigned long long	numFrames;
+	} updateStats = {0};
+
+	// Stats command
+	mixer_stats			lastMixerStats = {0};
+	null_device_stats	lastNullStats = {0};
+	uint32_t			lastNumSnapshots = 0, lastNumDroppedSnapshots = 0;
+	uint32_t			lastStatsUnderruns = 0;
+	update_stats		lastUpdateStats = {0};
+	voice_stats			lastVoiceStats = {0};
+
+	mix_snapshot*	NewMixSnapshot();
+	void			PublishMixSnapshot(mix_snapshot& snap, uint32_t stamp);
+	void			ReleaseMixSnapshots(uint32_t end);
+	size_t			CullVoices(mix_snapshot& snap, size_t numCandidates);
+	int				CompareCullVoices(const void* a, const void* b);
+	bool			MixAhead(bool all);
+	void			MixerProc(void* data);
+	void			AdaptLatency();
+	float			MixTimePercentile(const uint32_t* times, float p);
+	int				CompareMixTimes(const void* a, const void* b);
 }
 
+/*
+################################################################################################
+
+
+	UPDATE
+
+
+################################################################################################
+*/
+
 /*--------------------------------------
 	aud::Update
 
-FIXME: Optimize iteration over buffer
-FIXME: Separate thread?
-	Lock individual voices and active camera when editing/mixing
-	Keep fraction from last rendered frame (so sounds go with visuals)
-	...
-FIXME: Variable mixer-to-library latency
-	Keep latency at small safe value ~1/(updates per second), [0.001, 1] seconds
+Advances voices by however many frames the mixer clipped since the last update, then publishes a
+snapshot of every audible voice's final parameters for the mixer. Only the aud_max_voices loudest
+voices are mixed; the rest are virtual and keep their place without their samples being read. If
+aud_mix_thread was off at init, or the thread couldn't be started, mixes here.
 --------------------------------------*/
 void aud::Update()
 {
+	PRF_ZONE("aud::Update");
 	LibUpdate();
+	ReleaseMixSnapshots(wrp::AtomicLoad(snapTail));
+	uint32_t mixed = wrp::AtomicLoad(mixedFrames);
+	uint32_t numAdvance = mixed - lastMixedFrames;
+	lastMixedFrames = mixed;
+	updateStats.numUpdates++;
+	updateStats.numFrames += numAdvance;
+
+	if(numAdvance > updateStats.maxFrames)
+		updateStats.maxFrames = numAdvance;
+
+	AdaptLatency();
+	mix_snapshot* snap = NewMixSnapshot();
 	scn::Camera* cam = scn::ActiveCamera();
+	size_t numCandidates = 0, numVirtual = 0;
 
-	if(!cam)
-		return;
-
-	unsigned saveNumReadyFrames;
-
-	// x86 atomic fetch (assuming 4-byte alignment)
-	__asm
-	{
-		mov eax, numReadyFrames
-		mov saveNumReadyFrames, eax
-	}
-
-	unsigned numWrite = numMixFrames - saveNumReadyFrames;
-
-	if(!numWrite)
-		return;
-
-	unsigned start, end;
-	MixBufRange(mixWrite, numWrite, start, end);
-	unsigned cur = start;
-
-	// Clear samples
-	do
+	if(cam)
 	{
-		for(unsigned i = 0; i < AUD_NUM_MIX_CHANNELS; i++, cur++)
-			mix[cur] = 0.0f;
+		com::Vec3 camPos = cam->FinalPos();
+		com::Qua camOri = cam->FinalOri();
+		float volTimeAdd = wrp::timeStep.Float() * wrp::Fraction();
 
-		cur %= numMixSamples;
-	} while(cur != end);
+		for(com::linker<Voice>* it = Voice::List().f; it; it = it->next)
+		{
+			Voice& v = *it->o;
 
-	// Mix
-	com::Vec3 camPos = cam->FinalPos();
-	com::Qua camOri = cam->FinalOri();
-	float volTimeAdd = wrp::timeStep.Float() * wrp::Fraction();
+			if(!v.snd)
+				continue;
 
-	for(com::linker<Voice>* it = Voice::List().f; it; it = it->next)
-	{
-		Voice& v = *it->o;
+			const Sound& snd = *v.snd;
 
-		if(!v.snd)
-			continue;
+			if(snd.FrameRate() != mixFrameRate)
+				continue; // Loaded before the mixer was initialized
 
-		const Sound& snd = *v.snd;
+			if(numAdvance && !v.Advance(numAdvance * snd.NumChannels()))
+				continue;
 
-		if(snd.FrameRate() != mixFrameRate)
-			continue; // FIXME: resample while mixing or when sound is loaded
+			if(v.stream)
+				FillStream(*v.stream, snd.NumFrames(), (v.flags & v.LOOP) != 0);
 
-		float rad = v.FinalRadius();
-		float attn, left, right;
+			if(!snap)
+				continue;
 
-		if(v.flags & v.BACKGROUND)
-			attn = left = right = 1.0f;
-		else if(rad <= 0.0f)
-		{
-			v.Advance(numWrite * snd.NumChannels()); // FIXME: depends on sample rate being equal
-			continue;
-		}
-		else
-		{
-			com::Vec3 dif = v.FinalPos() - camPos;
-			float mag = dif.Mag();
+			float rad = v.FinalRadius();
+			float attn, left, right;
 
-			if(v.flags & v.LOGARITHMIC)
+			if(v.flags & v.BACKGROUND)
+				attn = left = right = 1.0f;
+			else if(rad <= 0.0f)
+				continue;
+			else
 			{
-				if(mag > 0.0f)
-				{
-					attn = 1.0f - log(mag * (EXP1 / rad));
+				com::Vec3 dif = v.FinalPos() - camPos;
+				float mag = dif.Mag();
 
-					if(attn > maxAttenuation.Float()) // FIXME: change attenuation so it doesn't need to be clamped?
+				if(v.flags & v.LOGARITHMIC)
+				{
+					if(mag > 0.0f)
+					{
+						attn = 1.0f - log(mag * (EXP1 / rad));
+
+						if(attn > maxAttenuation.Float()) // FIXME: change attenuation so it doesn't need to be clamped?
+							attn = maxAttenuation.Float();
+					}
+					else
 						attn = maxAttenuation.Float();
 				}
 				else
-					attn = maxAttenuation.Float();
+					attn = (rad - mag) / rad;
+
+				if(attn < 0.0f)
+					continue;
+
+				dif = com::VecRotInv(dif, camOri);
+				
+				if(!mag)
+					left = right = 1.0f;
+				else
+				{
+					float ny = dif.y / mag;
+					float srcRad = v.FinalSrcRadius();
+					float hard = !srcRad || srcRad <= mag ? 1.0f : mag / srcRad;
+
+					if(ny >= 0.0f)
+					{
+						left = 1.0f;
+						right = 1.0f - ny * hard;
+					}
+					else
+					{
+						left = 1.0f + ny * hard;
+						right = 1.0f;
+					}
+				}
 			}
-			else
-				attn = (rad - mag) / rad;
 
-			if(attn < 0.0f)
+			// FIXME: approach mono as src radius is exited?
+			mix_voice mv = {&snd, 0, snd.Samples(), snd.Samples16(), snd.NumFrames(),
+				snd.NumChannels(), v.curSample / snd.NumChannels(), (v.flags & v.LOOP) != 0,
+				left, right, v.Volume(volTimeAdd) * attn * masterVolume.Float()};
+
+			float gain = mv.amp * com::Max(left, right);
+
+			if(gain <= 0.0f)
 			{
-				v.Advance(numWrite * snd.NumChannels()); // FIXME: depends on sample rate being equal
+				numVirtual++; // Silent
 				continue;
 			}
 
-			dif = com::VecRotInv(dif, camOri);
-			
-			if(!mag)
-				left = right = 1.0f;
-			else
+			if(v.stream)
 			{
-				float ny = dif.y / mag;
-				float srcRad = v.FinalSrcRadius();
-				float hard = !srcRad || srcRad <= mag ? 1.0f : mag / srcRad;
-
-				if(ny >= 0.0f)
-				{
-					left = 1.0f;
-					right = 1.0f - ny * hard;
-				}
-				else
-				{
-					left = 1.0f + ny * hard;
-					right = 1.0f;
-				}
+				// Mix from the decoded ring; frames past a non-looping end are silent
+				mv.stream = v.stream;
+				mv.samples = v.stream->ring;
+				mv.samples16 = 0;
+				mv.numFrames = STREAM_RING_FRAMES;
+				mv.curFrame = v.stream->numPlayed % STREAM_RING_FRAMES;
+				mv.loop = true;
 			}
+
+			cullVoices.Ensure(numCandidates + 1);
+			cull_voice cv = {&v, gain * v.priority, snap->numVoices};
+			cullVoices[numCandidates++] = cv;
+			snap->voices.Ensure(snap->numVoices + 1);
+			snap->voices[snap->numVoices++] = mv;
 		}
+	}
+
+	if(snap)
+	{
+		numVirtual += CullVoices(*snap, numCandidates);
+		voiceStats.numUpdates++;
+		voiceStats.numReal += voiceStats.lastReal = snap->numVoices;
+		voiceStats.numVirtual += voiceStats.lastVirtual = numVirtual;
+		PublishMixSnapshot(*snap, mixed); // Empty if there's no camera
+	}
+
+	if(!mixer)
+		MixAhead(true);
+}
+
+/*--------------------------------------
+	aud::CullVoices
+
+If snap has more than aud_max_voices voices, ranks them by gain times priority times loudness
+over the next aud_cull_loudness_time seconds and removes all but the highest. Returns how many
+were removed.
+--------------------------------------*/
+size_t aud::CullVoices(mix_snapshot& snap, size_t numCandidates)
+{
+	size_t max = maxVoices.Unsigned();
+
+	if(numCandidates <= max)
+		return 0;
+
+	float ahead = cullLoudnessTime.Float();
+
+	for(size_t i = 0; i < numCandidates; i++)
+		cullVoices[i].score *= cullVoices[i].voice->Loudness(ahead);
+
+	qsort(cullVoices.o, numCandidates, sizeof(cull_voice), CompareCullVoices);
+
+	// Compact kept voices in snapshot order
+	com::Arr<mix_voice>& voices = snap.voices;
+
+	for(size_t i = max; i < numCandidates; i++)
+		voices[cullVoices[i].index].snd = 0;
+
+	size_t numKept = 0;
+
+	for(size_t i = 0; i < snap.numVoices; i++)
+	{
+		if(voices[i].snd)
+			voices[numKept++] = voices[i];
+	}
+
+	snap.numVoices = numKept;
+	return numCandidates - max;
+}
+
+/*--------------------------------------
+	aud::CompareCullVoices
+
+Loudest first.
+--------------------------------------*/
+int aud::CompareCullVoices(const void* a, const void* b)
+{
+	float x = ((const cull_voice*)a)->score, y = ((const cull_voice*)b)->score;
+	return x > y ? -1 : x < y;
+}
+
+/*--------------------------------------
+	aud::NewMixSnapshot
+
+Returns the next free snapshot slot, emptied, or 0 if the mixer hasn't released one yet.
+--------------------------------------*/
+aud::mix_snapshot* aud::NewMixSnapshot()
+{
+	if(snapHead - snapReleased >= NUM_MIX_SNAPSHOTS)
+	{
+		numDroppedSnapshots++;
+		return 0;
+	}
+
+	mix_snapshot& snap = mixSnapshots[snapHead % NUM_MIX_SNAPSHOTS];
+	snap.numVoices = 0;
+	return &snap;
+}
+
+/*--------------------------------------
+	aud::PublishMixSnapshot
 
-		const float* ss = snd.Samples();
-		float amp = v.Volume(volTimeAdd) * attn * masterVolume.Float();
-		cur = start;
+Locks the snapshot's sounds and streams so their samples outlive it, then hands it to the
+mixer.
+--------------------------------------*/
+void aud::PublishMixSnapshot(mix_snapshot& snap, uint32_t stamp)
+{
+	for(size_t i = 0; i < snap.numVoices; i++)
+	{
+		snap.voices[i].snd->AddLock();
+
+		if(snap.voices[i].stream)
+			LockStream(*snap.voices[i].stream);
+	}
+
+	snap.stamp = stamp;
+	numSnapshots++;
+	wrp::AtomicStore(snapHead, snapHead + 1);
+}
 
-		if(snd.NumChannels() == 1) // FIXME: template function?
+/*--------------------------------------
+	aud::ReleaseMixSnapshots
+
+Unlocks the sounds and streams of every snapshot before end.
+--------------------------------------*/
+void aud::ReleaseMixSnapshots(uint32_t end)
+{
+	for(; snapReleased != end; snapReleased++)
+	{
+		mix_snapshot& snap = mixSnapshots[snapReleased % NUM_MIX_SNAPSHOTS];
+
+		for(size_t i = 0; i < snap.numVoices; i++)
 		{
-			do
-			{
-				float mono = ss[v.curSample] * amp;
-				mix[cur] += mono * left;
-				mix[cur + 1] += mono * right;
-				cur = (cur + AUD_NUM_MIX_CHANNELS) % numMixSamples;
-
-				/* FIXME: Advancing every frame is probably slow
-				Prepare range until some event (stop/loop), then do fast iteration and mixing */
-				if(!v.Advance(1))
-					break;
-			} while(cur != end);
+			if(snap.voices[i].stream)
+				UnlockStream(*snap.voices[i].stream);
+
+			snap.voices[i].snd->RemoveLock();
 		}
-		else
+
+		snap.numVoices = 0;
+	}
+}
+
+/*
+################################################################################################
+
+
+	MIXER
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::MixAhead
+
+Mixes the newest snapshot until mixWindow frames are ready. If all is false, waits until a
+quarter of the window is free so the thread mixes in larger blocks. Returns true if anything was
+mixed. Only touches snapshot data, the ring buffer, and mixer stats.
+
+Older snapshots are released on every call, even if nothing is mixed, so the main thread doesn't
+run out of slots and drop updates while the window is full.
+--------------------------------------*/
+bool aud::MixAhead(bool all)
+{
+	// Take the newest snapshot and release the older ones
+	uint32_t head = wrp::AtomicLoad(snapHead), tail = snapTail;
+
+	if(head - tail > 1)
+		wrp::AtomicStore(snapTail, tail = head - 1);
+
+	unsigned window = wrp::AtomicLoad(mixWindow), numReady = wrp::AtomicLoad(numReadyFrames);
+
+	if(numReady >= window)
+		return false;
+
+	unsigned numWrite = window - numReady;
+
+	if(!all && numWrite < window / 4)
+		return false;
+
+	PRF_ZONE("aud::MixAhead");
+	unsigned long long startTime = wrp::MicroTime();
+	uint32_t frame = mixedFrames; // Only this thread writes it
+
+	if(head != tail)
+	{
+		const mix_snapshot& snap = mixSnapshots[tail % NUM_MIX_SNAPSHOTS];
+
+		for(size_t i = 0; i < snap.numVoices; i++)
 		{
-			// FIXME: approach mono as src radius is exited?
-			do
+			const mix_voice& mv = snap.voices[i];
+
+			if(!mv.numFrames)
+				continue;
+
+			// Voice has moved on since the snapshot was taken
+			size_t start = mv.curFrame + (frame - snap.stamp);
+
+			if(start >= mv.numFrames)
 			{
-				mix[cur] += ss[v.curSample] * amp;
-				mix[cur + 1] += ss[v.curSample + 1] * amp;
-				cur = (cur + AUD_NUM_MIX_CHANNELS) % numMixSamples;
+				if(!mv.loop)
+					continue;
 
-				if(!v.Advance(snd.NumChannels()))
-					break;
-			} while(cur != end);
+				start %= mv.numFrames;
+			}
+
+			MixVoice(mv, start, mixBlock, numWrite);
 		}
 	}
 
-	// Clip
-	cur = start;
+	// Clip into the buffer and clear the block in one pass
+	unsigned start, end;
+	MixBufRange(mixWrite, numWrite, start, end);
+	StoreMixBlock(start, numWrite);
+	mixWrite = mix + end;
+	wrp::AtomicAdd(numReadyFrames, numWrite);
+	wrp::AtomicStore(mixedFrames, frame + numWrite);
+
+	unsigned long long micro = wrp::MicroTime() - startTime;
+	size_t t = mixerStats.numBlocks % NUM_MIX_TIMES;
+	mixTimes[t] = (uint32_t)micro;
+	refillTimes[t] = (uint32_t)((lastMixStart ? startTime - lastMixStart : 0) + micro);
+	lastMixStart = startTime;
+	mixerStats.numBlocks++;
+	mixerStats.numFrames += numWrite;
+	mixerStats.micro += micro;
+
+	if(micro > mixerStats.maxMicro)
+		mixerStats.maxMicro = micro;
+
+	return true;
+}
 
-	do
+/*--------------------------------------
+	aud::MixerProc
+--------------------------------------*/
+void aud::MixerProc(void*)
+{
+	while(!wrp::AtomicLoad(mixerQuit))
 	{
-		for(unsigned i = 0; i < AUD_NUM_MIX_CHANNELS; i++, cur++)
-		{
-			if(mix[cur] > 1.0f)
-				mix[cur] = 1.0f;
-			else if(mix[cur] < -1.0f)
-				mix[cur] = -1.0f;
-		}
+		if(!MixAhead(false))
+			wrp::SleepMS(1);
+	}
+}
 
-		cur %= numMixSamples;
-	} while(cur != end);
+/*
+################################################################################################
 
-	mixWrite = mix + end;
 
-	// x86 atomic add
-	__asm
+	LATENCY
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::AdaptLatency
+
+Doubles the mix-ahead window when the device underruns. After aud_latency_shrink_time seconds
+without underruns, shrinks it by a fifth, but not below REFILL_MARGIN times the 95th percentile
+time between the mixer's writes, so the window outlasts the usual gap between refills. Always
+kept within [aud_min_latency, aud_max_latency].
+--------------------------------------*/
+void aud::AdaptLatency()
+{
+	unsigned long long now = wrp::MicroTime();
+	float delta = lastAdaptTime ? (now - lastAdaptTime) * 0.000001f : 0.0f;
+	lastAdaptTime = now;
+	float maxLat = com::Clamp(maxLatency.Float(), MIN_LATENCY, MAX_LATENCY);
+	float minLat = com::Clamp(minLatency.Float(), MIN_LATENCY, maxLat);
+	uint32_t underruns = wrp::AtomicLoad(numUnderruns);
+
+	if(underruns != lastAdaptUnderruns)
 	{
-		mov eax, numWrite
-		lock add numReadyFrames, eax
+		lastAdaptUnderruns = underruns;
+		latency *= 2.0f;
+		calmTime = 0.0f;
 	}
+	else if((calmTime += delta) >= latencyShrinkTime.Float())
+	{
+		float floor = MixTimePercentile(refillTimes, 0.95f) * 0.000001f * REFILL_MARGIN;
+		latency = com::Max(latency * 0.8f, floor);
+		calmTime = 0.0f;
+	}
+
+	latency = com::Clamp(latency, minLat, maxLat);
+	unsigned window = com::Max((unsigned)(latency * mixFrameRate), 1u);
+	wrp::AtomicStore(mixWindow, com::Min(window, numMixFrames));
+}
+
+/*--------------------------------------
+	aud::MixTimePercentile
+
+Returns the p-th percentile, [0, 1], of the recorded mixTimes or refillTimes in microseconds.
+--------------------------------------*/
+float aud::MixTimePercentile(const uint32_t* times, float p)
+{
+	size_t num = com::Min((size_t)mixerStats.numBlocks, NUM_MIX_TIMES);
+
+	if(!num)
+		return 0.0f;
+
+	uint32_t sorted[NUM_MIX_TIMES];
+	memcpy(sorted, times, num * sizeof(uint32_t));
+	qsort(sorted, num, sizeof(uint32_t), CompareMixTimes);
+	return sorted[(size_t)(com::Clamp(p, 0.0f, 1.0f) * (num - 1))];
 }
 
+/*--------------------------------------
+	aud::CompareMixTimes
+--------------------------------------*/
+int aud::CompareMixTimes(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+################################################################################################
+
+
+	GENERAL
+
+
+################################################################################################
+*/
+
 /*--------------------------------------
 	aud::SaveOld
 --------------------------------------*/
@@ -253,20 +619,24 @@ void aud::DeleteUnused()
 --------------------------------------*/
 bool aud::Init()
 {
-	uintptr_t addr = (uintptr_t)(&numReadyFrames);
-
-	// FIXME: x86 specific; make shared memory portable or add preprocessor conditions
-	if((addr & 0x3) != 0)
-		WRP_FATAL("Bad build: numReadyFrames is not 4-byte aligned");
-
 	mixFrameRate = 44100; // FIXME: configurable?
-	numMixFrames = 2048; // FIXME: variable latency
+	numMixFrames = (unsigned)(mixFrameRate * MAX_LATENCY);
 	numMixSamples = numMixFrames * AUD_NUM_MIX_CHANNELS;
 	mix = (float*)malloc(numMixFrames * AUD_NUM_MIX_CHANNELS * sizeof(float));
+	mixBlock = (float*)calloc(numMixSamples, sizeof(float));
 	mixWrite = mixRead = mix;
 	mixEnd = mix + numMixFrames * AUD_NUM_MIX_CHANNELS + 1;
-	numReadyFrames = 0;
-	bool good = LibInit();
+	numReadyFrames = numUnderruns = 0;
+	latency = 2048.0f / mixFrameRate; // Adapted from here
+	mixWindow = 2048;
+	mixedFrames = lastMixedFrames = 0;
+	bool good = libActive = LibInit();
+
+	if(!good && nullDevice.Bool())
+		good = StartNullDevice();
+
+	if(mixThread.Bool() && !(mixer = wrp::StartThread(MixerProc, 0)))
+		con::LogF("Could not start mixer thread, mixing inline");
 
 	// Lua
 	luaL_Reg regs[] =
@@ -274,6 +644,8 @@ bool aud::Init()
 		{"FindSound", FindSound},
 		{"EnsureSound", EnsureSound},
 		{"Voice", CreateVoice},
+		{"MixStats", MixStats},
+		{"VoiceStats", VoiceStats},
 		{0, 0}
 	};
 
@@ -325,6 +697,8 @@ bool aud::Init()
 		{"SetBackground", VoxSetBackground},
 		{"Logarithmic", VoxLogarithmic},
 		{"SetLogarithmic", VoxSetLogarithmic},
+		{"Priority", VoxPriority},
+		{"SetPriority", VoxSetPriority},
 		{"Play", VoxPlay},
 		{"Loudness", VoxLoudness},
 		{"Playing", VoxPlaying},
@@ -349,6 +723,10 @@ bool aud::Init()
 
 	// Console commands
 	lua_pushcfunction(scr::state, RefreshDevice); con::CreateCommand("refresh_audio_device");
+	lua_pushcfunction(scr::state, BenchMix); con::CreateCommand("aud_bench_mix");
+	lua_pushcfunction(scr::state, Stats); con::CreateCommand("aud_stats");
+	lua_pushcfunction(scr::state, SoundMemory); con::CreateCommand("aud_sound_memory");
+	lua_pushcfunction(scr::state, BenchSoundMemory); con::CreateCommand("aud_bench_sound_memory");
 
 	return good;
 }
@@ -358,9 +736,28 @@ bool aud::Init()
 --------------------------------------*/
 void aud::CleanUp()
 {
+	if(mixer)
+	{
+		wrp::AtomicStore(mixerQuit, 1);
+		wrp::JoinThread(mixer);
+		mixer = 0;
+		mixerQuit = 0;
+	}
+
+	StopNullDevice();
+	ReleaseMixSnapshots(snapHead);
+
+	for(size_t i = 0; i < NUM_MIX_SNAPSHOTS; i++)
+		mixSnapshots[i].voices.Free();
+
+	cullVoices.Free();
+
 	LibCleanUp();
+	libActive = false;
+	FreeResampleFilters();
 	free(mix);
-	mix = mixWrite = mixRead = mixEnd = 0;
+	free(mixBlock);
+	mix = mixWrite = mixRead = mixEnd = mixBlock = 0;
 }
 
 /*--------------------------------------
@@ -376,10 +773,127 @@ void aud::MixBufRange(float* cur, unsigned num, unsigned& start, unsigned& end)
 }
 
 /*--------------------------------------
-LUA	aud::RefreshDevice
+LUA	aud::RefreshDevice (refresh_audio_device)
+
+Also starts or stops the null device according to aud_null_device if the library isn't active.
 --------------------------------------*/
 int aud::RefreshDevice(lua_State* l)
 {
-	RefreshDevice();
+	if(libActive)
+		RefreshDevice();
+	else if(nullDevice.Bool())
+		StartNullDevice();
+	else
+		StopNullDevice();
+
+	return 0;
+}
+
+/*--------------------------------------
+LUA	aud::MixStats
+
+OUT	nLatency, iUnderruns, nFramesPerUpdate, nMixMS50, nMixMS95, nMixMS99
+
+Returns the current mix-ahead window in seconds, total underruns, average frames mixed between
+updates, and the 50th, 95th, and 99th percentile milliseconds taken to mix a block over the last
+256 blocks.
+--------------------------------------*/
+int aud::MixStats(lua_State* l)
+{
+	lua_pushnumber(l, latency);
+	lua_pushinteger(l, wrp::AtomicLoad(numUnderruns));
+
+	lua_pushnumber(l, updateStats.numUpdates ?
+		(double)updateStats.numFrames / updateStats.numUpdates : 0.0);
+
+	lua_pushnumber(l, MixTimePercentile(mixTimes, 0.5f) * 0.001);
+	lua_pushnumber(l, MixTimePercentile(mixTimes, 0.95f) * 0.001);
+	lua_pushnumber(l, MixTimePercentile(mixTimes, 0.99f) * 0.001);
+	return 6;
+}
+
+/*--------------------------------------
+LUA	aud::VoiceStats
+
+OUT	iNumReal, iNumVirtual, nMixMSPerUpdate
+
+Returns how many voices were mixed and how many were virtual at the last update, and the average
+milliseconds the mixer has spent per update.
+--------------------------------------*/
+int aud::VoiceStats(lua_State* l)
+{
+	lua_pushinteger(l, voiceStats.lastReal);
+	lua_pushinteger(l, voiceStats.lastVirtual);
+
+	lua_pushnumber(l, updateStats.numUpdates ?
+		mixerStats.micro * 0.001 / updateStats.numUpdates : 0.0);
+
+	return 3;
+}
+
+/*--------------------------------------
+LUA	aud::Stats (aud_stats)
+
+Logs mixer, latency, and null device stats since the last call. Percentiles and maximums cover
+the last 256 blocks and the whole session respectively.
+--------------------------------------*/
+int aud::Stats(lua_State* l)
+{
+	mixer_stats ms = mixerStats;
+	null_device_stats ns = nullStats;
+	uint32_t numBlocks = ms.numBlocks - lastMixerStats.numBlocks;
+
+	con::LogF("Mixer (%s): %u blocks, %u frames, %g ms avg, %g ms max",
+		mixer ? "thread" : "inline", numBlocks, ms.numFrames - lastMixerStats.numFrames,
+		numBlocks ? (ms.micro - lastMixerStats.micro) * 0.001 / numBlocks : 0.0,
+		ms.maxMicro * 0.001);
+
+	con::LogF("Mix time: %g ms 50%%, %g ms 95%%, %g ms 99%%",
+		MixTimePercentile(mixTimes, 0.5f) * 0.001, MixTimePercentile(mixTimes, 0.95f) * 0.001,
+		MixTimePercentile(mixTimes, 0.99f) * 0.001);
+
+	con::LogF("Snapshots: %u published, %u dropped", numSnapshots - lastNumSnapshots,
+		numDroppedSnapshots - lastNumDroppedSnapshots);
+
+	double voiceUpdates = voiceStats.numUpdates - lastVoiceStats.numUpdates;
+	double mixUpdates = updateStats.numUpdates - lastUpdateStats.numUpdates;
+	double real = voiceUpdates ? (voiceStats.numReal - lastVoiceStats.numReal) / voiceUpdates : 0.0;
+
+	double virt = voiceUpdates ?
+		(voiceStats.numVirtual - lastVoiceStats.numVirtual) / voiceUpdates : 0.0;
+
+	con::LogF("Voices: %g real, %g virtual per update (%u, %u last), mixer %g ms/update", real,
+		virt, voiceStats.lastReal, voiceStats.lastVirtual,
+		mixUpdates ? (ms.micro - lastMixerStats.micro) * 0.001 / mixUpdates : 0.0);
+
+	uint32_t numUpdates = updateStats.numUpdates - lastUpdateStats.numUpdates;
+	uint32_t underruns = wrp::AtomicLoad(numUnderruns);
+
+	con::LogF("Latency: %g ms window (%u frames), %u underruns, %g frames/update (%u max)",
+		latency * 1000.0, wrp::AtomicLoad(mixWindow), underruns - lastStatsUnderruns,
+		numUpdates ? (double)(updateStats.numFrames - lastUpdateStats.numFrames) / numUpdates :
+		0.0, updateStats.maxFrames);
+
+	if(NullDeviceRunning())
+	{
+		uint32_t numSamples = ns.numLatencySamples - lastNullStats.numLatencySamples;
+		double rate = mixFrameRate;
+
+		con::LogF("Null device: %u frames played, %u frames skipped by underruns",
+			(unsigned)(ns.numFrames - lastNullStats.numFrames),
+			(unsigned)(ns.numUnderrunFrames - lastNullStats.numUnderrunFrames));
+
+		con::LogF("Buffered: %g ms avg, %g ms max", numSamples ?
+			(ns.latencyFrameSum - lastNullStats.latencyFrameSum) * 1000.0 / numSamples / rate :
+			0.0, ns.maxLatencyFrames * 1000.0 / rate);
+	}
+
+	lastMixerStats = ms;
+	lastNullStats = ns;
+	lastNumSnapshots = numSnapshots;
+	lastNumDroppedSnapshots = numDroppedSnapshots;
+	lastStatsUnderruns = underruns;
+	lastUpdateStats = updateStats;
+	lastVoiceStats = voiceStats;
 	return 0;
 }
\ No newline at end of file
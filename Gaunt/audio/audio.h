@@ -13,6 +13,10 @@
 namespace aud
 {
 
+struct stream_source;
+struct sound_stream;
+struct pcm_store;
+
 /*
 ################################################################################################
 	SOUND
@@ -28,10 +32,20 @@ public:
 					// Managed sound constructor; don't call outside of audio subsystem
 					Sound(const char* fileName, float* samples, size_t numFrames,
 					size_t numChannels, unsigned frameRate);
+					// Streamed sound constructor; takes ownership of source
+					Sound(const char* fileName, stream_source* source, size_t numFrames,
+					size_t numChannels, unsigned frameRate);
+					// Mapped 16-bit sound constructor; takes one of store's references
+					Sound(const char* fileName, pcm_store* store, size_t numFrames,
+					size_t numChannels, unsigned frameRate);
 					~Sound();
 
 	const char*		FileName() const {return fileName;}
-	const float*	Samples() const {return samples;}
+	const float*	Samples() const {return samples;} // 0 if streamed or mapped
+	const int16_t*	Samples16() const {return samples16;} // 0 if not mapped
+	const stream_source*	Source() const {return source;}
+	const pcm_store*		Store() const {return store;}
+	bool			Streamed() const {return source != 0;}
 	size_t			NumFrames() const {return numFrames;}
 	size_t			NumChannels() const {return numChannels;}
 	size_t			NumSamples() const {return numSamples;}
@@ -42,6 +56,9 @@ public:
 private:
 	const char*		fileName;
 	float*			samples;
+	const int16_t*	samples16;
+	stream_source*	source;
+	pcm_store*		store;
 	size_t			numFrames, numChannels, numSamples;
 	unsigned		frameRate;
 };
@@ -78,10 +95,12 @@ public:
 	float					radius, oldRadius;
 	float					srcRadius, oldSrcRadius; // FIXME: remove if this turns out to be useless
 	float					volumeTarget;
+	float					priority; // Scales loudness when ranking voices for mixing
 	uint16_t				flags;
 
 							Voice(const com::Vec3& pos, float radius, float srcRadius,
 							float volume);
+							~Voice();
 	com::Vec3				FinalPos() const;
 	float					FinalRadius() const;
 	float					FinalSrcRadius() const;
@@ -97,9 +116,13 @@ private:
 	float					volume, volumeTime;
 	res::Ptr<const Sound>	snd;
 	size_t					curSample;
+	sound_stream*			stream; // If snd is streamed
 
 	bool					Advance(size_t numSamples);
+	void					ReleaseStream();
 	friend void				Update();
+	friend void				MixVoiceFrames(Voice& v, float* block, unsigned numFrames,
+							float left, float right, float amp);
 };
 
 /*
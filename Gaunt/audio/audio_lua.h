@@ -55,9 +55,23 @@ namespace aud
 	int VoxSetBackground(lua_State* l);
 	int VoxLogarithmic(lua_State* l);
 	int VoxSetLogarithmic(lua_State* l);
+	int VoxPriority(lua_State* l);
+	int VoxSetPriority(lua_State* l);
 	int VoxPlay(lua_State* l);
 	int VoxLoudness(lua_State* l);
 	int VoxPlaying(lua_State* l);
+
+	// MIX LUA
+	int BenchMix(lua_State* l);
+
+	// PCM LUA
+	int SoundMemory(lua_State* l);
+	int BenchSoundMemory(lua_State* l);
+
+	// GENERAL LUA
+	int MixStats(lua_State* l);
+	int VoiceStats(lua_State* l);
+	int Stats(lua_State* l);
 }
 
 #endif
\ No newline at end of file
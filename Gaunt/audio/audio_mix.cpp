@@ -0,0 +1,460 @@
+// audio_mix.cpp -- Block mixing
+// Martynas Ceicys
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+#include "audio.h"
+#include "audio_lua.h"
+#include "audio_private.h"
+#include "../console/console.h"
+#include "../../GauntCommon/math.h"
+#include "../wrap/wrap.h"
+
+namespace aud
+{
+	float* mixBlock = 0; // Voices are mixed here, linearly, before being clipped into mix
+
+	void	MixMonoRun(float* out, const float* src, size_t numFrames, float left, float right);
+	void	MixStereoRun(float* out, const float* src, size_t numFrames, float amp);
+	void	MixWideRun(float* out, const float* src, size_t numFrames, size_t numChannels,
+			float amp);
+	void	MixMonoRun16(float* out, const int16_t* src, size_t numFrames, float left,
+			float right);
+	void	MixStereoRun16(float* out, const int16_t* src, size_t numFrames, float amp);
+	void	MixWideRun16(float* out, const int16_t* src, size_t numFrames, size_t numChannels,
+			float amp);
+	__m128	Int16Lo(__m128i s);
+	__m128	Int16Hi(__m128i s);
+	void	MixVoiceFrames(Voice& v, float* block, unsigned numFrames, float left, float right,
+			float amp);
+	double	BenchMixRun(bool block, Voice** voices, const mix_voice* mixVoices,
+			float* blockBuf, size_t numVoices, float* out, size_t numFrames);
+}
+
+/*
+################################################################################################
+
+
+	BLOCK MIXING
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::MixVoice
+
+Adds numFrames of v's sound, starting at the given frame, to block. Mixes in runs that end where
+the sound loops or stops instead of advancing every frame. Mono sounds are panned by left and
+right, others only use their first two channels. 16-bit samples are converted while mixing.
+Safe to call from the mixer thread.
+--------------------------------------*/
+void aud::MixVoice(const mix_voice& v, size_t frame, float* block, unsigned numFrames)
+{
+	size_t numChannels = v.numChannels;
+	size_t done = 0;
+	const float INT16_SCALE = 1.0f / 32768.0f;
+
+	while(done < numFrames && frame < v.numFrames)
+	{
+		size_t run = com::Min(numFrames - done, v.numFrames - frame);
+		float* out = block + done * AUD_NUM_MIX_CHANNELS;
+
+		if(v.samples16)
+		{
+			const int16_t* src = v.samples16 + frame * numChannels;
+			float amp = v.amp * INT16_SCALE;
+
+			if(numChannels == 1)
+				MixMonoRun16(out, src, run, amp * v.left, amp * v.right);
+			else if(numChannels == 2)
+				MixStereoRun16(out, src, run, amp);
+			else
+				MixWideRun16(out, src, run, numChannels, amp);
+		}
+		else
+		{
+			const float* src = v.samples + frame * numChannels;
+
+			if(numChannels == 1)
+				MixMonoRun(out, src, run, v.amp * v.left, v.amp * v.right);
+			else if(numChannels == 2)
+				MixStereoRun(out, src, run, v.amp);
+			else
+				MixWideRun(out, src, run, numChannels, v.amp);
+		}
+
+		done += run;
+		frame += run;
+
+		if(frame == v.numFrames && v.loop)
+			frame = 0;
+	}
+}
+
+/*--------------------------------------
+	aud::StoreMixBlock
+
+Clips numFrames of mixBlock into mix starting at sample start, wrapping around mix's end, and
+clears mixBlock for the next update.
+--------------------------------------*/
+void aud::StoreMixBlock(unsigned start, unsigned numFrames)
+{
+	unsigned numSamples = numFrames * AUD_NUM_MIX_CHANNELS;
+	unsigned numFirst = com::Min(numSamples, numMixSamples - start);
+	ClipRun(mix + start, mixBlock, numFirst);
+	ClipRun(mix, mixBlock + numFirst, numSamples - numFirst);
+}
+
+/*--------------------------------------
+	aud::ClipRun
+
+Copies num samples from src to dest clipped to [-1, 1] and zeroes src.
+--------------------------------------*/
+void aud::ClipRun(float* dest, float* src, size_t num)
+{
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), negOne = _mm_set1_ps(-1.0f);
+	size_t i = 0;
+
+	for(; i + 4 <= num; i += 4)
+	{
+		__m128 s = _mm_loadu_ps(src + i);
+		_mm_storeu_ps(dest + i, _mm_max_ps(_mm_min_ps(s, one), negOne));
+		_mm_storeu_ps(src + i, zero);
+	}
+
+	for(; i < num; i++)
+	{
+		dest[i] = com::Clamp(src[i], -1.0f, 1.0f);
+		src[i] = 0.0f;
+	}
+}
+
+/*--------------------------------------
+	aud::MixMonoRun
+
+Adds each mono sample times left and right to an interleaved stereo frame.
+--------------------------------------*/
+void aud::MixMonoRun(float* out, const float* src, size_t numFrames, float left, float right)
+{
+	const __m128 gains = _mm_setr_ps(left, right, left, right);
+	size_t i = 0;
+
+	for(; i + 4 <= numFrames; i += 4)
+	{
+		__m128 s = _mm_loadu_ps(src + i);
+		float* o = out + i * 2;
+		_mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(_mm_unpacklo_ps(s, s), gains)));
+
+		_mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4),
+			_mm_mul_ps(_mm_unpackhi_ps(s, s), gains)));
+	}
+
+	for(; i < numFrames; i++)
+	{
+		out[i * 2] += src[i] * left;
+		out[i * 2 + 1] += src[i] * right;
+	}
+}
+
+/*--------------------------------------
+	aud::MixStereoRun
+--------------------------------------*/
+void aud::MixStereoRun(float* out, const float* src, size_t numFrames, float amp)
+{
+	const __m128 a = _mm_set1_ps(amp);
+	size_t num = numFrames * 2, i = 0;
+
+	for(; i + 4 <= num; i += 4)
+	{
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+			_mm_mul_ps(_mm_loadu_ps(src + i), a)));
+	}
+
+	for(; i < num; i++)
+		out[i] += src[i] * amp;
+}
+
+/*--------------------------------------
+	aud::MixWideRun
+
+Sounds with more than two channels only have their first two mixed.
+--------------------------------------*/
+void aud::MixWideRun(float* out, const float* src, size_t numFrames, size_t numChannels,
+	float amp)
+{
+	for(size_t i = 0; i < numFrames; i++, out += 2, src += numChannels)
+	{
+		out[0] += src[0] * amp;
+		out[1] += src[1] * amp;
+	}
+}
+
+/*--------------------------------------
+	aud::MixMonoRun16
+
+Like MixMonoRun, but left and right should include the 1/32768 scale.
+--------------------------------------*/
+void aud::MixMonoRun16(float* out, const int16_t* src, size_t numFrames, float left,
+	float right)
+{
+	const __m128 gains = _mm_setr_ps(left, right, left, right);
+	size_t i = 0;
+
+	for(; i + 4 <= numFrames; i += 4)
+	{
+		__m128 s = Int16Lo(_mm_loadl_epi64((const __m128i*)(src + i)));
+		float* o = out + i * 2;
+		_mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(_mm_unpacklo_ps(s, s), gains)));
+
+		_mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4),
+			_mm_mul_ps(_mm_unpackhi_ps(s, s), gains)));
+	}
+
+	for(; i < numFrames; i++)
+	{
+		out[i * 2] += src[i] * left;
+		out[i * 2 + 1] += src[i] * right;
+	}
+}
+
+/*--------------------------------------
+	aud::MixStereoRun16
+--------------------------------------*/
+void aud::MixStereoRun16(float* out, const int16_t* src, size_t numFrames, float amp)
+{
+	const __m128 a = _mm_set1_ps(amp);
+	size_t num = numFrames * 2, i = 0;
+
+	for(; i + 8 <= num; i += 8)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(Int16Lo(s), a)));
+
+		_mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_loadu_ps(out + i + 4),
+			_mm_mul_ps(Int16Hi(s), a)));
+	}
+
+	for(; i < num; i++)
+		out[i] += src[i] * amp;
+}
+
+/*--------------------------------------
+	aud::MixWideRun16
+--------------------------------------*/
+void aud::MixWideRun16(float* out, const int16_t* src, size_t numFrames, size_t numChannels,
+	float amp)
+{
+	for(size_t i = 0; i < numFrames; i++, out += 2, src += numChannels)
+	{
+		out[0] += src[0] * amp;
+		out[1] += src[1] * amp;
+	}
+}
+
+/*--------------------------------------
+	aud::Int16Lo
+
+Converts the low four 16-bit integers of s to floats.
+--------------------------------------*/
+__m128 aud::Int16Lo(__m128i s)
+{
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+}
+
+/*--------------------------------------
+	aud::Int16Hi
+--------------------------------------*/
+__m128 aud::Int16Hi(__m128i s)
+{
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+}
+
+/*
+################################################################################################
+
+
+	MIX LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	aud::BenchMix (aud_bench_mix)
+
+IN	[iNumVoices = 256], [nSeconds = 10]
+
+Mixes iNumVoices looping noise voices, half mono and half stereo, into an nSeconds buffer in
+mixer-sized updates. Runs once advancing every frame like the old mixer did and once with block
+mixing, then logs the times, how many voices' worth of audio were mixed per millisecond, and the
+largest difference between the two outputs.
+--------------------------------------*/
+int aud::BenchMix(lua_State* l)
+{
+	lua_Integer numVoices = luaL_optinteger(l, 1, 256);
+	float seconds = luaL_optnumber(l, 2, 10.0);
+
+	if(numVoices <= 0 || seconds <= 0.0f || !mixFrameRate)
+		return 0;
+
+	// One second of mono and stereo noise
+	uint32_t seed = 1;
+	Sound* snds[2];
+
+	for(size_t i = 0; i < 2; i++)
+	{
+		size_t numSamples = mixFrameRate * (i + 1);
+		float* samples = new float[numSamples];
+
+		for(size_t j = 0; j < numSamples; j++)
+			samples[j] = (com::BenchRandF(seed) - 0.5f) * 0.1f;
+
+		snds[i] = new Sound("aud_bench_mix", samples, mixFrameRate, i + 1, mixFrameRate);
+	}
+
+	Voice** voices = new Voice*[numVoices];
+	mix_voice* mixVoices = new mix_voice[numVoices];
+
+	for(lua_Integer i = 0; i < numVoices; i++)
+	{
+		voices[i] = new Voice(com::Vec3(0.0f), 1.0f, 0.0f, 1.0f);
+		voices[i]->flags |= Voice::LOOP | Voice::BACKGROUND;
+
+		// Same start as Voice::Play
+		const Sound& snd = *snds[i & 1];
+		mix_voice mv = {&snd, 0, snd.Samples(), 0, snd.NumFrames(), snd.NumChannels(),
+			size_t(((i % 100) * 0.01f / snd.Seconds()) * snd.NumFrames()), true, 1.0f, 1.0f,
+			0.5f};
+
+		mixVoices[i] = mv;
+	}
+
+	size_t numFrames = (size_t)(seconds * mixFrameRate);
+	float* outs[2];
+	double millis[2];
+
+	// The mixer thread owns mixBlock
+	float* blockBuf = (float*)calloc(numMixSamples, sizeof(float));
+
+	for(size_t i = 0; i < 2; i++)
+	{
+		for(lua_Integer j = 0; j < numVoices; j++)
+			voices[j]->Play(snds[j & 1], (j % 100) * 0.01f);
+
+		outs[i] = (float*)calloc(numFrames * AUD_NUM_MIX_CHANNELS, sizeof(float));
+		millis[i] = BenchMixRun(i != 0, voices, mixVoices, blockBuf, numVoices, outs[i],
+			numFrames);
+	}
+
+	float maxDif = 0.0f;
+
+	for(size_t i = 0; i < numFrames * AUD_NUM_MIX_CHANNELS; i++)
+		maxDif = com::Max(maxDif, (float)fabs(outs[0][i] - outs[1][i]));
+
+	con::LogF("%d voices, %g s: per-frame %g ms, block %g ms (%gx)", (int)numVoices, seconds,
+		millis[0], millis[1], millis[1] ? millis[0] / millis[1] : 0.0);
+
+	con::LogF("%g voices/ms, max difference %g",
+		millis[1] ? numVoices * (double)seconds * 1000.0 / millis[1] : 0.0, maxDif);
+
+	for(lua_Integer i = 0; i < numVoices; i++)
+	{
+		voices[i]->Play(0);
+		delete voices[i];
+	}
+
+	delete[] voices;
+	delete[] mixVoices;
+	delete snds[0];
+	delete snds[1];
+	free(outs[0]);
+	free(outs[1]);
+	free(blockBuf);
+	return 0;
+}
+
+/*--------------------------------------
+	aud::BenchMixRun
+
+blockBuf must hold numMixSamples zeroed floats and is left zeroed. Returns milliseconds taken.
+--------------------------------------*/
+double aud::BenchMixRun(bool block, Voice** voices, const mix_voice* mixVoices, float* blockBuf,
+	size_t numVoices, float* out, size_t numFrames)
+{
+	const float amp = 0.5f;
+	unsigned long long startTime = wrp::MicroTime();
+
+	for(size_t done = 0; done < numFrames; done += numMixFrames)
+	{
+		unsigned num = com::Min(numFrames - done, (size_t)numMixFrames);
+		float* dest = out + done * AUD_NUM_MIX_CHANNELS;
+
+		if(block)
+		{
+			for(size_t i = 0; i < numVoices; i++)
+			{
+				const mix_voice& mv = mixVoices[i];
+				MixVoice(mv, (mv.curFrame + done) % mv.numFrames, blockBuf, num);
+			}
+
+			ClipRun(dest, blockBuf, num * AUD_NUM_MIX_CHANNELS);
+		}
+		else
+		{
+			for(size_t i = 0; i < num * AUD_NUM_MIX_CHANNELS; i++)
+				dest[i] = 0.0f;
+
+			for(size_t i = 0; i < numVoices; i++)
+				MixVoiceFrames(*voices[i], dest, num, 1.0f, 1.0f, amp);
+
+			for(size_t i = 0; i < num * AUD_NUM_MIX_CHANNELS; i++)
+				dest[i] = com::Clamp(dest[i], -1.0f, 1.0f);
+		}
+	}
+
+	return (wrp::MicroTime() - startTime) * 0.001;
+}
+
+/*--------------------------------------
+	aud::MixVoiceFrames
+
+The old mixer's loop, advancing and wrapping every frame. Only used for benchmarking.
+--------------------------------------*/
+void aud::MixVoiceFrames(Voice& v, float* block, unsigned numFrames, float left, float right,
+	float amp)
+{
+	const Sound& snd = *v.snd;
+	const float* ss = snd.Samples();
+	unsigned numSamples = numFrames * AUD_NUM_MIX_CHANNELS, cur = 0;
+
+	if(snd.NumChannels() == 1)
+	{
+		do
+		{
+			float mono = ss[v.curSample] * amp;
+			block[cur] += mono * left;
+			block[cur + 1] += mono * right;
+			cur = (cur + AUD_NUM_MIX_CHANNELS) % numSamples;
+
+			if(!v.Advance(1))
+				break;
+		} while(cur);
+	}
+	else
+	{
+		do
+		{
+			block[cur] += ss[v.curSample] * amp;
+			block[cur + 1] += ss[v.curSample + 1] * amp;
+			cur = (cur + AUD_NUM_MIX_CHANNELS) % numSamples;
+
+			if(!v.Advance(snd.NumChannels()))
+				break;
+		} while(cur);
+	}
+}
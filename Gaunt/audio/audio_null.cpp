@@ -0,0 +1,121 @@
+// audio_null.cpp -- Headless device that plays mixed frames into nothing, in real time
+// Martynas Ceicys
+
+#include "audio.h"
+#include "audio_private.h"
+#include "../console/console.h"
+#include "../wrap/wrap.h"
+
+namespace aud
+{
+	con::Option nullDevice("aud_null_device", false); // Used if the library fails to init
+
+	null_device_stats	nullStats = {0};
+	void*				nullThread = 0;
+	volatile uint32_t	nullQuit = 0;
+
+	void NullDeviceProc(void* data);
+}
+
+/*
+################################################################################################
+
+
+	NULL DEVICE
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::StartNullDevice
+
+Returns true if the device is running.
+--------------------------------------*/
+bool aud::StartNullDevice()
+{
+	if(nullThread)
+		return true;
+
+	if(!(nullThread = wrp::StartThread(NullDeviceProc, 0)))
+	{
+		con::LogF("Could not start null audio device");
+		return false;
+	}
+
+	return true;
+}
+
+/*--------------------------------------
+	aud::StopNullDevice
+--------------------------------------*/
+void aud::StopNullDevice()
+{
+	if(!nullThread)
+		return;
+
+	wrp::AtomicStore(nullQuit, 1);
+	wrp::JoinThread(nullThread);
+	nullThread = 0;
+	nullQuit = 0;
+}
+
+/*--------------------------------------
+	aud::NullDeviceRunning
+--------------------------------------*/
+bool aud::NullDeviceRunning()
+{
+	return nullThread != 0;
+}
+
+/*--------------------------------------
+	aud::NullDeviceProc
+
+Consumes ready frames at mixFrameRate like a sound card would. Playing a frame that isn't ready
+is an underrun; the device plays silence and the frame is skipped. Latency is how many frames
+were buffered when the device came around for more. Underruns aren't counted until the mixer
+first fills the buffer.
+--------------------------------------*/
+void aud::NullDeviceProc(void*)
+{
+	unsigned long long startTime = wrp::MicroTime(), numPlayed = 0;
+	bool primed = false;
+
+	while(!wrp::AtomicLoad(nullQuit))
+	{
+		wrp::SleepMS(1);
+		unsigned long long due = (wrp::MicroTime() - startTime) * mixFrameRate / 1000000;
+		uint32_t num = (uint32_t)(due - numPlayed);
+
+		if(!num)
+			continue;
+
+		numPlayed = due;
+		uint32_t numReady = wrp::AtomicLoad(numReadyFrames);
+
+		if(!primed)
+		{
+			if(!numReady)
+				continue;
+
+			primed = true;
+		}
+
+		nullStats.numLatencySamples++;
+		nullStats.latencyFrameSum += numReady;
+
+		if(numReady > nullStats.maxLatencyFrames)
+			nullStats.maxLatencyFrames = numReady;
+
+		if(num > numReady)
+		{
+			wrp::AtomicAdd(numUnderruns, 1);
+			nullStats.numUnderrunFrames += num - numReady;
+			num = numReady;
+		}
+
+		mixRead = mix + (mixRead - mix + num * AUD_NUM_MIX_CHANNELS) % numMixSamples;
+		nullStats.numFrames += num;
+		wrp::AtomicAdd(numReadyFrames, 0u - num); // Subtract
+	}
+}
@@ -0,0 +1,318 @@
+// audio_pcm.cpp -- Memory-mapped 16-bit sample storage
+// Martynas Ceicys
+
+#include <string.h>
+
+#include "audio.h"
+#include "audio_lua.h"
+#include "audio_private.h"
+#include "../console/console.h"
+#include "../../GauntCommon/math.h"
+#include "../wrap/wrap.h"
+
+namespace aud
+{
+	con::Option pcm16("aud_pcm16", true); // Map 16-bit WAVs instead of converting to float
+
+	const size_t PCM_KEY_BYTES = 65536; // Hashed from each end of the data
+
+	com::Arr<pcm_store*>	pcmStores;
+	size_t					numPCMStores = 0;
+
+	uint32_t	PCMKey(const unsigned char* data, size_t size);
+	uint32_t	HashBytes(uint32_t hash, const unsigned char* data, size_t size);
+
+	// Benchmark
+	struct sound_memory_bench
+	{
+		size_t				numFiles, numMapped, numShared, numFailed;
+		unsigned long long	floatBytes, floatMicro;
+		unsigned long long	pcmBytes, pcmMicro;
+		com::Arr<pcm_store*>	stores;
+	};
+
+	void	BenchSoundMemoryFile(const char* path, void* data);
+}
+
+/*
+################################################################################################
+
+
+	PCM STORES
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::MapPCMStore
+
+Maps the 16-bit WAV at path, or adds a reference to an existing store with identical samples.
+Returns 0 if the file can't be mapped or is shorter than fmt says. Only call from the main
+thread.
+--------------------------------------*/
+aud::pcm_store* aud::MapPCMStore(const char* path, const wav_format& fmt)
+{
+	size_t viewSize;
+	const void* view = wrp::MapFile(path, viewSize);
+
+	if(!view)
+		return 0;
+
+	size_t numSamples = fmt.numFrames * fmt.numChannels;
+	size_t dataSize = numSamples * sizeof(int16_t);
+
+	if(fmt.dataOffset + dataSize > viewSize || fmt.dataOffset % sizeof(int16_t))
+	{
+		wrp::UnmapFile(view);
+		return 0;
+	}
+
+	const unsigned char* data = (const unsigned char*)view + fmt.dataOffset;
+	uint32_t key = PCMKey(data, dataSize);
+
+	for(size_t i = 0; i < numPCMStores; i++)
+	{
+		pcm_store& s = *pcmStores[i];
+
+		if(s.key == key && s.numSamples == numSamples && !memcmp(s.samples, data, dataSize))
+		{
+			wrp::UnmapFile(view);
+			s.numRefs++;
+			return &s;
+		}
+	}
+
+	pcm_store* s = new pcm_store;
+	s->view = view;
+	s->viewSize = viewSize;
+	s->samples = (const int16_t*)data;
+	s->numSamples = numSamples;
+	s->key = key;
+	s->numRefs = 1;
+	pcmStores.Ensure(numPCMStores + 1);
+	pcmStores[numPCMStores++] = s;
+	return s;
+}
+
+/*--------------------------------------
+	aud::ReleasePCMStore
+
+Unmaps the store when its last sound is deleted.
+--------------------------------------*/
+void aud::ReleasePCMStore(pcm_store& store)
+{
+	if(--store.numRefs)
+		return;
+
+	for(size_t i = 0; i < numPCMStores; i++)
+	{
+		if(pcmStores[i] == &store)
+		{
+			pcmStores[i] = pcmStores[--numPCMStores];
+			break;
+		}
+	}
+
+	wrp::UnmapFile(store.view);
+	delete &store;
+}
+
+/*--------------------------------------
+	aud::PCMKey
+
+Only hashes the ends of the data so sharing doesn't page in whole files. Stores with equal keys
+are compared in full.
+--------------------------------------*/
+uint32_t aud::PCMKey(const unsigned char* data, size_t size)
+{
+	uint32_t hash = HashBytes(2166136261u, (const unsigned char*)&size, sizeof(size));
+
+	if(size <= PCM_KEY_BYTES * 2)
+		return HashBytes(hash, data, size);
+
+	hash = HashBytes(hash, data, PCM_KEY_BYTES);
+	return HashBytes(hash, data + size - PCM_KEY_BYTES, PCM_KEY_BYTES);
+}
+
+/*--------------------------------------
+	aud::HashBytes
+
+FNV-1a.
+--------------------------------------*/
+uint32_t aud::HashBytes(uint32_t hash, const unsigned char* data, size_t size)
+{
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash;
+}
+
+/*
+################################################################################################
+
+
+	PCM LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	aud::SoundMemory (aud_sound_memory)
+
+Logs each sound's storage and memory. Mapped stores shared by several sounds are counted once in
+the total. Resident is how much of the mapped data is currently paged in.
+--------------------------------------*/
+int aud::SoundMemory(lua_State* l)
+{
+	unsigned long long floatBytes = 0, mappedBytes = 0, residentBytes = 0;
+	size_t numSounds = 0;
+
+	for(com::linker<Sound>* it = Sound::List().f; it; it = it->next)
+	{
+		const Sound& snd = *it->o;
+		numSounds++;
+
+		if(snd.Streamed())
+			con::LogF("%s: streamed", snd.FileName());
+		else if(const pcm_store* store = snd.Store())
+		{
+			size_t bytes = store->numSamples * sizeof(int16_t);
+			size_t resident = wrp::ResidentBytes(store->samples, bytes);
+
+			con::LogF("%s: int16 mapped, %u KB (%u KB resident), %u sounds", snd.FileName(),
+				(unsigned)(bytes / 1024), (unsigned)(resident / 1024), store->numRefs);
+		}
+		else
+		{
+			size_t bytes = snd.NumSamples() * sizeof(float);
+			floatBytes += bytes;
+			con::LogF("%s: float, %u KB", snd.FileName(), (unsigned)(bytes / 1024));
+		}
+	}
+
+	for(size_t i = 0; i < numPCMStores; i++)
+	{
+		const pcm_store& store = *pcmStores[i];
+		size_t bytes = store.numSamples * sizeof(int16_t);
+		mappedBytes += bytes;
+		residentBytes += wrp::ResidentBytes(store.samples, bytes);
+	}
+
+	con::LogF("%u sounds: %u KB float, %u KB mapped in %u stores (%u KB resident)",
+		(unsigned)numSounds, (unsigned)(floatBytes / 1024), (unsigned)(mappedBytes / 1024),
+		(unsigned)numPCMStores, (unsigned)(residentBytes / 1024));
+
+	return 0;
+}
+
+/*--------------------------------------
+LUA	aud::BenchSoundMemory (aud_bench_sound_memory)
+
+IN	[sDirectory = "DEFAULT"]
+
+Loads every WAV under sDirectory twice, once decoding to float like before and once mapping
+16-bit files, then logs the total sample memory and load time of each path. Files that can't be
+mapped count as float in both. Loaded sounds aren't kept.
+--------------------------------------*/
+int aud::BenchSoundMemory(lua_State* l)
+{
+	const char* dir = luaL_optstring(l, 1, "DEFAULT");
+	const char* err;
+
+	if(err = wrp::RestrictedPath(dir))
+		luaL_error(l, "%s", err);
+
+	sound_memory_bench b = {0};
+	wrp::ForEachFile(dir, ".wav", BenchSoundMemoryFile, &b);
+
+	for(size_t i = 0; i < b.numMapped; i++)
+		ReleasePCMStore(*b.stores[i]);
+
+	b.stores.Free();
+
+	if(!b.numFiles)
+	{
+		con::LogF("No WAV files under '%s'", dir);
+		return 0;
+	}
+
+	con::LogF("%u files (%u mapped, %u shared, %u failed)", (unsigned)b.numFiles,
+		(unsigned)b.numMapped, (unsigned)b.numShared, (unsigned)b.numFailed);
+
+	con::LogF("float: %u KB in %g ms", (unsigned)(b.floatBytes / 1024), b.floatMicro * 0.001);
+
+	con::LogF("int16: %u KB in %g ms (%g%% of float)", (unsigned)(b.pcmBytes / 1024),
+		b.pcmMicro * 0.001, b.floatBytes ? 100.0 * b.pcmBytes / b.floatBytes : 0.0);
+
+	return 0;
+}
+
+/*--------------------------------------
+	aud::BenchSoundMemoryFile
+--------------------------------------*/
+void aud::BenchSoundMemoryFile(const char* path, void* data)
+{
+	sound_memory_bench& b = *(sound_memory_bench*)data;
+	FILE* file = fopen(path, "rb");
+	wav_format fmt;
+	float* samples;
+
+	if(!file || ReadWAVHeader(file, fmt))
+	{
+		if(file)
+			fclose(file);
+
+		b.numFailed++;
+		return;
+	}
+
+	b.numFiles++;
+
+	// Float path
+	unsigned long long startTime = wrp::MicroTime();
+	size_t numFrames = fmt.numFrames;
+
+	if(!LoadWAV(file, fmt, samples))
+	{
+		if(fmt.frameRate != mixFrameRate && mixFrameRate)
+		{
+			const resample_filter& f = ResampleFilter(fmt.frameRate, mixFrameRate);
+			numFrames = ResampledFrames(f, fmt.numFrames);
+			float* resampled = new float[numFrames * fmt.numChannels];
+			Resample(f, samples, 0, fmt.numFrames, fmt.numChannels, resampled, 0, numFrames);
+			delete[] resampled;
+		}
+
+		delete[] samples;
+	}
+
+	fclose(file);
+	size_t floatBytes = numFrames * fmt.numChannels * sizeof(float);
+	b.floatMicro += wrp::MicroTime() - startTime;
+	b.floatBytes += floatBytes;
+
+	// Mapped path
+	startTime = wrp::MicroTime();
+	pcm_store* store = 0;
+
+	if(fmt.bytesPerSample == 2 && fmt.frameRate == mixFrameRate)
+		store = MapPCMStore(path, fmt);
+
+	b.pcmMicro += wrp::MicroTime() - startTime;
+
+	if(!store)
+	{
+		b.pcmBytes += floatBytes;
+		return;
+	}
+
+	b.stores.Ensure(b.numMapped + 1);
+	b.stores[b.numMapped++] = store;
+
+	if(store->numRefs > 1)
+		b.numShared++;
+	else
+		b.pcmBytes += store->numSamples * sizeof(int16_t);
+}
@@ -5,6 +5,9 @@
 #define AUDIO_PRIVATE_H
 
 #include <stdint.h>
+#include <stdio.h>
+
+#include "../../GauntCommon/array.h"
 
 #define AUD_NUM_MIX_CHANNELS 2
 
@@ -13,7 +16,35 @@ namespace aud
 
 extern float *mix, *mixRead;
 extern unsigned numMixFrames, numMixSamples, mixFrameRate;
-__declspec(align(8)) extern volatile uint32_t numReadyFrames;
+extern volatile uint32_t numReadyFrames; // wrp::Atomic* only
+extern volatile uint32_t numUnderruns; // Library-dependent code adds one per underrun
+
+// Copy of a voice's mixing parameters; the mixer thread never touches Voice or Sound objects
+struct mix_voice
+{
+	const Sound*	snd; // Locked by the main thread while the snapshot is queued
+	sound_stream*	stream; // Same; samples is its ring if not 0
+	const float*	samples;
+	const int16_t*	samples16; // Used instead of samples if not 0
+	size_t			numFrames, numChannels;
+	size_t			curFrame; // At the snapshot's stamp
+	bool			loop;
+	float			left, right, amp;
+};
+
+// Written by the mixer thread, read without synchronization for logging
+struct mixer_stats
+{
+	uint32_t			numBlocks, numFrames;
+	unsigned long long	micro, maxMicro;
+};
+
+// Written by the null device thread, read without synchronization for logging
+struct null_device_stats
+{
+	uint32_t			numLatencySamples, maxLatencyFrames;
+	unsigned long long	numFrames, numUnderrunFrames, latencyFrameSum;
+};
 
 // audio.cpp
 void	MixBufRange(float* cur, unsigned num, unsigned& startOut, unsigned& endOut);
@@ -25,9 +56,107 @@ bool	LibInit();
 void	LibCleanUp();
 void	RefreshDevice();
 
+// audio_mix.cpp
+extern float* mixBlock; // numMixSamples, zeroed between updates
+
+void	MixVoice(const mix_voice& v, size_t frame, float* block, unsigned numFrames);
+void	StoreMixBlock(unsigned start, unsigned numFrames);
+void	ClipRun(float* dest, float* src, size_t num);
+
+// audio_null.cpp
+extern con::Option			nullDevice;
+extern null_device_stats	nullStats;
+
+bool	StartNullDevice();
+void	StopNullDevice();
+bool	NullDeviceRunning();
+
+// audio_resample.cpp
+const size_t RESAMPLE_HALF_TAPS = 8, RESAMPLE_TAPS = RESAMPLE_HALF_TAPS * 2;
+
+struct resample_filter
+{
+	unsigned	srcRate, destRate;
+	unsigned	up, down; // destRate / srcRate in lowest terms
+	size_t		numPhases;
+	float*		taps; // numPhases * RESAMPLE_TAPS
+};
+
+const resample_filter&	ResampleFilter(unsigned srcRate, unsigned destRate);
+size_t					ResampledFrames(const resample_filter& f, size_t numSrcFrames);
+void					ResampleSource(const resample_filter& f, size_t numSrcFrames,
+						size_t destFirst, size_t destNum, size_t& srcFirstOut,
+						size_t& srcNumOut);
+void					Resample(const resample_filter& f, const float* src, size_t srcFirst,
+						size_t srcNum, size_t numChannels, float* dest, size_t destFirst,
+						size_t destNum);
+void					FreeResampleFilters();
+
 // audio_sound.cpp
-const char* SaveWAV(const char* filePath, const float* samples, size_t numSamples,
-	size_t numChannels, unsigned frameRate, bool i16 = false);
+struct wav_format
+{
+	size_t		numFrames, numChannels, bytesPerSample;
+	unsigned	frameRate;
+	long		dataOffset;
+};
+
+typedef void (*pcm_converter)(const unsigned char* src, float* dest, size_t numSamples);
+
+const char*		ReadWAVHeader(FILE* file, wav_format& fmtOut);
+const char*		LoadWAV(FILE* file, const wav_format& fmt, float*& samplesOut);
+pcm_converter	PCMConverter(size_t bytesPerSample);
+bool			ReadPCM(FILE* file, const wav_format& fmt, size_t firstFrame, size_t numFrames,
+				float* dest);
+const char*		SaveWAV(const char* filePath, const float* samples, size_t numSamples,
+				size_t numChannels, unsigned frameRate, bool i16 = false);
+
+// audio_pcm.cpp
+// Memory-mapped 16-bit WAV data, shared by sounds whose files have identical samples
+struct pcm_store
+{
+	const void*		view; // Whole file
+	size_t			viewSize;
+	const int16_t*	samples; // In view
+	size_t			numSamples;
+	uint32_t		key; // Hash of size and data near the start and end
+	unsigned		numRefs;
+};
+
+extern con::Option pcm16;
+
+pcm_store*	MapPCMStore(const char* path, const wav_format& fmt);
+void		ReleasePCMStore(pcm_store& store);
+
+// audio_stream.cpp
+const size_t STREAM_RING_FRAMES = (size_t)1 << 17; // Must outlast max latency plus a few updates
+
+// Where a streamed sound's frames come from
+struct stream_source
+{
+	char*					path;
+	wav_format				fmt;
+	const resample_filter*	filter; // 0 if fmt.frameRate is mixFrameRate
+};
+
+// A voice's decoded window of a streamed sound
+struct sound_stream
+{
+	const stream_source*	source;
+	FILE*					file;
+	float*					ring; // STREAM_RING_FRAMES
+	size_t					numPlayed, numDecoded; // Frames since stream start
+	size_t					trackFrame; // Sound frame to decode next
+	unsigned				numRefs; // Voice and queued snapshots
+	com::Arr<float>			srcBuf; // Source frames to resample
+};
+
+extern con::Option streamSeconds;
+
+sound_stream*	NewStream(const Sound& snd, size_t frame);
+void			LockStream(sound_stream& s);
+void			UnlockStream(sound_stream& s);
+void			FillStream(sound_stream& s, size_t numTrackFrames, bool loop);
+float			StreamLoudness(const sound_stream& s, size_t numFrames);
 
 }
 
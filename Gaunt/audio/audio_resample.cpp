@@ -0,0 +1,181 @@
+// audio_resample.cpp -- Windowed-sinc polyphase resampling
+// Martynas Ceicys
+
+#include <math.h>
+
+#include "audio.h"
+#include "audio_private.h"
+#include "../../GauntCommon/array.h"
+#include "../../GauntCommon/math.h"
+
+namespace aud
+{
+	const size_t MAX_RESAMPLE_PHASES = 512; // Rarer ratios round to the nearest lower phase
+
+	com::Arr<resample_filter*>	resampleFilters;
+	size_t						numResampleFilters = 0;
+
+	unsigned	GreatestCommonDivisor(unsigned a, unsigned b);
+	double		ResampleTap(double x, double cutoff);
+}
+
+/*
+################################################################################################
+
+
+	RESAMPLING
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::ResampleFilter
+
+Returns the filter bank converting srcRate to destRate. Banks are built once per pair of rates
+and kept until FreeResampleFilters.
+--------------------------------------*/
+const aud::resample_filter& aud::ResampleFilter(unsigned srcRate, unsigned destRate)
+{
+	for(size_t i = 0; i < numResampleFilters; i++)
+	{
+		const resample_filter& f = *resampleFilters[i];
+
+		if(f.srcRate == srcRate && f.destRate == destRate)
+			return f;
+	}
+
+	unsigned gcd = GreatestCommonDivisor(srcRate, destRate);
+	resample_filter* f = new resample_filter;
+	f->srcRate = srcRate;
+	f->destRate = destRate;
+	f->up = destRate / gcd;
+	f->down = srcRate / gcd;
+	f->numPhases = com::Min((size_t)f->up, MAX_RESAMPLE_PHASES);
+	f->taps = new float[f->numPhases * RESAMPLE_TAPS];
+
+	// Cut off at the lower Nyquist frequency when downsampling
+	double cutoff = com::Min(1.0, (double)destRate / srcRate);
+
+	for(size_t p = 0; p < f->numPhases; p++)
+	{
+		float* taps = f->taps + p * RESAMPLE_TAPS;
+		double frac = (double)p / f->numPhases, sum = 0.0;
+
+		for(size_t j = 0; j < RESAMPLE_TAPS; j++)
+			sum += taps[j] = ResampleTap((double)j - (RESAMPLE_HALF_TAPS - 1) - frac, cutoff);
+
+		for(size_t j = 0; j < RESAMPLE_TAPS; j++)
+			taps[j] /= sum; // Unity gain at DC
+	}
+
+	resampleFilters.Ensure(numResampleFilters + 1);
+	resampleFilters[numResampleFilters++] = f;
+	return *f;
+}
+
+/*--------------------------------------
+	aud::ResampledFrames
+--------------------------------------*/
+size_t aud::ResampledFrames(const resample_filter& f, size_t numSrcFrames)
+{
+	return (size_t)(((unsigned long long)numSrcFrames * f.up + f.down - 1) / f.down);
+}
+
+/*--------------------------------------
+	aud::ResampleSource
+
+Sets srcFirstOut and srcNumOut to the source frames needed to make destNum frames starting at
+destFirst, clamped to [0, numSrcFrames).
+--------------------------------------*/
+void aud::ResampleSource(const resample_filter& f, size_t numSrcFrames, size_t destFirst,
+	size_t destNum, size_t& srcFirst, size_t& srcNum)
+{
+	unsigned long long first = (unsigned long long)destFirst * f.down / f.up;
+	unsigned long long last = (unsigned long long)(destFirst + destNum) * f.down / f.up;
+	srcFirst = first >= RESAMPLE_HALF_TAPS - 1 ? (size_t)first - (RESAMPLE_HALF_TAPS - 1) : 0;
+	size_t end = com::Min((size_t)last + RESAMPLE_HALF_TAPS + 1, numSrcFrames);
+	srcNum = end > srcFirst ? end - srcFirst : 0;
+}
+
+/*--------------------------------------
+	aud::Resample
+
+Makes destNum interleaved frames, starting at output frame destFirst, from src, which holds
+source frames [srcFirst, srcFirst + srcNum). Source frames outside that span are silent, so
+chunks can be resampled separately if ResampleSource's span is given.
+--------------------------------------*/
+void aud::Resample(const resample_filter& f, const float* src, size_t srcFirst, size_t srcNum,
+	size_t numChannels, float* dest, size_t destFirst, size_t destNum)
+{
+	for(size_t n = 0; n < destNum; n++, dest += numChannels)
+	{
+		unsigned long long pos = (unsigned long long)(destFirst + n) * f.down;
+		long long center = (long long)(pos / f.up);
+		size_t phase = (size_t)(pos % f.up * f.numPhases / f.up);
+		const float* taps = f.taps + phase * RESAMPLE_TAPS;
+		long long first = center - (long long)(RESAMPLE_HALF_TAPS - 1) - (long long)srcFirst;
+		size_t jStart = first < 0 ? (size_t)-first : 0;
+		size_t jEnd = (long long)srcNum - first < (long long)RESAMPLE_TAPS ?
+			(size_t)com::Max((long long)srcNum - first, 0ll) : RESAMPLE_TAPS;
+
+		for(size_t c = 0; c < numChannels; c++)
+		{
+			float sum = 0.0f;
+			const float* s = src + (size_t)((first + (long long)jStart) * numChannels + c);
+
+			for(size_t j = jStart; j < jEnd; j++, s += numChannels)
+				sum += taps[j] * *s;
+
+			dest[c] = sum;
+		}
+	}
+}
+
+/*--------------------------------------
+	aud::FreeResampleFilters
+--------------------------------------*/
+void aud::FreeResampleFilters()
+{
+	for(size_t i = 0; i < numResampleFilters; i++)
+	{
+		delete[] resampleFilters[i]->taps;
+		delete resampleFilters[i];
+	}
+
+	resampleFilters.Free();
+	numResampleFilters = 0;
+}
+
+/*--------------------------------------
+	aud::GreatestCommonDivisor
+--------------------------------------*/
+unsigned aud::GreatestCommonDivisor(unsigned a, unsigned b)
+{
+	while(b)
+	{
+		unsigned t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*--------------------------------------
+	aud::ResampleTap
+
+Blackman-windowed sinc at x source frames from the output frame. cutoff is a fraction of the
+source's Nyquist frequency.
+--------------------------------------*/
+double aud::ResampleTap(double x, double cutoff)
+{
+	const double HALF = RESAMPLE_HALF_TAPS;
+
+	if(x <= -HALF || x >= HALF)
+		return 0.0;
+
+	double sinc = x ? sin(COM_PI * cutoff * x) / (COM_PI * cutoff * x) : 1.0;
+	double window = 0.42 + 0.5 * cos(COM_PI * x / HALF) + 0.08 * cos(2.0 * COM_PI * x / HALF);
+	return cutoff * sinc * window;
+}
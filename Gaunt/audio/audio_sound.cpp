@@ -1,19 +1,26 @@
 // audio_sound.cpp
 // Martynas Ceicys
 
+#include <string.h>
+
 #include "audio.h"
 #include "audio_lua.h"
 #include "audio_private.h"
+#include "../console/console.h"
 #include "../../GauntCommon/io.h"
+#include "../../GauntCommon/math.h"
 #include "../mod/mod.h"
 
 namespace aud
 {
 	Sound*		CreateSound(const char* fileName);
-	const char*	LoadWAV(const char* filePath, float*& samplesOut, size_t& numFramesOut,
-				size_t& numChannelsOut, unsigned& frameRateOut);
-	const char*	LoadWAVFail(FILE* file, float* samples, const char* err);
+	Sound*		CreateStreamedSound(const char* fileName, const char* path, FILE* file,
+				const wav_format& fmt);
 	void		FreeSoundSamples(float* samples);
+	void		ConvertPCM8(const unsigned char* src, float* dest, size_t numSamples);
+	void		ConvertPCM16(const unsigned char* src, float* dest, size_t numSamples);
+	void		ConvertPCM24(const unsigned char* src, float* dest, size_t numSamples);
+	void		ConvertPCM32(const unsigned char* src, float* dest, size_t numSamples);
 }
 
 /*
@@ -34,7 +41,23 @@ const char* const res::Resource<aud::Sound>::METATABLE = "metaSound";
 aud::Sound::Sound(const char* fileName, float* samples, size_t numFrames, size_t numChannels,
 	unsigned frameRate) : fileName(com::NewStringCopy(fileName)), samples(samples),
 	numFrames(numFrames), numChannels(numChannels), numSamples(numFrames * numChannels),
-	frameRate(frameRate)
+	frameRate(frameRate), samples16(0), source(0), store(0)
+{
+	EnsureLink();
+}
+
+aud::Sound::Sound(const char* fileName, stream_source* source, size_t numFrames,
+	size_t numChannels, unsigned frameRate) : fileName(com::NewStringCopy(fileName)), samples(0),
+	numFrames(numFrames), numChannels(numChannels), numSamples(numFrames * numChannels),
+	frameRate(frameRate), samples16(0), source(source), store(0)
+{
+	EnsureLink();
+}
+
+aud::Sound::Sound(const char* fileName, pcm_store* store, size_t numFrames, size_t numChannels,
+	unsigned frameRate) : fileName(com::NewStringCopy(fileName)), samples(0),
+	numFrames(numFrames), numChannels(numChannels), numSamples(numFrames * numChannels),
+	frameRate(frameRate), samples16(store->samples), source(0), store(store)
 {
 	EnsureLink();
 }
@@ -47,7 +70,17 @@ aud::Sound::~Sound()
 	if(fileName)
 		delete[] fileName;
 
-	FreeSoundSamples(samples);
+	if(samples)
+		FreeSoundSamples(samples);
+
+	if(source)
+	{
+		delete[] source->path;
+		delete source;
+	}
+
+	if(store)
+		ReleasePCMStore(*store);
 }
 
 /*--------------------------------------
@@ -75,46 +108,106 @@ aud::Sound* aud::EnsureSound(const char* fileName)
 
 /*--------------------------------------
 	aud::CreateSound
+
+Sounds longer than aud_stream_seconds are streamed. 16-bit sounds at the mixer's frame rate are
+memory-mapped if aud_pcm16 is on. Others are decoded entirely and resampled to the mixer's frame
+rate.
 --------------------------------------*/
 aud::Sound* aud::CreateSound(const char* fileName)
 {
 	const char *err = 0, *path = mod::Path("sounds/", fileName, err);
+	FILE* file = 0;
+	wav_format fmt;
 	float* samples;
-	size_t numFrames, numChannels;
-	unsigned frameRate;
 
-	if(err || (err = LoadWAV(path, samples, numFrames, numChannels, frameRate)))
+	if(!err && !(file = fopen(path, "rb")))
+		err = "Could not open file";
+
+	if(!err)
+		err = ReadWAVHeader(file, fmt);
+
+	if(!err && streamSeconds.Float() > 0.0f &&
+	fmt.numFrames > streamSeconds.Float() * fmt.frameRate)
+		return CreateStreamedSound(fileName, path, file, fmt);
+
+	if(!err && pcm16.Bool() && fmt.bytesPerSample == 2 && fmt.frameRate == mixFrameRate)
+	{
+		fclose(file);
+
+		if(pcm_store* store = MapPCMStore(path, fmt))
+			return new Sound(fileName, store, fmt.numFrames, fmt.numChannels, fmt.frameRate);
+
+		if(!(file = fopen(path, "rb")))
+			err = "Could not reopen file";
+	}
+
+	if(err || (err = LoadWAV(file, fmt, samples)))
 	{
+		if(file)
+			fclose(file);
+
 		con::LogF("Failed to load WAV sound '%s' (%s)", fileName, err);
 		return 0;
 	}
 
-	Sound* snd = new Sound(fileName, samples, numFrames, numChannels, frameRate);
-	return snd;
+	fclose(file);
+	size_t numFrames = fmt.numFrames;
+	unsigned frameRate = fmt.frameRate;
+
+	if(mixFrameRate && frameRate != mixFrameRate)
+	{
+		const resample_filter& f = ResampleFilter(frameRate, mixFrameRate);
+		size_t numResampled = ResampledFrames(f, numFrames);
+		float* resampled = new float[numResampled * fmt.numChannels];
+		Resample(f, samples, 0, numFrames, fmt.numChannels, resampled, 0, numResampled);
+		FreeSoundSamples(samples);
+		samples = resampled;
+		numFrames = numResampled;
+		frameRate = mixFrameRate;
+	}
+
+	return new Sound(fileName, samples, numFrames, fmt.numChannels, frameRate);
 }
 
 /*--------------------------------------
-	aud::LoadWAV
+	aud::CreateStreamedSound
+
+Closes file; voices reopen path when they play the sound.
+--------------------------------------*/
+aud::Sound* aud::CreateStreamedSound(const char* fileName, const char* path, FILE* file,
+	const wav_format& fmt)
+{
+	fclose(file);
+	stream_source* source = new stream_source;
+	source->path = com::NewStringCopy(path);
+	source->fmt = fmt;
+	source->filter = 0;
+	size_t numFrames = fmt.numFrames;
+	unsigned frameRate = fmt.frameRate;
+
+	if(mixFrameRate && frameRate != mixFrameRate)
+	{
+		source->filter = &ResampleFilter(frameRate, mixFrameRate);
+		numFrames = ResampledFrames(*source->filter, numFrames);
+		frameRate = mixFrameRate;
+	}
+
+	return new Sound(fileName, source, numFrames, fmt.numChannels, frameRate);
+}
+
+/*--------------------------------------
+	aud::ReadWAVHeader
 
-Loads WAV file at filePath. If successful, samples and subsequent arguments are modified, and 0
-is returned. Otherwise, an error string is returned.
+Reads the header at the start of file. If successful, fmtOut is set and 0 is returned.
+Otherwise, an error string is returned.
 
 Only supports basic WAVE chunk with uncompressed PCM.
 
 FIXME: Read but ignore unsupported chunks
 FIXME: Support fmtFormat 3, IEEE float
 --------------------------------------*/
-#define LOAD_WAV_FAIL(err) return LoadWAVFail(file, samples, err);
-
-const char* aud::LoadWAV(const char* filePath, float*& samplesOut, size_t& numFramesOut,
-	size_t& numChannelsOut, unsigned& frameRateOut)
+const char* aud::ReadWAVHeader(FILE* file, wav_format& fmtOut)
 {
-	float* samples = 0;
-	FILE* file = fopen(filePath, "rb");
-
-	if(!file)
-		LOAD_WAV_FAIL("Could not open file");
-
 	const size_t HEADER_SIZE = 44;
 	unsigned char header[HEADER_SIZE];
 	uint32_t riffTag;
@@ -131,129 +224,182 @@ const char* aud::LoadWAV(const char* filePath, float*& samplesOut, size_t& numFr
 	uint32_t dataSize;
 
 	if(fread(header, sizeof(unsigned char), HEADER_SIZE, file) != HEADER_SIZE)
-		LOAD_WAV_FAIL("Could not read header");
+		return "Could not read header";
 
 	com::MergeBE(header, riffTag);
 	if(riffTag != 0x52494646)
-		LOAD_WAV_FAIL("Bad 'RIFF' tag");
+		return "Bad 'RIFF' tag";
 
 	// Ignoring 4 bytes: riffSize
 
 	com::MergeBE(header + 8, waveTag);
 	if(waveTag != 0x57415645)
-		LOAD_WAV_FAIL("Bad 'WAVE' tag");
+		return "Bad 'WAVE' tag";
 
 	com::MergeBE(header + 12, fmtTag);
 	if(fmtTag != 0x666d7420)
-		LOAD_WAV_FAIL("Bad 'fmt ' tag");
+		return "Bad 'fmt ' tag";
 
 	com::MergeLE(header + 16, fmtSize);
 	if(fmtSize != 16)
-		LOAD_WAV_FAIL("fmtSize is not 16");
+		return "fmtSize is not 16";
 
 	com::MergeLE(header + 20, fmtFormat);
 	if(fmtFormat != 1)
-		LOAD_WAV_FAIL("fmtFormat is not 1 (PCM)");
+		return "fmtFormat is not 1 (PCM)";
 
 	com::MergeLE(header + 22, fmtNumChannels);
 	if(!fmtNumChannels)
-		LOAD_WAV_FAIL("fmtNumChannels is 0");
+		return "fmtNumChannels is 0";
 
 	com::MergeLE(header + 24, fmtSampleRate);
 	if(!fmtSampleRate)
-		LOAD_WAV_FAIL("fmtSampleRate is 0");
+		return "fmtSampleRate is 0";
 
 	// Ignoring 6 bytes: fmtByteRate and fmtBlockAlign
 
 	com::MergeLE(header + 34, fmtBPS);
 	if(fmtBPS != 8 && fmtBPS != 16 && fmtBPS != 24 && fmtBPS != 32)
-		LOAD_WAV_FAIL("Unsupported fmtBPS; must be 8, 16, 24, or 32");
+		return "Unsupported fmtBPS; must be 8, 16, 24, or 32";
 
 	com::MergeBE(header + 36, dataTag);
 	if(dataTag != 0x64617461)
-		LOAD_WAV_FAIL("Bad 'data' tag");
+		return "Bad 'data' tag";
 
 	com::MergeLE(header + 40, dataSize);
 	if(!dataSize)
-		LOAD_WAV_FAIL("dataSize is 0");
+		return "dataSize is 0";
 
 	uint16_t bytesPerSample = fmtBPS / 8;
 
 	if(dataSize % bytesPerSample)
-		LOAD_WAV_FAIL("dataSize not multiple of bytesPerSample");
+		return "dataSize not multiple of bytesPerSample";
+
+	fmtOut.numChannels = fmtNumChannels;
+	fmtOut.numFrames = dataSize / bytesPerSample / fmtNumChannels;
+	fmtOut.bytesPerSample = bytesPerSample;
+	fmtOut.frameRate = fmtSampleRate;
+	fmtOut.dataOffset = HEADER_SIZE;
+	return 0;
+}
+
+/*--------------------------------------
+	aud::LoadWAV
+
+Decodes all of file's samples. If successful, samplesOut is set and 0 is returned. Otherwise,
+an error string is returned. Doesn't close file.
+--------------------------------------*/
+const char* aud::LoadWAV(FILE* file, const wav_format& fmt, float*& samplesOut)
+{
+	float* samples = new float[fmt.numFrames * fmt.numChannels];
+
+	if(!ReadPCM(file, fmt, 0, fmt.numFrames, samples))
+	{
+		delete[] samples;
+		return "Could not read samples";
+	}
+
+	samplesOut = samples;
+	return 0;
+}
 
-	size_t numSamples = dataSize / bytesPerSample;
-	samples = new float[numSamples];
-	size_t curSample = 0;
-	const size_t BUF_SIZE = 1024;
+/*--------------------------------------
+	aud::ReadPCM
+
+Reads and converts numFrames starting at firstFrame into dest. Returns false on read error.
+--------------------------------------*/
+bool aud::ReadPCM(FILE* file, const wav_format& fmt, size_t firstFrame, size_t numFrames,
+	float* dest)
+{
+	size_t frameSize = fmt.numChannels * fmt.bytesPerSample;
+
+	if(fseek(file, fmt.dataOffset + (long)(firstFrame * frameSize), SEEK_SET))
+		return false;
+
+	pcm_converter convert = PCMConverter(fmt.bytesPerSample);
+	const size_t BUF_SIZE = 16384;
 	unsigned char buf[BUF_SIZE];
-	const size_t readLim = BUF_SIZE - BUF_SIZE % bytesPerSample;
-	size_t toRead = dataSize;
+	size_t bufFrames = BUF_SIZE / frameSize;
+
+	if(!bufFrames)
+		return false; // Absurd channel count
 
-	// FIXME: template function for different BPS
-	do
+	for(size_t done = 0; done < numFrames;)
 	{
-		size_t numRead = toRead <= readLim ? toRead : readLim;
+		size_t num = com::Min(numFrames - done, bufFrames);
 
-		if(fread(buf, sizeof(unsigned char), numRead, file) != numRead)
-			LOAD_WAV_FAIL("Could not read samples");
+		if(fread(buf, frameSize, num, file) != num)
+			return false;
 
-		for(size_t i = 0; i < numRead; i += bytesPerSample, curSample++)
-		{
-			switch(fmtBPS)
-			{
-			case 8: // FIXME: test
-				samples[curSample] = buf[i] * 0.0078125 - 1.0;
-				break;
-			case 16:
-			{
-				uint16_t s;
-				com::MergeLE(buf + i, s);
-				samples[curSample] = uint16_t(s + 32768) * 0.000030517578125 - 1.0;
-				break;
-			}
-			case 24: // FIXME: test
-			{
-				uint32_t s;
-				com::MergeLE<3>(buf + i, s);
-				samples[curSample] = (s + 8388608) % 16777216 * 0.00000011920928955078125 - 1.0;
-				break;
-			}
-			case 32: // FIXME: test
-			{
-				uint32_t s;
-				com::MergeLE(buf + i, s);
-				samples[curSample] = uint32_t(s + 2147483648) * 0.0000000004656612873077392578125 - 1.0;
-				break;
-			}
-			}
-		}
+		convert(buf, dest + done * fmt.numChannels, num * fmt.numChannels);
+		done += num;
+	}
 
-		toRead -= numRead;
-	} while(toRead);
+	return true;
+}
 
-	fclose(file);
-	samplesOut = samples;
-	numFramesOut = numSamples / fmtNumChannels;
-	numChannelsOut = fmtNumChannels;
-	frameRateOut = fmtSampleRate;
-	return 0;
+/*--------------------------------------
+	aud::PCMConverter
+
+Returns the conversion loop for the given bytes per sample, which must be 1 to 4.
+--------------------------------------*/
+aud::pcm_converter aud::PCMConverter(size_t bytesPerSample)
+{
+	switch(bytesPerSample)
+	{
+	case 1: return ConvertPCM8;
+	case 2: return ConvertPCM16;
+	case 3: return ConvertPCM24;
+	default: return ConvertPCM32;
+	}
 }
 
 /*--------------------------------------
-	aud::LoadWAVFail
+	aud::ConvertPCM8
+
+8-bit samples are unsigned.
 --------------------------------------*/
-const char* aud::LoadWAVFail(FILE* file, float* samples, const char* err)
+void aud::ConvertPCM8(const unsigned char* src, float* dest, size_t numSamples)
 {
-	if(file)
-		fclose(file);
+	for(size_t i = 0; i < numSamples; i++)
+		dest[i] = src[i] * 0.0078125f - 1.0f;
+}
 
-	if(samples)
-		delete[] samples;
+/*--------------------------------------
+	aud::ConvertPCM16
+--------------------------------------*/
+void aud::ConvertPCM16(const unsigned char* src, float* dest, size_t numSamples)
+{
+	for(size_t i = 0; i < numSamples; i++, src += 2)
+		dest[i] = (int16_t)(src[0] | src[1] << 8) * 0.000030517578125f;
+}
 
-	file = 0;
-	samples = 0;
-	return err;
+/*--------------------------------------
+	aud::ConvertPCM24
+--------------------------------------*/
+void aud::ConvertPCM24(const unsigned char* src, float* dest, size_t numSamples)
+{
+	for(size_t i = 0; i < numSamples; i++, src += 3)
+	{
+		int32_t s = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 |
+			(uint32_t)src[2] << 24) >> 8; // Sign extend
+
+		dest[i] = s * 0.00000011920928955078125f;
+	}
+}
+
+/*--------------------------------------
+	aud::ConvertPCM32
+--------------------------------------*/
+void aud::ConvertPCM32(const unsigned char* src, float* dest, size_t numSamples)
+{
+	for(size_t i = 0; i < numSamples; i++, src += 4)
+	{
+		int32_t s = (int32_t)((uint32_t)src[0] | (uint32_t)src[1] << 8 |
+			(uint32_t)src[2] << 16 | (uint32_t)src[3] << 24);
+
+		dest[i] = (float)(s * 0.0000000004656612873077392578125);
+	}
 }
 
 /*--------------------------------------
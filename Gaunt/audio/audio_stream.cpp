@@ -0,0 +1,178 @@
+// audio_stream.cpp -- Decoding long sounds in chunks as they play
+// Martynas Ceicys
+
+#include <math.h>
+#include <string.h>
+
+#include "audio.h"
+#include "audio_private.h"
+#include "../console/console.h"
+#include "../../GauntCommon/math.h"
+
+namespace aud
+{
+	con::Option streamSeconds("aud_stream_seconds", 30.0f); // 0 to never stream
+
+	const size_t STREAM_CHUNK_FRAMES = 4096;
+
+	void DecodeStreamChunk(sound_stream& s, size_t numFrames, float* dest);
+}
+
+/*
+################################################################################################
+
+
+	STREAMING
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	aud::NewStream
+
+Opens snd's file and decodes ahead from sound frame frame. Returns 0 if the file can't be opened.
+The stream starts with one reference.
+--------------------------------------*/
+aud::sound_stream* aud::NewStream(const Sound& snd, size_t frame)
+{
+	const stream_source& source = *snd.Source();
+	FILE* file = fopen(source.path, "rb");
+
+	if(!file)
+	{
+		con::LogF("Failed to stream sound '%s' (Could not open file)", snd.FileName());
+		return 0;
+	}
+
+	sound_stream* s = new sound_stream;
+	s->source = &source;
+	s->file = file;
+	s->ring = new float[STREAM_RING_FRAMES * source.fmt.numChannels];
+	s->numPlayed = s->numDecoded = 0;
+	s->trackFrame = frame;
+	s->numRefs = 1;
+	return s;
+}
+
+/*--------------------------------------
+	aud::LockStream
+--------------------------------------*/
+void aud::LockStream(sound_stream& s)
+{
+	s.numRefs++;
+}
+
+/*--------------------------------------
+	aud::UnlockStream
+
+Deletes the stream when the last reference is removed.
+--------------------------------------*/
+void aud::UnlockStream(sound_stream& s)
+{
+	if(--s.numRefs)
+		return;
+
+	fclose(s.file);
+	delete[] s.ring;
+	s.srcBuf.Free();
+	delete &s;
+}
+
+/*--------------------------------------
+	aud::FillStream
+
+Decodes until half the ring is ahead of the played position, which leaves the other half for the
+mixer to read from. If loop is false, frames past the end are silent.
+--------------------------------------*/
+void aud::FillStream(sound_stream& s, size_t numTrackFrames, bool loop)
+{
+	size_t numChannels = s.source->fmt.numChannels;
+	size_t target = s.numPlayed + STREAM_RING_FRAMES / 2;
+
+	while(s.numDecoded < target)
+	{
+		size_t slot = s.numDecoded % STREAM_RING_FRAMES;
+		size_t num = com::Min(com::Min(target - s.numDecoded, STREAM_CHUNK_FRAMES),
+			STREAM_RING_FRAMES - slot);
+
+		float* dest = s.ring + slot * numChannels;
+
+		if(s.trackFrame >= numTrackFrames)
+		{
+			if(loop)
+				s.trackFrame = 0;
+			else
+			{
+				memset(dest, 0, num * numChannels * sizeof(float));
+				s.numDecoded += num;
+				continue;
+			}
+		}
+
+		num = com::Min(num, numTrackFrames - s.trackFrame);
+		DecodeStreamChunk(s, num, dest);
+		s.numDecoded += num;
+		s.trackFrame += num;
+	}
+}
+
+/*--------------------------------------
+	aud::StreamLoudness
+
+Average absolute sample of the next numFrames decoded frames.
+--------------------------------------*/
+float aud::StreamLoudness(const sound_stream& s, size_t numFrames)
+{
+	size_t numChannels = s.source->fmt.numChannels;
+	numFrames = com::Min(numFrames, s.numDecoded - s.numPlayed);
+
+	if(!numFrames)
+		return 0.0f;
+
+	float sum = 0.0f;
+
+	for(size_t i = 0; i < numFrames; i++)
+	{
+		const float* frame = s.ring + (s.numPlayed + i) % STREAM_RING_FRAMES * numChannels;
+
+		for(size_t c = 0; c < numChannels; c++)
+			sum += fabs(frame[c]);
+	}
+
+	return sum / (float)(numFrames * numChannels);
+}
+
+/*--------------------------------------
+	aud::DecodeStreamChunk
+
+Decodes numFrames starting at s.trackFrame into dest. Resampled streams read the source frames
+under the filter's reach on both sides so chunks join seamlessly. Read errors become silence.
+--------------------------------------*/
+void aud::DecodeStreamChunk(sound_stream& s, size_t numFrames, float* dest)
+{
+	const stream_source& source = *s.source;
+	const wav_format& fmt = source.fmt;
+	size_t numSamples = numFrames * fmt.numChannels;
+
+	if(!source.filter)
+	{
+		if(!ReadPCM(s.file, fmt, s.trackFrame, numFrames, dest))
+			memset(dest, 0, numSamples * sizeof(float));
+
+		return;
+	}
+
+	size_t srcFirst, srcNum;
+	ResampleSource(*source.filter, fmt.numFrames, s.trackFrame, numFrames, srcFirst, srcNum);
+	s.srcBuf.Ensure(srcNum * fmt.numChannels);
+
+	if(!ReadPCM(s.file, fmt, srcFirst, srcNum, s.srcBuf.o))
+	{
+		memset(dest, 0, numSamples * sizeof(float));
+		return;
+	}
+
+	Resample(*source.filter, s.srcBuf.o, srcFirst, srcNum, fmt.numChannels, dest, s.trackFrame,
+		numFrames);
+}
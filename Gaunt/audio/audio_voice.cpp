@@ -5,6 +5,7 @@
 
 #include "audio.h"
 #include "audio_lua.h"
+#include "audio_private.h"
 #include "../../GauntCommon/math.h"
 #include "../vector/vec_lua.h"
 
@@ -26,11 +27,19 @@ const char* const res::Resource<aud::Voice>::METATABLE = "metaVoice";
 aud::Voice::Voice(const com::Vec3& pos, float radius, float srcRadius, float volume)
 	: pos(pos), oldPos(pos), radius(radius), oldRadius(radius), srcRadius(srcRadius),
 	oldSrcRadius(srcRadius), volume(volume), volumeTarget(volume), volumeTime(0.0f),
-	flags(LERP_POS | LERP_RADIUS | LERP_SRC_RADIUS), curSample(0)
+	priority(1.0f), flags(LERP_POS | LERP_RADIUS | LERP_SRC_RADIUS), curSample(0), stream(0)
 {
 	EnsureLink();
 }
 
+/*--------------------------------------
+	aud::Voice::~Voice
+--------------------------------------*/
+aud::Voice::~Voice()
+{
+	ReleaseStream();
+}
+
 /*--------------------------------------
 	aud::Voice::FinalPos
 --------------------------------------*/
@@ -106,15 +115,24 @@ void aud::Voice::Play(const Sound* s, float t)
 		if(!snd)
 			AddLock(); // Don't garbage collect while playing
 
+		ReleaseStream();
 		snd.Set(s);
 		curSample = size_t((t / s->Seconds()) * s->NumFrames()) * s->NumChannels();
-		Advance(0);
+
+		if(Advance(0) && s->Streamed())
+		{
+			if(stream = NewStream(*s, curSample / s->NumChannels()))
+				FillStream(*stream, s->NumFrames(), (flags & LOOP) != 0);
+			else
+				Play(0);
+		}
 	}
 	else
 	{
 		if(snd)
 			RemoveLock();
 
+		ReleaseStream();
 		snd.Set(0);
 		curSample = 0;
 	}
@@ -139,12 +157,26 @@ float aud::Voice::Loudness(float ahead) const
 	if(!numFramesAhead)
 		return 0.0f;
 
+	if(stream)
+		return StreamLoudness(*stream, numFramesAhead);
+
 	unsigned numSamplesAhead = numFramesAhead * numChannels;
-	const float* smps = s.Samples();
 	float sum = 0.0f;
 
-	for(unsigned i = 0; i < numSamplesAhead; i++)
-		sum += fabs(smps[curSample + i]);
+	if(const int16_t* smps16 = s.Samples16())
+	{
+		for(unsigned i = 0; i < numSamplesAhead; i++)
+			sum += abs(smps16[curSample + i]);
+
+		sum *= 1.0f / 32768.0f;
+	}
+	else
+	{
+		const float* smps = s.Samples();
+
+		for(unsigned i = 0; i < numSamplesAhead; i++)
+			sum += fabs(smps[curSample + i]);
+	}
 
 
 	return sum / (float)numSamplesAhead;
@@ -175,6 +207,9 @@ bool aud::Voice::Advance(size_t numSamples)
 
 	curSample += numSamples;
 
+	if(stream)
+		stream->numPlayed += numSamples / snd->NumChannels();
+
 	if(curSample >= snd->NumSamples())
 	{
 		if(flags & LOOP)
@@ -182,6 +217,7 @@ bool aud::Voice::Advance(size_t numSamples)
 		else
 		{
 			RemoveLock();
+			ReleaseStream();
 			snd.Set(0);
 			curSample = 0;
 			return false;
@@ -191,6 +227,20 @@ bool aud::Voice::Advance(size_t numSamples)
 	return true;
 }
 
+/*--------------------------------------
+	aud::Voice::ReleaseStream
+
+Queued mixer snapshots may keep the stream alive a little longer.
+--------------------------------------*/
+void aud::Voice::ReleaseStream()
+{
+	if(!stream)
+		return;
+
+	UnlockStream(*stream);
+	stream = 0;
+}
+
 /*
 ################################################################################################
 	
@@ -594,6 +644,29 @@ int aud::VoxSetLogarithmic(lua_State* l)
 	return 0;
 }
 
+/*--------------------------------------
+LUA	aud::VoxPriority (Priority)
+
+IN	voxV
+OUT	nPriority
+--------------------------------------*/
+int aud::VoxPriority(lua_State* l)
+{
+	lua_pushnumber(l, Voice::CheckLuaTo(1)->priority);
+	return 1;
+}
+
+/*--------------------------------------
+LUA	aud::VoxSetPriority (SetPriority)
+
+IN	voxV, nPriority
+--------------------------------------*/
+int aud::VoxSetPriority(lua_State* l)
+{
+	Voice::CheckLuaTo(1)->priority = lua_tonumber(l, 2);
+	return 0;
+}
+
 /*--------------------------------------
 LUA	aud::VoxPlay (Play)
 
@@ -18,11 +18,39 @@
 
 namespace hit
 {
+	con::Option entityTree("hit_entity_tree", 1); // Find entities with scn's entity tree
+
 	// HIT TEST
-	void PopToNextOp(Descent& d, desc_op op);
+	void	PopToNextOp(Descent& d, desc_op op);
+	bool	HullTestEntity(Context& c, scn::Entity& ent, const Hull& hull, const com::Vec3& a,
+			const com::Vec3& b, const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
+			Result& resIO);
+	size_t	SweepTree(Context& c, const com::Vec3& a, const com::Vec3& b, const com::Vec3& min,
+			const com::Vec3& max);
+
+	// CONTEXT
+	Context gCtx; // Main thread's
+	Context* workerContexts = 0;
+	size_t numWorkerContexts = 0;
+
+	void EnsureWorkerContexts();
 	
 	// HIT TEST LUA
 	size_t LuaToEntIgnores(lua_State* l, int index);
+
+	// CONTEXT LUA
+	struct stress_query
+	{
+		com::Vec3				a, b;
+		const Hull*				hull; // 0 for a line test
+		test_type				type;
+		const flg::FlagSet*		ignore;
+		Result					res;
+	};
+
+	bool SameResult(const Result& x, const Result& y);
+
+	void StressQuery(void* queries, size_t index, size_t worker);
 }
 
 /*
@@ -160,32 +188,43 @@ LineTest can return upon the first collision in a leaf unless an earlier descent
 entirely copied to both the left and right children of a node (the COPY operation of
 LineDescend). The segment may hit something earlier on the other side, so that branch needs
 to be tested.
+
+If hit_entity_tree is on, entities are found with the scene's entity tree after the descent
+instead of through leaf links.
 --------------------------------------*/
 hit::Result hit::LineTest(scn::WorldNode* root, const com::Vec3& a, const com::Vec3& b,
 	const test_type type, const flg::FlagSet& ignore, const scn::Entity** entIgnores,
-	size_t numEntIgnores)
+	size_t numEntIgnores, Context* ctx)
 {
 	Result res = {Result::NONE, FLT_MAX, -FLT_MAX};
-	unsigned markCode = scn::Entity::IncHitCode();
+	Context& c = ctx ? *ctx : GlobalContext();
+	Descent& desc = c.desc;
+	c.ClearMarks();
+
+	if(&c == &gCtx)
+		scn::FlushLinks();
 
 	for(size_t i = 0; i < numEntIgnores; i++)
 	{
 		if(entIgnores[i])
-			entIgnores[i]->hitCode = markCode;
+			c.Mark(*entIgnores[i]);
 	}
 
 	const float moveMag = (b - a).Mag();
 	const float invMoveMag = moveMag ? 1.0f / moveMag : 0.0f;
-	gDesc.Begin(root, a, b);
+	const bool useTree = root && (type & ENTITIES) && entityTree.Bool();
+	desc.BeginHot(root, a, b);
 
-	while(gDesc.numStacked)
+	while(desc.numStacked)
 	{
-		desc_elem& top = gDesc.s[gDesc.numStacked - 1];
-		scn::WorldNode& topNode = (scn::WorldNode&)*top.node;
+		desc_elem& top = desc.s[desc.numStacked - 1];
+		const hot_node& topHot = hotNodes[top.hot];
 
-		if(!topNode.left) // Leaf
+		if(!topHot.left) // Leaf
 		{
-			if(topNode.solid)
+			scn::WorldNode& topNode = HotWorldNode(top.hot);
+
+			if(topHot.flags & scn::Node::SOLID)
 			{
 				if(type & TREE)
 				{
@@ -211,51 +250,16 @@ hit::Result hit::LineTest(scn::WorldNode* root, const com::Vec3& a, const com::V
 						}
 
 						// Hit solid leaf; pop stack until next COPY branch
-						PopToNextOp(gDesc, COPY);
+						PopToNextOp(desc, COPY);
 						continue;
 					}
 				}
 			}
 			else
 			{
-				if(type & ENTITIES)
+				if((type & ENTITIES) && !useTree)
 				{
-					for(const scn::obj_link<scn::Entity>* it = topNode.entLinks.o;
-					it < topNode.entLinks.o + topNode.numEntLinks;
-					it++)
-					{
-						scn::Entity& ent = *it->obj;
-
-						if(ent.hitCode == markCode)
-							continue;
-
-						ent.hitCode = markCode;
-
-						if(ent.gFlags.True(ignore))
-							continue;
-
-						if((type & ALT) && (ent.flags & scn::Entity::ALT_HIT_TEST))
-						{
-							// FIXME: hit test root's link-hull or hull before testing children?
-							for(scn::Entity* chain = ent.Child(); chain; chain = chain->Child())
-							{
-								if(!chain->Hull())
-									continue;
-
-								if(TestLineHull(a, b, *chain->Hull(), chain->Pos(),
-								chain->HullOri(), res))
-									res.ent = chain;
-							}
-						}
-						else
-						{
-							if(!ent.Hull())
-								continue;
-
-							if(TestLineHull(a, b, *ent.Hull(), ent.Pos(), ent.HullOri(), res))
-								res.ent = &ent;
-						}
-					}
+					LineTestLeafEntities(c, 0, topNode, a, b, type, ignore, res);
 
 					if(res.contact == Result::HIT)
 					{
@@ -263,7 +267,7 @@ hit::Result hit::LineTest(scn::WorldNode* root, const com::Vec3& a, const com::V
 						{
 							// Hit entity at a point that is within the current leaf
 							// Pop stack until next COPY branch
-							PopToNextOp(gDesc, COPY);
+							PopToNextOp(desc, COPY);
 							continue;
 						}
 					}
@@ -273,16 +277,107 @@ hit::Result hit::LineTest(scn::WorldNode* root, const com::Vec3& a, const com::V
 			}
 		}
 
-		gDesc.LineDescend();
+		desc.HotLineDescend();
 	}
 
+	if(useTree)
+		LineTestTreeEntities(c, 0, a, b, type, ignore, res);
+
 	return res;
 }
 
 hit::Result hit::LineTest(scn::WorldNode* root, const com::Vec3& a, const com::Vec3& b,
-	const test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore)
+	const test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore,
+	Context* ctx)
+{
+	return LineTest(root, a, b, type, ignore, &entIgnore, 1, ctx);
+}
+
+/*--------------------------------------
+	hit::LineTestEntity
+
+Tests the line from a to b against ent if it isn't marked in set yet and marks it. Returns true
+if resIO was changed.
+--------------------------------------*/
+bool hit::LineTestEntity(Context& c, unsigned set, scn::Entity& ent, const com::Vec3& a,
+	const com::Vec3& b, test_type type, const flg::FlagSet& ignore, Result& res)
+{
+	if(!c.Mark(ent, set))
+		return false;
+
+	if(ent.gFlags.True(ignore))
+		return false;
+
+	bool changed = false;
+
+	if((type & ALT) && (ent.flags & scn::Entity::ALT_HIT_TEST))
+	{
+		// FIXME: hit test root's link-hull or hull before testing children?
+		for(scn::Entity* chain = ent.Child(); chain; chain = chain->Child())
+		{
+			if(!chain->Hull())
+				continue;
+
+			if(TestLineHull(a, b, *chain->Hull(), chain->Pos(), chain->HullOri(), res))
+			{
+				res.ent = chain;
+				changed = true;
+			}
+		}
+	}
+	else
+	{
+		if(!ent.Hull())
+			return false;
+
+		if(TestLineHull(a, b, *ent.Hull(), ent.Pos(), ent.HullOri(), res))
+		{
+			res.ent = &ent;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+/*--------------------------------------
+	hit::LineTestLeafEntities
+
+Does LineTestEntity on every entity linked to leaf. Returns true if resIO was changed.
+--------------------------------------*/
+bool hit::LineTestLeafEntities(Context& c, unsigned set, const scn::WorldNode& leaf,
+	const com::Vec3& a, const com::Vec3& b, test_type type, const flg::FlagSet& ignore,
+	Result& res)
 {
-	return LineTest(root, a, b, type, ignore, &entIgnore, 1);
+	bool changed = false;
+
+	for(const scn::obj_link<scn::Entity>* it = leaf.entLinks.o;
+	it < leaf.entLinks.o + leaf.numEntLinks;
+	it++)
+	{
+		changed |= LineTestEntity(c, set, *it->obj, a, b, type, ignore, res);
+	}
+
+	return changed;
+}
+
+/*--------------------------------------
+	hit::LineTestTreeEntities
+
+Does LineTestEntity on every entity in the entity tree the line passes by before resIO's hit.
+Does nothing if resIO is an intersection.
+--------------------------------------*/
+void hit::LineTestTreeEntities(Context& c, unsigned set, const com::Vec3& a,
+	const com::Vec3& b, test_type type, const flg::FlagSet& ignore, Result& res)
+{
+	if(res.contact == Result::INTERSECT)
+		return;
+
+	com::Vec3 end = res.contact == Result::HIT ? COM_LERP(a, b, res.timeFirst) : b;
+	size_t numEnts = SweepTree(c, a, end, 0.0f, 0.0f);
+
+	for(size_t i = 0; i < numEnts; i++)
+		LineTestEntity(c, set, *c.treeEnts[i], a, b, type, ignore, res);
 }
 
 /*--------------------------------------
@@ -318,34 +413,45 @@ A and B are solid. C is non-solid. In this case, A is checked before B in the de
 hit time is later than B's hit time. A similar thing can happen with entities, where an entity
 in a further leaf may be hit before an entity in a closer leaf. Once the current descent's start
 point is further than the earliest hit, then no earlier hit in that branch may occur.
+
+If hit_entity_tree is on, entities are found with the scene's entity tree after the descent
+instead of through leaf links.
 --------------------------------------*/
 hit::Result hit::HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec3& a,
 	const com::Vec3& b, const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-	const scn::Entity** entIgnores, size_t numEntIgnores)
+	const scn::Entity** entIgnores, size_t numEntIgnores, Context* ctx)
 {
 	Result res = {Result::NONE, FLT_MAX, -FLT_MAX};
-	unsigned markCode = scn::Entity::IncHitCode();
+	Context& c = ctx ? *ctx : GlobalContext();
+	Descent& desc = c.desc;
+	c.ClearMarks();
+
+	if(&c == &gCtx)
+		scn::FlushLinks();
 
 	for(size_t i = 0; i < numEntIgnores; i++)
 	{
 		if(entIgnores[i])
-			entIgnores[i]->hitCode = markCode;
+			c.Mark(*entIgnores[i]);
 	}
 
 	const float moveMag = (b - a).Mag();
-	gDesc.Begin(root, a, b);
+	const bool useTree = root && (type & ENTITIES) && entityTree.Bool();
+	desc.BeginHot(root, a, b);
 
-	while(gDesc.numStacked)
+	while(desc.numStacked)
 	{
-		desc_elem& top = gDesc.s[gDesc.numStacked - 1];
-		scn::WorldNode& topNode = (scn::WorldNode&)*top.node;
+		desc_elem& top = desc.s[desc.numStacked - 1];
+		const hot_node& topHot = hotNodes[top.hot];
 		float leafHitTime;
 
-		if(!topNode.left &&
+		if(!topHot.left &&
 		res.timeFirst >= (leafHitTime = moveMag ? (top.a - a).Mag() / moveMag : 0.0f))
 		{
 			// Entered leaf at earlier time than earliest hit
-			if(topNode.solid)
+			scn::WorldNode& topNode = HotWorldNode(top.hot);
+
+			if(topHot.flags & scn::Node::SOLID)
 			{
 				if(type & TREE)
 				{
@@ -407,56 +513,45 @@ hit::Result hit::HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec
 					}
 				}
 			}
-			else if(type & ENTITIES)
+			else if((type & ENTITIES) && !useTree)
 			{
 				for(const scn::obj_link<scn::Entity>* it = topNode.entLinks.o;
 				it < topNode.entLinks.o + topNode.numEntLinks;
 				it++)
 				{
-					scn::Entity& ent = *it->obj;
+					HullTestEntity(c, *it->obj, hull, a, b, ori, type, ignore, res);
 
-					if(ent.hitCode == markCode)
-						continue;
-
-					ent.hitCode = markCode;
+					if(res.contact == Result::INTERSECT)
+						break; // Intersection; break descent
+				}
+			}
+		}
 
-					if(ent.gFlags.True(ignore))
-						continue;
+		desc.HotDescend(hull, ori);
+	}
 
-					if((type & ALT) && (ent.flags & scn::Entity::ALT_HIT_TEST))
-					{
-						for(scn::Entity* chain = ent.Child(); chain; chain = chain->Child())
-						{
-							if(!chain->Hull())
-								continue;
+	if(useTree && res.contact != Result::INTERSECT)
+	{
+		// Sweep hull's bounds up to the earliest hit
+		com::Vec3 min, max;
 
-							if(TestHullHull(hull, a, b, ori, *chain->Hull(), chain->Pos(),
-							chain->HullOri(), res))
-							{
-								res.ent = chain;
+		for(int i = 0; i < 3; i++)
+		{
+			com::Vec3 axis(0.0f);
+			axis[i] = 1.0f;
+			Span(hull, ori, axis, min[i], max[i]);
+		}
 
-								if(res.contact == Result::INTERSECT)
-									break;
-							}
-						}
-					}
-					else
-					{
-						if(!ent.Hull())
-							continue;
+		com::Vec3 end = res.contact == Result::HIT ? COM_LERP(a, b, res.timeFirst) : b;
+		size_t numEnts = SweepTree(c, a, end, min, max);
 
-						if(TestHullHull(hull, a, b, ori, *ent.Hull(), ent.Pos(), ent.HullOri(),
-						res))
-							res.ent = &ent;
-					}
+		for(size_t i = 0; i < numEnts; i++)
+		{
+			HullTestEntity(c, *c.treeEnts[i], hull, a, b, ori, type, ignore, res);
 
-					if(res.contact == Result::INTERSECT)
-						break; // Intersection; break descent
-				}
-			}
+			if(res.contact == Result::INTERSECT)
+				break;
 		}
-
-		gDesc.Descend(hull, ori);
 	}
 
 	return res;
@@ -464,9 +559,78 @@ hit::Result hit::HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec
 
 hit::Result hit::HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec3& a,
 	const com::Vec3& b, const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-	const scn::Entity* entIgnore)
+	const scn::Entity* entIgnore, Context* ctx)
 {
-	return HullTest(root, hull, a, b, ori, type, ignore, &entIgnore, entIgnore ? 1 : 0);
+	return HullTest(root, hull, a, b, ori, type, ignore, &entIgnore, entIgnore ? 1 : 0, ctx);
+}
+
+/*--------------------------------------
+	hit::HullTestEntity
+
+Tests hull against ent if it isn't marked yet and marks it. Returns true if resIO was changed.
+--------------------------------------*/
+bool hit::HullTestEntity(Context& c, scn::Entity& ent, const Hull& hull, const com::Vec3& a,
+	const com::Vec3& b, const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
+	Result& res)
+{
+	if(!c.Mark(ent))
+		return false;
+
+	if(ent.gFlags.True(ignore))
+		return false;
+
+	bool changed = false;
+
+	if((type & ALT) && (ent.flags & scn::Entity::ALT_HIT_TEST))
+	{
+		for(scn::Entity* chain = ent.Child(); chain; chain = chain->Child())
+		{
+			if(!chain->Hull())
+				continue;
+
+			if(TestHullHull(hull, a, b, ori, *chain->Hull(), chain->Pos(), chain->HullOri(),
+			res))
+			{
+				res.ent = chain;
+				changed = true;
+
+				if(res.contact == Result::INTERSECT)
+					break;
+			}
+		}
+	}
+	else
+	{
+		if(!ent.Hull())
+			return false;
+
+		if(TestHullHull(hull, a, b, ori, *ent.Hull(), ent.Pos(), ent.HullOri(), res))
+		{
+			res.ent = &ent;
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+/*--------------------------------------
+	hit::SweepTree
+
+Puts entities found by scn::SweepEntityTree in c.treeEnts and returns how many. Queries done
+with the main thread's Context are counted in scn::linkStats.
+--------------------------------------*/
+size_t hit::SweepTree(Context& c, const com::Vec3& a, const com::Vec3& b, const com::Vec3& min,
+	const com::Vec3& max)
+{
+	if(&c != &gCtx)
+		return scn::SweepEntityTree(a, b, min, max, c.treeStack, c.treeEnts);
+
+	unsigned long long start = wrp::MicroTime();
+	size_t numEnts = scn::SweepEntityTree(a, b, min, max, c.treeStack, c.treeEnts);
+	scn::linkStats.numTreeQueries++;
+	scn::linkStats.treeQueryMicro += wrp::MicroTime() - start;
+	return numEnts;
 }
 
 /*--------------------------------------
@@ -480,6 +644,128 @@ void hit::PopToNextOp(Descent& d, desc_op op)
 		d.numStacked--;
 }
 
+/*
+################################################################################################
+
+
+	CONTEXT
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	hit::Context::Context
+--------------------------------------*/
+hit::Context::Context() : marks(16), numMarks(0), markCode(1)
+{
+	desc.AddLock(); // FIXME: make a non-Resource descent stack class
+	ent_mark unmarked = {0, 0, 0};
+	marks.Set(unmarked, marks.n, 0);
+}
+
+/*--------------------------------------
+	hit::Context::ClearMarks
+
+Unmarks all entities. Call at the start of every test.
+--------------------------------------*/
+void hit::Context::ClearMarks()
+{
+	numMarks = 0;
+
+	if(!(++markCode))
+	{
+		// Code wrapped, old marks could be mistaken for current ones
+		ent_mark unmarked = {0, 0, 0};
+		marks.Set(unmarked, marks.n, 0);
+		markCode = 1;
+	}
+}
+
+/*--------------------------------------
+	hit::Context::Mark
+--------------------------------------*/
+bool hit::Context::Mark(const scn::Entity& ent, unsigned set)
+{
+	if((numMarks + 1) * 2 > marks.n)
+		GrowMarks();
+
+	size_t mask = marks.n - 1;
+
+	for(size_t i = (((size_t)&ent >> 4) + set) * 2654435761u & mask; ; i = (i + 1) & mask)
+	{
+		ent_mark& m = marks[i];
+
+		if(m.code != markCode)
+		{
+			m.ent = &ent;
+			m.set = set;
+			m.code = markCode;
+			numMarks++;
+			return true;
+		}
+
+		if(m.ent == &ent && m.set == set)
+			return false;
+	}
+}
+
+/*--------------------------------------
+	hit::Context::GrowMarks
+
+Doubles the hash set's size and reinserts current marks.
+--------------------------------------*/
+void hit::Context::GrowMarks()
+{
+	com::Arr<ent_mark> old = marks;
+	ent_mark unmarked = {0, 0, 0};
+	marks.o = 0;
+	marks.n = 0;
+	marks.Init(old.n * 2);
+	marks.Set(unmarked, marks.n, 0);
+	size_t mask = marks.n - 1;
+
+	for(size_t i = 0; i < old.n; i++)
+	{
+		if(old[i].code != markCode)
+			continue;
+
+		size_t j = (((size_t)old[i].ent >> 4) + old[i].set) * 2654435761u & mask;
+
+		while(marks[j].code == markCode)
+			j = (j + 1) & mask;
+
+		marks[j] = old[i];
+	}
+
+	old.Free();
+}
+
+/*--------------------------------------
+	hit::GlobalContext
+--------------------------------------*/
+hit::Context& hit::GlobalContext()
+{
+	return gCtx;
+}
+
+/*--------------------------------------
+	hit::EnsureWorkerContexts
+--------------------------------------*/
+void hit::EnsureWorkerContexts()
+{
+	size_t numWorkers = wrp::NumWorkers();
+
+	if(numWorkers <= numWorkerContexts)
+		return;
+
+	if(workerContexts)
+		delete[] workerContexts;
+
+	numWorkerContexts = numWorkers;
+	workerContexts = new Context[numWorkerContexts];
+}
+
 /*
 ################################################################################################
 
@@ -535,6 +821,55 @@ int hit::LineTest(lua_State* l)
 	return HIT_NUM_RESULT_ELEMENTS;
 }
 
+/*--------------------------------------
+LUA	hit::LineTestBatch
+
+IN	tEnds, iTestType, fsetIgnore, tResultsOut, [entIgnore, ...]
+OUT	iNumLines
+
+tEnds is a sequence of line start and end coordinates, six numbers per line. Every line is tested
+like hit.LineTest, and the results are copied to tResultsOut in hit::ResultTable's format.
+--------------------------------------*/
+int hit::LineTestBatch(lua_State* l)
+{
+	static com::Arr<com::Vec3> as(1), bs(1);
+	static com::Arr<Result> results(1);
+
+	const int ENDS_INDEX = 1, RESULTS_INDEX = 4;
+	scr::CheckTable(l, ENDS_INDEX);
+	test_type testType = (test_type)luaL_checkinteger(l, 2);
+	const flg::FlagSet* ignore = flg::FlagSet::DefaultLuaTo(3);
+	scr::CheckTable(l, RESULTS_INDEX);
+	size_t numEntIgnores = LuaToEntIgnores(l, 5);
+
+	size_t numLines = lua_rawlen(l, ENDS_INDEX) / 6;
+	as.Ensure(numLines);
+	bs.Ensure(numLines);
+	results.Ensure(numLines);
+
+	for(size_t i = 0; i < numLines; i++)
+	{
+		float f[6];
+
+		for(size_t j = 0; j < 6; j++)
+		{
+			lua_rawgeti(l, ENDS_INDEX, i * 6 + j + 1);
+			f[j] = luaL_checknumber(l, -1);
+			lua_pop(l, 1);
+		}
+
+		as[i] = com::Vec3(f[0], f[1], f[2]);
+		bs[i] = com::Vec3(f[3], f[4], f[5]);
+	}
+
+	LineTestBatch(scn::WorldRoot(), as.o, bs.o, numLines, testType, *ignore, entIgnores.o,
+		numEntIgnores, results.o);
+
+	ResultTable(l, RESULTS_INDEX, results.o, numLines);
+	lua_pushinteger(l, numLines);
+	return 1;
+}
+
 /*--------------------------------------
 LUA	hit::HullTest
 
@@ -576,29 +911,31 @@ int hit::DescentEntities(lua_State* l)
 	com::Vec3 b = vec::CheckLuaToVec(l, 6, 7, 8);
 	com::Qua q = qua::CheckLuaToQua(l, 9, 10, 11, 12);
 	int numEnts = 0;
-	unsigned hitCode = scn::Entity::IncHitCode();
-	gDesc.Begin(scn::WorldRoot(), a, b);
+	Context& c = GlobalContext();
+	c.ClearMarks();
+	scn::FlushLinks();
+	c.desc.BeginHot(scn::WorldRoot(), a, b);
 
-	while(gDesc.numStacked)
+	while(c.desc.numStacked)
 	{
-		const scn::WorldNode& node = *(scn::WorldNode*)gDesc.s[gDesc.numStacked - 1].node;
+		uint32_t hot = c.desc.s[c.desc.numStacked - 1].hot;
 
-		if(!node.left && !node.solid)
+		if(!hotNodes[hot].left && !(hotNodes[hot].flags & scn::Node::SOLID))
 		{
+			const scn::WorldNode& node = HotWorldNode(hot);
+
 			for(size_t i = 0; i < node.numEntLinks; i++)
 			{
 				const scn::Entity& ent = *node.entLinks[i].obj;
 
-				if(ent.hitCode == hitCode)
+				if(!c.Mark(ent))
 					continue;
-
-				ent.hitCode = hitCode;
 				ent.LuaPush();
 				lua_rawseti(l, 1, ++numEnts);
 			}
 		}
 
-		gDesc.Descend(h, q);
+		c.desc.HotDescend(h, q);
 	}
 
 	lua_pushinteger(l, numEnts);
@@ -619,24 +956,26 @@ int hit::SphereEntities(lua_State* l)
 	const flg::FlagSet *ignore = flg::FlagSet::DefaultLuaTo(6);
 	float sqRadius = radius * radius;
 	int numEnts = 0;
-	unsigned hitCode = scn::Entity::IncHitCode();
-	gDesc.Begin(scn::WorldRoot(), pos, pos);
+	Context& c = GlobalContext();
+	c.ClearMarks();
+	scn::FlushLinks();
+	c.desc.BeginHot(scn::WorldRoot(), pos, pos);
 
-	while(gDesc.numStacked)
+	while(c.desc.numStacked)
 	{
-		const scn::WorldNode& node = *(scn::WorldNode*)gDesc.s[gDesc.numStacked - 1].node;
+		uint32_t hot = c.desc.s[c.desc.numStacked - 1].hot;
 
-		if(!node.left && !node.solid)
+		if(!hotNodes[hot].left && !(hotNodes[hot].flags & scn::Node::SOLID))
 		{
+			const scn::WorldNode& node = HotWorldNode(hot);
+
 			for(size_t i = 0; i < node.numEntLinks; i++)
 			{
 				const scn::Entity& ent = *node.entLinks[i].obj;
 
-				if(ent.hitCode == hitCode)
+				if(!c.Mark(ent))
 					continue;
 
-				ent.hitCode = hitCode;
-
 				if(ent.gFlags.True(*ignore) || (ent.Pos() - pos).MagSq() > sqRadius)
 					continue;
 
@@ -645,13 +984,129 @@ int hit::SphereEntities(lua_State* l)
 			}
 		}
 
-		gDesc.SphereDescend(radius);
+		c.desc.HotSphereDescend(radius);
 	}
 
 	lua_pushinteger(l, numEnts);
 	return 1;
 }
 
+/*
+################################################################################################
+
+
+	CONTEXT LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	hit::StressContexts (hit_stress_contexts)
+
+IN	[iNumQueries = 4000], [iNumRounds = 4], [iSeed = 1], [iTestType = ALL], [fsetIgnore]
+
+Does random line and box tests inside the world's bounds on the main thread, then repeats them
+iNumRounds times spread over wrp worker threads with a Context each. Logs how many threaded
+results differ from the main thread's.
+--------------------------------------*/
+int hit::StressContexts(lua_State* l)
+{
+	lua_Integer numQueries = luaL_optinteger(l, 1, 4000);
+	lua_Integer numRounds = luaL_optinteger(l, 2, 4);
+	uint32_t seed = luaL_optinteger(l, 3, 1);
+	test_type type = (test_type)luaL_optinteger(l, 4, ALL);
+	const flg::FlagSet* ignore = flg::FlagSet::DefaultLuaTo(5);
+
+	if(!scn::WorldRoot() || numQueries <= 0)
+		return 0;
+
+	scn::FlushLinks(); // Workers can't flush
+	Hull box(com::Vec3(-16.0f), com::Vec3(16.0f));
+	com::Arr<stress_query> queries(numQueries);
+	com::Arr<Result> expected(numQueries);
+	const com::Vec3& min = scn::WorldMin();
+	com::Vec3 size = scn::WorldMax() - min;
+
+	for(size_t i = 0; i < queries.n; i++)
+	{
+		stress_query& q = queries[i];
+
+		for(size_t j = 0; j < 3; j++)
+		{
+			q.a[j] = min[j] + size[j] * com::BenchRandF(seed);
+			q.b[j] = min[j] + size[j] * com::BenchRandF(seed);
+		}
+
+		q.hull = i % 2 ? &box : 0;
+		q.type = type;
+		q.ignore = ignore;
+		StressQuery(queries.o, i, -1);
+		expected[i] = q.res;
+	}
+
+	EnsureWorkerContexts();
+	size_t numDiffs = 0;
+	unsigned long long startTime = wrp::MicroTime();
+
+	for(lua_Integer r = 0; r < numRounds; r++)
+	{
+		wrp::RunJobs(StressQuery, queries.o, numQueries);
+
+		for(size_t i = 0; i < queries.n; i++)
+			numDiffs += !SameResult(queries[i].res, expected[i]);
+	}
+
+	unsigned long long micro = wrp::MicroTime() - startTime;
+
+	con::LogF("%d queries x %d rounds on %u threads in %g ms, %u results differ",
+		(int)numQueries, (int)numRounds, (unsigned)wrp::NumWorkers(), micro * 0.001,
+		(unsigned)numDiffs);
+
+	queries.Free();
+	expected.Free();
+	return 0;
+}
+
+/*--------------------------------------
+	hit::StressQuery
+
+worker -1 uses the main thread's Context.
+--------------------------------------*/
+void hit::StressQuery(void* queries, size_t index, size_t worker)
+{
+	stress_query& q = ((stress_query*)queries)[index];
+	Context* ctx = worker == -1 ? &gCtx : &workerContexts[worker];
+
+	if(q.hull)
+	{
+		q.res = HullTest(scn::WorldRoot(), *q.hull, q.a, q.b, com::QUA_IDENTITY, q.type,
+			*q.ignore, (const scn::Entity*)0, ctx);
+	}
+	else
+		q.res = LineTest(scn::WorldRoot(), q.a, q.b, q.type, *q.ignore, (const scn::Entity*)0, ctx);
+}
+
+/*--------------------------------------
+	hit::SameResult
+--------------------------------------*/
+bool hit::SameResult(const Result& x, const Result& y)
+{
+	if(x.contact != y.contact)
+		return false;
+
+	if(x.contact == Result::NONE)
+		return true;
+
+	if(x.ent != y.ent)
+		return false;
+
+	if(x.contact == Result::HIT)
+		return x.timeFirst == y.timeFirst && x.normal == y.normal;
+
+	return x.mtvMag == y.mtvMag && x.mtvDir == y.mtvDir;
+}
+
 /*
 ################################################################################################
 
@@ -679,6 +1134,7 @@ void hit::Init()
 		{"EnsureHull", EnsureHull},
 		{"Descent", CreateDescent},
 		{"LineTest", LineTest},
+		{"LineTestBatch", LineTestBatch},
 		{"HullTest", HullTest},
 		{"DescentEntities", DescentEntities},
 		{"SphereEntities", SphereEntities},
@@ -756,6 +1212,11 @@ void hit::Init()
 	scr::RegisterLibrary(scr::state, "ghit", regs, consts, 0, metas, prefixes);
 	Hull::RegisterMetatable(hulRegs, 0);
 	Descent::RegisterMetatable(dscRegs, 0);
+
+	// Console commands
+	lua_pushcfunction(scr::state, BenchDescent); con::CreateCommand("hit_bench_descent");
+	lua_pushcfunction(scr::state, StressContexts); con::CreateCommand("hit_stress_contexts");
+	lua_pushcfunction(scr::state, BenchRays); con::CreateCommand("hit_bench_rays");
 }
 
 /*--------------------------------------
@@ -18,6 +18,8 @@
 namespace hit
 {
 
+class Context;
+
 /*
 ################################################################################################
 	HULL
@@ -85,17 +87,26 @@ enum test_type
 	ALL_ALT = ENTITIES | TREE | ALT
 };
 
+/* Tests given no Context use the main thread's and flush deferred entity links first; call
+scn::FlushLinks before running tests with other Contexts */
 Result	LineTest(scn::WorldNode* root, const com::Vec3& a, const com::Vec3& b,
 		const test_type type, const flg::FlagSet& ignore, const scn::Entity** entIgnores,
-		size_t numEntIgnores);
+		size_t numEntIgnores, Context* ctx = 0);
 Result	LineTest(scn::WorldNode* root, const com::Vec3& a, const com::Vec3& b,
-		const test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore);
+		const test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore,
+		Context* ctx = 0);
 Result	HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 		const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-		const scn::Entity** entIgnores, size_t numEntIgnores);
+		const scn::Entity** entIgnores, size_t numEntIgnores, Context* ctx = 0);
 Result	HullTest(scn::WorldNode* root, const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 		const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-		const scn::Entity* entIgnore);
+		const scn::Entity* entIgnore, Context* ctx = 0);
+size_t	LineTestBatch(scn::WorldNode* root, const com::Vec3* as, const com::Vec3* bs,
+		size_t numRays, const test_type type, const flg::FlagSet& ignore,
+		const scn::Entity** entIgnores, size_t numEntIgnores, Result* resultsOut,
+		Context* ctx = 0);
+
+extern con::Option packetRays, entityTree;
 
 /*
 ################################################################################################
@@ -137,7 +148,8 @@ enum desc_op
 
 struct desc_elem
 {
-	scn::Node*	node;
+	scn::Node*	node; // 0 in hot descents
+	uint32_t	hot; // Index of hot_node in hot descents
 	com::Vec3	a, b;
 	com::Vec3	hitNormal; // Possible hit-surface normal
 	desc_op		op; // Last operation done to get this segment
@@ -149,6 +161,7 @@ struct desc_elem
 
 // Stack array used for BSP tree descent
 // A descent other than the global can be created if two concurrent descents need to be done
+// Hot descents go through the world's hot_node array and must only be continued with Hot funcs
 class Descent : public res::Resource<Descent>
 {
 public:
@@ -164,10 +177,96 @@ public:
 	size_t				LineDescend();
 	size_t				Descend(const Hull& h, const com::Qua& ori);
 	size_t				SphereDescend(float radius);
+	size_t				BeginHot(const scn::WorldNode* root, const com::Vec3& a,
+						const com::Vec3& b);
+	size_t				HotLineDescend();
+	size_t				HotDescend(const Hull& h, const com::Qua& ori);
+	size_t				HotSphereDescend(float radius);
 };
 
 Descent& GlobalDescent();
 
+/*======================================
+	hit::hot_node
+
+Compact, immutable copy of a world node's descent data. Children are hot_node indices; left is 0
+for leaves since the root is never a child. Leaf data stays in the scn::WorldNode. 32 bytes, so
+two nodes share a cache line.
+======================================*/
+struct hot_node
+{
+	com::Vec3	normal;
+	float		offset;
+	uint32_t	left, right;
+	uint32_t	node; // Index in the world's node array
+	uint32_t	flags; // scn::Node::SOLID
+};
+
+/*======================================
+	hit::packet_elem
+
+Descent stack element of a ray packet. Lanes are rays; lane i is active if bit i of mask is set.
+Each lane's piece is its ray's [tMin, tMax] interval.
+======================================*/
+struct packet_elem
+{
+	uint32_t	hot;
+	unsigned	mask;
+	unsigned	startMask; // Lanes whose piece contains the ray's start point
+	float		tMin[4], tMax[4];
+	float		normal[3][4]; // Possible hit-surface normal of each lane
+};
+
+void			BuildHotTree();
+void			ClearHotTree();
+scn::WorldNode&	HotWorldNode(uint32_t hot);
+
+/*
+################################################################################################
+	CONTEXT
+################################################################################################
+*/
+
+/*======================================
+	hit::Context
+
+Scratch memory for hit tests: a descent stack and a set of entities already tested. Tests that
+use different Contexts can run on different threads at the same time as long as the world and
+entities aren't modified meanwhile.
+======================================*/
+class Context
+{
+public:
+	Descent					desc;
+	com::Arr<packet_elem>	packetStack;
+	com::Arr<uint32_t>		treeStack; // Entity tree query
+	com::Arr<scn::Entity*>	treeEnts;
+
+				Context();
+				~Context() {marks.Free(); packetStack.Free(); treeStack.Free(); treeEnts.Free();}
+	void		ClearMarks();
+	bool		Mark(const scn::Entity& ent, unsigned set = 0); // False if already marked
+
+private:
+	// Each ray of a packet marks entities in its own set
+	struct ent_mark
+	{
+		const scn::Entity*	ent;
+		unsigned			set;
+		unsigned			code;
+	};
+
+	com::Arr<ent_mark>	marks; // Open-addressing hash set, size is a power of 2
+	size_t				numMarks;
+	unsigned			markCode;
+
+				Context(const Context&);
+	Context&	operator=(const Context&);
+	void		GrowMarks();
+};
+
+Context& GlobalContext();
+
 /*
 ################################################################################################
 	COLLISION RESPONSE
@@ -178,15 +277,16 @@ com::Vec3	RespondStop(const Result& r, const com::Vec3& a, const com::Vec3& b,
 			float* trOut = 0);
 com::Vec3	MoveStop(const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 			const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-			const scn::Entity* entIgnore, Result* rOut, float* tmOut = 0);
+			const scn::Entity* entIgnore, Result* rOut, float* tmOut = 0, Context* ctx = 0);
 com::Vec3	MoveClimb(const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 			const com::Qua& ori, float height, float floorZ, test_type type,
 			const flg::FlagSet& ignore, const scn::Entity* entIgnore, bool& climbedOut,
-			Result* resultsOut, size_t* numResultsOut, float* tmiOut = 0, float* tmoOut = 0);
+			Result* resultsOut, size_t* numResultsOut, float* tmiOut = 0, float* tmoOut = 0,
+			Context* ctx = 0);
 com::Vec3	MoveSlide(const Hull& hull, com::Vec3 pos, com::Vec3& velIO, const com::Qua& ori,
 			float& timeIO, Result* resultsIO, size_t& numResultsIO, float climbHeight,
 			float floorZ, test_type type, const flg::FlagSet& ignore,
-			const scn::Entity* entIgnore);
+			const scn::Entity* entIgnore, Context* ctx = 0);
 
 /*
 ################################################################################################
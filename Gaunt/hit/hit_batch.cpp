@@ -0,0 +1,448 @@
+// hit_batch.cpp
+// Martynas Ceicys
+
+#include <float.h>
+#include <math.h>
+#include <xmmintrin.h>
+
+#include "hit.h"
+#include "hit_lua.h"
+#include "hit_private.h"
+#include "../console/console.h"
+#include "../wrap/wrap.h"
+
+namespace hit
+{
+	con::Option packetRays("hit_packet_rays", 1);
+
+	const unsigned char NUM_LANE_BITS[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+	// LINE TEST BATCH
+	unsigned	TestPacket(scn::WorldNode* root, const com::Vec3* as, const com::Vec3* bs,
+				test_type type, const flg::FlagSet& ignore, const scn::Entity** entIgnores,
+				size_t numEntIgnores, Result* resultsOut, Context& c);
+	void		TestPacketLeaf(const packet_elem& cur, const com::Vec3* as, const com::Vec3* bs,
+				test_type type, const flg::FlagSet& ignore, Result* resultsIO,
+				unsigned& liveIO, Context& c);
+	void		SplitPacket(const packet_elem& cur, const __m128 (&o)[3], const __m128 (&d)[3],
+				unsigned& liveIO, unsigned& divergedIO, Context& c, size_t& numStackedIO);
+	__m128		Select(__m128 mask, __m128 a, __m128 b);
+
+	// LINE TEST BATCH LUA
+	bool		CloseResult(const Result& x, const Result& y);
+}
+
+/*
+################################################################################################
+
+
+	LINE TEST BATCH
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	hit::LineTestBatch
+
+Does a LineTest from as[i] to bs[i] for every i < numRays and puts the results in resultsOut.
+
+If hit_packet_rays is on, rays are descended through the hot tree four at a time with SSE plane
+tests. A ray leaves its packet and is tested alone if it lies in a plane or splits at a node in
+the opposite direction of the rest of the packet; rays in the same direction from nearby starts
+stay together the longest. Returns the number of rays that were tested alone.
+--------------------------------------*/
+size_t hit::LineTestBatch(scn::WorldNode* root, const com::Vec3* as, const com::Vec3* bs,
+	size_t numRays, const test_type type, const flg::FlagSet& ignore,
+	const scn::Entity** entIgnores, size_t numEntIgnores, Result* resultsOut, Context* ctx)
+{
+	Context& c = ctx ? *ctx : GlobalContext();
+	size_t numSingle = 0, i = 0;
+
+	if(&c == &GlobalContext())
+		scn::FlushLinks();
+
+	if(packetRays.Bool() && root && hotNodes)
+	{
+		for(; i + 4 <= numRays; i += 4)
+		{
+			unsigned diverged = TestPacket(root, as + i, bs + i, type, ignore, entIgnores,
+				numEntIgnores, resultsOut + i, c);
+
+			for(size_t j = 0; j < 4; j++)
+			{
+				if(!(diverged & 1 << j))
+					continue;
+
+				resultsOut[i + j] = LineTest(root, as[i + j], bs[i + j], type, ignore,
+					entIgnores, numEntIgnores, &c);
+
+				numSingle++;
+			}
+		}
+	}
+
+	for(; i < numRays; i++, numSingle++)
+	{
+		resultsOut[i] = LineTest(root, as[i], bs[i], type, ignore, entIgnores, numEntIgnores,
+			&c);
+	}
+
+	return numSingle;
+}
+
+/*--------------------------------------
+	hit::TestPacket
+
+Tests four rays together. Returns a mask of lanes that diverged; their results are not valid.
+
+Rays are o + d * t, t in [0, 1]. Each lane's pieces are visited in order of increasing t, so like
+LineTest, a lane is done once it hits something within its current leaf. If hit_entity_tree is
+on, each lane's entities are tested after the descent instead.
+--------------------------------------*/
+unsigned hit::TestPacket(scn::WorldNode* root, const com::Vec3* as, const com::Vec3* bs,
+	test_type type, const flg::FlagSet& ignore, const scn::Entity** entIgnores,
+	size_t numEntIgnores, Result* resultsOut, Context& c)
+{
+	__m128 o[3], d[3];
+
+	for(size_t k = 0; k < 3; k++)
+	{
+		o[k] = _mm_setr_ps(as[0][k], as[1][k], as[2][k], as[3][k]);
+		d[k] = _mm_setr_ps(bs[0][k] - as[0][k], bs[1][k] - as[1][k], bs[2][k] - as[2][k],
+			bs[3][k] - as[3][k]);
+	}
+
+	c.ClearMarks();
+
+	for(unsigned i = 0; i < 4; i++)
+	{
+		Result none = {Result::NONE, FLT_MAX, -FLT_MAX};
+		resultsOut[i] = none;
+
+		for(size_t j = 0; j < numEntIgnores; j++)
+		{
+			if(entIgnores[j])
+				c.Mark(*entIgnores[j], i);
+		}
+	}
+
+	bool useTree = (type & ENTITIES) && entityTree.Bool();
+	test_type leafType = useTree ? (test_type)(type & ~ENTITIES) : type;
+	unsigned live = 15, diverged = 0;
+	c.packetStack.Ensure(1);
+	packet_elem& start = c.packetStack[0];
+	start.hot = hotIndices[root - scn::WorldRoot()];
+	start.mask = start.startMask = 15;
+
+	for(size_t i = 0; i < 4; i++)
+	{
+		start.tMin[i] = 0.0f;
+		start.tMax[i] = 1.0f;
+		start.normal[0][i] = start.normal[1][i] = start.normal[2][i] = 0.0f;
+	}
+
+	size_t numStacked = 1;
+
+	while(numStacked)
+	{
+		packet_elem cur = c.packetStack[--numStacked]; // Save and pop
+		cur.mask &= live;
+
+		if(!cur.mask)
+			continue; // Every lane in this piece is done or diverged
+
+		if(!hotNodes[cur.hot].left)
+			TestPacketLeaf(cur, as, bs, leafType, ignore, resultsOut, live, c);
+		else
+			SplitPacket(cur, o, d, live, diverged, c, numStacked);
+	}
+
+	if(useTree)
+	{
+		for(unsigned i = 0; i < 4; i++)
+		{
+			if(!(diverged & 1 << i))
+				LineTestTreeEntities(c, i, as[i], bs[i], type, ignore, resultsOut[i]);
+		}
+	}
+
+	return diverged;
+}
+
+/*--------------------------------------
+	hit::TestPacketLeaf
+
+Does LineTest's leaf tests for each lane in cur.
+--------------------------------------*/
+void hit::TestPacketLeaf(const packet_elem& cur, const com::Vec3* as, const com::Vec3* bs,
+	test_type type, const flg::FlagSet& ignore, Result* results, unsigned& live, Context& c)
+{
+	scn::WorldNode& leaf = HotWorldNode(cur.hot);
+	bool solid = (hotNodes[cur.hot].flags & scn::Node::SOLID) != 0;
+
+	if(solid ? !(type & TREE) : !(type & ENTITIES))
+		return;
+
+	for(unsigned i = 0; i < 4; i++)
+	{
+		unsigned bit = 1 << i;
+
+		if(!(cur.mask & bit))
+			continue;
+
+		Result& res = results[i];
+
+		if(solid)
+		{
+			res.ent = 0;
+
+			if(cur.startMask & bit)
+			{
+				res.contact = Result::INTERSECT;
+				res.timeFirst = 0.0f;
+				LeafExitVec(as[i], leaf, res);
+			}
+			else if(res.timeFirst >= cur.tMin[i])
+			{
+				res.contact = Result::HIT;
+				res.timeFirst = cur.tMin[i];
+				res.normal = com::Vec3(cur.normal[0][i], cur.normal[1][i], cur.normal[2][i]);
+			}
+
+			live &= ~bit;
+		}
+		else
+		{
+			LineTestLeafEntities(c, i, leaf, as[i], bs[i], type, ignore, res);
+
+			if(res.contact == Result::INTERSECT ||
+			(res.contact == Result::HIT && res.timeFirst < cur.tMax[i]))
+				live &= ~bit; // Hit entity within the current leaf
+		}
+	}
+}
+
+/*--------------------------------------
+	hit::SplitPacket
+
+Pushes cur's lanes on either side of its node's plane, the near side last. A lane touching the
+plane goes to both sides like a LineDescend SPLIT.
+--------------------------------------*/
+void hit::SplitPacket(const packet_elem& cur, const __m128 (&o)[3], const __m128 (&d)[3],
+	unsigned& live, unsigned& diverged, Context& c, size_t& numStacked)
+{
+	const hot_node& n = hotNodes[cur.hot];
+	const __m128 zero = _mm_setzero_ps();
+	__m128 nx = _mm_set1_ps((float)n.normal.x);
+	__m128 ny = _mm_set1_ps((float)n.normal.y);
+	__m128 nz = _mm_set1_ps((float)n.normal.z);
+
+	__m128 distO = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, o[0]), _mm_mul_ps(ny, o[1])),
+		_mm_mul_ps(nz, o[2])), _mm_set1_ps(n.offset));
+
+	__m128 distD = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, d[0]), _mm_mul_ps(ny, d[1])),
+		_mm_mul_ps(nz, d[2]));
+
+	__m128 tMin = _mm_loadu_ps(cur.tMin), tMax = _mm_loadu_ps(cur.tMax);
+	__m128 distA = _mm_add_ps(distO, _mm_mul_ps(tMin, distD));
+	__m128 distB = _mm_add_ps(distO, _mm_mul_ps(tMax, distD));
+
+	unsigned left = cur.mask & ~_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(distA, zero),
+		_mm_cmpgt_ps(distB, zero)));
+
+	unsigned right = cur.mask & ~_mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(distA, zero),
+		_mm_cmplt_ps(distB, zero)));
+
+	// Lanes lying in the plane would be copied to both sides; leave that to LineTest
+	unsigned inPlane = cur.mask & _mm_movemask_ps(_mm_and_ps(_mm_cmpeq_ps(distA, zero),
+		_mm_cmpeq_ps(distB, zero)));
+
+	// Split lanes must agree on which side comes first; the minority diverges
+	unsigned split = left & right & ~inPlane;
+	unsigned splitRight = split & _mm_movemask_ps(_mm_cmpge_ps(distA, distB));
+	unsigned splitLeft = split & ~splitRight;
+	bool nearRight = NUM_LANE_BITS[splitRight] > NUM_LANE_BITS[splitLeft];
+	unsigned lost = inPlane | (nearRight ? splitLeft : splitRight);
+	split &= ~lost;
+	left &= ~lost;
+	right &= ~lost;
+	live &= ~lost;
+	diverged |= lost;
+
+	__m128 splitMask = _mm_cmpneq_ps(_mm_setr_ps((float)(split & 1), (float)(split & 2),
+		(float)(split & 4), (float)(split & 8)), zero);
+
+	// Split time, exact if an end is on the plane
+	__m128 tSplit = _mm_div_ps(_mm_sub_ps(zero, distO), distD);
+	tSplit = _mm_max_ps(tMin, _mm_min_ps(tMax, tSplit));
+	tSplit = Select(_mm_cmpeq_ps(distB, zero), tMax, tSplit);
+	tSplit = Select(_mm_cmpeq_ps(distA, zero), tMin, tSplit);
+
+	c.packetStack.Ensure(numStacked + 2);
+	unsigned nearMask = nearRight ? right : left, farMask = nearRight ? left : right;
+
+	if(farMask)
+	{
+		// Split lanes start at the plane; the hit-surface normal faces the near side
+		packet_elem& back = c.packetStack[numStacked++];
+		back.hot = nearRight ? n.left : n.right;
+		back.mask = farMask;
+		back.startMask = cur.startMask & ~split;
+		_mm_storeu_ps(back.tMin, Select(splitMask, tSplit, tMin));
+		_mm_storeu_ps(back.tMax, tMax);
+		float sign = nearRight ? 1.0f : -1.0f;
+
+		for(size_t k = 0; k < 3; k++)
+		{
+			__m128 normal = _mm_loadu_ps(cur.normal[k]);
+
+			_mm_storeu_ps(back.normal[k], Select(splitMask,
+				_mm_set1_ps(sign * (float)n.normal[k]), normal));
+		}
+	}
+
+	if(nearMask)
+	{
+		packet_elem& front = c.packetStack[numStacked++];
+		front = cur;
+		front.hot = nearRight ? n.right : n.left;
+		front.mask = nearMask;
+		_mm_storeu_ps(front.tMax, Select(splitMask, tSplit, tMax));
+	}
+}
+
+/*--------------------------------------
+	hit::Select
+
+Returns a's lanes where mask is set and b's elsewhere.
+--------------------------------------*/
+__m128 hit::Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/*
+################################################################################################
+
+
+	LINE TEST BATCH LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	hit::BenchRays (hit_bench_rays)
+
+IN	[iNumRays = 4096], [iNumFrames = 30], [iSeed = 1], [iTestType = ALL]
+
+Line tests iNumRays rays per frame from random points in the world's bounds, first one by one,
+then with LineTestBatch. Every four rays share a start and fan out slightly, like a burst of
+bullets. Logs rays per second of both modes, how many rays left their packet, and how many
+results differ.
+--------------------------------------*/
+int hit::BenchRays(lua_State* l)
+{
+	lua_Integer numRays = luaL_optinteger(l, 1, 4096);
+	lua_Integer numFrames = luaL_optinteger(l, 2, 30);
+	uint32_t seed = luaL_optinteger(l, 3, 1);
+	test_type type = (test_type)luaL_optinteger(l, 4, ALL);
+
+	if(!scn::WorldRoot() || numRays <= 0 || numFrames <= 0)
+		return 0;
+
+	com::Arr<com::Vec3> as(numRays), bs(numRays);
+	com::Arr<Result> single(numRays), batch(numRays);
+	const com::Vec3& min = scn::WorldMin();
+	com::Vec3 size = scn::WorldMax() - min;
+	float length = size.Mag() * 0.25f;
+	com::Vec3 start, dir;
+
+	for(size_t i = 0; i < as.n; i++)
+	{
+		if(i % 4 == 0)
+		{
+			for(size_t j = 0; j < 3; j++)
+			{
+				start[j] = min[j] + size[j] * com::BenchRandF(seed);
+				dir[j] = com::BenchRandF(seed) * 2.0f - 1.0f;
+			}
+
+			dir = dir.Normalized();
+		}
+
+		com::Vec3 spread;
+
+		for(size_t j = 0; j < 3; j++)
+			spread[j] = (com::BenchRandF(seed) * 2.0f - 1.0f) * 0.05f;
+
+		as[i] = start;
+		bs[i] = start + (dir + spread).Normalized() * length;
+	}
+
+	const flg::FlagSet& ignore = flg::EmptySet();
+	Context& c = GlobalContext();
+	unsigned long long startTime = wrp::MicroTime();
+
+	for(lua_Integer f = 0; f < numFrames; f++)
+	{
+		for(size_t i = 0; i < as.n; i++)
+			single[i] = LineTest(scn::WorldRoot(), as[i], bs[i], type, ignore, 0, 0, &c);
+	}
+
+	unsigned long long singleMicro = wrp::MicroTime() - startTime;
+	bool oldPacketRays = packetRays.Bool();
+	packetRays.SetValue(1.0f, false);
+	size_t numSingle = 0;
+	startTime = wrp::MicroTime();
+
+	for(lua_Integer f = 0; f < numFrames; f++)
+	{
+		numSingle = LineTestBatch(scn::WorldRoot(), as.o, bs.o, as.n, type, ignore, 0, 0,
+			batch.o, &c);
+	}
+
+	unsigned long long batchMicro = wrp::MicroTime() - startTime;
+	packetRays.SetValue(oldPacketRays ? 1.0f : 0.0f, false);
+	size_t numDiffs = 0;
+
+	for(size_t i = 0; i < as.n; i++)
+		numDiffs += !CloseResult(single[i], batch[i]);
+
+	double numTotal = (double)numRays * numFrames;
+
+	con::LogF("Single: %g rays/s", singleMicro ? numTotal / (singleMicro * 0.000001) : 0.0);
+	con::LogF("Packet: %g rays/s, %u of %u rays tested alone", batchMicro ?
+		numTotal / (batchMicro * 0.000001) : 0.0, (unsigned)numSingle, (unsigned)numRays);
+	con::LogF("%u results differ", (unsigned)numDiffs);
+
+	as.Free();
+	bs.Free();
+	single.Free();
+	batch.Free();
+	return 0;
+}
+
+/*--------------------------------------
+	hit::CloseResult
+
+Packets find hit times from plane distances instead of clipped segment lengths, so times may
+differ by rounding.
+--------------------------------------*/
+bool hit::CloseResult(const Result& x, const Result& y)
+{
+	if(x.contact != y.contact)
+		return false;
+
+	if(x.contact == Result::NONE)
+		return true;
+
+	if(x.ent != y.ent)
+		return false;
+
+	if(x.contact == Result::HIT)
+		return fabs(x.timeFirst - y.timeFirst) < 0.0001f && x.normal == y.normal;
+
+	return fabs(x.mtvMag - y.mtvMag) < 0.0001f;
+}
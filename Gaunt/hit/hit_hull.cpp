@@ -139,8 +139,7 @@ If only verts is given, generates a convex hull surrounding the vertices.
 If vertices and axes are given, they must be the output of com::ReadConvexData and not 0. The
 constructor copies the addresses of the arrays, so the caller should leave them alone after.
 --------------------------------------*/
-hit::Convex::Convex(const com::Vec3* verts, size_t numVerts) : Hull(CONVEX, 0.0f, 0.0f),
-	markCode(0)
+hit::Convex::Convex(const com::Vec3* verts, size_t numVerts) : Hull(CONVEX, 0.0f, 0.0f)
 {
 	com::list<com::Face> faces;
 	com::Vertex* tempVerts;
@@ -163,8 +162,7 @@ hit::Convex::Convex(const com::Vec3* verts, size_t numVerts) : Hull(CONVEX, 0.0f
 hit::Convex::Convex(const char* name, com::ClimbVertex* vertices, size_t numVertices,
 	com::Vec3* axes, size_t numNormalAxes, size_t numEdgeAxes, unsigned numLocks)
 	: Hull(name, CONVEX, 0.0f, 0.0f, numLocks), vertices(vertices), axes(axes),
-	numVertices(numVertices), numNormalAxes(numNormalAxes), numEdgeAxes(numEdgeAxes),
-	markCode(0)
+	numVertices(numVertices), numNormalAxes(numNormalAxes), numEdgeAxes(numEdgeAxes)
 {
 	com::VertBox(vertices, numVertices, boxMin, boxMax);
 	CreateNormalSpans();
@@ -189,6 +187,10 @@ hit::Convex::~Convex()
 /*--------------------------------------
 	hit::Convex::Span
 
+Hill climbing only moves to strictly farther vertices, so it needs no visited marks and the hull
+can be spanned by several threads at once. On a convex hull, a vertex with no farther neighbor
+is the farthest vertex.
+
 FIXME: Hill climbing might be sped up with an initial tetrahedron check.
 --------------------------------------*/
 void hit::Convex::Span(const com::Vec3& axis, float& minOut, float& maxOut) const
@@ -211,24 +213,16 @@ void hit::Convex::Span(const com::Vec3& axis, float& minOut, float& maxOut) cons
 	else
 	{
 		// Hill climbing
-		vertices->testCode = IncMarkCode();
-
-		com::ClimbVertex *minVert = vertices, *maxVert = vertices;
+		const com::ClimbVertex *minVert = vertices, *maxVert = vertices;
 		minOut = maxOut = com::Dot(*minVert, axis);
 
 		while(1)
 		{
-			com::ClimbVertex* cur = minVert;
+			const com::ClimbVertex* cur = minVert;
 
 			for(size_t i = 0; i < cur->numAdjacents; i++)
 			{
-				com::ClimbVertex& adjacent = *cur->adjacents[i];
-
-				if(adjacent.testCode == markCode)
-					continue;
-				else
-					adjacent.testCode = markCode;
-
+				const com::ClimbVertex& adjacent = *cur->adjacents[i];
 				float dot = com::Dot(adjacent.pos, axis);
 
 				if(dot < minOut)
@@ -249,17 +243,11 @@ void hit::Convex::Span(const com::Vec3& axis, float& minOut, float& maxOut) cons
 
 		while(1)
 		{
-			com::ClimbVertex* cur = maxVert;
+			const com::ClimbVertex* cur = maxVert;
 
 			for(size_t i = 0; i < cur->numAdjacents; i++)
 			{
-				com::ClimbVertex& adjacent = *cur->adjacents[i];
-
-				if(adjacent.testCode == markCode)
-					continue;
-				else
-					adjacent.testCode = markCode;
-
+				const com::ClimbVertex& adjacent = *cur->adjacents[i];
 				float dot = com::Dot(adjacent.pos, axis);
 
 				if(dot > maxOut)
@@ -275,55 +263,6 @@ void hit::Convex::Span(const com::Vec3& axis, float& minOut, float& maxOut) cons
 	}
 }
 
-/*--------------------------------------
-	hit::Convex::FarVertices
---------------------------------------*/
-size_t hit::Convex::FarVertices(const com::Vec3& axis,
-	com::Arr<com::ClimbVertex*>& far) const
-{
-	vertices->testCode = IncMarkCode();
-	com::ClimbVertex* cur = &vertices[0];
-	float maxDist = com::Dot(cur->pos, axis);
-	size_t numFar = 1;
-	far.Ensure(1);
-	far[0] = &vertices[0];
-
-	for(size_t i = 0; i < cur->numAdjacents;)
-	{
-		com::ClimbVertex& adjacent = *cur->adjacents[i];
-
-		if(adjacent.testCode == markCode)
-			continue;
-		else
-			adjacent.testCode = markCode;
-
-		float dot = com::Dot(adjacent.pos, axis);
-
-		// FIXME: epsilon based on hull radius?
-		if(dot > maxDist + HIT_ERROR_BUFFER)
-		{
-			// Found farther plane, restart list
-			maxDist = dot;
-			numFar = 1;
-			far[0] = &adjacent;
-			cur = &adjacent;
-			i = 0;
-		}
-		else if(dot >= maxDist - HIT_ERROR_BUFFER)
-		{
-			// Found coplanar vertex, add it to list
-			far.Ensure(numFar + 1);
-			far[numFar++] = &adjacent;
-			cur = &adjacent; // Restart search at adjacent
-			i = 0;
-		}
-		else
-			i++; // Vertex is behind cur
-	}
-
-	return numFar;
-}
-
 /*--------------------------------------
 	hit::Convex::Average
 --------------------------------------*/
@@ -396,22 +335,6 @@ void hit::Convex::DefaultHull()
 	CreateNormalSpans();
 }
 
-/*--------------------------------------
-	hit::Convex::IncMarkCode
---------------------------------------*/
-size_t hit::Convex::IncMarkCode() const
-{
-	if(++markCode == 0)
-	{
-		for(size_t i = 0; i < numVertices; i++)
-			vertices[i].testCode = 0;
-
-		markCode = 1;
-	}
-
-	return markCode;
-}
-
 /*--------------------------------------
 	hit::Frustum::Frustum
 --------------------------------------*/
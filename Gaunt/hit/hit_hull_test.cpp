@@ -45,14 +45,17 @@ static const com::Vec3 BOX_AXES[3] =
 	com::Vec3(0.0f, 0.0f, 1.0f)
 };
 
+// Not a function static so it's constructed before any thread can test a line
+static const hit::Hull LINE_POINT(0.0f, 0.0f);
+
 /*--------------------------------------
 	hit::TestLineHull
 --------------------------------------*/
 bool hit::TestLineHull(const com::Vec3& lineA, const com::Vec3& lineB, const Hull& h,
 	const com::Vec3& hullPos, const com::Qua& hullOri, Result& resInOut)
 {
-	static Hull point(0.0f, 0.0f);
-	return TestHullHull(point, lineA, lineB, com::QUA_IDENTITY, h, hullPos, hullOri, resInOut);
+	return TestHullHull(LINE_POINT, lineA, lineB, com::QUA_IDENTITY, h, hullPos, hullOri,
+		resInOut);
 }
 
 hit::Result hit::TestLineHull(const com::Vec3& lineA, const com::Vec3& lineB, const Hull& h,
@@ -33,10 +33,17 @@ namespace hit
 
 	// HIT TEST LUA
 	int LineTest(lua_State* l);
+	int LineTestBatch(lua_State* l);
 	int HullTest(lua_State* l);
 	int DescentEntities(lua_State* l);
 	int SphereEntities(lua_State* l);
 
+	// CONTEXT LUA
+	int StressContexts(lua_State* l);
+
+	// LINE TEST BATCH LUA
+	int BenchRays(lua_State* l);
+
 	// HULL TEST LUA
 	int TestLineHull(lua_State* l);
 	int TestHullHull(lua_State* l);
@@ -57,6 +64,7 @@ namespace hit
 	int DscNumElements(lua_State* l);
 	int DscElementNode(lua_State* l);
 	int DscElementLine(lua_State* l);
+	int BenchDescent(lua_State* l);
 }
 
 #endif
\ No newline at end of file
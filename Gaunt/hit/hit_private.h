@@ -13,6 +13,17 @@ namespace hit
 	// DESCENT
 	class Descent;
 	extern Descent gDesc;
+	extern const hot_node* hotNodes;
+	extern uint32_t* hotIndices;
+
+	// HIT TEST
+	bool	LineTestEntity(Context& c, unsigned set, scn::Entity& ent, const com::Vec3& a,
+			const com::Vec3& b, test_type type, const flg::FlagSet& ignore, Result& resIO);
+	bool	LineTestLeafEntities(Context& c, unsigned set, const scn::WorldNode& leaf,
+			const com::Vec3& a, const com::Vec3& b, test_type type, const flg::FlagSet& ignore,
+			Result& resIO);
+	void	LineTestTreeEntities(Context& c, unsigned set, const com::Vec3& a,
+			const com::Vec3& b, test_type type, const flg::FlagSet& ignore, Result& resIO);
 
 	// LEAF TEST
 	int		BehindBevel(const Hull& h, com::Vec3& aInOut, const com::Vec3& b,
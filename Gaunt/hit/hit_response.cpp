@@ -90,14 +90,14 @@ If rOut is not 0, copies the last test's result. If tmOut is not 0, sets it to t
 --------------------------------------*/
 com::Vec3 hit::MoveStop(const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 	const com::Qua& ori, test_type type, const flg::FlagSet& ignore,
-	const scn::Entity* entIgnore, Result* rOut, float* tm)
+	const scn::Entity* entIgnore, Result* rOut, float* tm, Context* ctx)
 {
-	Result r = HullTest(scn::WorldRoot(), hull, a, b, ori, type, ignore, entIgnore);
+	Result r = HullTest(scn::WorldRoot(), hull, a, b, ori, type, ignore, entIgnore, ctx);
 	com::Vec3 pos = RespondStop(r, a, b, tm);
 
 	if(r.contact == Result::INTERSECT)
 	{
-		r = HullTest(scn::WorldRoot(), hull, pos, b, ori, type, ignore, entIgnore);
+		r = HullTest(scn::WorldRoot(), hull, pos, b, ori, type, ignore, entIgnore, ctx);
 		pos = RespondStop(r, pos, b, tm);
 	}
 
@@ -134,14 +134,14 @@ FIXME: depth requirement that disallows super steep staircases? Extend over test
 com::Vec3 hit::MoveClimb(const Hull& hull, const com::Vec3& a, const com::Vec3& b,
 	const com::Qua& ori, float height, float floorZ, test_type type, const flg::FlagSet& ignore,
 	const scn::Entity* entIgnore, bool& climbed, Result* results, size_t* numResults,
-	float* tmi, float* tmo)
+	float* tmi, float* tmo, Context* ctx)
 {
 	static const float ZERO_EPSILON = 0.001f;
 	height += HIT_ERROR_BUFFER; // HACK: To get over slight imprecisions in nav tree
 	climbed = false;
 	Result r;
 	Result* fr = results ? results : &r;
-	com::Vec3 pos = MoveStop(hull, a, b, ori, type, ignore, entIgnore, fr, tmi);
+	com::Vec3 pos = MoveStop(hull, a, b, ori, type, ignore, entIgnore, fr, tmi, ctx);
 
 	if(numResults)
 		*numResults = 1;
@@ -152,7 +152,8 @@ com::Vec3 hit::MoveClimb(const Hull& hull, const com::Vec3& a, const com::Vec3&
 		com::Vec3 stairNormal = fr->normal;
 		com::Vec3 up = pos;
 		up.z += height;
-		up = MoveStop(hull, pos, up, ori, type, ignore, entIgnore, results ? results + 1 : 0);
+		up = MoveStop(hull, pos, up, ori, type, ignore, entIgnore, results ? results + 1 : 0, 0,
+			ctx);
 
 		if(numResults)
 			(*numResults)++;
@@ -164,7 +165,7 @@ com::Vec3 hit::MoveClimb(const Hull& hull, const com::Vec3& a, const com::Vec3&
 
 		Result* or = results ? results + 2 : &r;
 		com::Vec3 over(b.x, b.y, up.z);
-		over = MoveStop(hull, up, over, ori, type, ignore, entIgnore, or, tmo);
+		over = MoveStop(hull, up, over, ori, type, ignore, entIgnore, or, tmo, ctx);
 
 		if(numResults)
 			(*numResults)++;
@@ -175,7 +176,7 @@ com::Vec3 hit::MoveClimb(const Hull& hull, const com::Vec3& a, const com::Vec3&
 
 		Result* dr = results ? results + 3 : &r;
 		com::Vec3 down(over.x, over.y, over.z - change);
-		down = MoveStop(hull, over, down, ori, type, ignore, entIgnore, dr);
+		down = MoveStop(hull, over, down, ori, type, ignore, entIgnore, dr, 0, ctx);
 
 		if(numResults)
 			(*numResults)++;
@@ -214,7 +215,7 @@ useless.
 --------------------------------------*/
 com::Vec3 hit::MoveSlide(const Hull& hull, com::Vec3 pos, com::Vec3& vel, const com::Qua& ori,
 	float& time, Result* results, size_t& numResults, float climbHeight, float floorZ,
-	test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore)
+	test_type type, const flg::FlagSet& ignore, const scn::Entity* entIgnore, Context* ctx)
 {
 	const float saveTime = time;
 	const Result prev = results[0];
@@ -229,7 +230,7 @@ com::Vec3 hit::MoveSlide(const Hull& hull, com::Vec3 pos, com::Vec3& vel, const
 		float tmi;
 
 		pos = MoveClimb(hull, pos, dest, ori, climbHeight, floorZ, type, ignore, entIgnore,
-			climbed, r, &n, &tmi, &tm);
+			climbed, r, &n, &tmi, &tm, ctx);
 
 		if(climbed)
 		{
@@ -248,7 +249,7 @@ com::Vec3 hit::MoveSlide(const Hull& hull, com::Vec3 pos, com::Vec3& vel, const
 	else
 	{
 		// Not trying to climb
-		pos = MoveStop(hull, pos, dest, ori, type, ignore, entIgnore, results, &tm);
+		pos = MoveStop(hull, pos, dest, ori, type, ignore, entIgnore, results, &tm, ctx);
 		numResults = 1;
 	}
 
@@ -4,8 +4,10 @@
 #include "hit.h"
 #include "hit_lua.h"
 #include "hit_private.h"
+#include "../../GauntCommon/tree.h"
 #include "../quaternion/qua_lua.h"
 #include "../vector/vec_lua.h"
+#include "../wrap/wrap.h"
 
 #ifdef _MSC_VER
 #define FORCE_INLINE __forceinline
@@ -17,15 +19,34 @@ namespace hit
 {
 	Descent gDesc; // This stack is reallocated after a world load to support any loaded tree
 
+	// HOT TREE
+	const hot_node*	hotNodes = 0;
+	char*			hotBuffer = 0; // hotNodes is aligned inside
+	uint32_t*		hotIndices = 0; // Indexed by world node index
+	uint32_t		numHotNodes = 0;
+
+	// Plane and children of the node being descended
+	struct desc_split
+	{
+		com::Vec3	normal;
+		float		offset;
+		scn::Node	*left, *right; // 0 in hot descents
+		uint32_t	hotLeft, hotRight;
+	};
+
 #if 0
 	template <desc_op op> void LineDescendCopy(desc_elem* s, size_t& numStacked,
 		const desc_elem& cur);
 	template <int startRight, bool checkDist> void LineDescendSplit(desc_elem* s,
 		size_t& numStacked, const float (&dists)[2], const desc_elem& cur);
 #endif
-	void ThickPlaneSplit(Descent& d, const desc_elem& cur, const float (&offsets)[2]);
+	void LineSplit(Descent& d, const desc_elem& cur, const desc_split& split);
+	void ThickPlaneSplit(Descent& d, const desc_elem& cur, const desc_split& split,
+		const float (&offsets)[2]);
 	template <bool passRight, bool passFirst> void DoHullOp(int op, Descent& d,
-		const desc_elem& cur, const float (&dists)[2][2]);
+		const desc_elem& cur, const desc_split& split, const float (&dists)[2][2]);
+	void BenchDescentRun(bool hot, const Hull* h, const com::Vec3* ends, size_t numSweeps,
+		unsigned long long& microOut, unsigned long long& numLeavesOut);
 }
 
 /*
@@ -107,6 +128,7 @@ size_t hit::Descent::Begin(scn::Node* root, const com::Vec3& a, const com::Vec3&
 
 	s.Ensure(1);
 	s[0].node = root;
+	s[0].hot = 0;
 	s[0].a = a;
 	s[0].b = b;
 	s[0].op = ROOT;
@@ -131,9 +153,23 @@ size_t hit::Descent::LineDescend()
 
 	s.Ensure(numStacked + 2);
 
+	desc_split split = {cur.node->planes->normal, cur.node->planes->offset, cur.node->left,
+		cur.node->right, 0, 0};
+
+	LineSplit(*this, cur, split);
+	return numStacked;
+}
+
+/*--------------------------------------
+	hit::LineSplit
+
+Pushes cur's pieces on either side of split's plane. d.s must have room for two more elements.
+--------------------------------------*/
+void hit::LineSplit(Descent& d, const desc_elem& cur, const desc_split& split)
+{
 	float dists[2] = {
-		com::Dot(cur.node->planes->normal, cur.a) - cur.node->planes->offset,
-		com::Dot(cur.node->planes->normal, cur.b) - cur.node->planes->offset
+		com::Dot(split.normal, cur.a) - split.offset,
+		com::Dot(split.normal, cur.b) - split.offset
 	};
 
 	/*
@@ -172,8 +208,8 @@ size_t hit::Descent::LineDescend()
 	if(op == SPLIT)
 	{
 		// Start segment added to the stack last so the earliest hit is found first
-		desc_elem& end = s[numStacked++];
-		desc_elem& start = s[numStacked++];
+		desc_elem& end = d.s[d.numStacked++];
+		desc_elem& start = d.s[d.numStacked++];
 
 		com::Vec3 cut;
 
@@ -192,18 +228,22 @@ size_t hit::Descent::LineDescend()
 
 		if(dists[0] >= dists[1])
 		{
-			start.node = cur.node->right;
-			end.node = cur.node->left;
+			start.node = split.right;
+			start.hot = split.hotRight;
+			end.node = split.left;
+			end.hot = split.hotLeft;
 
-			end.hitNormal = cur.node->planes->normal;
+			end.hitNormal = split.normal;
 		}
 		else
 		{
-			start.node = cur.node->left;
-			end.node = cur.node->right;
+			start.node = split.left;
+			start.hot = split.hotLeft;
+			end.node = split.right;
+			end.hot = split.hotRight;
 
 			// If a solid is in front of plane, the hit surface's normal is negative
-			end.hitNormal = -cur.node->planes->normal;
+			end.hitNormal = -split.normal;
 		}
 
 		start.op = end.op = SPLIT;
@@ -215,8 +255,9 @@ size_t hit::Descent::LineDescend()
 	{
 		if(op <= COPY)
 		{
-			desc_elem& left = s[numStacked++];
-			left.node = cur.node->left;
+			desc_elem& left = d.s[d.numStacked++];
+			left.node = split.left;
+			left.hot = split.hotLeft;
 			left.a = cur.a;
 			left.b = cur.b;
 			left.hitNormal = cur.hitNormal;
@@ -226,8 +267,9 @@ size_t hit::Descent::LineDescend()
 
 		if(op >= COPY)
 		{
-			desc_elem& right = s[numStacked++];
-			right.node = cur.node->right;
+			desc_elem& right = d.s[d.numStacked++];
+			right.node = split.right;
+			right.hot = split.hotRight;
 			right.a = cur.a;
 			right.b = cur.b;
 			right.hitNormal = cur.hitNormal;
@@ -235,8 +277,6 @@ size_t hit::Descent::LineDescend()
 			right.hasStart = cur.hasStart;
 		}
 	}
-
-	return numStacked;
 }
 
 /*--------------------------------------
@@ -262,7 +302,10 @@ size_t hit::Descent::Descend(const Hull& h, const com::Qua& ori)
 		cur.node->planes->offset - min
 	};
 
-	ThickPlaneSplit(*this, cur, thickOffsets);
+	desc_split split = {cur.node->planes->normal, cur.node->planes->offset, cur.node->left,
+		cur.node->right, 0, 0};
+
+	ThickPlaneSplit(*this, cur, split, thickOffsets);
 	return numStacked;
 }
 
@@ -284,7 +327,87 @@ size_t hit::Descent::SphereDescend(float radius)
 		cur.node->planes->offset + radius
 	};
 
-	ThickPlaneSplit(*this, cur, thickOffsets);
+	desc_split split = {cur.node->planes->normal, cur.node->planes->offset, cur.node->left,
+		cur.node->right, 0, 0};
+
+	ThickPlaneSplit(*this, cur, split, thickOffsets);
+	return numStacked;
+}
+
+/*--------------------------------------
+	hit::Descent::BeginHot
+
+Like Begin, but the descent goes through the hot node array built from the world tree. root must
+be a node of the loaded world.
+--------------------------------------*/
+size_t hit::Descent::BeginHot(const scn::WorldNode* root, const com::Vec3& a,
+	const com::Vec3& b)
+{
+	if(!root || !hotNodes)
+		return numStacked = 0;
+
+	s.Ensure(1);
+	s[0].node = 0;
+	s[0].hot = hotIndices[root - scn::WorldRoot()];
+	s[0].a = a;
+	s[0].b = b;
+	s[0].op = ROOT;
+	s[0].hasStart = true;
+	return numStacked = 1;
+}
+
+/*--------------------------------------
+	hit::Descent::HotLineDescend
+--------------------------------------*/
+size_t hit::Descent::HotLineDescend()
+{
+	desc_elem cur = s[--numStacked];
+	const hot_node& n = hotNodes[cur.hot];
+
+	if(!n.left)
+		return numStacked;
+
+	s.Ensure(numStacked + 2);
+	desc_split split = {n.normal, n.offset, 0, 0, n.left, n.right};
+	LineSplit(*this, cur, split);
+	return numStacked;
+}
+
+/*--------------------------------------
+	hit::Descent::HotDescend
+--------------------------------------*/
+size_t hit::Descent::HotDescend(const Hull& h, const com::Qua& ori)
+{
+	desc_elem cur = s[--numStacked];
+	const hot_node& n = hotNodes[cur.hot];
+
+	if(!n.left)
+		return numStacked;
+
+	s.Ensure(numStacked + 2);
+	float min, max;
+	Span(h, ori, n.normal, min, max);
+	float thickOffsets[2] = {n.offset - max, n.offset - min};
+	desc_split split = {n.normal, n.offset, 0, 0, n.left, n.right};
+	ThickPlaneSplit(*this, cur, split, thickOffsets);
+	return numStacked;
+}
+
+/*--------------------------------------
+	hit::Descent::HotSphereDescend
+--------------------------------------*/
+size_t hit::Descent::HotSphereDescend(float radius)
+{
+	desc_elem cur = s[--numStacked];
+	const hot_node& n = hotNodes[cur.hot];
+
+	if(!n.left)
+		return numStacked;
+
+	s.Ensure(numStacked + 2);
+	float thickOffsets[2] = {n.offset - radius, n.offset + radius};
+	desc_split split = {n.normal, n.offset, 0, 0, n.left, n.right};
+	ThickPlaneSplit(*this, cur, split, thickOffsets);
 	return numStacked;
 }
 
@@ -364,12 +487,13 @@ template <int startRight, bool checkDist> FORCE_INLINE void hit::LineDescendSpli
 /*--------------------------------------
 	hit::ThickPlaneSplit
 --------------------------------------*/
-void hit::ThickPlaneSplit(Descent& d, const desc_elem& cur, const float (&offsets)[2])
+void hit::ThickPlaneSplit(Descent& d, const desc_elem& cur, const desc_split& split,
+	const float (&offsets)[2])
 {
 	float projs[2] =
 	{
-		com::Dot(cur.node->planes->normal, cur.a),
-		com::Dot(cur.node->planes->normal, cur.b)
+		com::Dot(split.normal, cur.a),
+		com::Dot(split.normal, cur.b)
 	};
 
 	float dists[2][2] =
@@ -422,13 +546,13 @@ void hit::ThickPlaneSplit(Descent& d, const desc_elem& cur, const float (&offset
 	// If coplanar, left side is pushed first
 	if(dists[0][0] >= dists[0][1])
 	{
-		DoHullOp<false, true>(ops[1], d, cur, dists);
-		DoHullOp<true, false>(ops[0], d, cur, dists);
+		DoHullOp<false, true>(ops[1], d, cur, split, dists);
+		DoHullOp<true, false>(ops[0], d, cur, split, dists);
 	}
 	else
 	{
-		DoHullOp<true, true>(ops[0], d, cur, dists);
-		DoHullOp<false, false>(ops[1], d, cur, dists);
+		DoHullOp<true, true>(ops[0], d, cur, split, dists);
+		DoHullOp<false, false>(ops[1], d, cur, split, dists);
 	}
 }
 
@@ -436,12 +560,13 @@ void hit::ThickPlaneSplit(Descent& d, const desc_elem& cur, const float (&offset
 	hit::DoHullOp
 --------------------------------------*/
 template <bool passRight, bool passFirst> FORCE_INLINE void hit::DoHullOp(int op, Descent& d,
-	const desc_elem& cur, const float (&dists)[2][2])
+	const desc_elem& cur, const desc_split& split, const float (&dists)[2][2])
 {
 	if(op == COPY)
 	{
 		desc_elem& e = d.s[d.numStacked++];
-		e.node = passRight ? cur.node->right : cur.node->left;
+		e.node = passRight ? split.right : split.left;
+		e.hot = passRight ? split.hotRight : split.hotLeft;
 		e.a = cur.a;
 		e.b = cur.b;
 		e.hitNormal = cur.hitNormal;
@@ -456,15 +581,17 @@ template <bool passRight, bool passFirst> FORCE_INLINE void hit::DoHullOp(int op
 		
 		if(passRight)
 		{
-			e.node = cur.node->right;
+			e.node = split.right;
+			e.hot = split.hotRight;
 			cut = COM_LERP(cur.a, cur.b, dists[0][0] / (dists[0][0] - dists[0][1]));
-			e.hitNormal = passFirst ? -cur.node->planes->normal : cur.hitNormal;
+			e.hitNormal = passFirst ? -split.normal : cur.hitNormal;
 		}
 		else
 		{
-			e.node = cur.node->left;
+			e.node = split.left;
+			e.hot = split.hotLeft;
 			cut = COM_LERP(cur.a, cur.b, dists[1][0] / (dists[1][0] - dists[1][1]));
-			e.hitNormal = passFirst ? cur.node->planes->normal : cur.hitNormal;
+			e.hitNormal = passFirst ? split.normal : cur.hitNormal;
 		}
 		
 		e.op = CLIP;
@@ -494,6 +621,100 @@ hit::Descent& hit::GlobalDescent()
 	return gDesc;
 }
 
+/*
+################################################################################################
+
+
+	HOT TREE
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	hit::BuildHotTree
+
+Copies the loaded world's tree into hotNodes in pre-order so a node's left child is usually in
+the same or the next cache line. Call after the world is loaded.
+--------------------------------------*/
+void hit::BuildHotTree()
+{
+	ClearHotTree();
+	scn::WorldNode* root = scn::WorldRoot();
+
+	if(!root)
+		return;
+
+	// Number nodes in pre-order
+	size_t numWorldNodes = 0;
+
+	for(const scn::WorldNode* n = root; n; n = com::TraverseTree(n))
+	{
+		numHotNodes++;
+		numWorldNodes = COM_MAX(numWorldNodes, (size_t)(n - root) + 1);
+	}
+
+	hotIndices = new uint32_t[numWorldNodes];
+	uint32_t index = 0;
+
+	for(const scn::WorldNode* n = root; n; n = com::TraverseTree(n))
+		hotIndices[n - root] = index++;
+
+	// Align so no node straddles a cache line
+	hotBuffer = new char[numHotNodes * sizeof(hot_node) + 31];
+	hot_node* nodes = (hot_node*)(((size_t)hotBuffer + 31) & ~(size_t)31);
+
+	for(const scn::WorldNode* n = root; n; n = com::TraverseTree(n))
+	{
+		hot_node& h = nodes[hotIndices[n - root]];
+		h.node = n - root;
+		h.flags = n->solid ? scn::Node::SOLID : 0;
+
+		if(n->left)
+		{
+			h.normal = n->planes->normal;
+			h.offset = n->planes->offset;
+			h.left = hotIndices[(const scn::WorldNode*)n->left - root];
+			h.right = hotIndices[(const scn::WorldNode*)n->right - root];
+		}
+		else
+		{
+			h.normal = 0.0f;
+			h.offset = 0.0f;
+			h.left = h.right = 0;
+		}
+	}
+
+	hotNodes = nodes;
+}
+
+/*--------------------------------------
+	hit::ClearHotTree
+--------------------------------------*/
+void hit::ClearHotTree()
+{
+	if(hotBuffer)
+		delete[] hotBuffer;
+
+	if(hotIndices)
+		delete[] hotIndices;
+
+	hotNodes = 0;
+	hotBuffer = 0;
+	hotIndices = 0;
+	numHotNodes = 0;
+}
+
+/*--------------------------------------
+	hit::HotWorldNode
+
+Returns the world node a hot node was copied from.
+--------------------------------------*/
+scn::WorldNode& hit::HotWorldNode(uint32_t hot)
+{
+	return scn::WorldRoot()[hotNodes[hot].node];
+}
+
 /*
 ################################################################################################
 
@@ -636,6 +857,96 @@ int hit::DscElementLine(lua_State* l)
 	return 6;
 }
 
+/*--------------------------------------
+LUA	hit::BenchDescent (hit_bench_descent)
+
+IN	[iNumSweeps = 10000], [iSeed = 1], [nBoxRadius = 16]
+
+Does full line and box descents between random points in the world's bounds, once through the
+scn::WorldNode tree and once through the hot node array, and logs the time each took. Meant to
+be run with horse.wld loaded.
+--------------------------------------*/
+int hit::BenchDescent(lua_State* l)
+{
+	lua_Integer numSweeps = luaL_optinteger(l, 1, 10000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+	float radius = luaL_optnumber(l, 3, 16.0);
+
+	if(!scn::WorldRoot() || numSweeps <= 0)
+		return 0;
+
+	// Generate sweeps beforehand so both runs get the same ones
+	com::Arr<com::Vec3> ends(numSweeps * 2);
+	const com::Vec3& min = scn::WorldMin();
+	com::Vec3 size = scn::WorldMax() - min;
+
+	for(size_t i = 0; i < ends.n; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+			ends[i][j] = min[j] + size[j] * com::BenchRandF(seed);
+	}
+
+	Hull box(com::Vec3(-radius), com::Vec3(radius));
+	const Hull* hulls[2] = {0, &box};
+	const char* names[2] = {"Line", "Box"};
+
+	for(size_t i = 0; i < 2; i++)
+	{
+		unsigned long long micros[2], numLeaves[2];
+		BenchDescentRun(false, hulls[i], ends.o, numSweeps, micros[0], numLeaves[0]);
+		BenchDescentRun(true, hulls[i], ends.o, numSweeps, micros[1], numLeaves[1]);
+
+		con::LogF("%s descents: %d sweeps, old %g ms, hot %g ms (%gx), %g leaves/sweep%s",
+			names[i], (int)numSweeps, micros[0] * 0.001, micros[1] * 0.001,
+			micros[1] ? (double)micros[0] / micros[1] : 0.0, (double)numLeaves[1] / numSweeps,
+			numLeaves[0] == numLeaves[1] ? "" : " (LEAF COUNT MISMATCH)");
+	}
+
+	ends.Free();
+	return 0;
+}
+
+/*--------------------------------------
+	hit::BenchDescentRun
+
+Does a full descent for each sweep without stopping at solids. h 0 means line descents.
+--------------------------------------*/
+void hit::BenchDescentRun(bool hot, const Hull* h, const com::Vec3* ends, size_t numSweeps,
+	unsigned long long& micro, unsigned long long& numLeaves)
+{
+	numLeaves = 0;
+	unsigned long long startTime = wrp::MicroTime();
+
+	for(size_t i = 0; i < numSweeps; i++)
+	{
+		const com::Vec3& a = ends[i * 2];
+		const com::Vec3& b = ends[i * 2 + 1];
+
+		if(hot)
+		{
+			gDesc.BeginHot(scn::WorldRoot(), a, b);
+
+			while(gDesc.numStacked)
+			{
+				numLeaves += !hotNodes[gDesc.s[gDesc.numStacked - 1].hot].left;
+				h ? gDesc.HotDescend(*h, com::QUA_IDENTITY) : gDesc.HotLineDescend();
+			}
+		}
+		else
+		{
+			gDesc.Begin(scn::WorldRoot(), a, b);
+
+			while(gDesc.numStacked)
+			{
+				numLeaves += !gDesc.s[gDesc.numStacked - 1].node->left;
+				h ? gDesc.Descend(*h, com::QUA_IDENTITY) : gDesc.LineDescend();
+			}
+		}
+	}
+
+	micro = wrp::MicroTime() - startTime;
+}
+
 /*
 ################################################################################################
 
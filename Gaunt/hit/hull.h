@@ -84,8 +84,6 @@ public:
 							~Convex();
 
 	void					Span(const com::Vec3& axis, float& minOut, float& maxOut) const;
-	size_t					FarVertices(const com::Vec3& axis,
-							com::Arr<com::ClimbVertex*>& farOut) const; // FIXME: don't need this, can remove
 	const com::ClimbVertex*	Vertices() const {return vertices;}
 	const com::Vec3*		Axes() const {return axes;}
 	size_t					NumVertices() const {return numVertices;}
@@ -101,15 +99,13 @@ protected:
 	com::Vec3*				axes;
 	size_t					numVertices, numNormalAxes, numEdgeAxes;
 	float*					normalSpans; // numNormalAxes * 2, min max
-	mutable size_t			markCode;
 
-							Convex(char type) : Hull(type, 0.0f, 0.0f), markCode(0) {}
+							Convex(char type) : Hull(type, 0.0f, 0.0f) {}
 							Convex(const Convex&);
 
 	void					CreateNormalSpans();
 	void					CalcNormalSpans();
 	void					DefaultHull();
-	size_t					IncMarkCode() const;
 };
 
 /*======================================
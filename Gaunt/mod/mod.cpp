@@ -7,6 +7,7 @@
 #include "mod.h"
 #include "../console/console.h"
 #include "../../GauntCommon/io.h"
+#include "../profile/profile.h"
 #include "../script/script.h"
 #include "../wrap/wrap.h"
 
@@ -47,7 +48,7 @@ void mod::CallGlobal(lua_State* l, const char* name)
 	mod::Game...
 --------------------------------------*/
 void mod::GameInit(){CallGlobal(scr::state, "GameInit");}
-void mod::GameTick(){CallGlobal(scr::state, "GameTick");}
+void mod::GameTick(){PRF_ZONE("mod::GameTick"); CallGlobal(scr::state, "GameTick");}
 void mod::GamePostTick(){CallGlobal(scr::state, "GamePostTick");}
 void mod::GameFrame(){CallGlobal(scr::state, "GameFrame");}
 void mod::GameSave(){CallGlobal(scr::state, "GameSave");}
@@ -11,6 +11,7 @@
 #include "../../GauntCommon/array.h"
 #include "../../GauntCommon/io.h"
 #include "../hit/hit.h"
+#include "../profile/profile.h"
 #include "../script/script.h"
 #include "../wrap/wrap.h"
 
@@ -114,6 +115,7 @@ void pat::Init()
 	luaL_Reg regs[] = {
 		{"BestFlightMap", BestFlightMap},
 		{"InstantFlightPathToPoint", InstantFlightPathToPoint},
+		{"FlightPathBatch", FlightPathBatch},
 		{"FlightNavigator", CreateFlightNavigator},
 		{0, 0}
 	};
@@ -161,6 +163,9 @@ void pat::Init()
 	scr::RegisterLibrary(scr::state, "gpat", regs, consts, 0, metas, prefixes);
 	FlightMap::RegisterMetatable(fmapRegs, 0);
 	FlightNavigator::RegisterMetatable(fnavRegs, 0);
+
+	// Console commands
+	lua_pushcfunction(scr::state, BenchFlightSearch); con::CreateCommand("pat_bench_flight");
 }
 
 /*--------------------------------------
@@ -168,5 +173,6 @@ void pat::Init()
 --------------------------------------*/
 void pat::PostTick()
 {
+	PRF_ZONE("pat::PostTick");
 	Ticket<FlightWorkMemory>::PostTick();
 }
\ No newline at end of file
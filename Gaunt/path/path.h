@@ -22,6 +22,7 @@ namespace pat
 
 class FlightPortal;
 class FlightNode;
+class FlightRegion;
 class FlightWorkMemory;
 
 enum state
@@ -41,6 +42,14 @@ struct waypoint
 	com::Vec3 pos;
 };
 
+// Scratch element for FlightMap::PosToBestLeaf's descent min heap
+struct loser_node
+{
+	const FlightNode *node;
+	float dist;
+	com::Vec3 pos;
+};
+
 /*
 ################################################################################################
 	FLIGHT MAP
@@ -58,7 +67,11 @@ public:
 	const FlightNode*	Nodes() const {return nodes;}
 	uint32_t			NumNodes() const {return numNodes;}
 	uint32_t			NumPortals() const {return numPortals;}
+	const FlightRegion*	Regions() const {return regions;}
+	uint32_t			NumRegions() const {return numRegions;}
 	const FlightNode*	PosToBestLeaf(const com::Vec3& pos, com::Vec3* fixedOut = 0) const;
+	const FlightNode*	PosToBestLeaf(const com::Vec3& pos, com::Vec3* fixedOut,
+						com::Arr<loser_node>& losersIO) const;
 	FlightNode*			PosToBestLeaf(const com::Vec3& pos, com::Vec3* fixedOut = 0);
 	void				Draw(int color, float time = 0.0f) const;
 
@@ -70,12 +83,16 @@ private:
 	res::Ptr<hit::Hull>	hull;
 	FlightNode*			nodes;
 	uint32_t			numNodes, numPortals;
+	FlightRegion*		regions;
+	uint32_t			numRegions;
 
 						FlightMap() : epsilon(0.0f), hull(0), nodes(0), numNodes(0),
-							numPortals(0) {AddLock(); /* Permanent lock */}
+							numPortals(0), regions(0), numRegions(0)
+							{AddLock(); /* Permanent lock */}
 						~FlightMap();
 
 	const char*			Load(FILE* file, size_t& maxNumLevelsIO);
+	void				BuildRegions();
 };
 
 const FlightMap* BestFlightMap(const com::Vec3& min, const com::Vec3& max);
@@ -86,11 +103,60 @@ const FlightMap* BestFlightMap(const com::Vec3& min, const com::Vec3& max);
 ################################################################################################
 */
 
-extern con::Option optimizeLength;
+extern con::Option optimizeLength, hierarchicalSearch, regionSize;
 
 state	InstantPathToPoint(const FlightMap& map, const com::Vec3& start, const com::Vec3& dest,
 		com::Arr<waypoint>& ptsOut, size_t& numPtsOut);
 
+/*
+################################################################################################
+	FLIGHT BATCH
+################################################################################################
+*/
+
+/*======================================
+	pat::PathBatch
+
+Finds many flight paths at once. Searches are spread over wrp worker threads, each with its own
+FlightWorkMemory, and results are kept in the order requests were added. Flight maps must not be
+loaded or cleared while Run is working.
+======================================*/
+class PathBatch
+{
+public:
+					PathBatch() : numRequests(0) {}
+					~PathBatch();
+
+	size_t			NumRequests() const {return numRequests;}
+	size_t			Add(const FlightMap& map, const com::Vec3& start, const com::Vec3& dest);
+	void			Clear() {numRequests = 0;}
+	void			Run();
+
+	// Results of the last Run
+	state			State(size_t i) const {return requests[i].s;}
+	const waypoint*	Points(size_t i) const {return requests[i].pts.o;}
+	size_t			NumPoints(size_t i) const {return requests[i].numPts;}
+	size_t			NumVisited(size_t i) const {return requests[i].numVisited;}
+
+private:
+	struct request
+	{
+		const FlightMap*	map;
+		com::Vec3			start, dest;
+		state				s;
+		com::Arr<waypoint>	pts; // Kept between runs
+		size_t				numPts, numVisited;
+	};
+
+	com::Arr<request>	requests;
+	size_t				numRequests;
+
+						PathBatch(const PathBatch&);
+	PathBatch&			operator=(const PathBatch&);
+
+	static void			RunRequest(void* batch, size_t index, size_t worker);
+};
+
 /*
 ################################################################################################
 	FLIGHT NAVIGATOR
@@ -157,21 +223,45 @@ enum {
 
 struct flight_work_point : public waypoint
 {
-#if 0
-	// FIXME: implement
-	// Min heap node indices
-	// Unused work_points use left and right as prev and next in a linked list
-	size_t						left, right, up;
-#endif
-
 	const FlightNode*	leaf;
 	const FlightPortal*	portal; // The exit from referenced leaf, not the entrance into leaf
 	uint32_t			flags;
 	float				g, f; // Cost so far, estimated final cost from start to destination
 	size_t				parent;
 	size_t				numPrevPts;
+	size_t				heapIndex; // Index in FlightWorkMemory::open, -1 if not open
+};
+
+// Refers to the waypoint created at a portal during the search with the same code
+struct flight_portal_mark
+{
+	size_t		pt;
+	unsigned	code;
+};
+
+// Abstract search point at a region exit, valid if code matches the search's
+struct region_work_point
+{
+	const FlightPortal*	portal; // 0 if this is the goal
+	float				g, f;
+	size_t				parent; // FlightPortal::fakeIndex of previous exit, -1 if none
+	size_t				heapIndex;
+	unsigned			code;
+};
+
+// Regions a recent search was allowed to visit
+struct corridor
+{
+	const FlightMap*	map;
+	unsigned			mapCode;
+	const FlightNode	*startLeaf, *destLeaf;
+	com::Arr<uint32_t>	regions;
+	size_t				numRegions; // 0 if there's no corridor and the search is unrestricted
+	unsigned			lastUse;
 };
 
+static const size_t NUM_CACHED_CORRIDORS = 8;
+
 /*======================================
 	pat::FlightWorkMemory
 
@@ -183,23 +273,58 @@ public:
 	// Modifiable search data
 	com::Vec3 dest;
 	size_t numPts;
-	com::Arr<flight_work_point> pts; // FIXME: global pool, see min heap FIXME comment in flight_work_point above
+	com::Arr<flight_work_point> pts; // Reused by every search, never needs more than numPortals + 2
+	com::Arr<size_t> open; // Min heap of pts indices keyed on f
+	size_t numOpen;
+	com::Arr<flight_portal_mark> portalMarks; // Indexed by FlightPortal::fakeIndex
+	unsigned markCode;
+	com::Arr<loser_node> losers; // PosToBestLeaf scratch so searches don't share memory
 	flg::FlagSet closeBits; // Corresponding bit is set if a portal is closed
 	const FlightNode *startLeaf, *destLeaf;
+	size_t destPt; // Index of STOP point at dest, -1 if none
 	size_t finale;
+	size_t numVisited; // Iterations done in current search
+
+	// Region corridor; see FindCorridor
+	bool restricted; // Portal points are only created in regions marked with markCode
+	com::Arr<unsigned> regionMarks; // Indexed by region
+	com::Arr<region_work_point> regionPts; // Indexed by FlightPortal::fakeIndex, goal at numPortals
+	com::Arr<size_t> regionOpen;
+	corridor corridors[NUM_CACHED_CORRIDORS]; // LRU cache
+	unsigned corridorUse;
 
 	// Search parameters; constant during a search
 	const FlightMap* map;
 	path_type pathType;
 	com::Vec3 start, origDest;
 
-	FlightWorkMemory() : numPts(0), startLeaf(0), destLeaf(0), finale(-1), map(0),
-		pathType(PATH_NONE), visits(0)
+	FlightWorkMemory() : numPts(0), numOpen(0), markCode(0), startLeaf(0), destLeaf(0),
+		destPt(-1), finale(-1), numVisited(0), restricted(false), corridorUse(0),
+		map(0), pathType(PATH_NONE), visits(0)
 	{
 		closeBits.AddLock(); // FIXME: make a non-Resource bit set class
+
+		for(size_t i = 0; i < NUM_CACHED_CORRIDORS; i++)
+		{
+			corridors[i].map = 0;
+			corridors[i].numRegions = 0;
+			corridors[i].lastUse = 0;
+		}
 	}
 
-	~FlightWorkMemory() {pts.Free();}
+	~FlightWorkMemory()
+	{
+		pts.Free();
+		open.Free();
+		portalMarks.Free();
+		losers.Free();
+		regionMarks.Free();
+		regionPts.Free();
+		regionOpen.Free();
+
+		for(size_t i = 0; i < NUM_CACHED_CORRIDORS; i++)
+			corridors[i].regions.Free();
+	}
 
 	void SetParams(const FlightMap& fmap, path_type pathType, const com::Vec3& start,
 	const com::Vec3& dest)
@@ -211,17 +336,43 @@ public:
 		this->origDest = dest;
 
 		size_t numPortals = map->NumPortals();
-		pts.Ensure(numPortals);
+		pts.Ensure(numPortals + 2);
+		open.Ensure(numPortals + 2);
 		closeBits.EnsureNumBits(numPortals);
+
+		flight_portal_mark unmarked = {(size_t)-1, 0};
+		portalMarks.Ensure(numPortals, unmarked);
+		regionMarks.Ensure(map->NumRegions(), 0);
+		region_work_point unreached = {0, 0.0f, 0.0f, (size_t)-1, (size_t)-1, 0};
+		regionPts.Ensure(numPortals + 1, unreached);
+		NewMarkCode();
+	}
+
+	void NewMarkCode()
+	{
+		if(!(++markCode))
+		{
+			// Code wrapped, old marks could be mistaken for current ones
+			flight_portal_mark unmarked = {(size_t)-1, 0};
+			region_work_point unreached = {0, 0.0f, 0.0f, (size_t)-1, (size_t)-1, 0};
+			portalMarks.Set(unmarked, portalMarks.n, 0);
+			regionMarks.Set(0, regionMarks.n, 0);
+			regionPts.Set(unreached, regionPts.n, 0);
+			markCode = 1;
+		}
 	}
 
 	void Clear()
 	{
 		pathType = PATH_NONE;
 		numPts = 0;
+		numOpen = 0;
 		closeBits.Clear();
 		startLeaf = destLeaf = 0;
+		destPt = -1;
 		finale = -1;
+		numVisited = 0;
+		restricted = false;
 		map = 0;
 	}
 
@@ -243,6 +394,7 @@ public:
 	void SetInfiniteVisits() {visits = -1;}
 
 	size_t TracePath(com::Arr<waypoint>& pathOut) const;
+	size_t TracePath(com::Arr<waypoint>& pathOut, hit::Descent& descIO) const;
 
 private:
 	unsigned visits;
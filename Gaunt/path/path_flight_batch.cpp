@@ -0,0 +1,184 @@
+// path_flight_batch.cpp
+// Martynas Ceicys
+
+#include "path.h"
+#include "path_lua.h"
+#include "path_private.h"
+#include "../wrap/wrap.h"
+
+namespace pat
+{
+	// One of each per worker thread; FlightMaps are only read during a search
+	FlightWorkMemory*	batchMemories = 0;
+	hit::Descent*		batchDescents = 0;
+	size_t				numBatchWorkers = 0;
+
+	void				EnsureBatchWorkers();
+}
+
+/*--------------------------------------
+	pat::EnsureBatchWorkers
+--------------------------------------*/
+void pat::EnsureBatchWorkers()
+{
+	size_t numWorkers = wrp::NumWorkers();
+
+	if(numWorkers <= numBatchWorkers)
+		return;
+
+	if(batchMemories)
+		delete[] batchMemories;
+
+	if(batchDescents)
+		delete[] batchDescents;
+
+	numBatchWorkers = numWorkers;
+	batchMemories = new FlightWorkMemory[numBatchWorkers];
+	batchDescents = new hit::Descent[numBatchWorkers];
+
+	for(size_t i = 0; i < numBatchWorkers; i++)
+		batchMemories[i].SetInfiniteVisits();
+}
+
+/*
+################################################################################################
+
+
+	PATH BATCH
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	pat::PathBatch::~PathBatch
+--------------------------------------*/
+pat::PathBatch::~PathBatch()
+{
+	for(size_t i = 0; i < requests.n; i++)
+		requests[i].pts.Free();
+
+	requests.Free();
+}
+
+/*--------------------------------------
+	pat::PathBatch::Add
+
+Returns the request's index.
+--------------------------------------*/
+size_t pat::PathBatch::Add(const FlightMap& map, const com::Vec3& start, const com::Vec3& dest)
+{
+	requests.Ensure(numRequests + 1);
+	request& r = requests[numRequests];
+	r.map = &map;
+	r.start = start;
+	r.dest = dest;
+	r.s = FAIL;
+	r.numPts = 0;
+	r.numVisited = 0;
+	return numRequests++;
+}
+
+/*--------------------------------------
+	pat::PathBatch::Run
+
+Searches for every added request's path. Blocks until all searches are done. Only call from the
+main thread.
+--------------------------------------*/
+void pat::PathBatch::Run()
+{
+	if(!numRequests)
+		return;
+
+	EnsureBatchWorkers();
+	wrp::RunJobs(RunRequest, this, numRequests);
+}
+
+/*--------------------------------------
+	pat::PathBatch::RunRequest
+--------------------------------------*/
+void pat::PathBatch::RunRequest(void* batch, size_t index, size_t worker)
+{
+	request& r = ((PathBatch*)batch)->requests[index];
+	FlightWorkMemory& mem = batchMemories[worker];
+	mem.SetParams(*r.map, PATH_POINT, r.start, r.dest);
+	r.s = Path(mem);
+	r.numPts = r.s == GO ? mem.TracePath(r.pts, batchDescents[worker]) : 0;
+	r.numVisited = mem.numVisited;
+	mem.Clear();
+}
+
+/*
+################################################################################################
+
+
+	FLIGHT BATCH LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	pat::FlightPathBatch
+
+IN	fmapM, tEnds, tPathsOut
+OUT	iNumRequests
+
+tEnds is a sequence of start and destination coordinates, six numbers per request. For each
+request i, tPathsOut[i] is set to a new sequence of waypoint coordinates if a path was found, or
+false otherwise.
+--------------------------------------*/
+int pat::FlightPathBatch(lua_State* l)
+{
+	static PathBatch batch;
+
+	const FlightMap& map = *FlightMap::CheckLuaTo(1);
+	const int ENDS_INDEX = 2, PATHS_INDEX = 3;
+	scr::CheckTable(l, ENDS_INDEX);
+	scr::CheckTable(l, PATHS_INDEX);
+
+	size_t numRequests = lua_rawlen(l, ENDS_INDEX) / 6;
+	batch.Clear();
+
+	for(size_t i = 0; i < numRequests; i++)
+	{
+		float f[6];
+
+		for(size_t j = 0; j < 6; j++)
+		{
+			lua_rawgeti(l, ENDS_INDEX, i * 6 + j + 1);
+			f[j] = luaL_checknumber(l, -1);
+			lua_pop(l, 1);
+		}
+
+		batch.Add(map, com::Vec3(f[0], f[1], f[2]), com::Vec3(f[3], f[4], f[5]));
+	}
+
+	batch.Run();
+
+	for(size_t i = 0; i < numRequests; i++)
+	{
+		if(batch.State(i) == GO)
+		{
+			size_t numPts = batch.NumPoints(i);
+			const waypoint* pts = batch.Points(i);
+			lua_createtable(l, numPts * 3, 0);
+
+			for(size_t j = 0; j < numPts; j++)
+			{
+				for(size_t k = 0; k < 3; k++)
+				{
+					lua_pushnumber(l, pts[j].pos[k]);
+					lua_rawseti(l, -2, j * 3 + k + 1);
+				}
+			}
+		}
+		else
+			lua_pushboolean(l, 0);
+
+		lua_rawseti(l, PATHS_INDEX, i + 1);
+	}
+
+	lua_pushinteger(l, numRequests);
+	return 1;
+}
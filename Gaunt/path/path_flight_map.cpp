@@ -12,15 +12,9 @@ namespace pat
 {
 	FlightMap*	flightMaps = 0;
 	uint32_t	numFlightMaps = 0;
+	unsigned	flightMapCode = 0;
 
 	// DESCENT MIN HEAP
-	struct loser_node
-	{
-		const FlightNode *node;
-		float dist;
-		com::Vec3 pos;
-	};
-
 	void		InsertLoser(com::Arr<loser_node>& losersIO, size_t& numLosersIO,
 				const FlightNode* node, float dist, const com::Vec3& pos);
 	loser_node	PopLoser(com::Arr<loser_node>& losersIO, size_t& numLosersIO);
@@ -31,15 +25,24 @@ const char* const pat::FlightMap::METATABLE = "metaFlightMap";
 /*--------------------------------------
 	pat::FlightMap::PosToBestLeaf
 
+The version without losersIO uses a static scratch array and is not safe to call from multiple
+threads.
+
 FIXME: move to scn, generalize for scn::Node
 --------------------------------------*/
 const pat::FlightNode* pat::FlightMap::PosToBestLeaf(const com::Vec3& pos,
 	com::Vec3* fixed) const
+{
+	static com::Arr<loser_node> losers(32);
+	return PosToBestLeaf(pos, fixed, losers);
+}
+
+const pat::FlightNode* pat::FlightMap::PosToBestLeaf(const com::Vec3& pos, com::Vec3* fixed,
+	com::Arr<loser_node>& losers) const
 {
 	if(!nodes)
 		return 0;
 
-	static com::Arr<loser_node> losers(32);
 	size_t numLosers = 0;
 
 	const FlightNode* cur = nodes;
@@ -132,6 +135,9 @@ pat::FlightMap::~FlightMap()
 
 	if(nodes)
 		delete[] nodes;
+
+	if(regions)
+		delete[] regions;
 }
 
 /*--------------------------------------
@@ -226,6 +232,28 @@ const char* pat::FlightMap::Load(FILE* file, size_t& maxNumLevelsIO)
 		}
 	}
 
+	// Link coportals
+	for(uint32_t i = 0; i < numNodes; i++)
+	{
+		FlightNode& node = nodes[i];
+
+		for(uint32_t j = 0; j < node.numPortals; j++)
+		{
+			FlightPortal& portal = node.portals[j];
+
+			for(uint32_t k = 0; k < portal.other->numPortals; k++)
+			{
+				if(portal.other->portals[k].other == &node)
+				{
+					portal.co = &portal.other->portals[k];
+					break;
+				}
+			}
+		}
+	}
+
+	BuildRegions();
+
 	if(nodes)
 		maxNumLevelsIO = com::Max(maxNumLevelsIO, com::NumTreeLevels(&nodes[0]));
 
@@ -264,6 +292,7 @@ void pat::FlightMap::ClearFlightMaps()
 
 	flightMaps = 0;
 	numFlightMaps = 0;
+	flightMapCode++; // Invalidate cached corridors
 }
 
 /*--------------------------------------
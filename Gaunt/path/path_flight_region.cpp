@@ -0,0 +1,398 @@
+// path_flight_region.cpp
+// Martynas Ceicys
+
+#include "path.h"
+#include "path_private.h"
+
+namespace pat
+{
+	con::Option hierarchicalSearch("pat_hierarchical", 1);
+	con::Option regionSize("pat_region_size", 32, con::PositiveIntegerOnly); // Applied on map load
+
+	// Dijkstra point used to find costs between a region's exits
+	struct region_build_point
+	{
+		const FlightPortal*	portal;
+		float				f;
+		size_t				heapIndex;
+		unsigned			code;
+	};
+
+	void	RelaxBuildPoint(com::Arr<region_build_point>& ptsIO, com::Arr<size_t>& heapIO,
+			size_t& numHeapIO, unsigned code, const FlightPortal& portal, float dist);
+	void	AbstractSearch(FlightWorkMemory& memIO, corridor& corIO);
+	void	RelaxRegionPoint(FlightWorkMemory& memIO, size_t& numOpenIO, size_t index,
+			size_t parent, float g, const FlightPortal* portal);
+}
+
+/*
+################################################################################################
+
+
+	REGION BUILDING
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	pat::FlightMap::BuildRegions
+
+Clusters non-solid leaves into regions of up to pat_region_size leaves, then finds the cost of
+travelling between every pair of a region's exits without leaving the region. Coportals must
+already be linked.
+--------------------------------------*/
+void pat::FlightMap::BuildRegions()
+{
+	if(regions)
+		delete[] regions;
+
+	regions = 0;
+	numRegions = 0;
+
+	if(!numNodes)
+		return;
+
+	// Grow regions breadth-first from unassigned leaves
+	size_t maxSize = com::Max(regionSize.Integer(), 1);
+	com::Arr<FlightNode*> queue(32);
+
+	for(uint32_t i = 0; i < numNodes; i++)
+	{
+		FlightNode& seed = nodes[i];
+
+		if(seed.left || (seed.flags & seed.SOLID) || seed.region != -1)
+			continue;
+
+		seed.region = numRegions;
+		queue[0] = &seed;
+		size_t numQueued = 1;
+
+		for(size_t q = 0; q < numQueued && numQueued < maxSize; q++)
+		{
+			FlightNode& leaf = *queue[q];
+
+			for(uint32_t j = 0; j < leaf.numPortals && numQueued < maxSize; j++)
+			{
+				FlightNode& other = *leaf.portals[j].other;
+
+				if(other.region != -1 || (other.flags & other.SOLID))
+					continue;
+
+				other.region = numRegions;
+				queue.Ensure(numQueued + 1);
+				queue[numQueued++] = &other;
+			}
+		}
+
+		numRegions++;
+	}
+
+	queue.Free();
+
+	if(!numRegions)
+		return;
+
+	regions = new FlightRegion[numRegions];
+
+	// Gather exits; portals into solid leaves (region -1) aren't exits
+	for(uint32_t i = 0; i < numNodes; i++)
+	{
+		const FlightNode& leaf = nodes[i];
+
+		if(leaf.region == -1)
+			continue;
+
+		for(uint32_t j = 0; j < leaf.numPortals; j++)
+		{
+			uint32_t otherRegion = leaf.portals[j].other->region;
+
+			if(otherRegion != -1 && otherRegion != leaf.region)
+				regions[leaf.region].numExits++;
+		}
+	}
+
+	for(uint32_t i = 0; i < numRegions; i++)
+	{
+		FlightRegion& region = regions[i];
+
+		if(region.numExits)
+		{
+			region.exits = new const FlightPortal*[region.numExits];
+			region.costs = new float[region.numExits * region.numExits];
+			region.numExits = 0; // Recounted below
+		}
+	}
+
+	for(uint32_t i = 0; i < numNodes; i++)
+	{
+		FlightNode& leaf = nodes[i];
+
+		if(leaf.region == -1)
+			continue;
+
+		for(uint32_t j = 0; j < leaf.numPortals; j++)
+		{
+			FlightPortal& portal = leaf.portals[j];
+
+			if(portal.other->region != -1 && portal.other->region != leaf.region)
+			{
+				FlightRegion& region = regions[leaf.region];
+				portal.exit = region.numExits;
+				region.exits[region.numExits++] = &portal;
+			}
+		}
+	}
+
+	// Find exit-to-exit costs, searching from each exit to every other exit in its region
+	region_build_point unreached = {0, 0.0f, (size_t)-1, 0};
+	com::Arr<region_build_point> pts(numPortals, unreached);
+	com::Arr<size_t> heap(32);
+	unsigned code = 0;
+
+	for(uint32_t i = 0; i < numRegions; i++)
+	{
+		FlightRegion& region = regions[i];
+
+		for(uint32_t from = 0; from < region.numExits; from++)
+		{
+			const FlightPortal& start = *region.exits[from];
+			float* row = region.costs + from * region.numExits;
+
+			for(uint32_t to = 0; to < region.numExits; to++)
+				row[to] = FLT_MAX;
+
+			code++;
+			size_t numHeap = 0;
+
+			for(uint32_t j = 0; j < start.leaf->numPortals; j++)
+			{
+				const FlightPortal& portal = start.leaf->portals[j];
+				RelaxBuildPoint(pts, heap, numHeap, code, portal, (portal.avg - start.avg).Mag());
+			}
+
+			while(numHeap)
+			{
+				const region_build_point& pt = pts[PopHeap(heap.o, numHeap, pts.o)];
+				const FlightPortal& portal = *pt.portal;
+
+				if(portal.exit != -1)
+				{
+					row[portal.exit] = pt.f; // Reached an exit, don't leave the region
+					continue;
+				}
+
+				for(uint32_t j = 0; j < portal.other->numPortals; j++)
+				{
+					const FlightPortal& next = portal.other->portals[j];
+					RelaxBuildPoint(pts, heap, numHeap, code, next,
+						pt.f + (next.avg - portal.avg).Mag());
+				}
+			}
+		}
+	}
+
+	pts.Free();
+	heap.Free();
+}
+
+/*--------------------------------------
+	pat::RelaxBuildPoint
+--------------------------------------*/
+void pat::RelaxBuildPoint(com::Arr<region_build_point>& pts, com::Arr<size_t>& heap,
+	size_t& numHeap, unsigned code, const FlightPortal& portal, float dist)
+{
+	if(portal.other->region == -1)
+		return; // Solid
+
+	region_build_point& pt = pts[portal.fakeIndex];
+
+	if(pt.code == code)
+	{
+		if(pt.heapIndex == -1 || dist >= pt.f)
+			return; // Closed or not cheaper
+
+		pt.f = dist;
+		RaiseHeap(heap.o, pts.o, pt.heapIndex);
+		return;
+	}
+
+	pt.portal = &portal;
+	pt.f = dist;
+	pt.code = code;
+	PushHeap(heap, numHeap, pts.o, portal.fakeIndex);
+}
+
+/*
+################################################################################################
+
+
+	CORRIDOR
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	pat::FindCorridor
+
+If hierarchical search is on and the start and destination leaves are in different regions,
+marks the regions along the cheapest route through the region graph and restricts the leaf
+search to them. Routes are cached per (startLeaf, destLeaf) in memIO until flight maps are
+reloaded. Returns true if the search is restricted.
+--------------------------------------*/
+bool pat::FindCorridor(FlightWorkMemory& mem)
+{
+	mem.restricted = false;
+	uint32_t startRegion = mem.startLeaf->region, destRegion = mem.destLeaf->region;
+
+	if(!hierarchicalSearch.Bool() || startRegion == -1 || destRegion == -1 ||
+	startRegion == destRegion)
+		return false;
+
+	// Check cache, replace the least recently used entry on a miss
+	corridor* cor = 0;
+	corridor* oldest = &mem.corridors[0];
+
+	for(size_t i = 0; i < NUM_CACHED_CORRIDORS; i++)
+	{
+		corridor& c = mem.corridors[i];
+
+		if(c.map == mem.map && c.mapCode == flightMapCode && c.startLeaf == mem.startLeaf &&
+		c.destLeaf == mem.destLeaf)
+		{
+			cor = &c;
+			break;
+		}
+
+		if(c.lastUse < oldest->lastUse)
+			oldest = &c;
+	}
+
+	if(!cor)
+	{
+		cor = oldest;
+		cor->map = mem.map;
+		cor->mapCode = flightMapCode;
+		cor->startLeaf = mem.startLeaf;
+		cor->destLeaf = mem.destLeaf;
+		AbstractSearch(mem, *cor);
+	}
+
+	cor->lastUse = ++mem.corridorUse;
+
+	if(!cor->numRegions)
+		return false;
+
+	for(size_t i = 0; i < cor->numRegions; i++)
+		mem.regionMarks[cor->regions[i]] = mem.markCode;
+
+	mem.restricted = true;
+	return true;
+}
+
+/*--------------------------------------
+	pat::AbstractSearch
+
+A* over region exits. Crossing an exit costs nothing, moving between exits of the same region
+uses the precomputed costs. The start and goal are connected to their region's exits by straight
+lines. Sets corIO's regions to every region touched by the winning route, or none if there is no
+route.
+--------------------------------------*/
+void pat::AbstractSearch(FlightWorkMemory& mem, corridor& cor)
+{
+	const FlightRegion* regions = mem.map->Regions();
+	region_work_point* pts = mem.regionPts.o;
+	size_t goal = mem.map->NumPortals();
+	size_t numOpen = 0;
+	cor.numRegions = 0;
+
+	const FlightRegion& startRegion = regions[mem.startLeaf->region];
+
+	for(uint32_t i = 0; i < startRegion.numExits; i++)
+	{
+		const FlightPortal* exit = startRegion.exits[i];
+		RelaxRegionPoint(mem, numOpen, exit->fakeIndex, -1, (exit->avg - mem.start).Mag(), exit);
+	}
+
+	while(numOpen)
+	{
+		size_t index = PopHeap(mem.regionOpen.o, numOpen, pts);
+
+		if(index == goal)
+		{
+			// Collect regions on both sides of every exit along the route
+			for(index = pts[goal].parent; index != -1; index = pts[index].parent)
+			{
+				const FlightPortal& exit = *pts[index].portal;
+				uint32_t sides[2] = {exit.leaf->region, exit.other->region};
+
+				for(size_t i = 0; i < 2; i++)
+				{
+					if(sides[i] == -1 || mem.regionMarks[sides[i]] == mem.markCode)
+						continue;
+
+					mem.regionMarks[sides[i]] = mem.markCode;
+					cor.regions.Ensure(cor.numRegions + 1);
+					cor.regions[cor.numRegions++] = sides[i];
+				}
+			}
+
+			return;
+		}
+
+		const FlightPortal& exit = *pts[index].portal;
+		const FlightPortal* entrance = exit.co;
+
+		if(!entrance || exit.other->region == -1)
+			continue; // One-way portal, cost of moving on from other side is unknown; or solid
+
+		float g = pts[index].g;
+		const FlightRegion& region = regions[exit.other->region];
+
+		if(exit.other->region == mem.destLeaf->region)
+			RelaxRegionPoint(mem, numOpen, goal, index, g + (mem.dest - entrance->avg).Mag(), 0);
+
+		const float* row = region.costs + entrance->exit * region.numExits;
+
+		for(uint32_t i = 0; i < region.numExits; i++)
+		{
+			if(i == entrance->exit || row[i] == FLT_MAX)
+				continue;
+
+			const FlightPortal* next = region.exits[i];
+			RelaxRegionPoint(mem, numOpen, next->fakeIndex, index, g + row[i], next);
+		}
+	}
+}
+
+/*--------------------------------------
+	pat::RelaxRegionPoint
+
+Opens the abstract point at index or lowers its g.
+--------------------------------------*/
+void pat::RelaxRegionPoint(FlightWorkMemory& mem, size_t& numOpen, size_t index,
+	size_t parent, float g, const FlightPortal* portal)
+{
+	region_work_point& pt = mem.regionPts[index];
+	float h = portal ? (mem.dest - portal->avg).Mag() : 0.0f;
+
+	if(pt.code == mem.markCode)
+	{
+		if(pt.heapIndex == -1 || g >= pt.g)
+			return; // Closed or not cheaper
+
+		pt.parent = parent;
+		pt.g = g;
+		pt.f = g + h;
+		RaiseHeap(mem.regionOpen.o, mem.regionPts.o, pt.heapIndex);
+		return;
+	}
+
+	pt.portal = portal;
+	pt.parent = parent;
+	pt.g = g;
+	pt.f = g + h;
+	pt.code = mem.markCode;
+	PushHeap(mem.regionOpen, numOpen, mem.regionPts.o, index);
+}
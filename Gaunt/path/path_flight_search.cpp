@@ -5,6 +5,7 @@
 #include "path_lua.h"
 #include "path_private.h"
 #include "../render/render.h"
+#include "../wrap/wrap.h"
 
 namespace pat
 {
@@ -15,6 +16,7 @@ namespace pat
 						size_t& selectIndexOut, flight_work_point*& selectOut, state& sOut);
 	bool				FinishIteration(FlightWorkMemory& memIO, const FlightNode*& curOut,
 						size_t& selectIndexOut, flight_work_point*& selectOut, state& sOut);
+	void				CreateStartPoint(FlightWorkMemory& memIO);
 	size_t				SelectStaticPoint(FlightWorkMemory& memIO, const FlightNode*& curOut);
 	size_t				SelectPoint(FlightWorkMemory& memIO, const FlightNode*& curOut);
 	void				ContinueStaticSearch(FlightWorkMemory& memIO, const FlightNode* cur,
@@ -64,10 +66,12 @@ pat::state pat::Path(FlightWorkMemory& mem)
 /*--------------------------------------
 	pat::PathToPoint
 
+Open waypoints are kept in a min heap keyed on f. Each portal gets at most one waypoint per
+search; finding a cheaper route to an open portal waypoint reparents it instead of adding
+another, so mem.pts never grows past the map's portal count plus the start and destination.
+
 FIXME: can change destination mid-search if new dest leaf has no waypoints yet
 	...and if it does, can try connecting lowest g waypoint to new destination
-
-FIXME: binary heap, pool waypoints
 --------------------------------------*/
 pat::state pat::PathToPoint(FlightWorkMemory& mem)
 {
@@ -83,6 +87,7 @@ pat::state pat::PathToPoint(FlightWorkMemory& mem)
 	while(1)
 	{
 		mem.DecVisits();
+		mem.numVisited++;
 
 		if(select)
 		{
@@ -98,19 +103,36 @@ pat::state pat::PathToPoint(FlightWorkMemory& mem)
 
 				if((select->flags & STOP) == 0)
 				{
-					// Create new point at destination
-					if(mem.pts.Ensure(mem.numPts + 1))
-						select = mem.pts.o + selectIndex;
-
-					flight_work_point& pt = mem.pts[mem.numPts++];
-					pt.pos = mem.dest;
-					pt.leaf = mem.destLeaf;
-					pt.portal = 0;
-					pt.flags = STOP;
-					pt.parent = selectIndex;
-					pt.g = GScore(mem, pt, *select);
-					pt.f = pt.g;
-					pt.numPrevPts = select->numPrevPts + 1;
+					float g = select->g + (mem.dest - select->pos).Mag();
+
+					if(mem.destPt == -1)
+					{
+						// Create new point at destination
+						if(mem.pts.Ensure(mem.numPts + 1))
+							select = mem.pts.o + selectIndex;
+
+						mem.destPt = mem.numPts++;
+						flight_work_point& pt = mem.pts[mem.destPt];
+						pt.pos = mem.dest;
+						pt.leaf = mem.destLeaf;
+						pt.portal = 0;
+						pt.flags = STOP;
+						pt.parent = selectIndex;
+						pt.g = g;
+						pt.f = pt.g;
+						pt.numPrevPts = select->numPrevPts + 1;
+						PushHeap(mem.open, mem.numOpen, mem.pts.o, mem.destPt);
+					}
+					else if(g < mem.pts[mem.destPt].g && mem.pts[mem.destPt].heapIndex != -1)
+					{
+						// Cheaper way to destination
+						flight_work_point& pt = mem.pts[mem.destPt];
+						pt.parent = selectIndex;
+						pt.g = g;
+						pt.f = pt.g;
+						pt.numPrevPts = select->numPrevPts + 1;
+						RaiseHeap(mem.open.o, mem.pts.o, pt.heapIndex);
+					}
 				}
 			}
 
@@ -171,7 +193,7 @@ bool pat::StartSearchSession(FlightWorkMemory& mem, const FlightNode*& cur, size
 	}
 	else // New search
 	{
-		mem.startLeaf = mem.map->PosToBestLeaf(mem.start);
+		mem.startLeaf = mem.map->PosToBestLeaf(mem.start, 0, mem.losers);
 
 		if(!mem.startLeaf || (mem.startLeaf->flags & scn::Node::SOLID))
 		{
@@ -179,7 +201,7 @@ bool pat::StartSearchSession(FlightWorkMemory& mem, const FlightNode*& cur, size
 			return false;
 		}
 
-		mem.destLeaf = mem.map->PosToBestLeaf(mem.origDest, &mem.dest);
+		mem.destLeaf = mem.map->PosToBestLeaf(mem.origDest, &mem.dest, mem.losers);
 
 		if(!mem.destLeaf || (mem.destLeaf->flags & scn::Node::SOLID))
 		{
@@ -187,26 +209,37 @@ bool pat::StartSearchSession(FlightWorkMemory& mem, const FlightNode*& cur, size
 			return false;
 		}
 
+		FindCorridor(mem);
+		CreateStartPoint(mem);
 		cur = mem.startLeaf;
-
-		// Create first waypoint
-		mem.pts.Ensure(1);
-		mem.numPts++;
 		selectIndex = 0;
 		select = mem.pts.o;
-		select->pos = mem.start;
-		select->leaf = mem.startLeaf;
-		select->portal = 0;
-		select->flags = 0;
-		select->g = 0.0f;
-		select->f = PAT_WAYPOINT_CLOSED;
-		select->parent = -1;
-		select->numPrevPts = 0;
 	}
 
 	return true;
 }
 
+/*--------------------------------------
+	pat::CreateStartPoint
+
+Creates the first waypoint at mem.start. mem.pts must be empty.
+--------------------------------------*/
+void pat::CreateStartPoint(FlightWorkMemory& mem)
+{
+	mem.pts.Ensure(1);
+	mem.numPts = 1;
+	flight_work_point& pt = mem.pts[0];
+	pt.pos = mem.start;
+	pt.leaf = mem.startLeaf;
+	pt.portal = 0;
+	pt.flags = 0;
+	pt.g = 0.0f;
+	pt.f = PAT_WAYPOINT_CLOSED;
+	pt.parent = -1;
+	pt.numPrevPts = 0;
+	pt.heapIndex = -1;
+}
+
 /*--------------------------------------
 	pat::FinishIteration
 --------------------------------------*/
@@ -236,32 +269,13 @@ bool pat::FinishIteration(FlightWorkMemory& mem, const FlightNode*& cur, size_t&
 
 Returns index of flight_work_point with lowest f or -1 if all are closed. Selected point is
 closed. cur is set to the next leaf to search.
-
-FIXME: binary heap
 --------------------------------------*/
 size_t pat::SelectStaticPoint(FlightWorkMemory& mem, const FlightNode*& cur)
 {
-	size_t index;
-	flight_work_point* select;
-
-	while(1)
+	while(mem.numOpen)
 	{
-		index = -1;
-		float bestF = FLT_MAX;
-
-		for(size_t i = 0; i < mem.numPts; i++)
-		{
-			if(mem.pts[i].f < bestF)
-			{
-				index = i;
-				bestF = mem.pts[i].f;
-			}
-		}
-
-		if(index == -1)
-			return -1;
-
-		select = mem.pts.o + index;
+		size_t index = PopHeap(mem.open.o, mem.numOpen, mem.pts.o);
+		flight_work_point* select = mem.pts.o + index;
 		select->f = PAT_WAYPOINT_CLOSED;
 
 		if(select->portal)
@@ -274,18 +288,35 @@ size_t pat::SelectStaticPoint(FlightWorkMemory& mem, const FlightNode*& cur)
 		else
 			cur = select->leaf;
 
-		break;
+		return index;
 	}
 
-	return index;
+	return -1;
 }
 
 /*--------------------------------------
 	pat::SelectPoint
+
+If a search restricted to a region corridor runs out of points, it starts over without the
+restriction since the corridor's estimated costs may have left out the only way through.
 --------------------------------------*/
 size_t pat::SelectPoint(FlightWorkMemory& mem, const FlightNode*& cur)
 {
-	return SelectStaticPoint(mem, cur);
+	size_t index = SelectStaticPoint(mem, cur);
+
+	if(index == -1 && mem.restricted)
+	{
+		mem.restricted = false;
+		mem.numOpen = 0;
+		mem.closeBits.Clear();
+		mem.destPt = -1;
+		mem.NewMarkCode();
+		CreateStartPoint(mem);
+		cur = mem.startLeaf;
+		index = 0;
+	}
+
+	return index;
 }
 
 /*--------------------------------------
@@ -347,8 +378,8 @@ float pat::FScore(const com::Vec3& dest, const flight_work_point& pt)
 /*--------------------------------------
 	pat::CreatePortalPoint
 
-Returns the created flight_work_point, or 0 on failure. select's address may be modified if
-mem.pts is reallocated.
+Returns the created or updated flight_work_point, or 0 if the portal is closed or its waypoint
+already has an equal or lower g. select's address may be modified if mem.pts is reallocated.
 --------------------------------------*/
 pat::flight_work_point* pat::CreatePortalPoint(FlightWorkMemory& mem,
 	flight_work_point*& select, const FlightPortal& portal)
@@ -356,20 +387,49 @@ pat::flight_work_point* pat::CreatePortalPoint(FlightWorkMemory& mem,
 	if(mem.closeBits.True(portal.fakeIndex))
 		return 0; // Closed
 
+	if(mem.restricted && (portal.other->region == -1 ||
+	mem.regionMarks[portal.other->region] != mem.markCode))
+		return 0; // Outside corridor
+
 	size_t selectIndex = select - mem.pts.o;
+	flight_portal_mark& mark = mem.portalMarks[portal.fakeIndex];
+
+	if(mark.code == mem.markCode)
+	{
+		// Portal already has a waypoint, reparent it if this path is cheaper
+		flight_work_point& pt = mem.pts[mark.pt];
+
+		if(pt.heapIndex == -1)
+			return 0;
+
+		float g = select->g + (pt.pos - select->pos).Mag();
+
+		if(g >= pt.g)
+			return 0;
+
+		pt.parent = selectIndex;
+		pt.g = g;
+		pt.f = FScore(mem.dest, pt);
+		pt.numPrevPts = select->numPrevPts + 1;
+		RaiseHeap(mem.open.o, mem.pts.o, pt.heapIndex);
+		return &pt;
+	}
 
 	if(mem.pts.Ensure(mem.numPts + 1))
 		select = mem.pts.o + selectIndex;
 
+	mark.pt = mem.numPts;
+	mark.code = mem.markCode;
 	flight_work_point& pt = mem.pts[mem.numPts++];
 	pt.pos = portal.avg; // FIXME: make portals polygons and place point decently close to parent
 	pt.leaf = portal.leaf;
 	pt.portal = &portal;
 	pt.flags = 0;
-	pt.parent = select - mem.pts.o;
+	pt.parent = selectIndex;
 	pt.g = GScore(mem, pt, *select);
 	pt.f = FScore(mem.dest, pt);
 	pt.numPrevPts = select->numPrevPts + 1;
+	PushHeap(mem.open, mem.numOpen, mem.pts.o, mark.pt);
 	return &pt;
 }
 
@@ -385,8 +445,16 @@ pat::flight_work_point* pat::CreatePortalPoint(FlightWorkMemory& mem,
 
 /*--------------------------------------
 	pat::FlightWorkMemory::TracePath
+
+Copies the winning path into path and returns the number of points. The version without desc
+uses the global hit::Descent.
 --------------------------------------*/
 size_t pat::FlightWorkMemory::TracePath(com::Arr<waypoint>& path) const
+{
+	return TracePath(path, hit::GlobalDescent());
+}
+
+size_t pat::FlightWorkMemory::TracePath(com::Arr<waypoint>& path, hit::Descent& desc) const
 {
 	if(finale == -1)
 		return 0;
@@ -431,7 +499,6 @@ size_t pat::FlightWorkMemory::TracePath(com::Arr<waypoint>& path) const
 				continue;
 			}
 
-			hit::Descent& desc = hit::GlobalDescent();
 			desc.Begin(const_cast<FlightNode*>(&map->Nodes()[0]), prev.pos, next.pos);
 
 			while(desc.numStacked)
@@ -519,4 +586,103 @@ int pat::InstantFlightPathToPoint(lua_State* l)
 		lua_pushinteger(l, s);
 		return 1;
 	}
+}
+
+/*--------------------------------------
+LUA	pat::BenchFlightSearch (pat_bench_flight)
+
+IN	[iNumQueries = 1000], [iSeed = 1], [bBatch = false]
+
+Runs iNumQueries searches between random portals of each flight map and logs queries per second
+and visited nodes per query. If bBatch is true, the queries are done with a PathBatch. Set
+pat_hierarchical to 0 to compare against searches that aren't limited to a region corridor.
+--------------------------------------*/
+int pat::BenchFlightSearch(lua_State* l)
+{
+	lua_Integer numQueries = luaL_optinteger(l, 1, 1000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+	bool batched = lua_toboolean(l, 3) != 0;
+	com::Arr<waypoint> path(32);
+	PathBatch batch;
+
+	for(uint32_t m = 0; m < numFlightMaps; m++)
+	{
+		const FlightMap& map = flightMaps[m];
+		const FlightNode* nodes = map.Nodes();
+
+		// Collect leaves that have portals so random points are inside open space
+		com::Arr<const FlightNode*> leaves(32);
+		size_t numLeaves = 0;
+
+		for(uint32_t i = 0; i < map.NumNodes(); i++)
+		{
+			if(nodes[i].numPortals)
+			{
+				leaves.Ensure(numLeaves + 1);
+				leaves[numLeaves++] = &nodes[i];
+			}
+		}
+
+		if(!numLeaves)
+		{
+			leaves.Free();
+			continue;
+		}
+
+		unsigned long long numVisited = 0;
+		lua_Integer numFound = 0;
+		batch.Clear();
+		unsigned long long startTime = wrp::MicroTime();
+
+		for(lua_Integer q = 0; q < numQueries; q++)
+		{
+			com::Vec3 ends[2];
+
+			for(size_t e = 0; e < 2; e++)
+			{
+				const FlightNode& leaf = *leaves[com::BenchRand(seed) % numLeaves];
+				ends[e] = leaf.portals[com::BenchRand(seed) % leaf.numPortals].avg;
+			}
+
+			if(batched)
+			{
+				batch.Add(map, ends[0], ends[1]);
+				continue;
+			}
+
+			globalFlightMemory.SetParams(map, PATH_POINT, ends[0], ends[1]);
+
+			if(Path(globalFlightMemory) == GO)
+			{
+				globalFlightMemory.TracePath(path);
+				numFound++;
+			}
+
+			numVisited += globalFlightMemory.numVisited;
+			globalFlightMemory.Clear();
+		}
+
+		if(batched)
+		{
+			batch.Run();
+
+			for(size_t i = 0; i < batch.NumRequests(); i++)
+			{
+				numFound += batch.State(i) == GO;
+				numVisited += batch.NumVisited(i);
+			}
+		}
+
+		unsigned long long micro = wrp::MicroTime() - startTime;
+		double sec = micro ? micro * 0.000001 : 0.000001;
+
+		con::LogF("Flight map %u: %d queries (%d found) in %g ms, %g queries/sec, %g visits/query",
+			m, (int)numQueries, (int)numFound, sec * 1000.0, numQueries / sec,
+			numQueries ? (double)numVisited / numQueries : 0.0);
+
+		leaves.Free();
+	}
+
+	path.Free();
+	return 0;
 }
\ No newline at end of file
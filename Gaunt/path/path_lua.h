@@ -17,6 +17,10 @@ namespace pat
 
 	// FLIGHT SEARCH LUA
 	int InstantFlightPathToPoint(lua_State* l);
+	int BenchFlightSearch(lua_State* l);
+
+	// FLIGHT BATCH LUA
+	int FlightPathBatch(lua_State* l);
 
 	// FLIGHT NAVIGATOR LUA
 	int CreateFlightNavigator(lua_State* l);
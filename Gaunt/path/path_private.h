@@ -29,11 +29,13 @@ namespace pat
 class FlightPortal
 {
 public:
-	uint32_t	fakeIndex; // FIXME TEMP: using this to refer to close-bits during search even though all of a map's portals are not stored in a sequential array at the moment
-	com::Vec3	avg;
-	FlightNode	*leaf, *other;
+	uint32_t			fakeIndex; // FIXME TEMP: using this to refer to close-bits during search even though all of a map's portals are not stored in a sequential array at the moment
+	com::Vec3			avg;
+	FlightNode			*leaf, *other;
+	const FlightPortal*	co; // Portal from other back to leaf, 0 if there isn't one
+	uint32_t			exit; // Index in leaf's region's exits, -1 if other is in the same region
 
-	FlightPortal() : fakeIndex(0), leaf(0), other(0) {}
+	FlightPortal() : fakeIndex(0), leaf(0), other(0), co(0), exit(-1) {}
 };
 
 /*======================================
@@ -44,13 +46,40 @@ class FlightNode : public scn::Node
 public:
 	FlightPortal*	portals;
 	uint32_t		numPortals;
+	uint32_t		region; // -1 if not a non-solid leaf
 
-	FlightNode() : portals(0), numPortals(0) {}
+	FlightNode() : portals(0), numPortals(0), region(-1) {}
 	~FlightNode() { if(portals) delete[] portals; }
 };
 
+/*======================================
+	pat::FlightRegion
+
+A cluster of neighboring leaves. Regions and the costs between their exits make up the abstract
+graph used to limit leaf-level searches to a corridor.
+======================================*/
+class FlightRegion
+{
+public:
+	const FlightPortal**	exits; // Portals that lead out of the region
+	uint32_t				numExits;
+	float*					costs; // [from * numExits + to], FLT_MAX if not connected inside
+
+	FlightRegion() : exits(0), numExits(0), costs(0) {}
+	~FlightRegion() {if(exits) delete[] exits; if(costs) delete[] costs;}
+};
+
 extern FlightMap*	flightMaps;
 extern uint32_t		numFlightMaps;
+extern unsigned		flightMapCode; // Changes whenever flight maps are cleared
+
+/*
+################################################################################################
+	FLIGHT REGION
+################################################################################################
+*/
+
+bool	FindCorridor(FlightWorkMemory& memIO);
 
 /*
 ################################################################################################
@@ -60,6 +89,100 @@ extern uint32_t		numFlightMaps;
 
 extern FlightWorkMemory globalFlightMemory;
 
+/*
+################################################################################################
+	OPEN MIN HEAP
+
+pt must have a float f and a size_t heapIndex. heap holds indices into pts.
+################################################################################################
+*/
+
+/*--------------------------------------
+	pat::RaiseHeap
+
+Moves the point at heapIndex up the heap after its f was lowered.
+--------------------------------------*/
+template <class pt> void RaiseHeap(size_t* heap, pt* pts, size_t heapIndex)
+{
+	size_t move = heap[heapIndex];
+	float moveF = pts[move].f;
+
+	while(heapIndex)
+	{
+		size_t parent = (heapIndex - 1) / 2;
+
+		if(pts[heap[parent]].f <= moveF)
+			break;
+
+		heap[heapIndex] = heap[parent];
+		pts[heap[heapIndex]].heapIndex = heapIndex;
+		heapIndex = parent;
+	}
+
+	heap[heapIndex] = move;
+	pts[move].heapIndex = heapIndex;
+}
+
+/*--------------------------------------
+	pat::PushHeap
+
+pts[index].f must already be calculated.
+--------------------------------------*/
+template <class pt> void PushHeap(com::Arr<size_t>& heap, size_t& num, pt* pts, size_t index)
+{
+	size_t heapIndex = num;
+	heap.Ensure(++num);
+	heap[heapIndex] = index;
+	pts[index].heapIndex = heapIndex;
+	RaiseHeap(heap.o, pts, heapIndex);
+}
+
+/*--------------------------------------
+	pat::PopHeap
+
+Removes and returns the index with the lowest f. The heap must not be empty.
+--------------------------------------*/
+template <class pt> size_t PopHeap(size_t* heap, size_t& num, pt* pts)
+{
+	size_t pop = heap[0];
+	pts[pop].heapIndex = -1;
+
+	if(!--num)
+		return pop;
+
+	size_t move = heap[num];
+	float moveF = pts[move].f;
+	size_t index = 0;
+
+	while(1)
+	{
+		size_t swap = index;
+		float swapF = moveF;
+		size_t left = index * 2 + 1;
+		size_t right = index * 2 + 2;
+
+		if(left < num && pts[heap[left]].f < swapF)
+		{
+			swap = left;
+			swapF = pts[heap[left]].f;
+		}
+
+		if(right < num && pts[heap[right]].f < swapF)
+			swap = right;
+
+		if(swap == index)
+			break;
+
+		heap[index] = heap[swap];
+		pts[heap[index]].heapIndex = index;
+		index = swap;
+	}
+
+	heap[index] = move;
+	pts[move].heapIndex = index;
+	return pop;
+}
+
 state	Path(FlightWorkMemory& memIO);
 state	PathToPoint(FlightWorkMemory& memIO);
 void	DrawSearch(const flight_work_point* pts, size_t num, int color, float time = 0.0f);
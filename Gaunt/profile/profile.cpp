@@ -0,0 +1,483 @@
+// profile.cpp
+// Martynas Ceicys
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "../console/console.h"
+#include "../mod/mod.h"
+#include "../script/script.h"
+#include "../../GauntCommon/array.h"
+#include "../../GauntCommon/json.h"
+#include "../../GauntCommon/math.h"
+#include "../../GauntCommon/pair.h"
+
+/*
+Each thread that records a zone claims one of PRF_MAX_THREADS ring buffers and is the only
+writer of it. Update runs on the main thread and folds new events into per-zone stats, which are
+published every prf_window_frames frames. Events stay in the rings after being folded, so the
+trace export covers the last PRF_RING_SIZE zones of every thread. Times are inclusive; a zone's
+time includes the zones nested in it.
+*/
+
+#ifdef _MSC_VER
+#define PRF_THREAD_LOCAL __declspec(thread)
+#else
+#define PRF_THREAD_LOCAL __thread
+#endif
+
+#define PRF_RING_SIZE 65536 // Must be a power of two
+#define PRF_MAX_THREADS 32
+#define PRF_MAX_NAME 128
+
+namespace prf
+{
+	struct event
+	{
+		const char*			name;
+		unsigned long long	start, end;
+	};
+
+	struct thread_buffer
+	{
+		event*				events; // Allocated by the first thread to claim the buffer
+		volatile uint32_t	head; // Number of events written
+		volatile uint32_t	claimed;
+		uint32_t			cursor; // Number of events folded into stats, only touched by Update
+	};
+
+	struct zone_stats
+	{
+		unsigned long long	windowTicks, windowMaxTicks;
+		uint32_t			windowCalls;
+		float				avgMS, maxMS, callsPerFrame; // Of the last full window
+
+		zone_stats() : windowTicks(0), windowMaxTicks(0), windowCalls(0), avgMS(0.0f),
+			maxMS(0.0f), callsPerFrame(0.0f) {}
+	};
+
+	con::Option enable("prf_enable", false);
+
+	namespace summary
+	{
+		con::Option
+			windowFrames("prf_window_frames", 120.0f, con::PositiveIntegerOnly),
+			log("prf_log_summary", false);
+	}
+
+	bool								active = false;
+	thread_buffer						buffers[PRF_MAX_THREADS] = {0};
+	thread_buffer						noBuffer = {0}; // Given to threads that couldn't claim one
+	PRF_THREAD_LOCAL thread_buffer*		threadBuffer = 0;
+	com::PairMap<zone_stats>			zones;
+	com::PairMap<bool>					names;
+	uint32_t							numWindowFrames = 0, numDropped = 0, windowDropped = 0;
+
+	// ZONE
+	thread_buffer*	ClaimBuffer();
+
+	// SUMMARY
+	void			FoldEvents(thread_buffer& buf);
+	void			CloseWindow();
+	void			LogSummary();
+	int				CompareZones(const void* a, const void* b);
+
+	// LUA
+	int				Summary(lua_State* l);
+	int				ExportTrace(lua_State* l);
+}
+
+/*
+################################################################################################
+
+
+	ZONE
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	prf::Record
+
+Appends an event to the calling thread's ring buffer. The buffer is claimed on the first call.
+--------------------------------------*/
+void prf::Record(const char* name, unsigned long long start, unsigned long long end)
+{
+	thread_buffer* buf = threadBuffer;
+
+	if(!buf)
+		buf = ClaimBuffer();
+
+	if(!buf->events)
+		return;
+
+	uint32_t head = buf->head; // Only this thread writes it
+	event& e = buf->events[head & (PRF_RING_SIZE - 1)];
+	e.name = name;
+	e.start = start;
+	e.end = end;
+	wrp::AtomicStore(buf->head, head + 1);
+}
+
+/*--------------------------------------
+	prf::ClaimBuffer
+
+Gives the calling thread the first unclaimed buffer. The main thread claims first in Init, so
+buffer 0 is always the main thread's.
+--------------------------------------*/
+prf::thread_buffer* prf::ClaimBuffer()
+{
+	for(size_t i = 0; i < PRF_MAX_THREADS; i++)
+	{
+		thread_buffer& buf = buffers[i];
+
+		if(wrp::AtomicAdd(buf.claimed, 1) == 1)
+		{
+			if(!buf.events)
+				buf.events = new event[PRF_RING_SIZE];
+
+			return threadBuffer = &buf;
+		}
+
+		wrp::AtomicAdd(buf.claimed, (uint32_t)-1);
+	}
+
+	return threadBuffer = &noBuffer;
+}
+
+/*--------------------------------------
+	prf::ReleaseThread
+
+Lets another thread reuse the calling thread's buffer. Call before a thread that may have
+recorded zones exits. The buffer's events are kept.
+--------------------------------------*/
+void prf::ReleaseThread()
+{
+	if(threadBuffer && threadBuffer != &noBuffer)
+		wrp::AtomicAdd(threadBuffer->claimed, (uint32_t)-1);
+
+	threadBuffer = 0;
+}
+
+/*--------------------------------------
+	prf::Name
+
+Returns a copy of prefix followed by str that lasts until CleanUp, for zones with names made at
+run time. The same string is returned for equal names. Only call from the main thread.
+--------------------------------------*/
+const char* prf::Name(const char* prefix, const char* str)
+{
+	char name[PRF_MAX_NAME];
+	size_t len = 0;
+
+	for(; *prefix && len < PRF_MAX_NAME - 1; prefix++)
+		name[len++] = *prefix;
+
+	for(; *str && len < PRF_MAX_NAME - 1; str++)
+		name[len++] = *str;
+
+	name[len] = 0;
+	return names.Ensure(name)->Key();
+}
+
+/*
+################################################################################################
+
+
+	SUMMARY
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	prf::FoldEvents
+
+Adds events written since the last call to their zones' window stats. If the writer lapped the
+cursor, the overwritten events are counted as dropped.
+--------------------------------------*/
+void prf::FoldEvents(thread_buffer& buf)
+{
+	uint32_t head = wrp::AtomicLoad(buf.head);
+
+	if(head - buf.cursor > PRF_RING_SIZE)
+	{
+		windowDropped += head - buf.cursor - PRF_RING_SIZE;
+		buf.cursor = head - PRF_RING_SIZE;
+	}
+
+	// Consecutive events usually share a name, so skip the lookup when they do
+	const char* lastName = 0;
+	zone_stats* stats = 0;
+
+	for(; buf.cursor != head; buf.cursor++)
+	{
+		const event& e = buf.events[buf.cursor & (PRF_RING_SIZE - 1)];
+
+		if(e.name != lastName)
+		{
+			lastName = e.name;
+			stats = &zones.Ensure(e.name)->Value();
+		}
+
+		unsigned long long ticks = e.end - e.start;
+		stats->windowTicks += ticks;
+		stats->windowCalls++;
+
+		if(ticks > stats->windowMaxTicks)
+			stats->windowMaxTicks = ticks;
+	}
+}
+
+/*--------------------------------------
+	prf::CloseWindow
+
+Publishes the window's stats and starts a new window.
+--------------------------------------*/
+void prf::CloseWindow()
+{
+	double msPerTick = 1000.0 / wrp::TicksPerSecond();
+
+	for(com::Pair<zone_stats>* p = zones.First(); p; p = p->Next())
+	{
+		zone_stats& stats = p->Value();
+		stats.avgMS = (float)(stats.windowTicks * msPerTick / numWindowFrames);
+		stats.maxMS = (float)(stats.windowMaxTicks * msPerTick);
+		stats.callsPerFrame = (float)stats.windowCalls / numWindowFrames;
+		stats.windowTicks = stats.windowMaxTicks = 0;
+		stats.windowCalls = 0;
+	}
+
+	numDropped = windowDropped;
+	windowDropped = 0;
+
+	if(summary::log.Bool())
+		LogSummary();
+
+	numWindowFrames = 0;
+}
+
+/*--------------------------------------
+	prf::LogSummary
+
+Logs zones that were entered in the last window, most expensive first.
+--------------------------------------*/
+void prf::LogSummary()
+{
+	com::Arr<const com::Pair<zone_stats>*> sorted(zones.Num());
+	size_t num = 0;
+
+	for(const com::Pair<zone_stats>* p = zones.First(); p; p = p->Next())
+	{
+		if(p->Value().callsPerFrame > 0.0f)
+			sorted[num++] = p;
+	}
+
+	if(!num)
+	{
+		con::LogF("No profiled zones in the last window; set prf_enable to 1");
+		return;
+	}
+
+	qsort(sorted.o, num, sizeof(const com::Pair<zone_stats>*), CompareZones);
+
+	con::LogF("Profile of the last %u frames (ms/frame, max ms/call, calls/frame), %u dropped:",
+		summary::windowFrames.Unsigned(), numDropped);
+
+	for(size_t i = 0; i < num; i++)
+	{
+		const zone_stats& stats = sorted[i]->Value();
+
+		con::LogF("%8.3f %8.3f %8.1f  %s", stats.avgMS, stats.maxMS, stats.callsPerFrame,
+			sorted[i]->Key());
+	}
+
+	sorted.Free();
+}
+
+/*--------------------------------------
+	prf::CompareZones
+--------------------------------------*/
+int prf::CompareZones(const void* a, const void* b)
+{
+	float avgA = (*(const com::Pair<zone_stats>**)a)->Value().avgMS;
+	float avgB = (*(const com::Pair<zone_stats>**)b)->Value().avgMS;
+	return avgA < avgB ? 1 : avgA > avgB ? -1 : 0;
+}
+
+/*
+################################################################################################
+
+
+	LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	prf::Summary (prf_summary)
+
+Logs the per-zone stats of the last full window.
+--------------------------------------*/
+int prf::Summary(lua_State* l)
+{
+	LogSummary();
+	return 0;
+}
+
+/*--------------------------------------
+LUA	prf::ExportTrace (prf_export_trace)
+
+IN	[sFilePath = "trace.json"]
+
+Writes every thread's buffered zones to sFilePath in the Chrome trace event format, which can be
+opened in chrome://tracing or Perfetto. Leaves the oldest eighth of full buffers out so threads
+still recording don't overwrite events while they're being written.
+--------------------------------------*/
+int prf::ExportTrace(lua_State* l)
+{
+	const char* filePath = luaL_optstring(l, 1, "trace.json");
+	const char* err = 0;
+	FILE* file = mod::FOpen(0, filePath, "w", err);
+
+	if(!file)
+	{
+		CON_ERRORF("Failed to open '%s': %s", filePath, err);
+		return 0;
+	}
+
+	const uint32_t MAX_EXPORT = PRF_RING_SIZE - PRF_RING_SIZE / 8;
+	uint32_t heads[PRF_MAX_THREADS], nums[PRF_MAX_THREADS];
+	unsigned long long base = 0;
+	bool haveBase = false;
+
+	for(size_t i = 0; i < PRF_MAX_THREADS; i++)
+	{
+		heads[i] = wrp::AtomicLoad(buffers[i].head);
+		nums[i] = com::Min(heads[i], MAX_EXPORT);
+
+		if(nums[i] && (!haveBase || buffers[i].events[(heads[i] - nums[i]) &
+		(PRF_RING_SIZE - 1)].start < base))
+		{
+			base = buffers[i].events[(heads[i] - nums[i]) & (PRF_RING_SIZE - 1)].start;
+			haveBase = true;
+		}
+	}
+
+	double microPerTick = 1000000.0 / wrp::TicksPerSecond();
+	size_t numEvents = 0;
+	fputs("{\"traceEvents\":[", file);
+
+	for(size_t i = 0; i < PRF_MAX_THREADS; i++)
+	{
+		if(!nums[i])
+			continue;
+
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+			"\"args\":{\"name\":\"", numEvents ? "," : "", (unsigned)i);
+
+		if(i)
+			fprintf(file, "thread %u\"}}", (unsigned)i);
+		else
+			fputs("main\"}}", file);
+
+		for(uint32_t j = heads[i] - nums[i]; j != heads[i]; j++)
+		{
+			const event& e = buffers[i].events[j & (PRF_RING_SIZE - 1)];
+			fputs(",\n{\"name\":\"", file);
+			com::WriteJSONEncodedString(e.name, file);
+
+			fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				(unsigned)i, (e.start - base) * microPerTick, (e.end - e.start) * microPerTick);
+		}
+
+		numEvents += nums[i];
+	}
+
+	fputs("\n]}\n", file);
+	bool failed = ferror(file) != 0;
+	fclose(file);
+
+	if(failed)
+		CON_ERRORF("Failed to write '%s'", filePath);
+	else
+		con::LogF("Wrote %u zones to '%s'", (unsigned)numEvents, filePath);
+
+	return 0;
+}
+
+/*
+################################################################################################
+
+
+	GENERAL
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	prf::Update
+
+Folds new events into zone stats and closes the window once it's prf_window_frames long. Call
+once per frame on the main thread.
+--------------------------------------*/
+void prf::Update()
+{
+	for(size_t i = 0; i < PRF_MAX_THREADS; i++)
+	{
+		if(buffers[i].events)
+			FoldEvents(buffers[i]);
+	}
+
+	if(active)
+	{
+		numWindowFrames++;
+
+		if(numWindowFrames >= summary::windowFrames.Unsigned())
+			CloseWindow();
+	}
+
+	bool wasActive = active;
+	active = PRF_ENABLED && enable.Bool();
+
+	if(active && !wasActive)
+	{
+		// Don't mix events left over from the last time profiling was on into the new window
+		for(com::Pair<zone_stats>* p = zones.First(); p; p = p->Next())
+			p->Value() = zone_stats();
+
+		numWindowFrames = windowDropped = 0;
+	}
+}
+
+/*--------------------------------------
+	prf::Init
+--------------------------------------*/
+void prf::Init()
+{
+	ClaimBuffer(); // Main thread gets buffer 0
+
+	lua_pushcfunction(scr::state, Summary); con::CreateCommand("prf_summary");
+	lua_pushcfunction(scr::state, ExportTrace); con::CreateCommand("prf_export_trace");
+}
+
+/*--------------------------------------
+	prf::CleanUp
+
+Call after every other thread has stopped.
+--------------------------------------*/
+void prf::CleanUp()
+{
+	active = false;
+
+	for(size_t i = 0; i < PRF_MAX_THREADS; i++)
+	{
+		delete[] buffers[i].events;
+		buffers[i].events = 0;
+	}
+}
@@ -0,0 +1,73 @@
+// profile.h -- CPU zone profiler
+// Martynas Ceicys
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "../console/option.h"
+#include "../wrap/wrap.h"
+
+// Define as 0 to compile zones out entirely
+#ifndef PRF_ENABLED
+#define PRF_ENABLED 1
+#endif
+
+#define PRF_CAT_(a, b) a##b
+#define PRF_CAT(a, b) PRF_CAT_(a, b)
+
+#if PRF_ENABLED
+#define PRF_ZONE(name) prf::Zone PRF_CAT(prfZone, __LINE__)(name)
+#else
+#define PRF_ZONE(name)
+#endif
+
+namespace prf
+{
+
+/*
+################################################################################################
+	ZONE
+################################################################################################
+*/
+
+extern bool active; // Set by Update from prf_enable
+
+void Record(const char* name, unsigned long long start, unsigned long long end);
+
+/*======================================
+	prf::Zone
+
+Records the time between construction and destruction on the calling thread's ring buffer if
+profiling was active at construction. name must outlive the profiler; use a literal or Name.
+======================================*/
+class Zone
+{
+public:
+	Zone(const char* name) : name(name), start(active ? wrp::Ticks() : 0) {}
+	~Zone() {if(start) Record(name, start, wrp::Ticks());}
+
+private:
+	const char*			name;
+	unsigned long long	start;
+
+	Zone(const Zone&);
+	Zone& operator=(const Zone&);
+};
+
+/*
+################################################################################################
+	GENERAL
+################################################################################################
+*/
+
+extern con::Option enable;
+
+const char*	Name(const char* prefix, const char* str);
+void		ReleaseThread();
+void		Update();
+void		Init();
+void		CleanUp();
+
+}
+
+#endif
@@ -13,6 +13,7 @@ namespace rec
 {
 
 void ApplyJSVarDiff(com::JSVar& destIO, const com::JSVar& src);
+bool SameJSVar(const com::JSVar& a, const com::JSVar& b);
 void LuaPushJSVar(lua_State* l, const com::JSVar& var);
 void LuaToJSVar(lua_State* l, int index, com::JSVar& varOut);
 
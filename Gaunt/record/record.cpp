@@ -10,6 +10,7 @@
 #include "../../GauntCommon/io.h"
 #include "../../GauntCommon/link.h"
 #include "../path/path.h"
+#include "../profile/profile.h"
 #include "../scene/scene.h"
 #include "../script/script.h"
 #include "../wrap/wrap.h"
@@ -19,9 +20,15 @@ namespace rec
 	// RECORD LUA
 	int GlobalTranscript(lua_State* l);
 	int SetGlobalTranscript(lua_State* l);
+	int BenchJSONObjects(lua_State* l);
+	int BenchJSONDoc(lua_State* l);
+
+	// JSON BENCH
+	void BenchJSONObjectsRun(size_t numEnts, uint32_t& seedIO);
 }
 
-com::JSVar rec::lvlRoot;
+com::JSDoc rec::lvlDoc;
+com::JSVar& rec::lvlRoot = lvlDoc.ArenaRoot();
 
 /*
 ################################################################################################
@@ -60,6 +67,17 @@ void rec::UnassignResourceTranscripts()
 	scn::Bulb::UnsetTranscripts();
 }
 
+/*--------------------------------------
+	rec::EditTranscripts
+
+Call before giving a resource transcript heap storage. While loading, transcripts point into
+lvlDoc's arena tree, so the document has to walk it when freed.
+--------------------------------------*/
+void rec::EditTranscripts()
+{
+	lvlDoc.EditRoot();
+}
+
 /*
 ################################################################################################
 
@@ -78,6 +96,7 @@ void rec::Init()
 	luaL_Reg regs[] =
 	{
 		{"RequestSave", RequestSave},
+		{"RequestAutosave", RequestAutosave},
 		{"RequestLoad", RequestLoad},
 		{"CurrentLevel", CurrentLevel},
 		{"SaveEdits", SaveEdits},
@@ -91,7 +110,12 @@ void rec::Init()
 	scr::RegisterLibrary(scr::state, "grec", regs, 0, 0, 0, 0);
 
 	lua_pushcfunction(scr::state, RequestSave); con::CreateCommand("save");
+	lua_pushcfunction(scr::state, RequestAutosave); con::CreateCommand("autosave");
 	lua_pushcfunction(scr::state, RequestLoad); con::CreateCommand("load");
+	lua_pushcfunction(scr::state, BenchJSONObjects); con::CreateCommand("rec_bench_json_objects");
+	lua_pushcfunction(scr::state, BenchJSONDoc); con::CreateCommand("rec_bench_json_doc");
+	lua_pushcfunction(scr::state, BenchSaveFormats); con::CreateCommand("rec_bench_save_formats");
+	lua_pushcfunction(scr::state, BenchJournal); con::CreateCommand("rec_bench_journal");
 }
 
 /*--------------------------------------
@@ -99,10 +123,23 @@ void rec::Init()
 --------------------------------------*/
 void rec::Update()
 {
+	PRF_ZONE("rec::Update");
 	if(saveFilePath) Save();
+	UpdateSaves();
 	if(loadFilePath) Load();
 }
 
+/*--------------------------------------
+	rec::CleanUp
+
+Waits for queued saves to be written.
+--------------------------------------*/
+void rec::CleanUp()
+{
+	FinishSaves();
+	ForgetJournal();
+}
+
 /*--------------------------------------
 	rec::CurrentLevel
 --------------------------------------*/
@@ -150,10 +187,207 @@ int rec::SetGlobalTranscript(lua_State* l)
 	if(lvlRoot.Type() != com::JSVar::OBJECT)
 		luaL_error(l, "No root object");
 
-	if(com::Pair<com::JSVar>* global = lvlRoot.Object()->Find("global"))
+	if(com::Pair<com::JSVar>* global = lvlDoc.EditRoot().Object()->Find("global"))
 		LuaToJSVar(l, 1, global->Value());
 	else
 		luaL_error(l, "Root object does not have a 'global' key");
 
 	return 0;
+}
+
+/*--------------------------------------
+LUA	rec::BenchJSONObjects (rec_bench_json_objects)
+
+IN	[iMinEnts = 10000], [iMaxEnts = 100000], [bLinear = false], [iSeed = 1]
+
+Builds synthetic save text with iMinEnts entities, doubling up to iMaxEnts, and logs how long
+parsing it, looking up every entity by record ID in random order, and freeing it take. If bLinear
+is true, each size is run again with PairMap hash indices disabled; that run is quadratic, so
+keep the sizes small.
+--------------------------------------*/
+int rec::BenchJSONObjects(lua_State* l)
+{
+	lua_Integer minEnts = luaL_optinteger(l, 1, 10000);
+	lua_Integer maxEnts = luaL_optinteger(l, 2, 100000);
+	bool linear = lua_toboolean(l, 3) != 0;
+	uint32_t seed = luaL_optinteger(l, 4, 1);
+
+	if(minEnts <= 0 || maxEnts < minEnts)
+		return 0;
+
+	for(size_t num = minEnts;; num *= 2)
+	{
+		if(num > (size_t)maxEnts)
+			num = maxEnts;
+
+		con::LogF("%u entities, indexed:", (unsigned)num);
+		BenchJSONObjectsRun(num, seed);
+
+		if(linear)
+		{
+			size_t saveThreshold = com::JSObj::indexThreshold;
+			com::JSObj::indexThreshold = -1;
+			con::LogF("%u entities, linear:", (unsigned)num);
+			BenchJSONObjectsRun(num, seed);
+			com::JSObj::indexThreshold = saveThreshold;
+		}
+
+		if(num == maxEnts)
+			break;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------
+LUA	rec::BenchJSONDoc (rec_bench_json_doc)
+
+IN	[iNumEnts = 100000], [iSeed = 1]
+
+Parses synthetic save text with iNumEnts entities into a heap tree with com::ParseJSON and into
+a com::JSDoc arena, then frees both. Logs parse time, the process's private memory growth while
+the tree is alive, and free time for each.
+--------------------------------------*/
+int rec::BenchJSONDoc(lua_State* l)
+{
+	lua_Integer numEnts = luaL_optinteger(l, 1, 100000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+
+	if(numEnts <= 0)
+		return 0;
+
+	com::Arr<char> text;
+	WriteBenchSave(numEnts, seed, text);
+	size_t textLen = strlen(text.o);
+
+	// Heap tree; parses a copy of the text since JSDoc::Parse copies it into its arena too
+	com::JSVar heapRoot;
+	size_t startBytes = wrp::PrivateBytes();
+	unsigned long long startTime = wrp::MicroTime();
+	com::Arr<char> heapText(textLen + 1);
+	memcpy(heapText.o, text.o, textLen + 1);
+	bool parsed = com::ParseJSON(heapText.o, heapRoot);
+	unsigned long long parseTime = wrp::MicroTime() - startTime;
+	size_t peakBytes = wrp::PrivateBytes();
+	heapText.Free();
+	startTime = wrp::MicroTime();
+	com::FreeJSON(heapRoot);
+	unsigned long long freeTime = wrp::MicroTime() - startTime;
+
+	con::LogF("%u entities, %u KB of text", (unsigned)numEnts, (unsigned)(textLen / 1024));
+
+	con::LogF("\theap:  parse %g ms, +%d KB private, free %g ms%s", parseTime * 0.001,
+		(int)((peakBytes - startBytes) / 1024), freeTime * 0.001, parsed ? "" : " (failed)");
+
+	// Arena document
+	com::JSDoc doc;
+	startBytes = wrp::PrivateBytes();
+	startTime = wrp::MicroTime();
+	parsed = doc.Parse(text.o);
+	parseTime = wrp::MicroTime() - startTime;
+	peakBytes = wrp::PrivateBytes();
+	size_t arenaBytes = doc.NumBytes();
+	startTime = wrp::MicroTime();
+	doc.Free();
+	freeTime = wrp::MicroTime() - startTime;
+
+	con::LogF("\tarena: parse %g ms, +%d KB private (%u KB arena), free %g ms%s",
+		parseTime * 0.001, (int)((peakBytes - startBytes) / 1024), (unsigned)(arenaBytes / 1024),
+		freeTime * 0.001, parsed ? "" : " (failed)");
+
+	text.Free();
+	return 0;
+}
+
+/*
+################################################################################################
+
+
+	JSON BENCH
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::WriteBenchSave
+
+Writes save text shaped like horse.sav with numEnts entities keyed "1" to numEnts.
+--------------------------------------*/
+void rec::WriteBenchSave(size_t numEnts, uint32_t& seed, com::Arr<char>& text)
+{
+	text.Init(REC_DEFAULT_BUFFER_SIZE);
+	size_t len = 0;
+	const char* sections[] = {"{\"global\": {\"gravity\": 800}, \"entities\": {", "}}"};
+
+	for(size_t i = 0; i <= numEnts; i++)
+	{
+		const char* str = sections[i == numEnts];
+		size_t strLen = strlen(str);
+		text.Ensure(len + strLen + 256);
+		strcpy(text.o + len, str);
+		len += strLen;
+
+		if(i == numEnts)
+			break;
+
+		float pos[3];
+
+		for(size_t j = 0; j < 3; j++)
+			pos[j] = (com::BenchRandF(seed) - 0.5f) * 8192.0f;
+
+		len += com::SNPrintF(text.o + len, (int)(text.n - len), 0, "%s\"%u\": {\"type\": \"bench\", "
+			"\"pos\": [%g, %g, %g], \"ori\": [0, 0, 0, 1], \"health\": %u}", i ? ", " : "",
+			(unsigned)i + 1, pos[0], pos[1], pos[2], (unsigned)i % 100);
+	}
+}
+
+/*--------------------------------------
+	rec::BenchJSONObjectsRun
+--------------------------------------*/
+void rec::BenchJSONObjectsRun(size_t numEnts, uint32_t& seed)
+{
+	com::Arr<char> text;
+	WriteBenchSave(numEnts, seed, text);
+
+	// Parse
+	com::JSVar root;
+	unsigned long long startTime = wrp::MicroTime();
+	bool parsed = com::ParseJSON(text.o, root);
+	unsigned long long parseTime = wrp::MicroTime() - startTime;
+	text.Free();
+
+	if(!parsed)
+	{
+		CON_ERROR("Failed to parse bench save");
+		com::FreeJSON(root);
+		return;
+	}
+
+	// Query
+	size_t numFound = 0;
+	startTime = wrp::MicroTime();
+
+	if(com::JSVar* entities = root.Object()->Value("entities"))
+	{
+		for(size_t i = 0; i < numEnts; i++)
+		{
+			char id[16];
+			com::SNPrintF(id, sizeof(id), 0, "%u", (unsigned)(com::BenchRand(seed) % numEnts) + 1);
+			com::JSVar* ent = entities->Object()->Value(id);
+
+			if(ent && ent->Object()->Find("type") && ent->Object()->Find("pos"))
+				numFound++;
+		}
+	}
+
+	unsigned long long queryTime = wrp::MicroTime() - startTime;
+
+	// Free
+	startTime = wrp::MicroTime();
+	com::FreeJSON(root);
+	unsigned long long freeTime = wrp::MicroTime() - startTime;
+
+	con::LogF("\tparse %g ms, query %g ms (%u/%u found), free %g ms", parseTime * 0.001,
+		queryTime * 0.001, (unsigned)numFound, (unsigned)numEnts, freeTime * 0.001);
 }
\ No newline at end of file
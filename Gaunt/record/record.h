@@ -15,8 +15,16 @@ namespace rec
 ################################################################################################
 */
 
-void RequestSave(const char* filePath, bool neat = false);
-bool Saving();
+enum save_format
+{
+	SAVE_JSON,
+	SAVE_BINARY,
+	SAVE_BINARY_LZ
+};
+
+void RequestSave(const char* filePath, bool neat = false, save_format format = SAVE_JSON);
+void RequestAutosave(const char* filePath, save_format format = SAVE_BINARY_LZ);
+bool Saving(float* progressOut = 0);
 
 /*
 ################################################################################################
@@ -26,6 +34,7 @@ bool Saving();
 
 void RequestLoad(const char* filePath);
 bool Loading();
+void EditTranscripts();
 
 /*
 ################################################################################################
@@ -43,6 +52,7 @@ void SaveEdits(const com::JSVar& edits);
 
 void		Init();
 void		Update();
+void		CleanUp();
 const char*	CurrentLevel();
 
 }
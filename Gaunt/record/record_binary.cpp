@@ -0,0 +1,1090 @@
+// record_binary.cpp -- Binary record format
+// Martynas Ceicys
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "record.h"
+#include "record_private.h"
+#include "../console/console.h"
+#include "../../GauntCommon/math.h"
+#include "../mod/mod.h"
+#include "../wrap/wrap.h"
+
+/*
+Layout, little-endian:
+	"GREC", u8 version, u8 flags, u16 0, u32 payload size, u32 stored size, stored bytes
+
+The payload is a string table followed by the root value. The table is a varuint count and then,
+for each string, a varuint length, the bytes, and a terminating 0 so strings can be used in
+place. Every object key and string value is an index into the table. Values start with a
+binary_tag byte. Integral numbers are zigzag varuints, numbers a float holds exactly are floats,
+and the rest are doubles, so JSON written from a loaded tree matches JSON written from the saved
+tree.
+
+If REC_BINARY_LZ is set, the payload is stored compressed as LZ4-style sequences: a token with
+the literal count in the high nibble and match length - 4 in the low, 255-continued extra
+lengths, the literals, then a 16-bit match offset. The last sequence only has literals.
+*/
+
+#define REC_BINARY_VERSION 1
+#define REC_BINARY_HEADER_SIZE 16
+#define REC_BINARY_LZ 1
+#define REC_BINARY_MAX_EXPANSION 255 // LZ length bytes add at most 255 payload bytes each
+
+#define LZ_MIN_MATCH 4
+#define LZ_END_LITERALS 5 // The last bytes are never part of a match
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+#define DEFAULT_BINARY_STACK_SIZE 8
+
+namespace rec
+{
+	enum binary_tag
+	{
+		BIN_NONE,
+		BIN_FALSE,
+		BIN_TRUE,
+		BIN_INT,
+		BIN_FLOAT,
+		BIN_DOUBLE,
+		BIN_STRING,
+		BIN_ARRAY,
+		BIN_OBJECT
+	};
+
+	struct binary_writer
+	{
+		com::Arr<unsigned char>	buf;
+		size_t					len;
+		com::PairMap<size_t>	strings; // Value is table index
+		volatile size_t*		numWritten; // Optional, incremented per value in each pass
+	};
+
+	struct binary_reader
+	{
+		const unsigned char	*c, *end;
+		char**				strings;
+		size_t				numStrings;
+		bool				failed;
+	};
+
+	struct binary_write_node
+	{
+		const com::JSVar* parent;
+
+		union
+		{
+			const com::Pair<com::JSVar>* pair;
+			size_t elem;
+		};
+	};
+
+	struct binary_read_node
+	{
+		com::JSVar*	parent;
+		size_t		numLeft;
+		size_t		elem;
+	};
+
+	// WRITE
+	void	WriteBinaryTree(const com::JSVar& root, binary_writer& wIO, bool collect);
+	void	WriteBinaryValue(const com::JSVar& var, binary_writer& wIO, bool collect,
+			com::Arr<binary_write_node>& stackIO, size_t& numNodesIO);
+	void	WriteBinaryString(binary_writer& wIO, const char* str, bool collect);
+	void	WriteBytes(binary_writer& wIO, const void* bytes, size_t num);
+	void	WriteVarUInt(binary_writer& wIO, unsigned long long u);
+	void	WriteU32(unsigned char* dest, uint32_t u);
+
+	// READ
+	bool	ReadBinaryTree(binary_reader& rIO, com::Arena& arena, com::JSVar& rootOut);
+	bool	ReadBinaryValue(binary_reader& rIO, com::Arena& arena, com::JSVar& varOut,
+			com::Arr<binary_read_node>& stackIO, size_t& numNodesIO);
+	unsigned char		ReadByte(binary_reader& rIO);
+	unsigned long long	ReadVarUInt(binary_reader& rIO);
+	const char*			ReadBinaryString(binary_reader& rIO);
+	uint32_t			ReadU32(const unsigned char* src);
+	long				BytesLeft(FILE* file);
+
+	// LZ
+	size_t	LZBound(size_t len);
+	size_t	CompressLZ(const unsigned char* src, size_t len, unsigned char* dest);
+	bool	DecompressLZ(const unsigned char* src, size_t srcLen, unsigned char* dest,
+			size_t destLen);
+	void	WriteLZSequence(unsigned char*& dIO, const unsigned char* lit, size_t numLit,
+			size_t offset, size_t matchLen);
+	void	WriteLZLength(unsigned char*& dIO, size_t len);
+	bool	ReadLZLength(const unsigned char*& sIO, const unsigned char* end, size_t& lenIO);
+	uint32_t Read32(const unsigned char* src);
+
+	// BINARY LUA
+	const char*	BenchWriteFile(const com::JSVar& root, save_format format, size_t& sizeOut,
+				unsigned long long& microOut);
+	bool		BenchReadFile(save_format format, com::JSDoc& docOut,
+				unsigned long long& microOut);
+	bool		SameFileContents(const char* pathA, const char* pathB);
+}
+
+#define BENCH_JSON_PATH "rec_bench.json"
+#define BENCH_BINARY_PATH "rec_bench.grec"
+#define BENCH_ROUND_TRIP_PATH "rec_bench_round_trip.json"
+
+/*
+################################################################################################
+
+
+	BINARY WRITE
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::WriteBinaryRecord
+
+Returns false if the file could not be written. If numWrittenIO is given, it's incremented for
+each value in both passes over root, so it ends at twice the number of values.
+--------------------------------------*/
+bool rec::WriteBinaryRecord(const com::JSVar& root, FILE* file, bool compress,
+	volatile size_t* numWrittenIO)
+{
+	binary_writer w;
+	w.buf.Init(REC_DEFAULT_BUFFER_SIZE);
+	w.len = 0;
+	w.numWritten = numWrittenIO;
+
+	// String table
+	WriteBinaryTree(root, w, true);
+	WriteVarUInt(w, w.strings.Num());
+
+	for(const com::Pair<size_t>* it = w.strings.First(); it; it = it->Next())
+	{
+		size_t len = strlen(it->Key());
+		WriteVarUInt(w, len);
+		WriteBytes(w, it->Key(), len + 1);
+	}
+
+	// Values
+	WriteBinaryTree(root, w, false);
+
+	unsigned char header[REC_BINARY_HEADER_SIZE] = {'G', 'R', 'E', 'C', REC_BINARY_VERSION};
+	const unsigned char* stored = w.buf.o;
+	size_t storedLen = w.len;
+	com::Arr<unsigned char> packed;
+
+	if(compress)
+	{
+		packed.Init(LZBound(w.len));
+		size_t packedLen = CompressLZ(w.buf.o, w.len, packed.o);
+
+		if(packedLen < w.len)
+		{
+			header[5] = REC_BINARY_LZ;
+			stored = packed.o;
+			storedLen = packedLen;
+		}
+	}
+
+	WriteU32(header + 8, (uint32_t)w.len);
+	WriteU32(header + 12, (uint32_t)storedLen);
+
+	bool written = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+		fwrite(stored, 1, storedLen, file) == storedLen;
+
+	w.buf.Free();
+	packed.Free();
+	return written;
+}
+
+/*--------------------------------------
+	rec::WriteBinaryTree
+
+If collect is true, only adds keys and strings to wIO's table. Otherwise writes values.
+--------------------------------------*/
+void rec::WriteBinaryTree(const com::JSVar& root, binary_writer& w, bool collect)
+{
+	com::Arr<binary_write_node> stack(DEFAULT_BINARY_STACK_SIZE);
+	size_t numNodes = 0;
+
+	WriteBinaryValue(root, w, collect, stack, numNodes);
+
+	while(numNodes)
+	{
+		binary_write_node& node = stack[numNodes - 1];
+		const com::JSVar& parent = *node.parent;
+
+		if(parent.Type() == com::JSVar::OBJECT)
+		{
+			if(const com::Pair<com::JSVar>* pair = node.pair)
+			{
+				node.pair = pair->Next();
+				WriteBinaryString(w, pair->Key(), collect);
+				WriteBinaryValue(pair->Value(), w, collect, stack, numNodes);
+			}
+			else
+				numNodes--;
+		}
+		else
+		{
+			if(node.elem < parent.NumElems())
+			{
+				const com::JSVar& child = (*parent.Array())[node.elem++];
+				WriteBinaryValue(child, w, collect, stack, numNodes);
+			}
+			else
+				numNodes--;
+		}
+	}
+
+	stack.Free();
+}
+
+/*--------------------------------------
+	rec::WriteBinaryValue
+
+Containers get their tag and count written and are pushed onto stackIO.
+--------------------------------------*/
+void rec::WriteBinaryValue(const com::JSVar& var, binary_writer& w, bool collect,
+	com::Arr<binary_write_node>& stack, size_t& numNodes)
+{
+	unsigned char tag = BIN_NONE;
+
+	if(w.numWritten)
+		(*w.numWritten)++;
+
+	switch(var.Type())
+	{
+	case com::JSVar::NUMBER:
+	{
+		double d = var.Double();
+		float f = (float)d;
+
+		// -0 isn't integral as far as the format is concerned
+		if(fabs(d) <= 9007199254740992.0 && d == (double)(long long)d && (d || 1.0 / d > 0.0))
+		{
+			long long i = (long long)d;
+			tag = BIN_INT;
+
+			if(!collect)
+			{
+				WriteBytes(w, &tag, 1);
+				WriteVarUInt(w, ((unsigned long long)i << 1) ^ (unsigned long long)(i >> 63));
+			}
+		}
+		else if((double)f == d)
+		{
+			tag = BIN_FLOAT;
+
+			if(!collect)
+			{
+				uint32_t u;
+				memcpy(&u, &f, sizeof(u));
+				unsigned char bytes[5] = {tag};
+				WriteU32(bytes + 1, u);
+				WriteBytes(w, bytes, sizeof(bytes));
+			}
+		}
+		else
+		{
+			tag = BIN_DOUBLE;
+
+			if(!collect)
+			{
+				unsigned long long u;
+				memcpy(&u, &d, sizeof(u));
+				unsigned char bytes[9] = {tag};
+				WriteU32(bytes + 1, (uint32_t)u);
+				WriteU32(bytes + 5, (uint32_t)(u >> 32));
+				WriteBytes(w, bytes, sizeof(bytes));
+			}
+		}
+
+		return;
+	}
+	case com::JSVar::BOOLEAN:
+		tag = var.Bool() ? BIN_TRUE : BIN_FALSE;
+		break;
+	case com::JSVar::STRING:
+		tag = BIN_STRING;
+
+		if(!collect)
+			WriteBytes(w, &tag, 1);
+
+		WriteBinaryString(w, var.String(), collect);
+		return;
+	case com::JSVar::ARRAY:
+		tag = BIN_ARRAY;
+		break;
+	case com::JSVar::OBJECT:
+		tag = BIN_OBJECT;
+		break;
+	}
+
+	if(!collect)
+		WriteBytes(w, &tag, 1);
+
+	if(tag == BIN_ARRAY || tag == BIN_OBJECT)
+	{
+		if(!collect)
+			WriteVarUInt(w, tag == BIN_ARRAY ? var.NumElems() : var.Object()->Num());
+
+		stack.Ensure(numNodes + 1);
+		binary_write_node& node = stack[numNodes++];
+		node.parent = &var;
+
+		if(tag == BIN_ARRAY)
+			node.elem = 0;
+		else
+			node.pair = var.Object()->First();
+	}
+}
+
+/*--------------------------------------
+	rec::WriteBinaryString
+--------------------------------------*/
+void rec::WriteBinaryString(binary_writer& w, const char* str, bool collect)
+{
+	if(collect)
+	{
+		size_t num = w.strings.Num();
+		com::Pair<size_t>* pair = w.strings.Ensure(str);
+
+		if(w.strings.Num() != num)
+			pair->Value() = num;
+	}
+	else
+		WriteVarUInt(w, *w.strings.Value(str));
+}
+
+/*--------------------------------------
+	rec::WriteBytes
+--------------------------------------*/
+void rec::WriteBytes(binary_writer& w, const void* bytes, size_t num)
+{
+	w.buf.Ensure(w.len + num);
+	memcpy(w.buf.o + w.len, bytes, num);
+	w.len += num;
+}
+
+/*--------------------------------------
+	rec::WriteVarUInt
+--------------------------------------*/
+void rec::WriteVarUInt(binary_writer& w, unsigned long long u)
+{
+	unsigned char bytes[10];
+	size_t num = 0;
+
+	for(; u >= 0x80; u >>= 7)
+		bytes[num++] = (unsigned char)(u | 0x80);
+
+	bytes[num++] = (unsigned char)u;
+	WriteBytes(w, bytes, num);
+}
+
+/*--------------------------------------
+	rec::WriteU32
+--------------------------------------*/
+void rec::WriteU32(unsigned char* dest, uint32_t u)
+{
+	dest[0] = (unsigned char)u;
+	dest[1] = (unsigned char)(u >> 8);
+	dest[2] = (unsigned char)(u >> 16);
+	dest[3] = (unsigned char)(u >> 24);
+}
+
+/*
+################################################################################################
+
+
+	BINARY READ
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::BinaryRecordFile
+
+Returns true if file starts like a binary record. Leaves the file position where it was.
+--------------------------------------*/
+bool rec::BinaryRecordFile(FILE* file)
+{
+	long pos = ftell(file);
+	char magic[4];
+	bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+		!memcmp(magic, "GREC", sizeof(magic));
+
+	fseek(file, pos, SEEK_SET);
+	return binary;
+}
+
+/*--------------------------------------
+	rec::ReadBinaryRecord
+
+Reads a binary record from file into docOut's arena. Strings point into the decoded payload. On
+failure, returns false and sets errOut.
+--------------------------------------*/
+bool rec::ReadBinaryRecord(FILE* file, com::JSDoc& doc, const char*& errOut)
+{
+	com::JSVar* root;
+	com::Arena& arena = doc.Reset(root);
+	unsigned char header[REC_BINARY_HEADER_SIZE];
+
+	if(fread(header, 1, sizeof(header), file) != sizeof(header) ||
+	memcmp(header, "GREC", 4))
+	{
+		errOut = "Not a binary record";
+		return false;
+	}
+
+	if(header[4] != REC_BINARY_VERSION)
+	{
+		errOut = "Unsupported binary record version";
+		return false;
+	}
+
+	size_t payloadLen = ReadU32(header + 8), storedLen = ReadU32(header + 12);
+	bool compressed = (header[5] & REC_BINARY_LZ) != 0;
+
+	// Sizes come from the file, so check them before allocating
+	long numLeft = BytesLeft(file);
+
+	if((!compressed && storedLen != payloadLen) || numLeft < 0 ||
+	storedLen > (unsigned long)numLeft || payloadLen / REC_BINARY_MAX_EXPANSION > storedLen ||
+	payloadLen + 1 < payloadLen)
+	{
+		errOut = "Bad binary record sizes";
+		return false;
+	}
+
+	unsigned char* payload = (unsigned char*)arena.Alloc(payloadLen + 1);
+
+	if(!payload)
+	{
+		errOut = "Not enough memory for binary record";
+		return false;
+	}
+
+	if(compressed)
+	{
+		com::Arr<unsigned char> stored(storedLen + 1);
+		bool decoded = fread(stored.o, 1, storedLen, file) == storedLen &&
+			DecompressLZ(stored.o, storedLen, payload, payloadLen);
+
+		stored.Free();
+
+		if(!decoded)
+		{
+			errOut = "Corrupt compressed binary record";
+			return false;
+		}
+	}
+	else if(fread(payload, 1, payloadLen, file) != payloadLen)
+	{
+		errOut = "Truncated binary record";
+		return false;
+	}
+
+	binary_reader r = {payload, payload + payloadLen, 0, 0, false};
+
+	if(!ReadBinaryTree(r, arena, *root))
+	{
+		errOut = "Corrupt binary record";
+		return false;
+	}
+
+	return true;
+}
+
+/*--------------------------------------
+	rec::BytesLeft
+
+Returns the number of bytes after the file position, or -1 if the file can't seek. Leaves the
+file position where it was.
+--------------------------------------*/
+long rec::BytesLeft(FILE* file)
+{
+	long pos = ftell(file);
+
+	if(pos < 0 || fseek(file, 0, SEEK_END))
+		return -1;
+
+	long end = ftell(file);
+	fseek(file, pos, SEEK_SET);
+	return end < pos ? -1 : end - pos;
+}
+
+/*--------------------------------------
+	rec::ReadBinaryTree
+--------------------------------------*/
+bool rec::ReadBinaryTree(binary_reader& r, com::Arena& arena, com::JSVar& root)
+{
+	// String table; the format terminates strings so they can be used in place
+	unsigned long long numStrings = ReadVarUInt(r);
+
+	if(r.failed || numStrings > (unsigned long long)(r.end - r.c))
+		return false;
+
+	r.strings = (char**)arena.Alloc(sizeof(char*) * ((size_t)numStrings + 1));
+
+	if(!r.strings)
+		return false;
+
+	r.numStrings = (size_t)numStrings;
+
+	for(size_t i = 0; i < numStrings; i++)
+	{
+		unsigned long long len = ReadVarUInt(r);
+
+		if(r.failed || len >= (unsigned long long)(r.end - r.c) || r.c[len])
+			return false;
+
+		r.strings[i] = (char*)r.c;
+		r.c += len + 1;
+	}
+
+	// Values
+	com::Arr<binary_read_node> stack(DEFAULT_BINARY_STACK_SIZE);
+	size_t numNodes = 0;
+	bool success = ReadBinaryValue(r, arena, root, stack, numNodes);
+
+	while(success && numNodes)
+	{
+		binary_read_node& node = stack[numNodes - 1];
+
+		if(!node.numLeft)
+		{
+			numNodes--;
+			continue;
+		}
+
+		node.numLeft--;
+		com::JSVar& parent = *node.parent;
+
+		if(parent.Type() == com::JSVar::OBJECT)
+		{
+			const char* key = ReadBinaryString(r);
+
+			if(!key)
+				success = false;
+			else
+			{
+				com::JSVar& child = parent.Object()->EnsureBorrowed(key)->Value();
+				success = ReadBinaryValue(r, arena, child, stack, numNodes);
+			}
+		}
+		else
+		{
+			com::JSVar& child = (*parent.Array())[node.elem++];
+			success = ReadBinaryValue(r, arena, child, stack, numNodes);
+		}
+	}
+
+	stack.Free();
+	return success && r.c == r.end;
+}
+
+/*--------------------------------------
+	rec::ReadBinaryValue
+--------------------------------------*/
+bool rec::ReadBinaryValue(binary_reader& r, com::Arena& arena, com::JSVar& var,
+	com::Arr<binary_read_node>& stack, size_t& numNodes)
+{
+	unsigned char tag = ReadByte(r);
+
+	if(r.failed)
+		return false;
+
+	switch(tag)
+	{
+	case BIN_NONE:
+		var.Free();
+		return true;
+	case BIN_FALSE:
+	case BIN_TRUE:
+		var.SetBool(tag == BIN_TRUE);
+		return true;
+	case BIN_INT:
+	{
+		unsigned long long u = ReadVarUInt(r);
+		var.SetNumber((double)((long long)(u >> 1) ^ -(long long)(u & 1)));
+		return !r.failed;
+	}
+	case BIN_FLOAT:
+	{
+		if(r.end - r.c < 4)
+			return false;
+
+		uint32_t u = ReadU32(r.c);
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		r.c += 4;
+		var.SetNumber(f);
+		return true;
+	}
+	case BIN_DOUBLE:
+	{
+		if(r.end - r.c < 8)
+			return false;
+
+		unsigned long long u = ReadU32(r.c) | (unsigned long long)ReadU32(r.c + 4) << 32;
+		double d;
+		memcpy(&d, &u, sizeof(d));
+		r.c += 8;
+		var.SetNumber(d);
+		return true;
+	}
+	case BIN_STRING:
+	{
+		const char* str = ReadBinaryString(r);
+
+		if(!str)
+			return false;
+
+		var.SetArenaString((char*)str);
+		return true;
+	}
+	case BIN_ARRAY:
+	case BIN_OBJECT:
+	{
+		// Every value takes at least a byte, which bounds the count
+		unsigned long long num = ReadVarUInt(r);
+
+		if(r.failed || num > (unsigned long long)(r.end - r.c))
+			return false;
+
+		if(tag == BIN_ARRAY)
+		{
+			var.SetArenaArray(arena);
+			var.EnsureArenaElems(arena, (size_t)num);
+			var.SetNumElems((size_t)num);
+		}
+		else
+			var.SetArenaObject(arena);
+
+		stack.Ensure(numNodes + 1);
+		binary_read_node& node = stack[numNodes++];
+		node.parent = &var;
+		node.numLeft = (size_t)num;
+		node.elem = 0;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/*--------------------------------------
+	rec::ReadByte
+--------------------------------------*/
+unsigned char rec::ReadByte(binary_reader& r)
+{
+	if(r.c == r.end)
+	{
+		r.failed = true;
+		return 0;
+	}
+
+	return *r.c++;
+}
+
+/*--------------------------------------
+	rec::ReadVarUInt
+--------------------------------------*/
+unsigned long long rec::ReadVarUInt(binary_reader& r)
+{
+	unsigned long long u = 0;
+
+	for(unsigned shift = 0; shift < 64; shift += 7)
+	{
+		unsigned char b = ReadByte(r);
+		u |= (unsigned long long)(b & 0x7f) << shift;
+
+		if(!(b & 0x80))
+			return u;
+	}
+
+	r.failed = true;
+	return 0;
+}
+
+/*--------------------------------------
+	rec::ReadBinaryString
+
+Returns 0 if the index is bad.
+--------------------------------------*/
+const char* rec::ReadBinaryString(binary_reader& r)
+{
+	unsigned long long index = ReadVarUInt(r);
+
+	if(r.failed || index >= r.numStrings)
+		return 0;
+
+	return r.strings[(size_t)index];
+}
+
+/*--------------------------------------
+	rec::ReadU32
+--------------------------------------*/
+uint32_t rec::ReadU32(const unsigned char* src)
+{
+	return src[0] | (uint32_t)src[1] << 8 | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+/*
+################################################################################################
+
+
+	LZ
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::LZBound
+
+Largest possible CompressLZ output for len bytes.
+--------------------------------------*/
+size_t rec::LZBound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+/*--------------------------------------
+	rec::CompressLZ
+
+Greedy matching against a hash of the last position each 4-byte sequence was seen. dest must fit
+LZBound(len) bytes. Returns the compressed size.
+--------------------------------------*/
+size_t rec::CompressLZ(const unsigned char* src, size_t len, unsigned char* dest)
+{
+	com::Arr<uint32_t> table(1 << LZ_HASH_BITS, UINT32_MAX);
+	unsigned char* d = dest;
+	size_t anchor = 0, i = 0;
+	size_t limit = len > LZ_END_LITERALS + LZ_MIN_MATCH ? len - LZ_END_LITERALS - LZ_MIN_MATCH : 0;
+
+	while(i < limit)
+	{
+		uint32_t seq = Read32(src + i);
+		uint32_t& slot = table[(seq * 2654435761u) >> (32 - LZ_HASH_BITS)];
+		size_t cand = slot;
+		slot = (uint32_t)i;
+
+		if(cand >= i || i - cand > LZ_MAX_OFFSET || Read32(src + cand) != seq)
+		{
+			i++;
+			continue;
+		}
+
+		size_t matchLen = LZ_MIN_MATCH, maxLen = len - LZ_END_LITERALS - i;
+
+		while(matchLen < maxLen && src[cand + matchLen] == src[i + matchLen])
+			matchLen++;
+
+		WriteLZSequence(d, src + anchor, i - anchor, i - cand, matchLen);
+		i += matchLen;
+		anchor = i;
+	}
+
+	WriteLZSequence(d, src + anchor, len - anchor, 0, 0);
+	table.Free();
+	return d - dest;
+}
+
+/*--------------------------------------
+	rec::DecompressLZ
+
+Returns false if src is malformed or doesn't decode to exactly destLen bytes.
+--------------------------------------*/
+bool rec::DecompressLZ(const unsigned char* src, size_t srcLen, unsigned char* dest,
+	size_t destLen)
+{
+	const unsigned char *s = src, *sEnd = src + srcLen;
+	unsigned char *d = dest, *dEnd = dest + destLen;
+
+	while(s < sEnd)
+	{
+		unsigned token = *s++;
+		size_t numLit = token >> 4;
+
+		if(numLit == 15 && !ReadLZLength(s, sEnd, numLit))
+			return false;
+
+		if(numLit > (size_t)(sEnd - s) || numLit > (size_t)(dEnd - d))
+			return false;
+
+		memcpy(d, s, numLit);
+		d += numLit;
+		s += numLit;
+
+		if(s == sEnd)
+			break; // Last sequence
+
+		if(sEnd - s < 2)
+			return false;
+
+		size_t offset = s[0] | (size_t)s[1] << 8;
+		s += 2;
+		size_t matchLen = token & 15;
+
+		if(matchLen == 15 && !ReadLZLength(s, sEnd, matchLen))
+			return false;
+
+		matchLen += LZ_MIN_MATCH;
+
+		if(!offset || offset > (size_t)(d - dest) || matchLen > (size_t)(dEnd - d))
+			return false;
+
+		// Byte by byte since the match may overlap what it's writing
+		const unsigned char* m = d - offset;
+
+		for(size_t k = 0; k < matchLen; k++)
+			d[k] = m[k];
+
+		d += matchLen;
+	}
+
+	return d == dEnd;
+}
+
+/*--------------------------------------
+	rec::WriteLZSequence
+--------------------------------------*/
+void rec::WriteLZSequence(unsigned char*& d, const unsigned char* lit, size_t numLit,
+	size_t offset, size_t matchLen)
+{
+	unsigned char* token = d++;
+	*token = (unsigned char)(com::Min(numLit, (size_t)15) << 4);
+
+	if(numLit >= 15)
+		WriteLZLength(d, numLit - 15);
+
+	memcpy(d, lit, numLit);
+	d += numLit;
+
+	if(!matchLen)
+		return;
+
+	*d++ = (unsigned char)offset;
+	*d++ = (unsigned char)(offset >> 8);
+	size_t extra = matchLen - LZ_MIN_MATCH;
+	*token |= (unsigned char)com::Min(extra, (size_t)15);
+
+	if(extra >= 15)
+		WriteLZLength(d, extra - 15);
+}
+
+/*--------------------------------------
+	rec::WriteLZLength
+--------------------------------------*/
+void rec::WriteLZLength(unsigned char*& d, size_t len)
+{
+	for(; len >= 255; len -= 255)
+		*d++ = 255;
+
+	*d++ = (unsigned char)len;
+}
+
+/*--------------------------------------
+	rec::ReadLZLength
+--------------------------------------*/
+bool rec::ReadLZLength(const unsigned char*& s, const unsigned char* end, size_t& len)
+{
+	unsigned char b;
+
+	do
+	{
+		if(s == end)
+			return false;
+
+		b = *s++;
+		len += b;
+	} while(b == 255);
+
+	return true;
+}
+
+/*--------------------------------------
+	rec::Read32
+--------------------------------------*/
+uint32_t rec::Read32(const unsigned char* src)
+{
+	uint32_t u;
+	memcpy(&u, src, sizeof(u));
+	return u;
+}
+
+/*
+################################################################################################
+
+
+	BINARY LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	rec::BenchSaveFormats (rec_bench_save_formats)
+
+IN	[iNumEnts = 20000 | sFilePath]
+
+Saves a tree as compact JSON, binary, and compressed binary in the working directory, and loads
+each back the way rec::Load does. Logs write time, load time, and file size for each. The tree is
+either synthetic with iNumEnts entities or parsed from the save at sFilePath. Binary loads are
+written back out as JSON and compared to the JSON save to check the round trip is lossless.
+--------------------------------------*/
+int rec::BenchSaveFormats(lua_State* l)
+{
+	com::JSDoc src;
+
+	if(lua_type(l, 1) == LUA_TSTRING)
+	{
+		const char* err = 0;
+		FILE* file = mod::FOpen(0, lua_tostring(l, 1), "rb", err);
+		bool parsed = false;
+
+		if(file)
+		{
+			parsed = BinaryRecordFile(file) ? ReadBinaryRecord(file, src, err) :
+				src.ParseFile(file);
+
+			fclose(file);
+		}
+
+		if(!parsed)
+		{
+			CON_ERRORF("Failed to read '%s'", lua_tostring(l, 1));
+			return 0;
+		}
+	}
+	else
+	{
+		lua_Integer numEnts = luaL_optinteger(l, 1, 20000);
+		uint32_t seed = 1;
+
+		if(numEnts <= 0)
+			return 0;
+
+		com::Arr<char> text;
+		WriteBenchSave(numEnts, seed, text);
+		src.Parse(text.o);
+		text.Free();
+	}
+
+	static const char* const NAMES[] = {"json", "binary", "lz"};
+
+	for(int f = SAVE_JSON; f <= SAVE_BINARY_LZ; f++)
+	{
+		save_format format = (save_format)f;
+		size_t size;
+		unsigned long long writeTime, readTime;
+
+		if(const char* path = BenchWriteFile(src.Root(), format, size, writeTime))
+		{
+			com::JSDoc loaded;
+			bool read = BenchReadFile(format, loaded, readTime);
+			const char* check = "";
+
+			if(read && format != SAVE_JSON)
+			{
+				// Round trip
+				if(FILE* file = fopen(BENCH_ROUND_TRIP_PATH, "w"))
+				{
+					com::WriteJSON(loaded.Root(), file, 0, false);
+					fclose(file);
+					check = SameFileContents(BENCH_JSON_PATH, BENCH_ROUND_TRIP_PATH) ?
+						", lossless" : ", MISMATCH";
+				}
+			}
+
+			con::LogF("%-6s write %g ms, load %g ms%s, %u KB%s", NAMES[f], writeTime * 0.001,
+				readTime * 0.001, read ? "" : " (failed)", (unsigned)(size / 1024), check);
+		}
+		else
+			CON_ERROR("Failed to write bench file");
+	}
+
+	remove(BENCH_JSON_PATH);
+	remove(BENCH_BINARY_PATH);
+	remove(BENCH_ROUND_TRIP_PATH);
+	return 0;
+}
+
+/*--------------------------------------
+	rec::BenchWriteFile
+
+Writes root the way rec::Save does. Returns the file's path, or 0 on failure.
+--------------------------------------*/
+const char* rec::BenchWriteFile(const com::JSVar& root, save_format format, size_t& sizeOut,
+	unsigned long long& microOut)
+{
+	const char* path = format == SAVE_JSON ? BENCH_JSON_PATH : BENCH_BINARY_PATH;
+	unsigned long long startTime = wrp::MicroTime();
+	FILE* file = fopen(path, format == SAVE_JSON ? "w" : "wb");
+
+	if(!file)
+		return 0;
+
+	bool written = true;
+
+	if(format == SAVE_JSON)
+		com::WriteJSON(root, file, 0, false);
+	else
+		written = WriteBinaryRecord(root, file, format == SAVE_BINARY_LZ);
+
+	sizeOut = ftell(file);
+	fclose(file);
+	microOut = wrp::MicroTime() - startTime;
+	return written ? path : 0;
+}
+
+/*--------------------------------------
+	rec::BenchReadFile
+--------------------------------------*/
+bool rec::BenchReadFile(save_format format, com::JSDoc& doc, unsigned long long& microOut)
+{
+	unsigned long long startTime = wrp::MicroTime();
+	FILE* file = fopen(format == SAVE_JSON ? BENCH_JSON_PATH : BENCH_BINARY_PATH, "rb");
+
+	if(!file)
+		return false;
+
+	const char* err;
+	bool read = BinaryRecordFile(file) ? ReadBinaryRecord(file, doc, err) : doc.ParseFile(file);
+	fclose(file);
+	microOut = wrp::MicroTime() - startTime;
+	return read;
+}
+
+/*--------------------------------------
+	rec::SameFileContents
+--------------------------------------*/
+bool rec::SameFileContents(const char* pathA, const char* pathB)
+{
+	FILE* a = fopen(pathA, "rb");
+	FILE* b = fopen(pathB, "rb");
+	bool same = a && b;
+
+	while(same)
+	{
+		char bufA[4096], bufB[4096];
+		size_t numA = fread(bufA, 1, sizeof(bufA), a), numB = fread(bufB, 1, sizeof(bufB), b);
+		same = numA == numB && !memcmp(bufA, bufB, numA);
+
+		if(!numA)
+			break;
+	}
+
+	if(a)
+		fclose(a);
+
+	if(b)
+		fclose(b);
+
+	return same;
+}
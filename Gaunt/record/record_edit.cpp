@@ -25,6 +25,8 @@ void rec::SaveEdits(const com::JSVar& edits)
 	if(!currentLevel)
 		return SAVE_EDITS_FAIL("No current level");
 
+	FinishSaves(); // Don't race a save to the same file
+
 	con::LogF("Saving edits on '%s'", currentLevel);
 
 	const char* pathErr = 0;
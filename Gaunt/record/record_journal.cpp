@@ -0,0 +1,601 @@
+// record_journal.cpp -- Delta autosaves
+// Martynas Ceicys
+
+#include <stdio.h>
+#include <string.h>
+
+#include "record.h"
+#include "record_private.h"
+#include "../console/console.h"
+#include "../../GauntCommon/math.h"
+#include "../wrap/wrap.h"
+
+/*
+A journaled save is a binary record with the full state followed by more binary records, each a
+journal entry holding the records that changed since the previous one. Loading reads the first
+record and applies the entries in order. Appends don't touch earlier bytes, so a crash while
+appending only loses the entry being written; loading stops at the first bad entry.
+*/
+
+#define BENCH_JOURNAL_PATH "rec_bench_journal.grec"
+
+namespace rec
+{
+	con::Option journalMaxEntries("rec_journal_max_entries", 32.0f, con::PositiveIntegerOnly);
+
+	// Committed state of the journaled file; only touched by the save writer
+	char*		journalPath = 0;
+	com::JSVar*	journalBase = 0;
+	size_t		numJournalEntries = 0, journalBytes = 0, journalBaseBytes = 0;
+
+	// JOURNAL
+	com::JSVar&	JournalSlot(com::Arena& arena, com::JSVar& entry, const char* section,
+				const char* key);
+	const char*	AppendJournalEntry(const char* filePath, const com::JSVar& entry, bool compress,
+				size_t expectedSize, size_t& bytesOut);
+	void		SetJournalBase(const char* filePath, com::JSVar*& rootIO, size_t baseBytes);
+
+	// JOURNAL LUA
+	void		MutateBenchEntities(com::JSObj& entities, size_t numTouches, size_t& nextIDIO,
+				uint32_t& seedIO);
+}
+
+/*
+################################################################################################
+
+
+	JOURNAL
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::WriteJournal
+
+If the last journaled save went to filePath and the journal isn't due for compaction, appends an
+entry with what changed between it and rootIO. Otherwise writes rootIO as a full save. Either
+way, rootIO becomes the journal's base and is set to 0. Returns an error string on failure, in
+which case rootIO is left alone. Only call from the save writer.
+--------------------------------------*/
+const char* rec::WriteJournal(const char* filePath, com::JSVar*& root, bool compress,
+	size_t maxEntries, save_progress* progress, journal_report& report)
+{
+	report.numChanges = report.numBytes = 0;
+	report.baseBytes = journalBaseBytes;
+	report.compacted = false;
+
+	if(journalPath && !strcmp(journalPath, filePath) && numJournalEntries < maxEntries &&
+	journalBytes < journalBaseBytes && root->Type() == com::JSVar::OBJECT)
+	{
+		com::Arena arena;
+		com::JSVar entry;
+		report.numChanges = BuildJournalEntry(*journalBase, *root, arena, entry);
+		const char* err = 0;
+
+		if(report.numChanges)
+		{
+			err = AppendJournalEntry(filePath, entry, compress, journalBaseBytes + journalBytes,
+				report.numBytes);
+		}
+
+		arena.Free();
+
+		if(!err)
+		{
+			numJournalEntries += report.numChanges != 0;
+			journalBytes += report.numBytes;
+			SetJournalBase(filePath, root, journalBaseBytes);
+			return 0;
+		}
+
+		// Rewrite the whole file so a partial entry or outside change doesn't break it
+	}
+
+	// Compact
+	ForgetJournal();
+
+	if(const char* err = WriteSaveFile(filePath, *root, compress ? SAVE_BINARY_LZ : SAVE_BINARY,
+	false, progress, &report.numBytes))
+		return err;
+
+	report.compacted = true;
+	report.baseBytes = report.numBytes;
+	SetJournalBase(filePath, root, report.numBytes);
+	numJournalEntries = journalBytes = 0;
+	return 0;
+}
+
+/*--------------------------------------
+	rec::ForgetJournal
+
+Frees the journal's base if filePath is 0 or the journaled file, so the next autosave to it is a
+full save. Only call from the save writer or when no save is being written.
+--------------------------------------*/
+void rec::ForgetJournal(const char* filePath)
+{
+	if(!journalPath || (filePath && strcmp(filePath, journalPath)))
+		return;
+
+	free(journalPath);
+	journalPath = 0;
+
+	if(journalBase)
+	{
+		com::FreeJSON(*journalBase);
+		delete journalBase;
+		journalBase = 0;
+	}
+
+	numJournalEntries = journalBytes = journalBaseBytes = 0;
+}
+
+/*--------------------------------------
+	rec::BuildJournalEntry
+
+Sets entryOut to what changed from base to root and returns the number of changed records. Every
+object in root is treated as a map of records; other values are records themselves. entryOut is
+laid out as:
+
+	"unset": {key: [record IDs] or true if the whole value is gone}
+	"replace": {key: value}
+	"set": {key: {record ID: record}}
+
+entryOut is allocated in arena and shares keys and values with base and root, so don't FreeJSON
+it; free arena when done, before changing base or root.
+--------------------------------------*/
+size_t rec::BuildJournalEntry(const com::JSVar& base, const com::JSVar& root, com::Arena& arena,
+	com::JSVar& entry)
+{
+	entry.SetArenaObject(arena);
+
+	const com::JSObj* baseObj = base.Object();
+	const com::JSObj* rootObj = root.Object();
+	size_t numChanges = 0;
+
+	if(!baseObj || !rootObj)
+		return 0;
+
+	for(const com::Pair<com::JSVar>* it = rootObj->First(); it; it = it->Next())
+	{
+		const com::JSVar* old = baseObj->Value(it->Key());
+		const com::JSVar& cur = it->Value();
+
+		if(old && old->Type() == com::JSVar::OBJECT && cur.Type() == com::JSVar::OBJECT)
+		{
+			for(const com::Pair<com::JSVar>* r = cur.Object()->First(); r; r = r->Next())
+			{
+				const com::JSVar* oldRecord = old->Object()->Value(r->Key());
+
+				if(oldRecord && SameJSVar(*oldRecord, r->Value()))
+					continue;
+
+				com::JSVar& records = JournalSlot(arena, entry, "set", it->Key());
+
+				if(records.Type() != com::JSVar::OBJECT)
+					records.SetArenaObject(arena);
+
+				records.Object()->EnsureBorrowed(r->Key())->Value() = r->Value(); // Shared
+				numChanges++;
+			}
+
+			for(const com::Pair<com::JSVar>* r = old->Object()->First(); r; r = r->Next())
+			{
+				if(cur.Object()->Find(r->Key()))
+					continue;
+
+				com::JSVar& ids = JournalSlot(arena, entry, "unset", it->Key());
+
+				if(ids.Type() != com::JSVar::ARRAY)
+					ids.SetArenaArray(arena);
+
+				size_t numIDs = ids.NumElems();
+				ids.EnsureArenaElems(arena, numIDs + 1);
+				ids.SetNumElems(numIDs + 1);
+				(*ids.Array())[numIDs].SetArenaString((char*)r->Key()); // Borrowed
+				numChanges++;
+			}
+		}
+		else if(!old || !SameJSVar(*old, cur))
+		{
+			JournalSlot(arena, entry, "replace", it->Key()) = cur; // Shared
+			numChanges++;
+		}
+	}
+
+	for(const com::Pair<com::JSVar>* it = baseObj->First(); it; it = it->Next())
+	{
+		if(rootObj->Find(it->Key()))
+			continue;
+
+		JournalSlot(arena, entry, "unset", it->Key()).SetBool(true);
+		numChanges++;
+	}
+
+	return numChanges;
+}
+
+/*--------------------------------------
+	rec::ApplyJournalEntry
+
+Applies an entry made by BuildJournalEntry. Changed values are copied into rootIO.
+--------------------------------------*/
+void rec::ApplyJournalEntry(com::JSVar& root, const com::JSVar& entry)
+{
+	com::JSObj* rootObj = root.Object();
+	const com::JSObj* entryObj = entry.Object();
+
+	if(!rootObj || !entryObj)
+		return;
+
+	const com::JSVar* unset = entryObj->Value("unset");
+	const com::JSVar* replace = entryObj->Value("replace");
+	const com::JSVar* set = entryObj->Value("set");
+
+	if(unset && unset->Type() == com::JSVar::OBJECT)
+	{
+		for(const com::Pair<com::JSVar>* it = unset->Object()->First(); it; it = it->Next())
+		{
+			com::Pair<com::JSVar>* target = rootObj->Find(it->Key());
+
+			if(!target)
+				continue;
+
+			const com::JSVar& ids = it->Value();
+			com::JSObj* records = target->Value().Object();
+
+			if(ids.Type() == com::JSVar::ARRAY && records)
+			{
+				for(size_t i = 0; i < ids.NumElems(); i++)
+				{
+					const char* id = (*ids.Array())[i].String();
+					com::Pair<com::JSVar>* record = id ? records->Find(id) : 0;
+
+					if(record)
+					{
+						com::FreeJSON(record->Value());
+						records->UnsetKey(*record);
+					}
+				}
+			}
+			else
+			{
+				com::FreeJSON(target->Value());
+				rootObj->UnsetKey(*target);
+			}
+		}
+	}
+
+	if(replace && replace->Type() == com::JSVar::OBJECT)
+	{
+		for(const com::Pair<com::JSVar>* it = replace->Object()->First(); it; it = it->Next())
+		{
+			com::JSVar& dest = rootObj->Ensure(it->Key())->Value();
+			com::FreeJSON(dest);
+			ApplyJSVarDiff(dest, it->Value());
+		}
+	}
+
+	if(set && set->Type() == com::JSVar::OBJECT)
+	{
+		for(const com::Pair<com::JSVar>* it = set->Object()->First(); it; it = it->Next())
+		{
+			if(it->Value().Type() != com::JSVar::OBJECT)
+				continue;
+
+			com::JSVar& records = rootObj->Ensure(it->Key())->Value();
+
+			if(records.Type() != com::JSVar::OBJECT)
+			{
+				com::FreeJSON(records);
+				records.SetObject();
+			}
+
+			const com::JSObj& src = *it->Value().Object();
+
+			for(const com::Pair<com::JSVar>* r = src.First(); r; r = r->Next())
+			{
+				com::JSVar& dest = records.Object()->Ensure(r->Key())->Value();
+				com::FreeJSON(dest);
+				ApplyJSVarDiff(dest, r->Value());
+			}
+		}
+	}
+}
+
+/*--------------------------------------
+	rec::ReplayJournal
+
+Reads journal entries from file's position until its end and applies them to rootIO. Returns the
+number applied. If an entry couldn't be read, stops there and sets errOut; otherwise sets it to
+0.
+--------------------------------------*/
+size_t rec::ReplayJournal(FILE* file, com::JSVar& root, const char*& errOut)
+{
+	com::JSDoc entryDoc;
+	size_t numEntries = 0;
+	errOut = 0;
+
+	while(!feof(file))
+	{
+		if(!BinaryRecordFile(file))
+		{
+			if(fgetc(file) != EOF)
+				errOut = "Unknown data after journal";
+
+			break;
+		}
+
+		if(!ReadBinaryRecord(file, entryDoc, errOut))
+			break;
+
+		ApplyJournalEntry(root, entryDoc.Root());
+		numEntries++;
+	}
+
+	entryDoc.Free();
+	return numEntries;
+}
+
+/*--------------------------------------
+	rec::JournalSlot
+
+Returns entry[section][key], creating section in arena if needed.
+--------------------------------------*/
+com::JSVar& rec::JournalSlot(com::Arena& arena, com::JSVar& entry, const char* section,
+	const char* key)
+{
+	com::JSVar& sec = entry.Object()->EnsureBorrowed(section)->Value();
+
+	if(sec.Type() != com::JSVar::OBJECT)
+		sec.SetArenaObject(arena);
+
+	return sec.Object()->EnsureBorrowed(key)->Value();
+}
+
+/*--------------------------------------
+	rec::AppendJournalEntry
+
+Fails without writing if the file isn't expectedSize bytes, which means it was changed by
+something else or an earlier append failed partway.
+--------------------------------------*/
+const char* rec::AppendJournalEntry(const char* filePath, const com::JSVar& entry,
+	bool compress, size_t expectedSize, size_t& bytesOut)
+{
+	bytesOut = 0;
+	FILE* file = fopen(filePath, "ab");
+
+	if(!file)
+		return "Failed to open file";
+
+	fseek(file, 0, SEEK_END);
+	long start = ftell(file);
+
+	if(start < 0 || (size_t)start != expectedSize)
+	{
+		fclose(file);
+		return "File changed outside the journal";
+	}
+
+	const char* err = 0;
+
+	if(!WriteBinaryRecord(entry, file, compress))
+		err = "Failed to write journal entry";
+	else if(!wrp::SyncFile(file))
+		err = "Failed to flush file";
+
+	long end = ftell(file);
+
+	if(fclose(file) && !err)
+		err = "Failed to close file";
+
+	bytesOut = end > start ? end - start : 0;
+	return err;
+}
+
+/*--------------------------------------
+	rec::SetJournalBase
+
+Takes rootIO, freeing the previous base, and sets it to 0.
+--------------------------------------*/
+void rec::SetJournalBase(const char* filePath, com::JSVar*& root, size_t baseBytes)
+{
+	if(!journalPath)
+	{
+		journalPath = (char*)malloc(sizeof(char) * (strlen(filePath) + 1));
+		strcpy(journalPath, filePath);
+	}
+
+	if(journalBase)
+	{
+		com::FreeJSON(*journalBase);
+		delete journalBase;
+	}
+
+	journalBase = root;
+	root = 0;
+	journalBaseBytes = baseBytes;
+}
+
+/*
+################################################################################################
+
+
+	JOURNAL LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	rec::BenchJournal (rec_bench_journal)
+
+IN	[iNumEnts = 20000], [nChurn = 0.05], [iNumSaves = 20], [iSeed = 1]
+
+Simulates a busy level autosaving to a journal in the working directory. Starts with a synthetic
+save of iNumEnts entities. Before each autosave after the first, touches nChurn of them: most
+move, some die, and some spawn. Logs the bytes each autosave wrote next to the full save's size,
+then loads the file, replays the journal, and checks the result matches the final state. Shares
+the journal with autosaves, so the next autosave will be a full save.
+--------------------------------------*/
+int rec::BenchJournal(lua_State* l)
+{
+	lua_Integer numEnts = luaL_optinteger(l, 1, 20000);
+	float churn = com::Clamp((float)luaL_optnumber(l, 2, 0.05), 0.0f, 1.0f);
+	lua_Integer numSaves = luaL_optinteger(l, 3, 20);
+	uint32_t seed = luaL_optinteger(l, 4, 1);
+
+	if(numEnts <= 0 || numSaves <= 0)
+		return 0;
+
+	FinishSaves(); // Journal state belongs to the writer
+	ForgetJournal();
+
+	com::Arr<char> text;
+	WriteBenchSave(numEnts, seed, text);
+	com::JSVar state;
+	bool parsed = com::ParseJSON(text.o, state);
+	text.Free();
+	com::JSVar* entities = parsed ? state.Object()->Value("entities") : 0;
+
+	if(!entities || entities->Type() != com::JSVar::OBJECT)
+	{
+		CON_ERROR("Failed to parse bench save");
+		com::FreeJSON(state);
+		return 0;
+	}
+
+	size_t maxEntries = (size_t)journalMaxEntries.Float();
+	size_t nextID = numEnts + 1, numEntries = 0, entryBytes = 0, fullBytes = 0;
+	bool failed = false;
+
+	for(lua_Integer s = 0; s < numSaves; s++)
+	{
+		if(s)
+		{
+			MutateBenchEntities(*entities->Object(),
+				(size_t)(entities->Object()->Num() * churn), nextID, seed);
+		}
+
+		// Autosaves take a fresh transcription each time
+		com::JSVar* snapshot = new com::JSVar;
+		ApplyJSVarDiff(*snapshot, state);
+
+		journal_report report;
+		unsigned long long startTime = wrp::MicroTime();
+		const char* err = WriteJournal(BENCH_JOURNAL_PATH, snapshot, true, maxEntries, 0,
+			report);
+
+		double ms = (wrp::MicroTime() - startTime) * 0.001;
+
+		if(snapshot)
+		{
+			com::FreeJSON(*snapshot);
+			delete snapshot;
+		}
+
+		if(err)
+		{
+			CON_ERRORF("Autosave %d failed: %s", (int)s, err);
+			failed = true;
+			break;
+		}
+
+		if(report.compacted)
+		{
+			fullBytes = report.numBytes;
+			con::LogF("%3d: full save, %.1f KB, %g ms", (int)s, report.numBytes / 1024.0, ms);
+		}
+		else
+		{
+			numEntries++;
+			entryBytes += report.numBytes;
+
+			con::LogF("%3d: %u changes, %.1f KB (%.1f%% of full), %g ms", (int)s,
+				(unsigned)report.numChanges, report.numBytes / 1024.0,
+				report.baseBytes ? report.numBytes * 100.0 / report.baseBytes : 0.0, ms);
+		}
+	}
+
+	if(numEntries)
+	{
+		con::LogF("Journal entries average %.1f KB, full saves %.1f KB",
+			entryBytes / 1024.0 / numEntries, fullBytes / 1024.0);
+	}
+
+	// Check the replay
+	if(!failed)
+	{
+		const char* err = "Failed to open file";
+		FILE* file = fopen(BENCH_JOURNAL_PATH, "rb");
+		com::JSDoc loaded;
+		size_t numReplayed = 0;
+
+		if(file && ReadBinaryRecord(file, loaded, err))
+			numReplayed = ReplayJournal(file, loaded.EditRoot(), err);
+
+		if(file)
+			fclose(file);
+
+		if(err)
+			CON_ERRORF("Failed to replay journal: %s", err);
+		else
+		{
+			con::LogF("Replayed %u entries, %s", (unsigned)numReplayed,
+				SameJSVar(loaded.Root(), state) ? "matches" : "MISMATCH");
+		}
+
+		loaded.Free();
+	}
+
+	com::FreeJSON(state);
+	ForgetJournal();
+	remove(BENCH_JOURNAL_PATH);
+	return 0;
+}
+
+/*--------------------------------------
+	rec::MutateBenchEntities
+
+Picks numTouches random entity IDs below nextIDIO. Of the ones still alive, 10% die, 10% spawn a
+copy of themselves with a new ID, and the rest move.
+--------------------------------------*/
+void rec::MutateBenchEntities(com::JSObj& entities, size_t numTouches, size_t& nextID,
+	uint32_t& seed)
+{
+	for(size_t i = 0; i < numTouches; i++)
+	{
+		uint32_t roll = com::BenchRand(seed) % 10;
+		char key[24];
+		size_t id = 1 + com::BenchRand(seed) % (nextID - 1);
+		com::SNPrintF(key, sizeof(key), 0, "%u", (unsigned)id);
+		com::Pair<com::JSVar>* ent = entities.Find(key);
+
+		if(!ent)
+			continue;
+
+		if(roll == 0)
+		{
+			com::FreeJSON(ent->Value());
+			entities.UnsetKey(*ent);
+		}
+		else if(roll == 1)
+		{
+			com::SNPrintF(key, sizeof(key), 0, "%u", (unsigned)nextID++);
+			ApplyJSVarDiff(entities.Ensure(key)->Value(), ent->Value());
+		}
+		else
+		{
+			com::JSVar* pos = ent->Value().Object() ? ent->Value().Object()->Value("pos") : 0;
+
+			if(!pos || pos->NumElems() != 3)
+				continue;
+
+			for(size_t j = 0; j < 3; j++)
+			{
+				com::JSVar& p = (*pos->Array())[j];
+				p.SetNumber(p.Double() + (com::BenchRandF(seed) - 0.5) * 64.0);
+			}
+		}
+	}
+}
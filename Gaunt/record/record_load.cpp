@@ -11,6 +11,7 @@
 #include "../path/path.h"
 #include "../render/render.h"
 #include "../scene/scene.h"
+#include "../wrap/wrap.h"
 
 namespace rec
 {
@@ -71,33 +72,56 @@ FIXME: Needs perfect clean-up in case of error.
 --------------------------------------*/
 void rec::Load()
 {
+	FinishSaves(); // Might be loading a file that's still being written
 	loading = true;
 	con::LogF("Loading '%s'", loadFilePath);
 	size_t pathLen = strlen(loadFilePath);
 	currentLevel = (char*)realloc(currentLevel, sizeof(char) * pathLen + 1);
 	strcpy(currentLevel, loadFilePath);
 
-	// Read whole file into buffer
+	// Read whole file into the document's arena and parse it in place
+	// Binary mode; the JSON parser treats carriage returns as whitespace
 	const char* err = 0;
-	FILE* file = mod::FOpen(0, loadFilePath, "r", err);
+	FILE* file = mod::FOpen(0, loadFilePath, "rb", err);
 
 	if(err)
 		return LoadFail(err, file);
 
-	com::Arr<char> buf(REC_DEFAULT_BUFFER_SIZE);
-	com::FReadAll(buf, file);
-	fclose(file);
-	file = 0;
+	if(BinaryRecordFile(file))
+	{
+		bool read = ReadBinaryRecord(file, lvlDoc, err);
+
+		if(read)
+		{
+			// Autosaves append journal entries after the full state
+			const char* journalErr;
+			size_t numEntries = ReplayJournal(file, lvlDoc.EditRoot(), journalErr);
+
+			if(numEntries)
+				con::LogF("Replayed %u journal entries", (unsigned)numEntries);
 
-	// Convert to JSVar
-	unsigned line;
-	bool parsed = com::ParseJSON(buf.o, lvlRoot, &line);
-	buf.Free();
+			if(journalErr)
+				con::AlertF("Ignored rest of journal (%s)", journalErr);
+		}
+
+		fclose(file);
+		file = 0;
 
-	if(!parsed)
+		if(!read)
+			return LoadFail(err, file);
+	}
+	else
 	{
-		con::AlertF("Invalid JSON ln %u", line);
-		return LoadFail(0, file);
+		unsigned line;
+		bool parsed = lvlDoc.ParseFile(file, &line);
+		fclose(file);
+		file = 0;
+
+		if(!parsed)
+		{
+			con::AlertF("Invalid JSON ln %u", line);
+			return LoadFail(0, file);
+		}
 	}
 
 	if(lvlRoot.Type() != com::JSVar::OBJECT)
@@ -130,7 +154,15 @@ void rec::Load()
 	aud::DeleteUnused();
 	rnd::DeleteUnused();
 	UnassignResourceTranscripts();
-	com::FreeJSON(lvlRoot);
+
+	// Only journal replays and transcript edits make the document walk its tree
+	bool edited = lvlDoc.Edited();
+	unsigned long long freeStart = wrp::MicroTime();
+	lvlDoc.Free();
+
+	con::LogF("Freed level document in %g ms (%s)", (wrp::MicroTime() - freeStart) * 0.001,
+		edited ? "walked tree" : "arena only");
+
 	free(loadFilePath);
 	loadFilePath = 0;
 	loading = false;
@@ -152,7 +184,7 @@ void rec::LoadFail(const char* str, FILE* file)
 		fclose(file);
 
 	UnassignResourceTranscripts();
-	com::FreeJSON(lvlRoot);
+	lvlDoc.Free();
 	free(currentLevel);
 	currentLevel = 0;
 	free(loadFilePath);
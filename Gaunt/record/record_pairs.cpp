@@ -1,6 +1,8 @@
 // record_pairs.cpp
 // Martynas Ceicys
 
+#include <string.h>
+
 #include "pairs.h"
 #include "../../GauntCommon/io.h"
 #include "../wrap/wrap.h"
@@ -178,6 +180,92 @@ bool rec::ApplyBasicJSVarDiff(com::JSVar& dest, const com::JSVar& src)
 	return false;
 }
 
+/*--------------------------------------
+	rec::SameJSVar
+
+Returns true if a and b hold the same values. Object key order is ignored. Numbers must match
+bit for bit, so nan equals nan but -0 doesn't equal 0.
+--------------------------------------*/
+bool rec::SameJSVar(const com::JSVar& a, const com::JSVar& b)
+{
+	com::Arr<const com::JSVar*> stack(DEFAULT_JSVAR_STACK_SIZE * 2); // Pairs to compare
+	stack[0] = &a;
+	stack[1] = &b;
+	size_t numNodes = 2;
+	bool same = true;
+
+	while(numNodes && same)
+	{
+		const com::JSVar& x = *stack[numNodes - 2];
+		const com::JSVar& y = *stack[numNodes - 1];
+		numNodes -= 2;
+
+		if(x.Type() != y.Type())
+		{
+			same = false;
+			break;
+		}
+
+		switch(x.Type())
+		{
+		case com::JSVar::NUMBER:
+		{
+			double dx = x.Double(), dy = y.Double();
+			same = !memcmp(&dx, &dy, sizeof(dx));
+			break;
+		}
+		case com::JSVar::BOOLEAN:
+			same = x.Bool() == y.Bool();
+			break;
+		case com::JSVar::STRING:
+			same = !strcmp(x.String(), y.String());
+			break;
+		case com::JSVar::ARRAY:
+			if(x.NumElems() != y.NumElems())
+			{
+				same = false;
+				break;
+			}
+
+			stack.Ensure(numNodes + x.NumElems() * 2);
+
+			for(size_t i = 0; i < x.NumElems(); i++)
+			{
+				stack[numNodes++] = &(*x.Array())[i];
+				stack[numNodes++] = &(*y.Array())[i];
+			}
+
+			break;
+		case com::JSVar::OBJECT:
+			if(x.Object()->Num() != y.Object()->Num())
+			{
+				same = false;
+				break;
+			}
+
+			for(const com::Pair<com::JSVar>* it = x.Object()->First(); it; it = it->Next())
+			{
+				const com::Pair<com::JSVar>* other = y.Object()->Find(it->Key());
+
+				if(!other)
+				{
+					same = false;
+					break;
+				}
+
+				stack.Ensure(numNodes + 2);
+				stack[numNodes++] = &it->Value();
+				stack[numNodes++] = &other->Value();
+			}
+
+			break;
+		}
+	}
+
+	stack.Free();
+	return same;
+}
+
 /*
 ################################################################################################
 
@@ -5,13 +5,16 @@
 #define RECORD_PRIVATE_H
 
 #include "pairs.h"
+#include "record.h"
+#include "../console/option.h"
 
 namespace rec
 {
 
 #define REC_DEFAULT_BUFFER_SIZE 8192
 
-extern com::JSVar lvlRoot;
+extern com::JSDoc lvlDoc;
+extern com::JSVar& lvlRoot; // lvlDoc.ArenaRoot(); use lvlDoc.EditRoot() to add heap storage
 extern char *saveFilePath, *loadFilePath, *currentLevel;
 
 /*
@@ -30,7 +33,40 @@ void UnassignResourceTranscripts();
 ################################################################################################
 */
 
-void Save();
+struct save_progress
+{
+	volatile size_t numTotal, numWritten; // Set by the writer, polled by the main thread
+};
+
+void		Save();
+void		UpdateSaves();
+void		FinishSaves();
+const char*	WriteSaveFile(const char* filePath, const com::JSVar& root, save_format format,
+			bool neat, save_progress* progressIO, size_t* sizeOut);
+
+/*
+################################################################################################
+	JOURNAL
+################################################################################################
+*/
+
+extern con::Option journalMaxEntries;
+
+struct journal_report
+{
+	size_t	numChanges; // Records set or unset by the entry
+	size_t	numBytes; // Written by this save
+	size_t	baseBytes; // Size of the last full save
+	bool	compacted; // Wrote a full save instead of an entry
+};
+
+const char*	WriteJournal(const char* filePath, com::JSVar*& rootIO, bool compress,
+			size_t maxEntries, save_progress* progressIO, journal_report& reportOut);
+void		ForgetJournal(const char* filePath = 0);
+size_t		BuildJournalEntry(const com::JSVar& base, const com::JSVar& root,
+			com::Arena& arena, com::JSVar& entryOut);
+void		ApplyJournalEntry(com::JSVar& rootIO, const com::JSVar& entry);
+size_t		ReplayJournal(FILE* file, com::JSVar& rootIO, const char*& errOut);
 
 /*
 ################################################################################################
@@ -40,6 +76,25 @@ void Save();
 
 void Load();
 
+/*
+################################################################################################
+	BINARY
+################################################################################################
+*/
+
+bool WriteBinaryRecord(const com::JSVar& root, FILE* file, bool compress,
+	volatile size_t* numWrittenIO = 0);
+bool BinaryRecordFile(FILE* file);
+bool ReadBinaryRecord(FILE* file, com::JSDoc& docOut, const char*& errOut);
+
+/*
+################################################################################################
+	JSON BENCH
+################################################################################################
+*/
+
+void WriteBenchSave(size_t numEnts, uint32_t& seedIO, com::Arr<char>& textOut);
+
 /*
 ################################################################################################
 	LUA
@@ -52,6 +107,9 @@ int CurrentLevel(lua_State* l);
 int SaveEdits(lua_State* l);
 int LoadJSON(lua_State* l);
 int SaveJSON(lua_State* l);
+int BenchSaveFormats(lua_State* l);
+int RequestAutosave(lua_State* l);
+int BenchJournal(lua_State* l);
 
 }
 
@@ -7,16 +7,53 @@
 #include "../../GauntCommon/json_ext.h"
 #include "../mod/mod.h"
 #include "../path/path.h"
+#include "../profile/profile.h"
 #include "../scene/scene.h"
+#include "../wrap/wrap.h"
 
 namespace rec
 {
+	/* save_job
+	A transcribed game state waiting to be written. Only the writer touches root once the job is
+	queued. */
+	struct save_job
+	{
+		char*				filePath;
+		save_format			format;
+		bool				neat;
+		bool				journal;
+		size_t				maxJournalEntries;
+		com::JSVar*			root; // Allocated, so the journal can keep it without copying
+		save_progress		progress;
+		volatile uint32_t	done; // wrp::Atomic* only
+		const char*			err; // Set by the writer before done
+		journal_report		report; // Set by the writer before done if journal
+		unsigned long long	startTime;
+		save_job*			next;
+	};
+
+	con::Option asyncSave("rec_async_save", true);
+
+	save_job*	saveJobs = 0; // FIFO; first is being written if saveThread is set
+	void*		saveThread = 0;
+
 	// SAVE
 	void					SetGlobalPairs(com::PairMap<com::JSVar>& globalOut);
 	template <class T> void	CreateResourceMap(const char* key);
 	template <class T> void	TranscribeResources();
+
+	// SAVE JOBS
+	void		QueueSaveJob(save_job* job);
+	void		StartSaveJob();
+	void		FinishSaveJob();
+	void		FreeSaveJob(save_job* job);
+	void		SaveJobProc(void* data);
+	const char*	WriteSaveJob(save_job& job);
+	size_t		NumSaveValues(const com::JSVar& root);
 }
 
+#define DEFAULT_SAVE_STACK_SIZE 8
+
 /*
 ################################################################################################
 
@@ -30,16 +67,20 @@ namespace rec
 char* rec::saveFilePath = 0;
 static bool saving = false;
 static bool saveNeat = false;
+static bool saveJournal = false;
+static rec::save_format saveFormat = rec::SAVE_JSON;
 
 /*--------------------------------------
 	rec::RequestSave
 
 Makes a request to save the game state after the current frame.
 
+neat only affects SAVE_JSON.
+
 FIXME: only accept names with letters, numbers, and underscores
 FIXME: automatically write to {mod}/saves/
 --------------------------------------*/
-void rec::RequestSave(const char* filePath, bool neat)
+void rec::RequestSave(const char* filePath, bool neat, save_format format)
 {
 	if(!filePath)
 		return;
@@ -47,43 +88,69 @@ void rec::RequestSave(const char* filePath, bool neat)
 	saveFilePath = (char*)realloc(saveFilePath, sizeof(char) * (strlen(filePath) + 1));
 	strcpy(saveFilePath, filePath);
 	saveNeat = neat;
+	saveJournal = false;
+	saveFormat = format;
+}
+
+/*--------------------------------------
+	rec::RequestAutosave
+
+Like RequestSave, but if the last autosave went to the same file, only appends the records that
+changed since then to a journal at the end of it. A full save is written instead the first time,
+after rec_journal_max_entries appends, or once the journal outgrows the full save. A full save
+with RequestSave to the same file also restarts the journal.
+
+format must be binary; SAVE_JSON is treated as SAVE_BINARY.
+--------------------------------------*/
+void rec::RequestAutosave(const char* filePath, save_format format)
+{
+	RequestSave(filePath, false, format == SAVE_JSON ? SAVE_BINARY : format);
+	saveJournal = saveFilePath != 0;
 }
 
 /*--------------------------------------
 	rec::Saving
+
+Returns true if a save is requested, being transcribed, or queued or being written on the save
+thread. If progressOut is given, it's set to the fraction of the oldest unwritten save that has
+been serialized.
 --------------------------------------*/
-bool rec::Saving()
+bool rec::Saving(float* progressOut)
 {
-	return saving;
+	if(progressOut)
+	{
+		*progressOut = 0.0f;
+
+		if(saveJobs)
+		{
+			const save_progress& p = saveJobs->progress;
+			size_t numTotal = p.numTotal, numWritten = p.numWritten;
+
+			if(numTotal)
+				*progressOut = com::Min((float)numWritten / numTotal, 1.0f);
+		}
+	}
+
+	return saving || saveFilePath || saveJobs;
 }
 
 /*--------------------------------------
 	rec::Save
 
-Saves the game state.
+Transcribes the game state into a new tree and queues it to be written. Only the transcription
+and save scripts stall the main thread unless rec_async_save is false.
 --------------------------------------*/
 void rec::Save()
 {
+	unsigned long long startTime = wrp::MicroTime();
 	lua_gc(scr::state, LUA_GCCOLLECT, 0);
 
 	saving = true;
 	con::LogF("Saving '%s'", saveFilePath);
-
-	// Open file
-	FILE* file = fopen(saveFilePath, "w");
-	if(!file)
-	{
-		con::LogF("Failed to open file", saveFilePath);
-		free(saveFilePath);
-		saveFilePath = 0;
-		saving = false;
-		return;
-	}
-
 	SetDefaultIDs();
 
 	// FIXME: Call a before-save script so record IDs can be modified before creating the tree
-	com::PairMap<com::JSVar>& rootMap = *lvlRoot.SetObject();
+	com::PairMap<com::JSVar>& rootMap = *lvlDoc.EditRoot().SetObject();
 	com::PairMap<com::JSVar>& global = *rootMap.Ensure("global")->Value().SetObject();
 	CreateResourceMap<scn::Entity>("entities");
 	CreateResourceMap<scn::Bulb>("bulbs");
@@ -97,19 +164,30 @@ void rec::Save()
 	mod::GameSave();
 	scn::CallEntityFunctions(scn::ENT_FUNC_SAVE);
 
-	// Write
-	if(saveNeat)
-		com::WriteJSON(lvlRoot, file);
-	else
-		com::WriteJSON(lvlRoot, file, 0, false);
-
-	// Done
-	fclose(file);
+	// Hand the tree off; it must not change from here on
 	UnassignResourceTranscripts();
-	com::FreeJSON(lvlRoot);
-	free(saveFilePath);
+	save_job* job = new save_job;
+	job->filePath = saveFilePath;
+	job->format = saveFormat;
+	job->neat = saveNeat;
+	job->journal = saveJournal;
+	job->maxJournalEntries = (size_t)journalMaxEntries.Float();
+	job->root = new com::JSVar;
+	job->root->Steal(lvlRoot);
+	job->progress.numTotal = job->progress.numWritten = 0;
+	job->done = 0;
+	job->err = 0;
+	job->next = 0;
 	saveFilePath = 0;
 	saving = false;
+
+	QueueSaveJob(job);
+
+	if(!asyncSave.Bool())
+		FinishSaves();
+
+	con::LogF("Save stalled main thread for %g ms",
+		(wrp::MicroTime() - startTime) * 0.001);
 }
 
 /*--------------------------------------
@@ -154,6 +232,300 @@ template <class T> void rec::TranscribeResources()
 		it->o->Transcribe();
 }
 
+/*
+################################################################################################
+
+
+	SAVE JOBS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rec::UpdateSaves
+
+Finishes the save being written if the save thread is done and starts the next queued one.
+--------------------------------------*/
+void rec::UpdateSaves()
+{
+	if(saveThread && wrp::AtomicLoad(saveJobs->done))
+		FinishSaveJob();
+
+	StartSaveJob();
+}
+
+/*--------------------------------------
+	rec::FinishSaves
+
+Blocks until every queued save is written. Call before reading or replacing a file a save might
+be writing to.
+--------------------------------------*/
+void rec::FinishSaves()
+{
+	while(saveJobs)
+	{
+		StartSaveJob();
+
+		if(saveJobs)
+			FinishSaveJob();
+	}
+}
+
+/*--------------------------------------
+	rec::QueueSaveJob
+
+A queued job that hasn't started writing is dropped if job goes to the same path, since it would
+be overwritten anyway.
+--------------------------------------*/
+void rec::QueueSaveJob(save_job* job)
+{
+	save_job** it = &saveJobs;
+
+	if(saveThread)
+		it = &saveJobs->next; // Being written, keep
+
+	while(*it)
+	{
+		// A full save supersedes anything, an autosave only older autosaves
+		if(!strcmp((*it)->filePath, job->filePath) && (!job->journal || (*it)->journal))
+		{
+			save_job* old = *it;
+			*it = old->next;
+			con::LogF("Dropped older queued save of '%s'", old->filePath);
+			FreeSaveJob(old);
+		}
+		else
+			it = &(*it)->next;
+	}
+
+	*it = job;
+	StartSaveJob();
+}
+
+/*--------------------------------------
+	rec::StartSaveJob
+
+Starts writing the first queued job on the save thread if it's not already busy. If the thread
+can't be started, writes on this thread instead.
+--------------------------------------*/
+void rec::StartSaveJob()
+{
+	while(saveJobs && !saveThread)
+	{
+		saveJobs->startTime = wrp::MicroTime();
+
+		saveThread = wrp::StartThread(SaveJobProc, saveJobs);
+
+		if(saveThread)
+			return;
+
+		SaveJobProc(saveJobs);
+		FinishSaveJob();
+	}
+}
+
+/*--------------------------------------
+	rec::FinishSaveJob
+
+Waits for the first job to be written, reports the result, and frees it.
+--------------------------------------*/
+void rec::FinishSaveJob()
+{
+	save_job* job = saveJobs;
+
+	if(saveThread)
+	{
+		wrp::JoinThread(saveThread);
+		saveThread = 0;
+	}
+
+	double ms = (wrp::MicroTime() - job->startTime) * 0.001;
+
+	if(job->err)
+		CON_ERRORF("Failed to save '%s': %s", job->filePath, job->err);
+	else if(!job->journal || job->report.compacted)
+		con::LogF("Wrote '%s' in %g ms", job->filePath, ms);
+	else
+	{
+		con::LogF("Appended %u changed records to '%s' in %g ms (%.1f KB, full save %.1f KB)",
+			(unsigned)job->report.numChanges, job->filePath, ms,
+			job->report.numBytes / 1024.0, job->report.baseBytes / 1024.0);
+	}
+
+	saveJobs = job->next;
+	FreeSaveJob(job);
+}
+
+/*--------------------------------------
+	rec::FreeSaveJob
+--------------------------------------*/
+void rec::FreeSaveJob(save_job* job)
+{
+	if(job->root)
+	{
+		com::FreeJSON(*job->root);
+		delete job->root;
+	}
+
+	free(job->filePath);
+	delete job;
+}
+
+/*--------------------------------------
+	rec::SaveJobProc
+
+Runs on the save thread. Doesn't touch anything but the job and the journal state.
+--------------------------------------*/
+void rec::SaveJobProc(void* data)
+{
+	save_job& job = *(save_job*)data;
+	job.err = WriteSaveJob(job);
+
+	// Keep the free off the main thread too
+	if(job.root)
+	{
+		com::FreeJSON(*job.root);
+		delete job.root;
+		job.root = 0;
+	}
+
+	wrp::AtomicStore(job.done, 1);
+}
+
+/*--------------------------------------
+	rec::WriteSaveJob
+
+Returns an error string on failure.
+--------------------------------------*/
+const char* rec::WriteSaveJob(save_job& job)
+{
+	PRF_ZONE("rec::WriteSaveJob");
+	if(job.journal)
+	{
+		return WriteJournal(job.filePath, job.root, job.format == SAVE_BINARY_LZ,
+			job.maxJournalEntries, &job.progress, job.report);
+	}
+
+	const char* err = WriteSaveFile(job.filePath, *job.root, job.format, job.neat, &job.progress,
+		0);
+
+	if(!err)
+		ForgetJournal(job.filePath); // Replaced the journaled file
+
+	return err;
+}
+
+/*--------------------------------------
+	rec::WriteSaveFile
+
+Writes root to a temporary file, flushes it to disk, and renames it over filePath, so a failed or
+interrupted save leaves the previous one intact. Returns an error string on failure. Safe to call
+on the save thread.
+--------------------------------------*/
+const char* rec::WriteSaveFile(const char* filePath, const com::JSVar& root, save_format format,
+	bool neat, save_progress* progress, size_t* sizeOut)
+{
+	bool binary = format != SAVE_JSON;
+	volatile size_t* numWritten = 0;
+
+	if(progress)
+	{
+		size_t numValues = NumSaveValues(root);
+		progress->numTotal = binary ? numValues * 2 : numValues; // Binary makes two passes
+		numWritten = &progress->numWritten;
+	}
+
+	size_t pathLen = strlen(filePath);
+	char* tempPath = (char*)malloc(sizeof(char) * (pathLen + 5));
+	strcpy(tempPath, filePath);
+	strcpy(tempPath + pathLen, ".tmp");
+
+	FILE* file = fopen(tempPath, binary ? "wb" : "w");
+
+	if(!file)
+	{
+		free(tempPath);
+		return "Failed to open file";
+	}
+
+	const char* err = 0;
+
+	if(binary)
+	{
+		if(!WriteBinaryRecord(root, file, format == SAVE_BINARY_LZ, numWritten))
+			err = "Failed to write file";
+	}
+	else
+	{
+		if(neat)
+			com::WriteJSON(root, file, "\t", true, numWritten);
+		else
+			com::WriteJSON(root, file, 0, false, numWritten);
+
+		if(ferror(file))
+			err = "Failed to write file";
+	}
+
+	if(!err && !wrp::SyncFile(file))
+		err = "Failed to flush file";
+
+	if(sizeOut)
+	{
+		long size = ftell(file);
+		*sizeOut = size > 0 ? size : 0;
+	}
+
+	if(fclose(file) && !err)
+		err = "Failed to close file";
+
+	if(!err && !wrp::RenameFile(tempPath, filePath))
+		err = "Failed to replace file";
+
+	if(err)
+		remove(tempPath);
+
+	free(tempPath);
+	return err;
+}
+
+/*--------------------------------------
+	rec::NumSaveValues
+
+Counts every value in root, including root.
+--------------------------------------*/
+size_t rec::NumSaveValues(const com::JSVar& root)
+{
+	com::Arr<const com::JSVar*> stack(DEFAULT_SAVE_STACK_SIZE);
+	size_t numNodes = 1, numValues = 0;
+	stack[0] = &root;
+
+	while(numNodes)
+	{
+		const com::JSVar& var = *stack[--numNodes];
+		numValues++;
+
+		if(var.Type() == com::JSVar::OBJECT)
+		{
+			for(const com::Pair<com::JSVar>* it = var.Object()->First(); it; it = it->Next())
+			{
+				stack.Ensure(numNodes + 1);
+				stack[numNodes++] = &it->Value();
+			}
+		}
+		else if(var.Type() == com::JSVar::ARRAY)
+		{
+			stack.Ensure(numNodes + var.NumElems());
+
+			for(size_t i = 0; i < var.NumElems(); i++)
+				stack[numNodes++] = &(*var.Array())[i];
+		}
+	}
+
+	stack.Free();
+	return numValues;
+}
+
 /*
 ################################################################################################
 
@@ -167,18 +539,46 @@ template <class T> void rec::TranscribeResources()
 /*--------------------------------------
 LUA	rec::RequestSave
 
-IN	sFilePath, bNeat
+IN	sFilePath, bNeat, [sFormat = "json"]
+
+sFormat is "json", "binary", or "lz" for compressed binary. Loading detects the format.
 --------------------------------------*/
 int rec::RequestSave(lua_State* l)
 {
+	static const char* const FORMATS[] = {"json", "binary", "lz", 0};
+
 	if(!lua_gettop(l))
 	{
-		con::LogF("%s: sFilePath, bNeat", COM_FUNC_NAME);
+		con::LogF("%s: sFilePath, bNeat, [sFormat = \"json\"]", COM_FUNC_NAME);
 		return 0;
 	}
 
 	const char* filePath = luaL_checkstring(l, 1);
 	bool neat = lua_toboolean(l, 2);
-	RequestSave(filePath, neat);
+	save_format format = (save_format)luaL_checkoption(l, 3, "json", FORMATS);
+	RequestSave(filePath, neat, format);
+	return 0;
+}
+
+/*--------------------------------------
+LUA	rec::RequestAutosave (autosave)
+
+IN	sFilePath, [sFormat = "lz"]
+
+sFormat is "binary" or "lz".
+--------------------------------------*/
+int rec::RequestAutosave(lua_State* l)
+{
+	static const char* const FORMATS[] = {"binary", "lz", 0};
+
+	if(!lua_gettop(l))
+	{
+		con::LogF("%s: sFilePath, [sFormat = \"lz\"]", COM_FUNC_NAME);
+		return 0;
+	}
+
+	const char* filePath = luaL_checkstring(l, 1);
+	save_format format = luaL_checkoption(l, 2, "lz", FORMATS) ? SAVE_BINARY_LZ : SAVE_BINARY;
+	RequestAutosave(filePath, format);
 	return 0;
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "../../GauntCommon/io.h"
 #include "../../GauntCommon/link.h"
 #include "../hit/hit.h"
+#include "../profile/profile.h"
 #include "../script/script.h"
 #include "../vector/vec_lua.h"
 #include "../wrap/wrap.h"
@@ -34,7 +35,7 @@ namespace rnd
 	GLuint skyMask, overlayMask, overlayRelitMask, cloudMask;
 	simple_mesh *lightSphere, *lightHemi;
 	GLfloat shaderRandomSeed, shaderRandomSeed2;
-	Timer timers[NUM_TIMERS];
+	Timer timers[NUM_TIMERS], frameTimer;
 	bool doTiming;
 
 	const char* TIMER_NAMES[NUM_TIMERS] = {
@@ -1402,23 +1403,23 @@ fraction [0, 1] is used to lerp between the old and new tick state.
 --------------------------------------*/
 void rnd::Frame()
 {
+	PRF_ZONE("rnd::Frame");
+
 	if(!CurrentPalette())
 		WRP_FATAL("Rendering frame without a palette");
 
+	scn::FlushLinks(); // Zones' entity links are read while drawing
+
 	EnsureShaderPrograms();
+	BeginInstanceFrame();
 	glClearDepth(0.0);
 	CheckCurveUpdates();
 
 	if(curveColor.Integer() >= 0)
 		DrawCurve(curveColor.Integer());
 
-	doTiming = extensions.timer && timeRender.Bool();
-
-	if(doTiming)
-	{
-		for(size_t i = 0; i < NUM_TIMERS; i++)
-			timers[i].Reset();
-	}
+	doTiming = extensions.timer && timeRender.Bool() && Timer::BeginFrame();
+	frameTimer.Start();
 
 	if(scn::ActiveCamera())
 	{
@@ -1431,10 +1432,8 @@ void rnd::Frame()
 		UpdateNoise();
 		UpdateShadowBuffer();
 		UpdateMatrices();
-		FloodSunVisible();
-		unsigned zoneVisCode;
-		FloodVisible(zoneVisCode);
-		bool drawSun = TrimVisibleSunBranches(zoneVisCode);
+		FloodVisible();
+		bool drawSun = TrimVisibleSunBranches();
 
 		timers[TIMER_MISC].Stop();
 
@@ -1534,19 +1533,17 @@ void rnd::Frame()
 	ImagePass();
 	LinePass();
 	AdvanceLines();
+	EndInstanceFrame();
 
-	if(doTiming)
+	if(doTiming && Timer::EndFrame())
 	{
-		GLuint total = 0;
-
 		for(size_t i = 0; i < NUM_TIMERS; i++)
 		{
-			GLuint result = timers[i].Accumulated();
-			total += result;
-			con::LogF("%s: %g ms", TIMER_NAMES[i], result * 1e-06f);
+			con::LogF("%s: %g ms avg, %g ms max", TIMER_NAMES[i], timers[i].AverageMS(),
+				timers[i].MaxMS());
 		}
 
-		con::LogF("frame: %g ms\n", total * 1e-06f);
+		con::LogF("frame: %g ms avg, %g ms max\n", frameTimer.AverageMS(), frameTimer.MaxMS());
 	}
 
 	if(checkErrors.Bool())
@@ -1632,6 +1629,9 @@ void rnd::Init()
 	extensions.depthBufferFloat = HaveGLExtension("GL_ARB_depth_buffer_float");
 	extensions.clipControl = HaveGLCore(4, 5) || HaveGLExtension("GL_ARB_clip_control");
 	extensions.timer = HaveGLCore(3, 3) || HaveGLExtension("GL_ARB_timer_query");
+	extensions.instancing = HaveGLCore(3, 3) &&
+		numVertexAttribs >= RND_MODEL_INST_NUM_VERTEX_ATTRIBS;
+	extensions.bufferStorage = HaveGLCore(4, 4) || HaveGLExtension("GL_ARB_buffer_storage");
 
 	skyBit = stencilBits - 1;
 	skyMask = 1 << skyBit;
@@ -1724,12 +1724,6 @@ void rnd::Init()
 	if(extensions.fbo)
 		glGenFramebuffers(1, &fboShadowBuffer);
 
-	if(extensions.timer)
-	{
-		for(size_t i = 0; i < NUM_TIMERS; i++)
-			timers[i].Init();
-	}
-
 	lineWidth.SetValue(lineWidth.Float());
 	ClearCurvePoints();
 
@@ -1892,6 +1886,9 @@ void rnd::Init()
 
 	// Commands
 	lua_pushcfunction(scr::state, CalculateCascadeDistances); con::CreateCommand("calc_cascade_dists");
+	lua_pushcfunction(scr::state, BenchVis); con::CreateCommand("rnd_bench_vis");
+	lua_pushcfunction(scr::state, BenchDrawSort); con::CreateCommand("rnd_bench_draw_sort");
+	lua_pushcfunction(scr::state, CheckModelBatches); con::CreateCommand("rnd_check_model_batches");
 
 	while(GLenum err = glGetError())
 		con::AlertF("Initialization GL error: %s (%u)", GetErrorString(err), (unsigned)err);
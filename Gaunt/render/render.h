@@ -155,6 +155,7 @@ extern con::Option
 	preciseClipRange,
 	highDepthBuffer,
 	forceLowDepthBuffer,
+	instancing,
 	shadowRes,
 	sunShadowRes,
 	kernelSize,
@@ -228,6 +229,7 @@ extern con::Option
 	solidLeafColor,
 	lineWidth,
 	timeRender,
+	timeRenderWindow,
 	lockCullCam,
 	antiAliasing,
 	fxaaQualitySubpix,
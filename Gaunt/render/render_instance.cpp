@@ -0,0 +1,609 @@
+// render_instance.cpp -- Instanced model drawing
+// Martynas Ceicys
+
+#include <stddef.h>
+#include <string.h>
+
+#include "render.h"
+#include "render_private.h"
+#include "render_lua.h"
+#include "../console/console.h"
+
+#define RND_INSTANCE_FRAMES			3 // Frames of instance data the GPU may still be reading
+#define RND_INSTANCE_MIN_REGION		(256 * sizeof(rnd::model_instance))
+
+namespace rnd
+{
+	// Per-instance attributes of instModelProg
+	struct model_instance
+	{
+		GLfloat	modelToClip[16];
+		GLfloat	modelToNormal[9]; // Rows of the upper left 3x3
+		GLfloat	texShiftLerp[3];
+		GLfloat	subPaletteOpacity[2];
+	};
+
+	com::Arr<model_draw>	modelDraws;
+	com::Arr<model_cmd>		modelCmds;
+
+	/* Streaming instance buffer. With buffer storage, it's persistently mapped and split into
+	RND_INSTANCE_FRAMES regions, one written per frame and fenced. Otherwise it's one region
+	that's orphaned when it fills up. */
+	GLuint					instBuffer = 0;
+	GLubyte*				instMapped = 0;
+	size_t					instRegionSize = 0, instRegion = 0, instUsed = 0;
+	GLsync					instFences[RND_INSTANCE_FRAMES] = {0};
+	com::Arr<model_instance>	instStaging;
+
+	bool	SameModelInstance(const model_draw& a, const model_draw& b);
+	void	ResizeInstanceBuffer(size_t regionSize);
+	size_t	WriteModelInstances(const model_draw* draws, size_t numDraws,
+			const GLfloat (&wtc)[16]);
+	void	FillModelInstance(const model_draw& d, const GLfloat (&wtc)[16],
+			model_instance& instOut);
+	void	SetInstanceAttribPointers(size_t offset);
+	void	SetInstanceAttribArrays(bool enable);
+}
+
+/*--------------------------------------
+	rnd::InstancingModels
+
+True if ModelDrawInstanced will use instModelProg.
+--------------------------------------*/
+bool rnd::InstancingModels()
+{
+	return extensions.instancing && instancing.Bool() && instModelProg.shaderProgram;
+}
+
+/*--------------------------------------
+	rnd::SameModelInstance
+--------------------------------------*/
+bool rnd::SameModelInstance(const model_draw& a, const model_draw& b)
+{
+	return a.msh == b.msh && a.tex == b.tex && a.offsets[0] == b.offsets[0] &&
+		a.offsets[1] == b.offsets[1];
+}
+
+/*--------------------------------------
+	rnd::BatchModelDraws
+
+Turns draws into a command stream. Each run of consecutive draws with the same mesh, texture, and
+frame pair becomes one DRAW command, preceded by binds of whatever differs from curMsh and curTex.
+Runs aren't merged across other draws so the given order, and thus sorting, is kept. Touches no
+GL state. Returns the number of commands written to cmdsOut.
+--------------------------------------*/
+size_t rnd::BatchModelDraws(const model_draw* draws, size_t numDraws, const Mesh* curMsh,
+	const Texture* curTex, com::Arr<model_cmd>& cmdsOut)
+{
+	size_t numCmds = 0;
+
+	for(size_t i = 0; i < numDraws;)
+	{
+		const model_draw& d = draws[i];
+		cmdsOut.Ensure(numCmds + 3);
+
+		if(curMsh != d.msh)
+		{
+			model_cmd& c = cmdsOut[numCmds++];
+			c.type = model_cmd::BIND_MESH;
+			c.start = i;
+			c.num = 1;
+			curMsh = d.msh;
+		}
+
+		if(curTex != d.tex)
+		{
+			model_cmd& c = cmdsOut[numCmds++];
+			c.type = model_cmd::BIND_TEXTURE;
+			c.start = i;
+			c.num = 1;
+			curTex = d.tex;
+		}
+
+		size_t end = i + 1;
+		for(; end < numDraws && SameModelInstance(d, draws[end]); end++);
+
+		model_cmd& c = cmdsOut[numCmds++];
+		c.type = model_cmd::DRAW;
+		c.start = i;
+		c.num = end - i;
+		i = end;
+	}
+
+	return numCmds;
+}
+
+/*--------------------------------------
+	rnd::DrawModelBatches
+
+Executes cmds from BatchModelDraws with instModelProg, which must be in use. Leaves the last
+bound mesh's vertex buffer bound to GL_ARRAY_BUFFER like ModelDrawArray does.
+
+Like RegularModelProg::UpdateStateForEntity, normals aren't rotated by an overlay's normOri.
+--------------------------------------*/
+void rnd::DrawModelBatches(const model_draw* draws, size_t numDraws, const model_cmd* cmds,
+	size_t numCmds, const GLfloat (&wtc)[16], const Mesh*& curMsh, const Texture*& curTex)
+{
+	if(!numDraws)
+		return;
+
+	size_t base = WriteModelInstances(draws, numDraws, wtc);
+	SetInstanceAttribArrays(true);
+
+	for(size_t i = 0; i < numCmds; i++)
+	{
+		const model_cmd& c = cmds[i];
+		const model_draw& d = draws[c.start];
+
+		switch(c.type)
+		{
+		case model_cmd::BIND_MESH:
+			glBindBuffer(GL_ARRAY_BUFFER, d.msh->vBufName);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d.msh->iBufName);
+			curMsh = d.msh;
+			break;
+		case model_cmd::BIND_TEXTURE:
+			glActiveTexture(RND_VARIABLE_TEXTURE_UNIT);
+			glBindTexture(GL_TEXTURE_2D, d.tex->texName);
+			ModelUploadTexDims(instModelProg.uniTexDims, *d.ent);
+			curTex = d.tex;
+			break;
+		case model_cmd::DRAW:
+			// Instance attribute pointers source from instBuffer, then the mesh is rebound
+			SetInstanceAttribPointers(base + c.start * sizeof(model_instance));
+			glBindBuffer(GL_ARRAY_BUFFER, d.msh->vBufName);
+			ModelSetPlaceVertexAttribPointers(*d.msh, d.offsets);
+			ModelSetTexcoordVertexAttribPointer(*d.msh);
+			ModelDrawElementsInstanced(*d.msh, c.num);
+			break;
+		}
+	}
+
+	SetInstanceAttribArrays(false);
+}
+
+/*--------------------------------------
+	rnd::BeginInstanceFrame
+
+Moves to the next region of the persistently mapped instance buffer and waits for the GPU to be
+done reading it, which only stalls if the GPU is RND_INSTANCE_FRAMES frames behind.
+--------------------------------------*/
+void rnd::BeginInstanceFrame()
+{
+	if(!instMapped)
+	{
+		instUsed = instRegionSize; // Orphan on first write
+		return;
+	}
+
+	instRegion = (instRegion + 1) % RND_INSTANCE_FRAMES;
+	instUsed = 0;
+	GLsync& fence = instFences[instRegion];
+
+	if(fence)
+	{
+		GLuint64 timeout = 1000000000; // ns
+		while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED);
+
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+/*--------------------------------------
+	rnd::EndInstanceFrame
+--------------------------------------*/
+void rnd::EndInstanceFrame()
+{
+	if(instMapped && instUsed)
+		instFences[instRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*--------------------------------------
+	rnd::ResizeInstanceBuffer
+
+Replaces the instance buffer. Draws already issued keep reading the old buffer's storage.
+--------------------------------------*/
+void rnd::ResizeInstanceBuffer(size_t regionSize)
+{
+	for(size_t i = 0; i < RND_INSTANCE_FRAMES; i++)
+	{
+		if(instFences[i])
+		{
+			glDeleteSync(instFences[i]);
+			instFences[i] = 0;
+		}
+	}
+
+	if(instBuffer)
+		glDeleteBuffers(1, &instBuffer); // Unmaps
+
+	instRegionSize = regionSize;
+	instRegion = instUsed = 0;
+	instMapped = 0;
+	glGenBuffers(1, &instBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, instBuffer);
+
+	if(extensions.bufferStorage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		GLsizeiptr size = regionSize * RND_INSTANCE_FRAMES;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, 0, flags);
+		instMapped = (GLubyte*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+
+		if(!instMapped)
+			WRP_FATAL("Could not map instance buffer");
+	}
+	else
+		glBufferData(GL_COPY_WRITE_BUFFER, regionSize, 0, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+/*--------------------------------------
+	rnd::WriteModelInstances
+
+Writes an instance for each draw to the instance buffer and returns the byte offset of the first.
+--------------------------------------*/
+size_t rnd::WriteModelInstances(const model_draw* draws, size_t numDraws,
+	const GLfloat (&wtc)[16])
+{
+	size_t size = numDraws * sizeof(model_instance);
+
+	if(size > instRegionSize)
+	{
+		size_t regionSize = COM_MAX(instRegionSize, RND_INSTANCE_MIN_REGION);
+		for(; regionSize < size; regionSize *= 2);
+		ResizeInstanceBuffer(regionSize);
+	}
+
+	if(instMapped)
+	{
+		if(instUsed + size > instRegionSize)
+			ResizeInstanceBuffer(instRegionSize * 2); // Can't wait on this frame's own draws
+
+		size_t offset = instRegion * instRegionSize + instUsed;
+		model_instance* insts = (model_instance*)(instMapped + offset);
+
+		for(size_t i = 0; i < numDraws; i++)
+			FillModelInstance(draws[i], wtc, insts[i]);
+
+		instUsed += size;
+		return offset;
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, instBuffer);
+
+	if(instUsed + size > instRegionSize)
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, instRegionSize, 0, GL_STREAM_DRAW); // Orphan
+		instUsed = 0;
+	}
+
+	instStaging.Ensure(numDraws);
+
+	for(size_t i = 0; i < numDraws; i++)
+		FillModelInstance(draws[i], wtc, instStaging[i]);
+
+	size_t offset = instUsed;
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, instStaging.o);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	instUsed += size;
+	return offset;
+}
+
+/*--------------------------------------
+	rnd::FillModelInstance
+
+Same values RegularModelProg::UpdateStateForEntity uploads as uniforms.
+--------------------------------------*/
+void rnd::FillModelInstance(const model_draw& d, const GLfloat (&wtc)[16],
+	model_instance& instOut)
+{
+	const scn::Entity& ent = *d.ent;
+	GLfloat modelToWorld[16], modelToNormal[16];
+	ModelToWorld(ent.FinalPos(), ent.FinalOri(), ent.FinalScale(), modelToWorld, &modelToNormal);
+	com::Multiply4x4(modelToWorld, wtc, instOut.modelToClip);
+
+	for(size_t r = 0; r < 3; r++)
+	{
+		for(size_t c = 0; c < 3; c++)
+			instOut.modelToNormal[r * 3 + c] = modelToNormal[r * 4 + c];
+	}
+
+	com::Vec2 uv = ent.FinalUV();
+	instOut.texShiftLerp[0] = uv.x;
+	instOut.texShiftLerp[1] = uv.y;
+	instOut.texShiftLerp[2] = d.lerp;
+	instOut.subPaletteOpacity[0] = NormalizeSubPalette(ent.subPalette);
+	instOut.subPaletteOpacity[1] = ent.FinalOpacity();
+}
+
+/*--------------------------------------
+	rnd::SetInstanceAttribPointers
+
+Binds instBuffer to GL_ARRAY_BUFFER.
+--------------------------------------*/
+void rnd::SetInstanceAttribPointers(size_t offset)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instBuffer);
+	GLsizei stride = sizeof(model_instance);
+
+	for(size_t i = 0; i < 4; i++)
+	{
+		glVertexAttribPointer(RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP + i, 4, GL_FLOAT, GL_FALSE,
+			stride, (void*)(offset + offsetof(model_instance, modelToClip) +
+			sizeof(GLfloat) * 4 * i));
+	}
+
+	for(size_t i = 0; i < 3; i++)
+	{
+		glVertexAttribPointer(RND_MODEL_INST_ATTRIB_MODEL_TO_NORMAL + i, 3, GL_FLOAT, GL_FALSE,
+			stride, (void*)(offset + offsetof(model_instance, modelToNormal) +
+			sizeof(GLfloat) * 3 * i));
+	}
+
+	glVertexAttribPointer(RND_MODEL_INST_ATTRIB_TEX_SHIFT_LERP, 3, GL_FLOAT, GL_FALSE, stride,
+		(void*)(offset + offsetof(model_instance, texShiftLerp)));
+
+	glVertexAttribPointer(RND_MODEL_INST_ATTRIB_SUB_PAL_OPACITY, 2, GL_FLOAT, GL_FALSE, stride,
+		(void*)(offset + offsetof(model_instance, subPaletteOpacity)));
+}
+
+/*--------------------------------------
+	rnd::SetInstanceAttribArrays
+
+Enables or disables the per-instance attribute arrays. Divisors are reset when disabling so other
+programs using these indices aren't affected.
+--------------------------------------*/
+void rnd::SetInstanceAttribArrays(bool enable)
+{
+	for(GLuint i = RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP; i < RND_MODEL_INST_NUM_VERTEX_ATTRIBS;
+	i++)
+	{
+		if(enable)
+			glEnableVertexAttribArray(i);
+		else
+			glDisableVertexAttribArray(i);
+
+		glVertexAttribDivisor(i, enable);
+	}
+}
+
+/*
+################################################################################################
+
+
+	INSTANCE LUA
+
+
+################################################################################################
+*/
+
+namespace rnd
+{
+	struct check_batches
+	{
+		const char*			name;
+		const model_draw*	draws;
+		size_t				numDraws;
+		size_t				curMsh, curTex; // Index into fake arrays, or -1 for none
+		const model_cmd*	expected;
+		size_t				numExpected;
+	};
+
+	bool CheckBatchInvariants(const model_draw* draws, size_t numDraws, const Mesh* curMsh,
+		const Texture* curTex, const model_cmd* cmds, size_t numCmds);
+}
+
+/*--------------------------------------
+	rnd::CheckBatchInvariants
+
+Returns true if cmds draws every draw once in order, each DRAW is a maximal run of identical
+instances, and binds happen exactly when the mesh or texture changes.
+--------------------------------------*/
+bool rnd::CheckBatchInvariants(const model_draw* draws, size_t numDraws, const Mesh* curMsh,
+	const Texture* curTex, const model_cmd* cmds, size_t numCmds)
+{
+	size_t next = 0;
+	bool boundMsh = false, boundTex = false;
+
+	for(size_t i = 0; i < numCmds; i++)
+	{
+		const model_cmd& c = cmds[i];
+
+		if(c.start != next || c.start >= numDraws)
+			return false;
+
+		switch(c.type)
+		{
+		case model_cmd::BIND_MESH:
+			if(boundMsh || curMsh == draws[c.start].msh)
+				return false;
+
+			curMsh = draws[c.start].msh;
+			boundMsh = true;
+			break;
+		case model_cmd::BIND_TEXTURE:
+			if(boundTex || curTex == draws[c.start].tex)
+				return false;
+
+			curTex = draws[c.start].tex;
+			boundTex = true;
+			break;
+		case model_cmd::DRAW:
+			if(!c.num || c.start + c.num > numDraws || curMsh != draws[c.start].msh ||
+			curTex != draws[c.start].tex)
+				return false;
+
+			for(size_t j = c.start + 1; j < c.start + c.num; j++)
+			{
+				if(!SameModelInstance(draws[c.start], draws[j]))
+					return false;
+			}
+
+			next = c.start + c.num;
+
+			if(next < numDraws && SameModelInstance(draws[c.start], draws[next]))
+				return false; // Run should have continued
+
+			boundMsh = boundTex = false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return next == numDraws;
+}
+
+/*--------------------------------------
+LUA	rnd::CheckModelBatches (rnd_check_model_batches)
+
+IN	[iNumRandom = 10000, iSeed = 1]
+
+Checks BatchModelDraws's command stream against recorded streams for a few small draw lists, then
+checks invariants on a random, mostly sorted list of iNumRandom draws. Fake meshes and textures
+are only compared, so no GL or entities are needed. Alerts on a mismatch.
+--------------------------------------*/
+int rnd::CheckModelBatches(lua_State* l)
+{
+	size_t numRandom = luaL_optinteger(l, 1, 10000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+
+	// Never dereferenced
+	static const char fakeMeshes[4] = {0}, fakeTextures[4] = {0};
+	const MeshGL* m[4];
+	const TextureGL* t[4];
+
+	for(size_t i = 0; i < 4; i++)
+	{
+		m[i] = (const MeshGL*)&fakeMeshes[i];
+		t[i] = (const TextureGL*)&fakeTextures[i];
+	}
+
+	const model_draw runs[] = {
+		{0, m[0], t[0], {0, 0}, 0.0f},
+		{0, m[0], t[0], {0, 0}, 0.5f}, // Lerp is per instance
+		{0, m[0], t[0], {0, 0}, 0.0f},
+		{0, m[0], t[1], {0, 0}, 0.0f},
+		{0, m[1], t[1], {0, 0}, 0.0f},
+		{0, m[1], t[1], {0, 0}, 0.0f}
+	};
+
+	const model_cmd runsCmds[] = {
+		{model_cmd::BIND_MESH, 0, 1},
+		{model_cmd::BIND_TEXTURE, 0, 1},
+		{model_cmd::DRAW, 0, 3},
+		{model_cmd::BIND_TEXTURE, 3, 1},
+		{model_cmd::DRAW, 3, 1},
+		{model_cmd::BIND_MESH, 4, 1},
+		{model_cmd::DRAW, 4, 2}
+	};
+
+	const model_draw frames[] = {
+		{0, m[0], t[0], {0, 0}, 0.0f},
+		{0, m[0], t[0], {0, 64}, 0.0f},
+		{0, m[0], t[0], {0, 64}, 0.0f},
+		{0, m[0], t[0], {0, 0}, 0.0f} // Not merged with the first
+	};
+
+	const model_cmd framesCmds[] = {
+		{model_cmd::BIND_MESH, 0, 1},
+		{model_cmd::BIND_TEXTURE, 0, 1},
+		{model_cmd::DRAW, 0, 1},
+		{model_cmd::DRAW, 1, 2},
+		{model_cmd::DRAW, 3, 1}
+	};
+
+	const model_draw bound[] = {
+		{0, m[2], t[2], {0, 0}, 0.0f},
+		{0, m[2], t[2], {0, 0}, 0.0f},
+		{0, m[2], t[3], {0, 0}, 0.0f}
+	};
+
+	const model_cmd boundCmds[] = {
+		{model_cmd::DRAW, 0, 2},
+		{model_cmd::BIND_TEXTURE, 2, 1},
+		{model_cmd::DRAW, 2, 1}
+	};
+
+	#define RND_CHECK_CASE(name, draws, msh, tex, cmds) \
+		{name, draws, sizeof(draws) / sizeof(model_draw), msh, tex, cmds, \
+		sizeof(cmds) / sizeof(model_cmd)}
+
+	const check_batches cases[] = {
+		RND_CHECK_CASE("runs", runs, (size_t)-1, (size_t)-1, runsCmds),
+		RND_CHECK_CASE("frames", frames, (size_t)-1, (size_t)-1, framesCmds),
+		RND_CHECK_CASE("bound", bound, 2, 2, boundCmds),
+		{"empty", 0, 0, (size_t)-1, (size_t)-1, 0, 0}
+	};
+
+	#undef RND_CHECK_CASE
+
+	com::Arr<model_cmd> cmds(16);
+	size_t numFailed = 0;
+
+	for(size_t i = 0; i < sizeof(cases) / sizeof(check_batches); i++)
+	{
+		const check_batches& cb = cases[i];
+		const Mesh* curMsh = cb.curMsh == (size_t)-1 ? 0 : m[cb.curMsh];
+		const Texture* curTex = cb.curTex == (size_t)-1 ? 0 : t[cb.curTex];
+		size_t numCmds = BatchModelDraws(cb.draws, cb.numDraws, curMsh, curTex, cmds);
+		bool match = numCmds == cb.numExpected;
+
+		for(size_t j = 0; match && j < numCmds; j++)
+		{
+			match = cmds[j].type == cb.expected[j].type && cmds[j].start == cb.expected[j].start &&
+				cmds[j].num == cb.expected[j].num;
+		}
+
+		if(!match)
+		{
+			con::AlertF("Model batches '%s' don't match the recorded stream", cb.name);
+			numFailed++;
+		}
+	}
+
+	// Random list with long runs, like a list sorted by ModelDrawKey
+	com::Arr<model_draw> draws(numRandom ? numRandom : 1);
+
+	for(size_t i = 0; i < numRandom; i++)
+	{
+		model_draw& d = draws[i];
+
+		if(i && com::BenchRandF(seed) < 0.8f)
+			d = draws[i - 1];
+		else
+		{
+			d.ent = 0;
+			d.msh = m[(size_t)(com::BenchRandF(seed) * 4)];
+			d.tex = t[(size_t)(com::BenchRandF(seed) * 4)];
+			d.offsets[0] = (size_t)(com::BenchRandF(seed) * 2);
+			d.offsets[1] = (size_t)(com::BenchRandF(seed) * 2);
+			d.lerp = 0.0f;
+		}
+	}
+
+	size_t numCmds = BatchModelDraws(draws.o, numRandom, 0, 0, cmds);
+	size_t numDrawCmds = 0;
+
+	for(size_t i = 0; i < numCmds; i++)
+		numDrawCmds += cmds[i].type == model_cmd::DRAW;
+
+	if(!CheckBatchInvariants(draws.o, numRandom, 0, 0, cmds.o, numCmds))
+	{
+		con::AlertF("Random model batches are invalid");
+		numFailed++;
+	}
+
+	con::LogF("%u draws in %u instanced calls (%u commands)", (unsigned)numRandom,
+		(unsigned)numDrawCmds, (unsigned)numCmds);
+
+	if(!numFailed)
+		con::LogF("Model batches OK");
+
+	cmds.Free();
+	draws.Free();
+	return 0;
+}
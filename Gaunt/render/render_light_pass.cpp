@@ -11,8 +11,7 @@
 
 namespace rnd
 {
-	com::Arr<const scn::Zone*> litZones;
-	com::Arr<const scn::Entity*> litEnts;
+	bulb_lists pointLists;
 
 	shadow_pass_type shadowPass = {0};
 	shadow_fade_pass_type shadowFadePass = {0};
@@ -26,9 +25,12 @@ namespace rnd
 	// SHADOW SUN PASS
 	void	DrawSunShadowMap(const com::Vec3& dir, GLfloat (&sunViewToClipsOut)[4][16],
 			com::Vec3 (&centersOut)[4], com::Vec3 (&locksOut)[4]);
-	void	DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f, GLfloat cBias,
-			GLfloat cSlopeBias, GLfloat (&sunViewToClipOut)[16], com::Vec3& centerOut,
-			com::Vec3& lockOut, const Texture*& curTexIO);
+	bool	CascadeView(const com::Vec3& dir, float n, float f, cascade_lists& listsOut,
+			GLfloat (&sunWorldToClipOut)[16], GLfloat (&sunViewToClipOut)[16],
+			com::Vec3& centerOut, com::Vec3& lockOut, float& texelSizeOut);
+	void	DrawCascade(GLint x, GLint y, const cascade_lists& lists,
+			const GLfloat (&sunWorldToClip)[16], float texelSize, GLfloat cBias,
+			GLfloat cSlopeBias, const Texture*& curTexIO);
 	template <typename pass>
 	void	SetSharedSunShadowUniforms(const pass& p, const scn::Entity& ent, const MeshGL& msh,
 			GLfloat (&sunMTW)[16], const GLfloat (&sunWTC)[16], GLfloat (&sunMTC)[16],
@@ -221,6 +223,27 @@ static struct
 void rnd::DrawSunShadowMap(const com::Vec3& dir, GLfloat (&sunViewToClips)[4][16],
 	com::Vec3 (&centers)[4], com::Vec3 (&locks)[4])
 {
+	static cascade_lists cascades[4];
+	cascade_lists* jobs[4];
+	GLfloat sunWorldToClips[4][16];
+	float texelSizes[4];
+	bool valid[4];
+	size_t numJobs = 0;
+
+	float dists[5] = {camHull.NearDist(), cascadeDist0.Float(), cascadeDist1.Float(),
+		cascadeDist2.Float(), camHull.FarDist()};
+
+	// List every cascade's zones and entities at once before drawing any
+	for(size_t i = 0; i < 4; i++)
+	{
+		valid[i] = CascadeView(dir, dists[i], dists[i + 1], cascades[i], sunWorldToClips[i],
+			sunViewToClips[i], centers[i], locks[i], texelSizes[i]);
+
+		if(valid[i])
+			jobs[numJobs++] = &cascades[i];
+	}
+
+	RunVisJobs(CascadeDrawListsJob, jobs, numJobs);
 	glDepthMask(GL_TRUE);
 
 	if(usingFBOs.Bool())
@@ -242,20 +265,29 @@ void rnd::DrawSunShadowMap(const com::Vec3& dir, GLfloat (&sunViewToClips)[4][16
 	glDisable(GL_BLEND);
 	const Texture* curTex = 0;
 
-	DrawCascade(0, 0, dir, camHull.NearDist(), cascadeDist0.Float(), polyBias0.Float(),
-		polySlopeBias0.Float(), sunViewToClips[0], centers[0], locks[0], curTex);
+	if(valid[0])
+	{
+		DrawCascade(0, 0, cascades[0], sunWorldToClips[0], texelSizes[0], polyBias0.Float(),
+			polySlopeBias0.Float(), curTex);
+	}
 
-	DrawCascade(allocCascadeRes, 0, dir, cascadeDist0.Float(), cascadeDist1.Float(),
-		polyBias1.Float(), polySlopeBias1.Float(), sunViewToClips[1], centers[1], locks[1],
-		curTex);
+	if(valid[1])
+	{
+		DrawCascade(allocCascadeRes, 0, cascades[1], sunWorldToClips[1], texelSizes[1],
+			polyBias1.Float(), polySlopeBias1.Float(), curTex);
+	}
 
-	DrawCascade(0, allocCascadeRes, dir, cascadeDist1.Float(), cascadeDist2.Float(),
-		polyBias2.Float(), polySlopeBias2.Float(), sunViewToClips[2], centers[2], locks[2],
-		curTex);
+	if(valid[2])
+	{
+		DrawCascade(0, allocCascadeRes, cascades[2], sunWorldToClips[2], texelSizes[2],
+			polyBias2.Float(), polySlopeBias2.Float(), curTex);
+	}
 
-	DrawCascade(allocCascadeRes, allocCascadeRes, dir, cascadeDist2.Float(), camHull.FarDist(),
-		polyBias3.Float(), polySlopeBias3.Float(), sunViewToClips[3], centers[3], locks[3],
-		curTex);
+	if(valid[3])
+	{
+		DrawCascade(allocCascadeRes, allocCascadeRes, cascades[3], sunWorldToClips[3],
+			texelSizes[3], polyBias3.Float(), polySlopeBias3.Float(), curTex);
+	}
 
 	if(usingFBOs.Bool())
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fboLightBuffer);
@@ -274,23 +306,21 @@ void rnd::DrawSunShadowMap(const com::Vec3& dir, GLfloat (&sunViewToClips)[4][16
 }
 
 /*--------------------------------------
-	rnd::DrawCascade
+	rnd::CascadeView
 
-FIXME: option to allow a cascade to not be locked so shadows jitter less on an object moving and rotating with the camera
+Sets up the sun frustum covering the camera between distances n and f. Sets lists' frustum for
+CascadeDrawLists. Returns false if the cascade is empty, in which case nothing is set.
 
-FIXME: disable back face culling for clouds if they're two-sided
+FIXME: option to allow a cascade to not be locked so shadows jitter less on an object moving and rotating with the camera
 --------------------------------------*/
-void rnd::DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f, GLfloat cBias,
-	GLfloat cSlopeBias, GLfloat (&sunViewToClip)[16], com::Vec3& center, com::Vec3& lock,
-	const Texture*& curTex)
+bool rnd::CascadeView(const com::Vec3& dir, float n, float f, cascade_lists& lists,
+	GLfloat (&sunWorldToClip)[16], GLfloat (&sunViewToClip)[16], com::Vec3& center,
+	com::Vec3& lock, float& texelSize)
 {
 	if(n >= f)
-		return;
+		return false;
 
 	GLfloat sunWorldToView[16];
-	GLfloat sunWorldToClip[16];
-	GLfloat sunModelToWorld[16];
-	GLfloat sunModelToClip[16];
 	const scn::Camera& cam = *scn::ActiveCamera();
 	float radius;
 	center = com::VecRot(camHull.MinSphere(radius, n, f), cam.FinalOri());
@@ -300,7 +330,7 @@ void rnd::DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f,
 	WorldToSunView(pitch, yaw, -pos, sunWorldToView);
 
 	// Translate in texel-sized increments to prevent shimmering
-	GLfloat texelSize = radius * 2.0f / allocCascadeRes;
+	texelSize = radius * 2.0f / allocCascadeRes;
 	lock.x = fmod(sunWorldToView[3], texelSize);
 	lock.y = fmod(sunWorldToView[7], texelSize);
 	lock.z = fmod(sunWorldToView[11], texelSize);
@@ -329,6 +359,27 @@ void rnd::DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f,
 	com::Vec3 fMax(sunFar, radius, radius);
 	ViewToClipOrth(-fMax.y, -fMin.y, fMin.z, fMax.z, fMin.x, fMax.x, sunViewToClip);
 	com::Multiply4x4(sunWorldToView, sunViewToClip, sunWorldToClip);
+	lists.pos = pos;
+	lists.pitch = pitch;
+	lists.yaw = yaw;
+	lists.fMin = fMin;
+	lists.fMax = fMax;
+	return true;
+}
+
+/*--------------------------------------
+	rnd::DrawCascade
+
+lists must have been filled by CascadeDrawLists.
+
+FIXME: disable back face culling for clouds if they're two-sided
+--------------------------------------*/
+void rnd::DrawCascade(GLint x, GLint y, const cascade_lists& lists,
+	const GLfloat (&sunWorldToClip)[16], float texelSize, GLfloat cBias, GLfloat cSlopeBias,
+	const Texture*& curTex)
+{
+	GLfloat sunModelToWorld[16];
+	GLfloat sunModelToClip[16];
 	bool fadeProg = false;
 	glUseProgram(shadowSunPass.shaderProgram);
 
@@ -345,8 +396,6 @@ void rnd::DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f,
 	else
 		glClear(GL_DEPTH_BUFFER_BIT);
 
-	size_t numLitZones, numLitEnts;
-	CascadeDrawLists(pos, pitch, yaw, fMin, fMax, litZones, numLitZones, litEnts, numLitEnts);
 	glUniform1f(shadowSunPass.uniLerp, 0.0f);
 	glUniformMatrix4fv(shadowSunPass.uniToClip, 1, GL_FALSE, sunWorldToClip);
 
@@ -360,14 +409,14 @@ void rnd::DrawCascade(GLint x, GLint y, const com::Vec3& dir, float n, float f,
 			sizeof(vertex_world), (void*)0);
 	}
 
-	for(uint32_t i = 0; i < numLitZones; i++)
-		WorldDrawZone(litZones[i]);
+	for(uint32_t i = 0; i < lists.numZones; i++)
+		WorldDrawZone(lists.zones[i]);
 
 	const Mesh* curMsh = 0;
 
-	for(size_t j = 0; j < numLitEnts; j++)
+	for(size_t j = 0; j < lists.numEnts; j++)
 	{
-		const scn::Entity& ent = *litEnts[j];
+		const scn::Entity& ent = *lists.ents[j];
 		const MeshGL* msh = (MeshGL*)ent.Mesh();
 		const TextureGL* tex = (TextureGL*)ent.tex.Value();
 
@@ -984,8 +1033,11 @@ void rnd::DrawShadowMap(const scn::Bulb& bulb, GLfloat& depthProjOut, float radi
 	ViewToClipPersLimited(1.0f, COM_PI * 0.25f, BULB_NEAR, radius, bulbViewToClip);
 	depthProjOut = bulbViewToClip[11];
 	frustum.SetFarDist(radius);
-	size_t numLitEnts;
-	BulbDrawList(bulb, radius, pos, litEnts, numLitEnts, overlaysOut);
+	pointLists.bulb = &bulb;
+	pointLists.radius = radius;
+	pointLists.pos = pos;
+	BulbDrawList(pointLists);
+	overlaysOut |= pointLists.overlays;
 	const Mesh* curMsh = 0;
 	const Texture* curTex = 0;
 
@@ -998,8 +1050,8 @@ void rnd::DrawShadowMap(const scn::Bulb& bulb, GLfloat& depthProjOut, float radi
 		}
 
 		glClear(GL_DEPTH_BUFFER_BIT);
-		DrawShadowMapFace(bulb, pos, ORIS[i], bulbViewToClip, frustum, litEnts.o, numLitEnts,
-			fadeProg, curMsh, curTex);
+		DrawShadowMapFace(bulb, pos, ORIS[i], bulbViewToClip, frustum, pointLists.ents.o,
+			pointLists.numEnts, fadeProg, curMsh, curTex);
 
 		if(!usingFBOs.Bool())
 		{
@@ -14,12 +14,11 @@ namespace rnd
 	};
 
 	// SPOT SHADOW PASS
-	void	DrawSpotShadowMap(const scn::Bulb& spot, GLint x, GLint y, float radius,
-			const com::Vec3& pos, const com::Qua& ori, float outer,
-			GLfloat (&spotViewToClipOut)[16], uint16_t& overlaysOut, bool& fadeProgIO,
-			const Texture*& curTexIO);
-	void	DrawSpotShadowBatch(const scn::Bulb** spots, spot_batch_state* states,
-			size_t numSpots);
+	void	DrawSpotShadowMap(const scn::Bulb& spot, const bulb_lists& lists, GLint x, GLint y,
+			const com::Qua& ori, float outer, GLfloat (&spotViewToClipOut)[16],
+			bool& fadeProgIO, const Texture*& curTexIO);
+	void	DrawSpotShadowBatch(const scn::Bulb** spots, bulb_lists* const* lists,
+			spot_batch_state* states, size_t numSpots);
 	void	ShadowMapViewportOffset(size_t index, GLint& xOut, GLint& yOut);
 	void	ShadowMapCoordsOffset(size_t index, GLfloat& xOut, GLfloat& yOut);
 
@@ -53,12 +52,15 @@ namespace rnd
 
 /*--------------------------------------
 	rnd::DrawSpotShadowMap
+
+lists must have been filled by BulbDrawList for spot.
 --------------------------------------*/
-void rnd::DrawSpotShadowMap(const scn::Bulb& spot, GLint x, GLint y, float radius,
-	const com::Vec3& pos, const com::Qua& ori, float outer, GLfloat (&spotViewToClip)[16],
-	uint16_t& overlaysOut, bool& fadeProg, const Texture*& curTex)
+void rnd::DrawSpotShadowMap(const scn::Bulb& spot, const bulb_lists& lists, GLint x, GLint y,
+	const com::Qua& ori, float outer, GLfloat (&spotViewToClip)[16], bool& fadeProg,
+	const Texture*& curTex)
 {
 	const float SPOT_NEAR = 1.0f;
+	float radius = lists.radius;
 	static hit::Frustum frustum(0.0f, 0.0f, SPOT_NEAR, SPOT_NEAR + 1.0f);
 
 	float outerBig = outer + spotShadowAddedAngle.Float();
@@ -77,12 +79,10 @@ void rnd::DrawSpotShadowMap(const scn::Bulb& spot, GLint x, GLint y, float radiu
 
 	ViewToClipPersLimited(1.0f, outerBig, SPOT_NEAR, radius, spotViewToClip);
 	frustum.Set(outerBig, outerBig, SPOT_NEAR, radius);
-	size_t numLitEnts;
-	BulbDrawList(spot, radius, pos, litEnts, numLitEnts, overlaysOut);
 	const Mesh* curMsh = 0;
 
-	DrawShadowMapFace(spot, pos, ori, spotViewToClip, frustum, litEnts.o, numLitEnts, fadeProg,
-		curMsh, curTex);
+	DrawShadowMapFace(spot, lists.pos, ori, spotViewToClip, frustum, lists.ents.o, lists.numEnts,
+		fadeProg, curMsh, curTex);
 
 	if(!usingFBOs.Bool())
 	{
@@ -94,8 +94,8 @@ void rnd::DrawSpotShadowMap(const scn::Bulb& spot, GLint x, GLint y, float radiu
 /*--------------------------------------
 	rnd::DrawSpotShadowBatch
 --------------------------------------*/
-void rnd::DrawSpotShadowBatch(const scn::Bulb** spots, spot_batch_state* states,
-	size_t numSpots)
+void rnd::DrawSpotShadowBatch(const scn::Bulb** spots, bulb_lists* const* lists,
+	spot_batch_state* states, size_t numSpots)
 {
 	timers[TIMER_SPOT_SHADOW_PASS].Start();
 
@@ -133,9 +133,10 @@ void rnd::DrawSpotShadowBatch(const scn::Bulb** spots, spot_batch_state* states,
 		ShadowMapViewportOffset(i, x, y);
 		const scn::Bulb& spot = *spots[i];
 		spot_batch_state& state = states[i];
+		state.overlays = lists[i]->overlays;
 
-		DrawSpotShadowMap(spot, x, y, spot.FinalRadius(), spot.FinalPos(), spot.FinalOri(),
-			spot.FinalOuter(), state.spotViewToClip, state.overlays, fadeProg, curTex);
+		DrawSpotShadowMap(spot, *lists[i], x, y, spot.FinalOri(), spot.FinalOuter(),
+			state.spotViewToClip, fadeProg, curTex);
 	}
 
 	if(curTex)
@@ -513,10 +514,27 @@ void rnd::SpotPass()
 	static com::Arr<spot_batch_state> states(16);
 	states.Ensure(numBatch);
 
+	// List every spot's shadow casters at once before drawing any
+	static com::Arr<bulb_lists*> lists;
+	lists.Ensure(numVisSpots, 0);
+
+	for(size_t i = 0; i < numVisSpots; i++)
+	{
+		if(!lists[i])
+			lists[i] = new bulb_lists;
+
+		bulb_lists& l = *lists[i];
+		l.bulb = visSpots[i];
+		l.radius = l.bulb->FinalRadius();
+		l.pos = l.bulb->FinalPos();
+	}
+
+	RunVisJobs(BulbDrawListJob, lists.o, numVisSpots);
+
 	for(size_t i = 0; i < numVisSpots; i += numBatch)
 	{
 		size_t numSpots = COM_MIN(numVisSpots - i, numBatch);
-		DrawSpotShadowBatch(visSpots.o + i, states.o, numSpots);
+		DrawSpotShadowBatch(visSpots.o + i, lists.o + i, states.o, numSpots);
 		DrawSpotLightBatch(visSpots.o + i, states.o, numSpots);
 	}
 	#else
@@ -82,6 +82,15 @@ namespace rnd
 
 	// SHADOW LUA
 	int CalculateCascadeDistances(lua_State* l);
+
+	// VIS LUA
+	int BenchVis(lua_State* l);
+
+	// SORT LUA
+	int BenchDrawSort(lua_State* l);
+
+	// INSTANCE LUA
+	int CheckModelBatches(lua_State* l);
 }
 
 #endif
\ No newline at end of file
@@ -39,9 +39,11 @@ namespace rnd
 		void UndoStateForEntity(const scn::Entity&) {}
 	} cloudPass = {};
 
-	RegularModelProg modelProg = {0};
+	RegularModelProg modelProg = {0}, instModelProg = {0};
 
 	bool InitCloudPass();
+	bool InitInstancedModelProgram(const char* const* fragSrcs, size_t numFragSrcs);
+	void UploadModelPassUniforms(const RegularModelProg& prog);
 }
 
 /*--------------------------------------
@@ -229,6 +231,15 @@ void rnd::ModelDrawElements(const MeshGL& msh)
 	glDrawElements(GL_TRIANGLES, msh.numFrameIndices, msh.indexType, 0);
 }
 
+/*--------------------------------------
+	rnd::ModelDrawElementsInstanced
+--------------------------------------*/
+void rnd::ModelDrawElementsInstanced(const MeshGL& msh, size_t numInstances)
+{
+	glDrawElementsInstanced(GL_TRIANGLES, msh.numFrameIndices, msh.indexType, 0,
+		(GLsizei)numInstances);
+}
+
 /*--------------------------------------
 	rnd::ModelToWorld
 
@@ -346,26 +357,12 @@ void rnd::ModelPass()
 	// Regular model pass
 	if(numVisEnts)
 	{
-		glUseProgram(modelProg.shaderProgram);
+		const RegularModelProg& prog = InstancingModels() ? instModelProg : modelProg;
+		glUseProgram(prog.shaderProgram);
 		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 		glStencilFunc(GL_GEQUAL, 0, -1); // Don't draw over overlay stencils
-
-		// FIXME: need to set these whenever modelProg is used (e.g. overlay pass)
-		if(modelProg.uniMipBias != -1)
-			glUniform1f(modelProg.uniMipBias, mipBias.Float());
-
-		if(modelProg.uniMipFade != -1)
-			glUniform1f(modelProg.uniMipFade, mipFade.Float());
-
-		PaletteGL* curPal = CurrentPaletteGL();
-
-		if(modelProg.uniRampDistScale != -1)
-			glUniform1f(modelProg.uniRampDistScale, curPal->rampDistScale);
-
-		if(modelProg.uniInvNumRampTexels != -1)
-			glUniform1f(modelProg.uniInvNumRampTexels, curPal->invNumRampTexels);
-	
-		ModelDrawArray<0, true>(modelProg, gWorldToClip, 0, visEnts.o, numVisEnts, curMsh, curTex);
+		UploadModelPassUniforms(prog);
+		ModelDrawInstanced<0>(gWorldToClip, 0, visEnts.o, numVisEnts, curMsh, curTex);
 	}
 
 	// Cloud pass
@@ -392,6 +389,30 @@ void rnd::ModelPass()
 	timers[numVisCloudEnts ? TIMER_CLOUD_PASS : TIMER_MODEL_PASS].Stop();
 }
 
+/*--------------------------------------
+	rnd::UploadModelPassUniforms
+
+prog must be in use.
+
+FIXME: need to set these whenever modelProg is used (e.g. overlay pass)
+--------------------------------------*/
+void rnd::UploadModelPassUniforms(const RegularModelProg& prog)
+{
+	if(prog.uniMipBias != -1)
+		glUniform1f(prog.uniMipBias, mipBias.Float());
+
+	if(prog.uniMipFade != -1)
+		glUniform1f(prog.uniMipFade, mipFade.Float());
+
+	PaletteGL* curPal = CurrentPaletteGL();
+
+	if(prog.uniRampDistScale != -1)
+		glUniform1f(prog.uniRampDistScale, curPal->rampDistScale);
+
+	if(prog.uniInvNumRampTexels != -1)
+		glUniform1f(prog.uniInvNumRampTexels, curPal->invNumRampTexels);
+}
+
 /*--------------------------------------
 	rnd::FilterNoGlass
 --------------------------------------*/
@@ -436,7 +457,7 @@ void rnd::OverlayPass()
 		return;
 
 	ModelState();
-	glUseProgram(modelProg.shaderProgram);
+	glUseProgram(InstancingModels() ? instModelProg.shaderProgram : modelProg.shaderProgram);
 	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 	com::Qua actOri = scn::ActiveCamera()->FinalOri();
 
@@ -459,8 +480,8 @@ void rnd::OverlayPass()
 			}
 
 			// Filtering out GLASS here because overlay glass is drawn in the glass pass
-			ModelDrawArray<FilterNoGlass, true>(modelProg, gOverlayWTC[i], &normOri,
-				ovr.Entities(), ovr.NumEntities(), curMsh, curTex);
+			ModelDrawInstanced<FilterNoGlass>(gOverlayWTC[i], &normOri, ovr.Entities(),
+				ovr.NumEntities(), curMsh, curTex);
 		}
 	}
 
@@ -559,6 +580,22 @@ bool rnd::ReinitModelProgram()
 	// Reset
 	glUseProgram(0);
 
+	if(extensions.instancing)
+	{
+		const char* instFragSrcs[sizeof(fragSrcs) / sizeof(char*) + 1];
+		size_t numInstFragSrcs = 0;
+
+		for(size_t i = 0; i < sizeof(fragSrcs) / sizeof(char*) - 1; i++)
+			instFragSrcs[numInstFragSrcs++] = fragSrcs[i];
+
+		instFragSrcs[numInstFragSrcs++] = "\n#define INSTANCED\n";
+		instFragSrcs[numInstFragSrcs++] = fragModelSource;
+
+		// Not a failure; ModelDrawInstanced falls back to modelProg
+		if(!InitInstancedModelProgram(instFragSrcs, numInstFragSrcs))
+			con::LogF("Instanced model program initialization failed");
+	}
+
 	return true;
 
 fail:
@@ -575,8 +612,87 @@ void rnd::DeleteModelProgram()
 	if(modelProg.shaderProgram) glDeleteProgram(modelProg.shaderProgram);
 	if(modelProg.vertexShader) glDeleteShader(modelProg.vertexShader);
 	if(modelProg.fragmentShader) glDeleteShader(modelProg.fragmentShader);
+	if(instModelProg.shaderProgram) glDeleteProgram(instModelProg.shaderProgram);
+	if(instModelProg.vertexShader) glDeleteShader(instModelProg.vertexShader);
+	if(instModelProg.fragmentShader) glDeleteShader(instModelProg.fragmentShader);
 
 	memset(&modelProg, 0, sizeof(modelProg));
+	memset(&instModelProg, 0, sizeof(instModelProg));
+}
+
+/*--------------------------------------
+	rnd::InitInstancedModelProgram
+
+Makes instModelProg. Uniforms that are per-instance attributes stay -1. Deletes the program on
+failure.
+--------------------------------------*/
+bool rnd::InitInstancedModelProgram(const char* const* fragSrcs, size_t numFragSrcs)
+{
+	prog_attribute attributes[] =
+	{
+		{RND_MODEL_PASS_ATTRIB_POS0, "pos0"},
+		{RND_MODEL_PASS_ATTRIB_POS1, "pos1"},
+		{RND_MODEL_PASS_ATTRIB_TEXCOORD, "texCoord"},
+		{RND_MODEL_PASS_ATTRIB_NORM0, "norm0"},
+		{RND_MODEL_PASS_ATTRIB_NORM1, "norm1"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP, "modelToClip0"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP + 1, "modelToClip1"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP + 2, "modelToClip2"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP + 3, "modelToClip3"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_NORMAL, "modelToNormal0"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_NORMAL + 1, "modelToNormal1"},
+		{RND_MODEL_INST_ATTRIB_MODEL_TO_NORMAL + 2, "modelToNormal2"},
+		{RND_MODEL_INST_ATTRIB_TEX_SHIFT_LERP, "texShiftLerp"},
+		{RND_MODEL_INST_ATTRIB_SUB_PAL_OPACITY, "subPaletteOpacity"},
+		{0, 0}
+	};
+
+	prog_uniform uniforms[] =
+	{
+		{&instModelProg.uniTexDims, "texDims"},
+		{&instModelProg.uniDither, "dither"},
+		{&instModelProg.uniMipBias, "mipBias"},
+		{&instModelProg.uniMipFade, "mipFade"},
+		{&instModelProg.uniRampDistScale, "rampDistScale"},
+		{&instModelProg.uniInvNumRampTexels, "invNumRampTexels"},
+		{&instModelProg.samTexture, "texture"},
+		{&instModelProg.samSubPalettes, "subPalettes"},
+		{&instModelProg.samRampLookup, "rampLookup"},
+		{&instModelProg.samRamps, "ramps"},
+		{0, 0}
+	};
+
+	instModelProg.uniLerp = instModelProg.uniTexShift = instModelProg.uniModelToClip =
+		instModelProg.uniModelToNormal = instModelProg.uniSubPalette =
+		instModelProg.uniOpacity = -1;
+
+	if(!InitProgram("instanced model", instModelProg.shaderProgram, instModelProg.vertexShader,
+	&vertModelInstancedSource, 1, instModelProg.fragmentShader, fragSrcs, numFragSrcs,
+	attributes, uniforms))
+	{
+		if(instModelProg.shaderProgram) glDeleteProgram(instModelProg.shaderProgram);
+		if(instModelProg.vertexShader) glDeleteShader(instModelProg.vertexShader);
+		if(instModelProg.fragmentShader) glDeleteShader(instModelProg.fragmentShader);
+		memset(&instModelProg, 0, sizeof(instModelProg));
+		return false;
+	}
+
+	glUseProgram(instModelProg.shaderProgram); // RESET
+
+	// Set constant uniforms
+	GLfloat dither[16];
+	MakeDitherArray(dither);
+
+	glUniform1fv(instModelProg.uniDither, 16, dither);
+	glUniform1i(instModelProg.samTexture, RND_VARIABLE_TEXTURE_NUM);
+	glUniform1i(instModelProg.samSubPalettes, RND_SUB_PALETTES_TEXTURE_NUM);
+	glUniform1i(instModelProg.samRamps, RND_RAMP_TEXTURE_NUM);
+	glUniform1i(instModelProg.samRampLookup, RND_RAMP_LOOKUP_TEXTURE_NUM);
+
+	// Reset
+	glUseProgram(0);
+
+	return true;
 }
 
 /*--------------------------------------
@@ -39,4 +39,42 @@ void ModelDrawArray(Pass& p, const GLfloat (&wtc)[16], const com::Qua* normOri,
 		ModelDrawElements(*msh);
 		p.UndoStateForEntity(ent);
 	}
+}
+
+/*--------------------------------------
+	rnd::ModelDrawInstanced
+
+Draws ents with instModelProg, one instanced call per run of entities sharing a mesh, texture,
+and frame pair. instModelProg must be in use. Falls back to ModelDrawArray with modelProg, which
+must be in use instead, if InstancingModels returns false.
+--------------------------------------*/
+template <bool (*Filter)(const scn::Entity&), class EntPtr>
+void ModelDrawInstanced(const GLfloat (&wtc)[16], const com::Qua* normOri, const EntPtr* ents,
+	size_t numEnts, const Mesh*& curMsh, const Texture*& curTex)
+{
+	if(!InstancingModels())
+	{
+		ModelDrawArray<Filter, true>(modelProg, wtc, normOri, ents, numEnts, curMsh, curTex);
+		return;
+	}
+
+	modelDraws.Ensure(numEnts);
+	size_t numDraws = 0;
+
+	for(size_t i = 0; i < numEnts; i++)
+	{
+		const scn::Entity& ent = *ents[i];
+
+		if(!(ent.flags & ent.VISIBLE) || (Filter && !Filter(ent)))
+			continue;
+
+		model_draw& d = modelDraws[numDraws++];
+		d.ent = &ent;
+		d.msh = (MeshGL*)ent.Mesh();
+		d.tex = (TextureGL*)ent.tex.Value();
+		ModelVertexAttribOffset(ent, *d.msh, d.offsets, d.lerp);
+	}
+
+	size_t numCmds = BatchModelDraws(modelDraws.o, numDraws, curMsh, curTex, modelCmds);
+	DrawModelBatches(modelDraws.o, numDraws, modelCmds.o, numCmds, wtc, curMsh, curTex);
 }
\ No newline at end of file
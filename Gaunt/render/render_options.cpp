@@ -39,6 +39,7 @@ namespace rnd
 		preciseClipRange("rnd_precise_clip_range", false, con::ReadOnly), // Clip space z is [1, 0] instead of [1, -1]
 		highDepthBuffer("rnd_high_depth_buffer", false, con::ReadOnly),
 		forceLowDepthBuffer("rnd_force_low_depth_buffer", false, ResetViewportBool),
+		instancing("rnd_instancing", true), // Ignored if GL 3.3 is unavailable
 		shadowRes("rnd_shadow_res", 1024, SetTextureDimension),
 		sunShadowRes("rnd_sun_shadow_res", 2048, SetTextureDimension), // Res of each cascade
 		kernelSize("rnd_kernel_size", 0.6f),
@@ -114,6 +115,7 @@ namespace rnd
 		solidLeafColor("rnd_solid_leaf_color", -1),
 		lineWidth("rnd_line_width", 1, SetLineWidth),
 		timeRender("rnd_time_render", 0),
+		timeRenderWindow("rnd_time_render_window", 60.0f, con::PositiveIntegerOnly),
 		lockCullCam("rnd_lock_cull_cam", false),
 		antiAliasing("rnd_anti_aliasing", ANTI_ALIASING_SOFT_FXAA, SetAntiAliasing),
 		fxaaQualitySubpix("rnd_fxaa_subpix", 0.0f), // Only affects original FXAA
@@ -15,6 +15,7 @@
 #include "../scene/scene.h"
 #include "../script/script.h"
 #include "../wrap/glengine.h"
+#include "../wrap/wrap.h"
 
 #define RND_VARIABLE_TEXTURE_UNIT		GL_TEXTURE0 // Used for everything except palettes
 #define RND_VARIABLE_TEXTURE_NUM		0
@@ -56,6 +57,13 @@
 #define RND_MODEL_PASS_ATTRIB_NORM0		3
 #define RND_MODEL_PASS_ATTRIB_NORM1		4
 
+// Per-instance attributes of the instanced model program
+#define RND_MODEL_INST_ATTRIB_MODEL_TO_CLIP		5 // 4 rows
+#define RND_MODEL_INST_ATTRIB_MODEL_TO_NORMAL	9 // 3 rows
+#define RND_MODEL_INST_ATTRIB_TEX_SHIFT_LERP	12
+#define RND_MODEL_INST_ATTRIB_SUB_PAL_OPACITY	13
+#define RND_MODEL_INST_NUM_VERTEX_ATTRIBS		14
+
 #define RND_LIGHT_PASS_ATTRIB_POS0		0
 #define RND_LIGHT_PASS_ATTRIB_POS1		1
 #define RND_LIGHT_PASS_ATTRIB_TEXCOORD	2
@@ -215,31 +223,40 @@ struct zone_reg
 
 /*======================================
 	rnd::Timer
+
+Measures GPU time between Start and Stop with timestamp queries, so timers can nest. Each frame's
+queries are read back a few frames later once they're available instead of stalling for them.
+Times are summed per frame and published as an average and max every rnd_time_render_window
+timed frames.
 ======================================*/
 class Timer
 {
 public:
 					Timer();
-					~Timer();
-	void			Init();
 	void			Start();
 	void			Stop();
-	void			Reset();
-	GLuint			Accumulated();
+	float			AverageMS() const {return avgMS;}
+	float			MaxMS() const {return maxMS;}
 
-private:
-	GLuint			query;
-	GLuint			accum;
-	bool			pending;
-	static Timer*	timing;
+	static bool		BeginFrame();
+	static bool		EndFrame();
 
-	void			UpdateAccumulated();
+private:
+	size_t			span; // Index + 1 of the open span in the current frame, 0 if stopped
+	GLuint64		frameNS, windowNS, windowMaxNS;
+	float			avgMS, maxMS;
+	Timer*			next;
+	static Timer*	first;
+
+	static size_t	Timestamp();
+	static void		ResolveFrames();
+	static void		CloseWindow();
 };
 
 // render.cpp
 struct render_extensions
 {
-	bool fbo, depthBufferFloat, clipControl, timer;
+	bool fbo, depthBufferFloat, clipControl, timer, instancing, bufferStorage;
 };
 
 extern render_extensions extensions;
@@ -360,23 +377,110 @@ void CheckCurveUpdates();
 void CalculateCurveTexture();
 void DrawCurve(int color);
 
+// render_sort.cpp
+// Scratch for SortDrawKeys; each concurrent sort needs its own
+struct draw_sort_temp
+{
+	com::Arr<uint64_t>				keys;
+	com::Arr<const scn::Entity*>	ents;
+
+	~draw_sort_temp() {keys.Free(); ents.Free();}
+};
+
+uint64_t	ModelDrawKey(const scn::Entity& ent, float depthFraction);
+uint64_t	ShadowDrawKey(const scn::Entity& ent, float depthFraction);
+void		SortDrawKeys(const scn::Entity** entsIO, uint64_t* keysIO, size_t num,
+			draw_sort_temp& temp);
+int			CmpEntityModels(const void* a, const void* b);
+
 // render_vis.cpp
+/*======================================
+	rnd::VisMarks
+
+Visited marks owned by one flood so floods can run concurrently instead of sharing the scene's
+drawCode and hitCode members. Zones are marked by index, entities and bulbs by address in an
+open-addressed table. BeginZones and BeginObjs clear their marks by incrementing a code.
+======================================*/
+class VisMarks
+{
+public:
+				VisMarks() : numObjs(0), zoneCode(0), objCode(0) {}
+				~VisMarks() {zoneCodes.Free(); objs.Free();}
+	void		BeginZones();
+	void		BeginObjs();
+	bool		Zone(const scn::Zone& zone) const;
+	bool		MarkZone(const scn::Zone& zone);
+	bool		Obj(const void* obj) const;
+	bool		MarkObj(const void* obj);
+
+private:
+	struct obj_mark
+	{
+		const void*	obj;
+		unsigned	code;
+	};
+
+	com::Arr<unsigned>	zoneCodes;
+	com::Arr<obj_mark>	objs; // Power-of-two size
+	size_t				numObjs;
+	unsigned			zoneCode, objCode;
+
+				VisMarks(const VisMarks&);
+	VisMarks&	operator=(const VisMarks&);
+	size_t		ObjSlot(const void* obj) const;
+	void		GrowObjs();
+};
+
+// Input and output of a sun cascade's draw list job
+struct cascade_lists
+{
+	com::Vec3						pos, fMin, fMax;
+	float							pitch, yaw;
+	com::Arr<const scn::Zone*>		zones;
+	com::Arr<const scn::Entity*>	ents;
+	com::Arr<uint64_t>				keys; // ShadowDrawKey of each ent
+	size_t							numZones, numEnts;
+	VisMarks						marks;
+	draw_sort_temp					sortTemp;
+	com::Arr<com::Plane>			tempPlanes;
+	com::Poly						tempClip, frsClip;
+
+	cascade_lists() : numZones(0), numEnts(0) {}
+	~cascade_lists() {zones.Free(); ents.Free(); keys.Free(); tempPlanes.Free();}
+};
+
+// Input and output of a bulb's shadow draw list job
+struct bulb_lists
+{
+	const scn::Bulb*				bulb;
+	float							radius;
+	com::Vec3						pos;
+	com::Arr<const scn::Entity*>	ents;
+	com::Arr<uint64_t>				keys; // ShadowDrawKey of each ent
+	size_t							numEnts;
+	uint16_t						overlays;
+	VisMarks						marks;
+	draw_sort_temp					sortTemp;
+
+	bulb_lists() : bulb(0), radius(0.0f), numEnts(0), overlays(0) {}
+	~bulb_lists() {ents.Free(); keys.Free();}
+};
+
 extern com::Arr<const scn::Zone*> visZones;
 extern com::Arr<const scn::Entity*> visEnts, visCloudEnts, visGlassEnts;
 extern com::Arr<const scn::Bulb*> visBulbs, visSpots;
 extern size_t numVisZones, numVisEnts, numVisCloudEnts, numVisGlassEnts, numVisBulbs,
 	numVisSpots;
 extern hit::Frustum camHull;
-extern com::Vec3 prevSunDir;
-
-void	FloodVisible(unsigned& zoneVisCodeOut);
-void	FloodSunVisible();
-bool	TrimVisibleSunBranches(unsigned zoneVisCode);
-void	CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const com::Vec3& fMin,
-		const com::Vec3& fMax, com::Arr<const scn::Zone*>& litZonesOut, size_t& numLitZonesOut,
-		com::Arr<const scn::Entity*>& litEntsOut, size_t& numLitEntsOut);
-void	BulbDrawList(const scn::Bulb& bulb, float radius, const com::Vec3& pos,
-		com::Arr<const scn::Entity*>& litEntsOut, size_t& numLitEntsOut, uint16_t& overlaysOut);
+
+void	RunVisJobs(wrp::job_func func, void* data, size_t numJobs);
+void	FloodVisible();
+void	ResetVisibility();
+bool	TrimVisibleSunBranches();
+void	CascadeDrawLists(cascade_lists& lists);
+void	CascadeDrawListsJob(void* data, size_t job, size_t worker);
+void	BulbDrawList(bulb_lists& lists);
+void	BulbDrawListJob(void* data, size_t job, size_t worker);
 void	BulbLitFlags(const scn::Bulb& bulb, float radius, const com::Vec3& pos,
 		uint16_t& overlaysOut);
 float	PortalGap(const scn::PortalSet& set, const com::Vec3& pos, bool fwd);
@@ -423,7 +527,7 @@ public:
 	void	UndoStateForEntity(const scn::Entity&) {}
 };
 
-extern RegularModelProg modelProg;
+extern RegularModelProg modelProg, instModelProg;
 
 void		ModelUploadMTC(GLint uniMTC, const scn::Entity& ent,
 			const GLfloat (&wtc)[16]);
@@ -441,6 +545,7 @@ void		ModelVertexAttribOffset(const scn::Entity& ent, const MeshGL& msh,
 void		ModelSetPlaceVertexAttribPointers(const Mesh& msh, const size_t (&offsets)[2]);
 void		ModelSetTexcoordVertexAttribPointer(const Mesh& msh);
 void		ModelDrawElements(const MeshGL& msh);
+void		ModelDrawElementsInstanced(const MeshGL& msh, size_t numInstances);
 void		ModelToWorld(const com::Vec3& pos, const com::Qua& ori, float scale,
 			GLfloat (&mtwOut)[16], GLfloat (*mtnOut)[16] = 0, const com::Qua* normOri = 0);
 void		ModelToWorld(const scn::Entity& ent, GLfloat (&mOut)[16]);
@@ -455,6 +560,43 @@ bool		ReinitModelProgram();
 void		DeleteModelProgram();
 void		EnsureModelProgram();
 
+// render_instance.cpp
+// An entity to draw with the instanced model program
+struct model_draw
+{
+	const scn::Entity*	ent;
+	const MeshGL*		msh;
+	const TextureGL*	tex;
+	size_t				offsets[2]; // Frame offsets from ModelVertexAttribOffset
+	float				lerp;
+};
+
+// A command made by BatchModelDraws; start and num index the model_draw array
+struct model_cmd
+{
+	enum cmd_type
+	{
+		BIND_MESH, // Bind draws[start]'s mesh
+		BIND_TEXTURE, // Bind draws[start]'s texture
+		DRAW // Draw draws[start] to draws[start + num - 1] in one instanced call
+	};
+
+	cmd_type	type;
+	size_t		start, num;
+};
+
+extern com::Arr<model_draw>	modelDraws;
+extern com::Arr<model_cmd>	modelCmds;
+
+bool		InstancingModels();
+size_t		BatchModelDraws(const model_draw* draws, size_t numDraws, const Mesh* curMsh,
+			const Texture* curTex, com::Arr<model_cmd>& cmdsOut);
+void		DrawModelBatches(const model_draw* draws, size_t numDraws, const model_cmd* cmds,
+			size_t numCmds, const GLfloat (&wtc)[16], const Mesh*& curMsh,
+			const Texture*& curTex);
+void		BeginInstanceFrame();
+void		EndInstanceFrame();
+
 #include "render_model_pass_template.h"
 
 // render_sky.cpp
@@ -480,8 +622,6 @@ struct shadow_fade_pass_type
 	GLint	samTexture;
 };
 
-extern com::Arr<const scn::Zone*> litZones; // Kept allocated for shadow map functions
-extern com::Arr<const scn::Entity*>	litEnts;
 extern shadow_pass_type shadowPass;
 extern shadow_fade_pass_type shadowFadePass;
 
@@ -557,6 +697,7 @@ extern char *vertSimpleSource, *fragSimpleSource,
 	*vertWorldSource, *fragWorldSource,
 	*vertWorldGlassSource, *fragWorldGlassSource,
 	*vertModelSource, *fragModelSource,
+	*vertModelInstancedSource,
 	*fragModelFadeSource,
 	*vertModelNoNormalSource,
 	*fragModelAddSource,
@@ -586,6 +586,57 @@ char* rnd::vertModelSource = {
 	"}"
 };
 
+/* Same as vertModelSource but the per-entity uniforms are per-instance attributes. Matrices come
+in as rows. Pair with fragModelSource and INSTANCED defined. */
+char* rnd::vertModelInstancedSource = {
+	"#version 130\n"
+
+	// model space
+	"in vec4 pos0;"
+	"in vec4 pos1;"
+
+	"in vec2 texCoord;"
+
+	// model space
+	"in vec4 norm0;"
+	"in vec4 norm1;"
+
+	// per instance
+	"in vec4 modelToClip0;"
+	"in vec4 modelToClip1;"
+	"in vec4 modelToClip2;"
+	"in vec4 modelToClip3;"
+	"in vec3 modelToNormal0;"
+	"in vec3 modelToNormal1;"
+	"in vec3 modelToNormal2;"
+	"in vec3 texShiftLerp;"
+	"in vec2 subPaletteOpacity;"
+
+	"uniform vec2 texDims;"
+
+	"out vec2 tc;"
+	"out vec2 origTexel;"
+	"out " NORMAL_PACKED_TYPE " packedNorm;"
+	"flat out float subPalette;"
+	"flat out float opacity;"
+
+	SHADER_FUNC_PACK_NORMAL
+
+	"void main()"
+	"{"
+		"float lerp = texShiftLerp.z;"
+		"mat3 modelToNormal = mat3(modelToNormal0, modelToNormal1, modelToNormal2);"
+		"mat4 modelToClip = mat4(modelToClip0, modelToClip1, modelToClip2, modelToClip3);"
+
+		"tc = texCoord + texShiftLerp.xy;"
+		"origTexel = tc * texDims;"
+		"packedNorm = PackNormal(mix(norm0, norm1, lerp).xyz * modelToNormal);"
+		"gl_Position = mix(pos0, pos1, lerp) * modelToClip;"
+		"subPalette = subPaletteOpacity.x;"
+		"opacity = subPaletteOpacity.y;"
+	"}"
+};
+
 #if 0 // FIXME: make the transparency stuff a #define so the same shader source can be used to make two shader programs
 char* rnd::fragModelSource = {
 	"#version 120\n"
@@ -612,8 +663,14 @@ char* rnd::fragModelFadeSource = {
 #else
 char* rnd::fragModelSource = {
 #endif
-	"uniform float subPalette;"
-	"uniform float opacity;"
+	"\n#ifdef INSTANCED\n"
+		"flat in float subPalette;"
+		"flat in float opacity;"
+	"\n#else\n"
+		"uniform float subPalette;"
+		"uniform float opacity;"
+	"\n#endif\n"
+
 	"uniform float dither[16];"
 	"uniform sampler2D texture;"
 	"uniform sampler2D subPalettes;"
@@ -0,0 +1,322 @@
+// render_sort.cpp -- Draw list sort keys
+// Martynas Ceicys
+
+#include <string.h>
+
+#include "render.h"
+#include "render_private.h"
+#include "render_lua.h"
+#include "../console/console.h"
+
+/* Draw key bits, most significant first:
+	2	pass; shadow lists order opaque, alpha-tested, translucent, translucent alpha-tested
+	20	mesh vertex buffer name
+	20	texture name
+	16	depth bucket, near to far
+
+Names past 2^20 share bits with lower names, which only costs state changes. */
+#define RND_KEY_PASS_SHIFT		56
+#define RND_KEY_MESH_SHIFT		36
+#define RND_KEY_TEXTURE_SHIFT	16
+#define RND_KEY_NAME_MASK		0xfffff
+#define RND_KEY_DEPTH_MAX		0xffff
+
+#define RND_RADIX_MIN 32 // Lists shorter than this are insertion sorted
+
+namespace rnd
+{
+	uint64_t	DrawKey(const scn::Entity& ent, unsigned pass, float depthFraction);
+	void		InsertionSortDrawKeys(const scn::Entity** ents, uint64_t* keys, size_t num);
+}
+
+/*--------------------------------------
+	rnd::DrawKey
+--------------------------------------*/
+uint64_t rnd::DrawKey(const scn::Entity& ent, unsigned pass, float depthFraction)
+{
+	const MeshGL* msh = (MeshGL*)ent.Mesh();
+	const TextureGL* tex = (TextureGL*)ent.tex.Value();
+	depthFraction = COM_MIN(COM_MAX(depthFraction, 0.0f), 1.0f);
+
+	return (uint64_t)pass << RND_KEY_PASS_SHIFT |
+		(uint64_t)(msh->vBufName & RND_KEY_NAME_MASK) << RND_KEY_MESH_SHIFT |
+		(uint64_t)(tex->texName & RND_KEY_NAME_MASK) << RND_KEY_TEXTURE_SHIFT |
+		(uint64_t)(depthFraction * RND_KEY_DEPTH_MAX);
+}
+
+/*--------------------------------------
+	rnd::ModelDrawKey
+
+Sorts by mesh, then texture, then depth. depthFraction is clamped to [0, 1].
+--------------------------------------*/
+uint64_t rnd::ModelDrawKey(const scn::Entity& ent, float depthFraction)
+{
+	return DrawKey(ent, 0, depthFraction);
+}
+
+/*--------------------------------------
+	rnd::ShadowDrawKey
+
+Sorts by opaque/transparent, then mesh, then texture, then depth.
+--------------------------------------*/
+uint64_t rnd::ShadowDrawKey(const scn::Entity& ent, float depthFraction)
+{
+	unsigned pass = (ent.FinalOpacity() != 1.0f) << 1 | ent.tex.Value()->Alpha();
+	return DrawKey(ent, pass, depthFraction);
+}
+
+/*--------------------------------------
+	rnd::SortDrawKeys
+
+Sorts ents and keys by keys with an LSD radix sort, one byte per pass. Bytes that are the same in
+every key are skipped.
+--------------------------------------*/
+void rnd::SortDrawKeys(const scn::Entity** ents, uint64_t* keys, size_t num, draw_sort_temp& temp)
+{
+	if(num < RND_RADIX_MIN)
+	{
+		InsertionSortDrawKeys(ents, keys, num);
+		return;
+	}
+
+	uint32_t counts[8][256];
+	memset(counts, 0, sizeof(counts));
+
+	for(size_t i = 0; i < num; i++)
+	{
+		uint64_t key = keys[i];
+
+		for(size_t d = 0; d < 8; d++)
+			counts[d][key >> d * 8 & 0xff]++;
+	}
+
+	temp.keys.Ensure(num);
+	temp.ents.Ensure(num);
+	uint64_t* srcKeys = keys;
+	uint64_t* destKeys = temp.keys.o;
+	const scn::Entity** srcEnts = ents;
+	const scn::Entity** destEnts = temp.ents.o;
+
+	for(size_t d = 0; d < 8; d++)
+	{
+		uint32_t* count = counts[d];
+		size_t shift = d * 8;
+
+		if(count[srcKeys[0] >> shift & 0xff] == num)
+			continue;
+
+		uint32_t offset = 0;
+
+		for(size_t b = 0; b < 256; b++)
+		{
+			uint32_t n = count[b];
+			count[b] = offset;
+			offset += n;
+		}
+
+		for(size_t i = 0; i < num; i++)
+		{
+			uint32_t dest = count[srcKeys[i] >> shift & 0xff]++;
+			destKeys[dest] = srcKeys[i];
+			destEnts[dest] = srcEnts[i];
+		}
+
+		com::Swap(srcKeys, destKeys);
+		com::Swap(srcEnts, destEnts);
+	}
+
+	if(srcKeys != keys)
+	{
+		memcpy(keys, srcKeys, num * sizeof(uint64_t));
+		memcpy(ents, srcEnts, num * sizeof(const scn::Entity*));
+	}
+}
+
+/*--------------------------------------
+	rnd::InsertionSortDrawKeys
+--------------------------------------*/
+void rnd::InsertionSortDrawKeys(const scn::Entity** ents, uint64_t* keys, size_t num)
+{
+	for(size_t i = 1; i < num; i++)
+	{
+		uint64_t key = keys[i];
+		const scn::Entity* ent = ents[i];
+		size_t j = i;
+
+		for(; j && keys[j - 1] > key; j--)
+		{
+			keys[j] = keys[j - 1];
+			ents[j] = ents[j - 1];
+		}
+
+		keys[j] = key;
+		ents[j] = ent;
+	}
+}
+
+/*--------------------------------------
+	rnd::CmpEntityModels
+
+Sort by mesh then texture. Draw lists are sorted with ModelDrawKey instead; this is kept to check
+and time against.
+--------------------------------------*/
+int rnd::CmpEntityModels(const void* av, const void* bv)
+{
+	const scn::Entity* a = *(const scn::Entity**)av;
+	const MeshGL* aMsh = (MeshGL*)a->Mesh();
+	const TextureGL* aTex = (TextureGL*)a->tex.Value();
+	const scn::Entity* b = *(const scn::Entity**)bv;
+	const MeshGL* bMsh = (MeshGL*)b->Mesh();
+	const TextureGL* bTex = (TextureGL*)b->tex.Value();
+
+	if(aMsh->vBufName == bMsh->vBufName)
+	{
+		if(aTex->texName == bTex->texName)
+			return 0;
+
+		return aTex->texName < bTex->texName ? -1 : 1;
+	}
+	else
+		return aMsh->vBufName < bMsh->vBufName ? -1 : 1;
+}
+
+/*
+################################################################################################
+
+
+	SORT LUA
+
+
+################################################################################################
+*/
+
+namespace rnd
+{
+	struct bench_sort
+	{
+		const char*	name;
+		uint64_t	(*Key)(const scn::Entity& ent, float depthFraction);
+		int			(*Cmp)(const void* a, const void* b);
+	};
+}
+
+/*--------------------------------------
+LUA	rnd::BenchDrawSort (rnd_bench_draw_sort)
+
+IN	[iNumEnts = 10000, iSeed = 1]
+
+Fills a draw list with random picks of the world's entities that have a model and times qsort
+with the old comparators against building draw keys and radix sorting them. Alerts if a radix
+sorted list is out of order by the comparator.
+--------------------------------------*/
+int rnd::BenchDrawSort(lua_State* l)
+{
+	static const size_t NUM_REPS = 10;
+	size_t num = luaL_optinteger(l, 1, 10000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+
+	// Gather entities with a model from the world's zones
+	scn::FlushLinks();
+	com::Arr<const scn::Entity*> models(64);
+	size_t numModels = 0;
+
+	for(uint32_t z = 0; z < scn::NumZones(); z++)
+	{
+		const scn::Zone& zone = scn::Zones()[z];
+
+		for(size_t i = 0; i < zone.numEntLinks; i++)
+		{
+			for(const scn::Entity* ent = zone.entLinks[i].obj; ent; ent = ent->Child())
+			{
+				if(!ent->Mesh() || !ent->tex)
+					continue;
+
+				size_t j = 0;
+				for(; j < numModels && models[j] != ent; j++);
+
+				if(j != numModels)
+					continue;
+
+				models.Ensure(numModels + 1);
+				models[numModels++] = ent;
+			}
+		}
+	}
+
+	if(!num || !numModels)
+	{
+		CON_ERROR("No entities or no linked entities with a model");
+		models.Free();
+		return 0;
+	}
+
+	const scn::Entity** src = new const scn::Entity*[num];
+	float* depths = new float[num];
+	const scn::Entity** ents = new const scn::Entity*[num];
+	uint64_t* keys = new uint64_t[num];
+	draw_sort_temp temp;
+
+	for(size_t i = 0; i < num; i++)
+	{
+		src[i] = models[(size_t)(com::BenchRandF(seed) * numModels)];
+		depths[i] = com::BenchRandF(seed);
+	}
+
+	const bench_sort sorts[2] = {
+		{"Model", ModelDrawKey, CmpEntityModels},
+		{"Shadow", ShadowDrawKey, CmpShadowEntities}
+	};
+
+	double usPerTick = 1e6 / wrp::TicksPerSecond() / NUM_REPS;
+	con::LogF("%u entities from %u models, %u reps:", (unsigned)num, (unsigned)numModels,
+		(unsigned)NUM_REPS);
+
+	for(size_t s = 0; s < 2; s++)
+	{
+		const bench_sort& sort = sorts[s];
+		unsigned long long qsortTicks = 0, keyTicks = 0, radixTicks = 0;
+		size_t numUnordered = 0;
+
+		for(size_t r = 0; r < NUM_REPS; r++)
+		{
+			memcpy(ents, src, num * sizeof(const scn::Entity*));
+			unsigned long long start = wrp::Ticks();
+			qsort(ents, num, sizeof(const scn::Entity*), sort.Cmp);
+			qsortTicks += wrp::Ticks() - start;
+
+			memcpy(ents, src, num * sizeof(const scn::Entity*));
+			start = wrp::Ticks();
+
+			for(size_t i = 0; i < num; i++)
+				keys[i] = sort.Key(*ents[i], depths[i]);
+
+			unsigned long long keyed = wrp::Ticks();
+			SortDrawKeys(ents, keys, num, temp);
+			radixTicks += wrp::Ticks() - keyed;
+			keyTicks += keyed - start;
+		}
+
+		for(size_t i = 1; i < num; i++)
+		{
+			if(sort.Cmp(&ents[i - 1], &ents[i]) > 0)
+				numUnordered++;
+		}
+
+		double qsortUS = qsortTicks * usPerTick;
+		double radixUS = radixTicks * usPerTick;
+		double keyUS = keyTicks * usPerTick;
+
+		con::LogF("%s: qsort %g us, keys %g us + radix %g us (%.2fx)", sort.name, qsortUS, keyUS,
+			radixUS, keyUS + radixUS ? qsortUS / (keyUS + radixUS) : 0.0);
+
+		if(numUnordered)
+			con::AlertF("%s: %u radix sorted entities out of order", sort.name, (unsigned)numUnordered);
+	}
+
+	delete[] src;
+	delete[] depths;
+	delete[] ents;
+	delete[] keys;
+	models.Free();
+	return 0;
+}
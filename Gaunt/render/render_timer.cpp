@@ -3,99 +3,190 @@
 
 #include "render_private.h"
 #include "../console/console.h"
+#include "../../GauntCommon/array.h"
 
-rnd::Timer* rnd::Timer::timing = 0;
+#define RND_TIMER_FRAMES 4 // Frames of queries in flight before timing is skipped
+
+namespace rnd
+{
+	struct timer_span
+	{
+		Timer*	timer;
+		size_t	start, end; // Query indices
+	};
+
+	struct timer_frame
+	{
+		com::Arr<GLuint>		queries; // Generated as needed and reused
+		com::Arr<timer_span>	spans;
+		size_t					numGenQueries, numQueries, numSpans;
+	};
+
+	timer_frame	timerFrames[RND_TIMER_FRAMES];
+	size_t		curTimerFrame = 0, oldestTimerFrame = 0, numPendingTimerFrames = 0;
+	size_t		numWindowTimerFrames = 0;
+	bool		timerWindowClosed = false;
+}
+
+rnd::Timer* rnd::Timer::first = 0;
 
 /*--------------------------------------
 	rnd::Timer::Timer
 --------------------------------------*/
-rnd::Timer::Timer() : query(0), accum(0), pending(false) {}
+rnd::Timer::Timer() : span(0), frameNS(0), windowNS(0), windowMaxNS(0), avgMS(0.0f),
+	maxMS(0.0f), next(first)
+{
+	first = this;
+}
 
 /*--------------------------------------
-	rnd::Timer::~Timer
+	rnd::Timer::Start
+
+Does nothing if the timer is already started.
 --------------------------------------*/
-rnd::Timer::~Timer()
+void rnd::Timer::Start()
 {
-	Stop();
+	if(!doTiming || span)
+		return;
 
-	if(query)
-		glDeleteQueries(1, &query);
+	timer_frame& frame = timerFrames[curTimerFrame];
+	frame.spans.Ensure(frame.numSpans + 1);
+	timer_span& s = frame.spans[frame.numSpans];
+	s.timer = this;
+	s.start = s.end = Timestamp();
+	span = ++frame.numSpans;
 }
 
 /*--------------------------------------
-	rnd::Timer::Init
+	rnd::Timer::Stop
 --------------------------------------*/
-void rnd::Timer::Init()
+void rnd::Timer::Stop()
 {
-	if(query)
-		WRP_FATAL("Render timer initialized twice");
+	if(!span)
+		return;
 
-	glGenQueries(1, &query);
+	timerFrames[curTimerFrame].spans[span - 1].end = Timestamp();
+	span = 0;
 }
 
 /*--------------------------------------
-	rnd::Timer::Start
+	rnd::Timer::BeginFrame
+
+Reads back every finished frame's queries. Returns false if all RND_TIMER_FRAMES frames are still
+waiting on the GPU, in which case this frame shouldn't be timed.
 --------------------------------------*/
-void rnd::Timer::Start()
+bool rnd::Timer::BeginFrame()
 {
-	if(!doTiming || timing == this)
-		return;
+	ResolveFrames();
 
-	if(timing)
-	{
-		// Can only have one query running at a time
-		con::LogF("Render timers overlapped");
-		timing->Stop();
-	}
+	if(numPendingTimerFrames == RND_TIMER_FRAMES)
+		return false;
 
-	UpdateAccumulated();
-	glBeginQuery(GL_TIME_ELAPSED, query);
-	timing = this;
+	curTimerFrame = (oldestTimerFrame + numPendingTimerFrames) % RND_TIMER_FRAMES;
+	timer_frame& frame = timerFrames[curTimerFrame];
+	frame.numQueries = frame.numSpans = 0;
+	return true;
 }
 
 /*--------------------------------------
-	rnd::Timer::Stop
+	rnd::Timer::EndFrame
+
+Stops every timer and leaves the frame's queries for a later BeginFrame to read. Returns true if
+a window was closed since the last call, meaning there are new averages and maxes to report.
 --------------------------------------*/
-void rnd::Timer::Stop()
+bool rnd::Timer::EndFrame()
 {
-	if(timing == this)
-	{
-		glEndQuery(GL_TIME_ELAPSED);
-		pending = true;
-		timing = 0;
-	}
+	for(Timer* t = first; t; t = t->next)
+		t->Stop();
+
+	numPendingTimerFrames++;
+	bool closed = timerWindowClosed;
+	timerWindowClosed = false;
+	return closed;
 }
 
 /*--------------------------------------
-	rnd::Timer::Reset
+	rnd::Timer::Timestamp
+
+Queues a timestamp query in the current frame and returns its index.
 --------------------------------------*/
-void rnd::Timer::Reset()
+size_t rnd::Timer::Timestamp()
 {
-	Stop();
-	accum = 0;
-	pending = false;
+	timer_frame& frame = timerFrames[curTimerFrame];
+
+	if(frame.numQueries == frame.numGenQueries)
+	{
+		frame.queries.Ensure(frame.numGenQueries + 1);
+		glGenQueries(frame.queries.n - frame.numGenQueries, frame.queries.o + frame.numGenQueries);
+		frame.numGenQueries = frame.queries.n;
+	}
+
+	glQueryCounter(frame.queries[frame.numQueries], GL_TIMESTAMP);
+	return frame.numQueries++;
 }
 
 /*--------------------------------------
-	rnd::Timer::Accumulated
+	rnd::Timer::ResolveFrames
+
+Reads pending frames in order until one isn't done. The GPU finishes commands in order, so once a
+frame's last query is available, the rest of its queries are too.
 --------------------------------------*/
-GLuint rnd::Timer::Accumulated()
+void rnd::Timer::ResolveFrames()
 {
-	Stop();
-	UpdateAccumulated();
-	return accum;
+	for(; numPendingTimerFrames; numPendingTimerFrames--)
+	{
+		timer_frame& frame = timerFrames[oldestTimerFrame];
+
+		if(frame.numQueries)
+		{
+			GLuint available = 0;
+
+			glGetQueryObjectuiv(frame.queries[frame.numQueries - 1], GL_QUERY_RESULT_AVAILABLE,
+				&available);
+
+			if(!available)
+				break;
+		}
+
+		for(Timer* t = first; t; t = t->next)
+			t->frameNS = 0;
+
+		for(size_t i = 0; i < frame.numSpans; i++)
+		{
+			const timer_span& s = frame.spans[i];
+			GLuint64 start, end;
+			glGetQueryObjectui64v(frame.queries[s.start], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(frame.queries[s.end], GL_QUERY_RESULT, &end);
+			s.timer->frameNS += end > start ? end - start : 0;
+		}
+
+		for(Timer* t = first; t; t = t->next)
+		{
+			t->windowNS += t->frameNS;
+
+			if(t->frameNS > t->windowMaxNS)
+				t->windowMaxNS = t->frameNS;
+		}
+
+		oldestTimerFrame = (oldestTimerFrame + 1) % RND_TIMER_FRAMES;
+
+		if(++numWindowTimerFrames >= timeRenderWindow.Unsigned())
+			CloseWindow();
+	}
 }
 
 /*--------------------------------------
-	rnd::Timer::UpdateAccumulated
+	rnd::Timer::CloseWindow
 --------------------------------------*/
-void rnd::Timer::UpdateAccumulated()
+void rnd::Timer::CloseWindow()
 {
-	if(pending)
+	for(Timer* t = first; t; t = t->next)
 	{
-		GLuint result;
-		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &result);
-		accum += result;
-		pending = false;
+		t->avgMS = (float)(t->windowNS * 1e-06 / numWindowTimerFrames);
+		t->maxMS = (float)(t->windowMaxNS * 1e-06);
+		t->windowNS = t->windowMaxNS = 0;
 	}
-}
\ No newline at end of file
+
+	numWindowTimerFrames = 0;
+	timerWindowClosed = true;
+}
@@ -3,6 +3,9 @@
 
 #include "render.h"
 #include "render_private.h"
+#include "render_lua.h"
+#include "../console/console.h"
+#include "../profile/profile.h"
 
 namespace rnd
 {
@@ -43,6 +46,94 @@ namespace rnd
 		unsigned					fullDrawCode;
 	};
 
+	// A zone seen thru a clipped portal, or thru the camera frustum for the start zone
+	struct vis_window
+	{
+		const scn::Zone*	zone;
+		com::Poly			clip;
+		size_t				planeStart;
+	};
+
+	/*======================================
+		rnd::CameraFlood
+
+	Floods zones thru portals from a camera and lists the visible zones and objects. The descent
+	is kept as a list of windows, so flooding again from the same view only redoes the object
+	tests; objects move every frame but portals don't. Each CameraFlood has its own descent stack
+	and marks, so different CameraFloods may flood at the same time.
+	======================================*/
+	class CameraFlood
+	{
+	public:
+		com::Arr<const scn::Zone*>		zones;
+		com::Arr<const scn::Entity*>	ents, cloudEnts, glassEnts;
+		com::Arr<const scn::Bulb*>		bulbs, spots;
+		size_t							numZones, numEnts, numCloudEnts, numGlassEnts, numBulbs,
+										numSpots;
+		VisMarks						marks;
+
+										CameraFlood();
+										~CameraFlood();
+		void							Flood(const scn::Zone& start, const com::Vec3& pos,
+										const com::Plane* rootPlanes, const com::Poly& rootClip,
+										bool lines);
+		void							Invalidate() {numWindows = 0;}
+		bool							Reused() const {return reused;}
+
+	private:
+		PortalDescent					pd;
+		com::Arr<vis_window>			windows;
+		com::Arr<com::Plane>			windowPlanes;
+		com::Arr<com::Vec3>				dirs;
+		size_t							numWindows, numWindowPlanes;
+		bool							reused;
+		com::Arr<uint64_t>				entKeys, cloudEntKeys, glassEntKeys; // ModelDrawKeys
+		draw_sort_temp					sortTemp;
+		com::Vec3						fwd;
+		float							invDepthRange;
+
+		// View the windows were made from
+		const scn::Zone*				prevWorld;
+		uint32_t						prevNumZones;
+		const scn::Zone*				prevStart;
+		com::Vec3						prevPos;
+		com::Plane						prevPlanes[4];
+		com::Poly						prevClip;
+
+										CameraFlood(const CameraFlood&);
+		CameraFlood&					operator=(const CameraFlood&);
+		bool							SameView(const scn::Zone& start, const com::Vec3& pos,
+										const com::Plane* rootPlanes,
+										const com::Poly& rootClip) const;
+		void							Descend(const scn::Zone& start, const com::Vec3& pos,
+										const com::Plane* rootPlanes, const com::Poly& rootClip,
+										bool lines);
+		void							AddZone(const scn::Zone& zone);
+		void							AddWindow(const scn::Zone& zone, const com::Poly& clip,
+										const com::Plane* plns);
+		void							AddWindowObjects(const vis_window& window,
+										const com::Vec3& cam, bool lines);
+		void							AddEntity(const scn::Entity& ent, uint64_t key);
+		void							AddBulb(const scn::Bulb& bulb);
+	};
+
+	// Input of the jobs run by FloodVisible
+	struct visible_jobs
+	{
+		enum kind
+		{
+			CAMERA,
+			SUN
+		};
+
+		kind				kinds[2];
+		const scn::Zone*	start;
+		com::Vec3			pos, sunDir;
+		com::Plane			planes[4];
+		com::Poly			clip;
+		bool				lines;
+	};
+
 	// Camera visibility
 	com::Arr<const scn::Zone*>		visZones;
 	com::Arr<const scn::Entity*>	visEnts, visCloudEnts, visGlassEnts;
@@ -53,15 +144,20 @@ namespace rnd
 									numVisGlassEnts = 0,
 									numVisBulbs = 0,
 									numVisSpots = 0;
-	PortalDescent					pd(8);
+	CameraFlood						camFlood;
 	hit::Frustum					camHull;
 
 	// Sun visibility
 	com::Vec3		prevSunDir;
 	PortalDescent	spd(8);
 
+	bool	VisLines();
+	void	VisibleJob(void* data, size_t job, size_t worker);
+	void	FloodSunVisible(const com::Vec3& dir);
 	void	CameraFrustum(const scn::Camera& cam, hit::Frustum& frsOut, com::Plane* plnsOut,
 			com::Poly& clipOut);
+	void	FrustumPlanes(const hit::Frustum& frs, const com::Vec3& pos, const com::Qua& ori,
+			com::Plane* plnsOut, com::Poly& clipOut);
 	bool	ClipPortal(com::Poly& clipIO, const com::Plane* plns, size_t num);
 	void	GeneratePerspectivePlanes(const com::Vec3& pos, const com::Poly& clip,
 			com::Plane* planesIO);
@@ -70,17 +166,536 @@ namespace rnd
 	template <bool orthographic>
 	bool	ClipSphere(const com::Vec3& pos, float radius, const com::Plane* plns,
 			size_t numPlns, const com::Poly& clip, const com::Vec3* dirs);
-	void	AddVisibleZoneObjects(const scn::Zone& zone, const com::Poly& clip,
-			const com::Plane* plns, const com::Vec3& cam, unsigned entCode, unsigned bulbCode);
-	void	AddVisibleEntity(const scn::Entity& ent);
-	void	AddVisibleBulb(const scn::Bulb& bulb);
 	void	MinConeSphere(float origRadius, float angle, float& radiusOut, float& offsetOut);
-	int		CmpEntityModels(const void* a, const void* b);
 	void	DrawPortalLines(const com::Poly& poly, int color, float time);
 	void	DrawEntityLines(const scn::Entity& ent, int color, float time);
 	void	DrawBulbLines(const scn::Bulb& bulb, float time);
+
+	// VIS LUA
+	struct bench_pose
+	{
+		const scn::Zone*	start;
+		com::Vec3			pos;
+		com::Plane			planes[4];
+		com::Poly			clip;
+	};
+
+	struct bench_result
+	{
+		size_t	numZones, numObjs;
+		bool	reused;
+	};
+
+	struct bench_vis
+	{
+		const bench_pose*	poses;
+		CameraFlood*		floods; // One per worker
+		bench_result*		results;
+	};
+
+	void	BenchVisJob(void* data, size_t job, size_t worker);
+}
+
+/*
+################################################################################################
+
+
+	VISIBILITY MARKS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rnd::VisMarks::BeginZones
+
+Clears zone marks. Call after the world changes and before marking zones.
+--------------------------------------*/
+void rnd::VisMarks::BeginZones()
+{
+	zoneCodes.Ensure(scn::NumZones(), 0);
+	zoneCode++;
+
+	if(!zoneCode)
+	{
+		for(size_t i = 0; i < zoneCodes.n; i++)
+			zoneCodes[i] = 0;
+
+		zoneCode = 1;
+	}
+}
+
+/*--------------------------------------
+	rnd::VisMarks::BeginObjs
+
+Clears entity and bulb marks.
+--------------------------------------*/
+void rnd::VisMarks::BeginObjs()
+{
+	objCode++;
+	numObjs = 0;
+
+	if(!objCode)
+	{
+		for(size_t i = 0; i < objs.n; i++)
+			objs[i].code = 0;
+
+		objCode = 1;
+	}
+}
+
+/*--------------------------------------
+	rnd::VisMarks::Zone
+--------------------------------------*/
+bool rnd::VisMarks::Zone(const scn::Zone& zone) const
+{
+	return zoneCodes[&zone - scn::Zones()] == zoneCode;
+}
+
+/*--------------------------------------
+	rnd::VisMarks::MarkZone
+
+Returns false if zone was already marked.
+--------------------------------------*/
+bool rnd::VisMarks::MarkZone(const scn::Zone& zone)
+{
+	unsigned& code = zoneCodes[&zone - scn::Zones()];
+
+	if(code == zoneCode)
+		return false;
+
+	code = zoneCode;
+	return true;
+}
+
+/*--------------------------------------
+	rnd::VisMarks::Obj
+--------------------------------------*/
+bool rnd::VisMarks::Obj(const void* obj) const
+{
+	return objs.n && objs[ObjSlot(obj)].code == objCode;
+}
+
+/*--------------------------------------
+	rnd::VisMarks::MarkObj
+
+Returns false if obj was already marked.
+--------------------------------------*/
+bool rnd::VisMarks::MarkObj(const void* obj)
+{
+	if((numObjs + 1) * 2 > objs.n)
+		GrowObjs(); // Keep table at most half full so probes stay short
+
+	obj_mark& mark = objs[ObjSlot(obj)];
+
+	if(mark.code == objCode)
+		return false;
+
+	mark.obj = obj;
+	mark.code = objCode;
+	numObjs++;
+	return true;
+}
+
+/*--------------------------------------
+	rnd::VisMarks::ObjSlot
+
+Returns the index of obj's mark, or the index of the unmarked slot obj would be put in.
+--------------------------------------*/
+size_t rnd::VisMarks::ObjSlot(const void* obj) const
+{
+	size_t mask = objs.n - 1;
+	uint32_t hash = (uint32_t)((size_t)obj >> 3) * 2654435761u;
+	size_t i = (hash ^ hash >> 16) & mask; // Bring mixed high bits down to the masked bits
+
+	while(objs[i].code == objCode && objs[i].obj != obj)
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+/*--------------------------------------
+	rnd::VisMarks::GrowObjs
+--------------------------------------*/
+void rnd::VisMarks::GrowObjs()
+{
+	com::Arr<obj_mark> old = objs;
+	objs.o = 0;
+	objs.Init(old.n ? old.n * 2 : 64);
+
+	for(size_t i = 0; i < objs.n; i++)
+		objs[i].code = 0;
+
+	for(size_t i = 0; i < old.n; i++)
+	{
+		if(old[i].code != objCode)
+			continue;
+
+		obj_mark& mark = objs[ObjSlot(old[i].obj)];
+		mark.obj = old[i].obj;
+		mark.code = objCode;
+	}
+
+	old.Free();
+}
+
+/*
+################################################################################################
+
+
+	CAMERA FLOOD
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rnd::CameraFlood::CameraFlood
+--------------------------------------*/
+rnd::CameraFlood::CameraFlood() : numZones(0), numEnts(0), numCloudEnts(0), numGlassEnts(0),
+	numBulbs(0), numSpots(0), pd(8), dirs(8), numWindows(0), numWindowPlanes(0), reused(false),
+	prevWorld(0), prevNumZones(0), prevStart(0)
+{
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::~CameraFlood
+--------------------------------------*/
+rnd::CameraFlood::~CameraFlood()
+{
+	zones.Free();
+	ents.Free();
+	cloudEnts.Free();
+	glassEnts.Free();
+	bulbs.Free();
+	spots.Free();
+	windows.Free();
+	windowPlanes.Free();
+	dirs.Free();
+	entKeys.Free();
+	cloudEntKeys.Free();
+	glassEntKeys.Free();
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::Flood
+
+rootPlanes and rootClip are the camera frustum's side planes and near polygon. If lines is true,
+debug lines are drawn and the previous descent is not reused, so this must be called on the main
+thread.
+--------------------------------------*/
+void rnd::CameraFlood::Flood(const scn::Zone& start, const com::Vec3& pos,
+	const com::Plane* rootPlanes, const com::Poly& rootClip, bool lines)
+{
+	reused = !lines && SameView(start, pos, rootPlanes, rootClip);
+
+	if(!reused)
+		Descend(start, pos, rootPlanes, rootClip, lines);
+
+	numEnts = numCloudEnts = numGlassEnts = numBulbs = numSpots = 0;
+	marks.BeginObjs();
+	fwd = -rootClip.pln.normal;
+	invDepthRange = 1.0f / farClip.Float();
+
+	for(size_t i = 0; i < numWindows; i++)
+		AddWindowObjects(windows[i], pos, lines);
+
+	// Minimize model-pass state changes
+	SortDrawKeys(ents.o, entKeys.o, numEnts, sortTemp);
+	SortDrawKeys(cloudEnts.o, cloudEntKeys.o, numCloudEnts, sortTemp);
+	SortDrawKeys(glassEnts.o, glassEntKeys.o, numGlassEnts, sortTemp);
 }
 
+/*--------------------------------------
+	rnd::CameraFlood::SameView
+
+Returns true if the windows were made in the current world from the exact same view. Staying in
+the same zone isn't enough since the windows depend on the camera's position and orientation.
+--------------------------------------*/
+bool rnd::CameraFlood::SameView(const scn::Zone& start, const com::Vec3& pos,
+	const com::Plane* rootPlanes, const com::Poly& rootClip) const
+{
+	if(!numWindows || prevWorld != scn::Zones() || prevNumZones != scn::NumZones() ||
+	prevStart != &start || !(prevPos == pos) || prevClip.numVerts != rootClip.numVerts)
+		return false;
+
+	for(size_t i = 0; i < 4; i++)
+	{
+		if(!(prevPlanes[i].normal == rootPlanes[i].normal) ||
+		prevPlanes[i].offset != rootPlanes[i].offset)
+			return false;
+	}
+
+	for(size_t i = 0; i < rootClip.numVerts; i++)
+	{
+		if(!(prevClip.verts[i] == rootClip.verts[i]))
+			return false;
+	}
+
+	return true;
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::Descend
+
+Floods zones thru portals to make the zone list and windows.
+--------------------------------------*/
+void rnd::CameraFlood::Descend(const scn::Zone& start, const com::Vec3& pos,
+	const com::Plane* rootPlanes, const com::Poly& rootClip, bool lines)
+{
+	prevWorld = scn::Zones();
+	prevNumZones = scn::NumZones();
+	prevStart = &start;
+	prevPos = pos;
+	com::Copy(prevPlanes, rootPlanes, 4);
+	prevClip = rootClip;
+
+	int lineColor = lines ? (int)portalColor.Float() : -1;
+	numZones = numWindows = numWindowPlanes = 0;
+	marks.BeginZones();
+	pd.Clear();
+	pd.Push(&start, -1);
+	pd.PushPlanes(4);
+	com::Copy(pd.planes.o, rootPlanes, 4);
+	pd.Top().clip = rootClip;
+	AddZone(start);
+	AddWindow(start, rootClip, rootPlanes);
+
+	while(pd.NumStack())
+	{
+		size_t curIndex = pd.NumStack() - 1;
+		port_desc_elem* cur = &pd.stack[curIndex];
+		bool pushed = false;
+
+		for(; cur->set < cur->zone->numPortals; cur->set++, cur->poly = 0)
+		{
+			const scn::PortalSet& set = *cur->zone->portals[cur->set];
+			const scn::Zone* other = set.Other(*cur->zone);
+
+			// Don't go into zone if it's already on the stack or portal is facing wrong way
+			if(!cur->poly)
+			{
+				if(PortalGap(set, pos, other == set.front) < 0.0f)
+					continue;
+
+				size_t i = 0;
+				for(; i < pd.NumStack() && pd.stack[i].zone != other; i++);
+
+				if(i != pd.NumStack())
+					continue;
+			}
+
+			for(; cur->poly < set.numPolys; cur->poly++)
+			{
+				port_desc_elem& next = pd.Push(other, curIndex);
+				cur = &pd.stack[curIndex]; // Stack may have been reallocated
+				next.clip = set.polys[cur->poly];
+
+				if(!ClipPortal(next.clip, pd.planes.o + cur->planeStart, cur->clip.numVerts))
+				{
+					pd.Pop();
+					continue;
+				}
+
+				if(other == set.front)
+					next.clip.Flip(); // Make polygon face camera
+
+				DrawPortalLines(next.clip, lineColor, false);
+				AddZone(*other);
+				pd.PushPlanes(next.clip.numVerts);
+				GeneratePerspectivePlanes(pos, next.clip, pd.planes.o + next.planeStart);
+				AddWindow(*other, next.clip, pd.planes.o + next.planeStart);
+				cur->poly++;
+				pushed = true;
+				break;
+			}
+
+			if(pushed)
+			{
+				if(cur->poly == set.numPolys)
+				{
+					cur->set++;
+					cur->poly = 0;
+				}
+
+				break;
+			}
+		}
+
+		if(!pushed)
+			pd.Pop();
+	}
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::AddZone
+--------------------------------------*/
+void rnd::CameraFlood::AddZone(const scn::Zone& zone)
+{
+	if(!marks.MarkZone(zone))
+		return;
+
+	zones.Ensure(numZones + 1);
+	zones[numZones++] = &zone;
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::AddWindow
+--------------------------------------*/
+void rnd::CameraFlood::AddWindow(const scn::Zone& zone, const com::Poly& clip,
+	const com::Plane* plns)
+{
+	windows.Ensure(numWindows + 1);
+	vis_window& window = windows[numWindows++];
+	window.zone = &zone;
+	window.clip = clip;
+	window.planeStart = numWindowPlanes;
+	windowPlanes.Ensure(numWindowPlanes + clip.numVerts);
+	com::Copy(windowPlanes.o + numWindowPlanes, plns, clip.numVerts);
+	numWindowPlanes += clip.numVerts;
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::AddWindowObjects
+--------------------------------------*/
+void rnd::CameraFlood::AddWindowObjects(const vis_window& window, const com::Vec3& cam,
+	bool lines)
+{
+	const scn::Zone& zone = *window.zone;
+	const com::Poly& clip = window.clip;
+	const com::Plane* plns = windowPlanes.o + window.planeStart;
+	int entLineColor = lines ? (int)entityColor.Float() : -1;
+	int bulbLineColor = lines ? (int)bulbColor.Float() : -1;
+	dirs.Ensure(clip.numVerts);
+
+	for(size_t i = 0; i < clip.numVerts; i++)
+		dirs[i] = (cam - clip.verts[i]).Normalized();
+
+	for(size_t i = 0; i < zone.numEntLinks; i++)
+	{
+		const scn::Entity* chain = zone.entLinks[i].obj;
+
+		do
+		{
+			const scn::Entity& ent = *chain;
+
+			if(marks.Obj(&ent))
+				continue;
+
+			if(((ent.flags & (ent.VISIBLE | ent.WORLD_VISIBLE)) !=
+			(ent.VISIBLE | ent.WORLD_VISIBLE)) || !ent.Mesh() || !ent.tex)
+			{
+				marks.MarkObj(&ent);
+				continue;
+			}
+
+			if(!ClipSphere<false>(ent.FinalPos(), ent.Mesh()->Radius() * ent.FinalScale(), plns,
+			clip.numVerts, clip, dirs.o))
+				continue;
+
+			float depth = com::Dot(ent.FinalPos() - cam, fwd);
+			AddEntity(ent, ModelDrawKey(ent, depth * invDepthRange));
+			marks.MarkObj(&ent);
+			DrawEntityLines(ent, entLineColor, false);
+		} while(chain = chain->Child());
+	}
+
+	for(size_t i = 0; i < zone.numBulbLinks; i++)
+	{
+		const scn::Bulb& bulb = *zone.bulbLinks[i].obj;
+
+		if(marks.Obj(&bulb))
+			continue;
+
+		float radius = bulb.FinalRadius();
+		float outer;
+
+		if(!radius || !bulb.FinalIntensity() || !(outer = bulb.FinalOuter()))
+		{
+			marks.MarkObj(&bulb);
+			continue;
+		}
+		
+		com::Vec3 spherePos = bulb.FinalPos();
+		float sphereRadius = radius;
+
+		if(!ClipSphere<false>(spherePos, sphereRadius, plns, clip.numVerts, clip, dirs.o))
+			continue;
+
+		if(outer < COM_PI && tighterSpotCull.Bool())
+		{
+			// Clip a second, smaller but forward-offset sphere for spot lights
+			float sphereOffset;
+			MinConeSphere(radius, outer, sphereRadius, sphereOffset);
+			spherePos += bulb.FinalOri().Dir() * sphereOffset;
+
+			if(!ClipSphere<false>(spherePos, sphereRadius, plns, clip.numVerts, clip, dirs.o))
+				continue;
+		}
+
+		AddBulb(bulb);
+		marks.MarkObj(&bulb);
+
+		if(bulbLineColor >= 0)
+			DrawSphereLines(spherePos, com::QUA_IDENTITY, sphereRadius, bulbLineColor, false);
+	}
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::AddEntity
+--------------------------------------*/
+void rnd::CameraFlood::AddEntity(const scn::Entity& ent, uint64_t key)
+{
+	if(ent.Glass())
+	{
+		glassEnts.Ensure(numGlassEnts + 1);
+		glassEntKeys.Ensure(numGlassEnts + 1);
+		glassEntKeys[numGlassEnts] = key;
+		glassEnts[numGlassEnts++] = &ent;
+	}
+	else if((ent.flags & ent.CLOUD) && (ent.Mesh()->Flags() & Mesh::VOXELS))
+	{
+		cloudEnts.Ensure(numCloudEnts + 1);
+		cloudEntKeys.Ensure(numCloudEnts + 1);
+		cloudEntKeys[numCloudEnts] = key;
+		cloudEnts[numCloudEnts++] = &ent;
+	}
+	else if(ent.FinalOpacity() != 0.0f)
+	{
+		ents.Ensure(numEnts + 1);
+		entKeys.Ensure(numEnts + 1);
+		entKeys[numEnts] = key;
+		ents[numEnts++] = &ent;
+	}
+}
+
+/*--------------------------------------
+	rnd::CameraFlood::AddBulb
+--------------------------------------*/
+void rnd::CameraFlood::AddBulb(const scn::Bulb& bulb)
+{
+	if(bulb.FinalOuter() >= COM_PI)
+	{
+		bulbs.Ensure(numBulbs + 1);
+		bulbs[numBulbs++] = &bulb;
+	}
+	else
+	{
+		spots.Ensure(numSpots + 1);
+		spots[numSpots++] = &bulb;
+	}
+}
+
+/*
+################################################################################################
+
+
+	VISIBILITY
+
+
+################################################################################################
+*/
+
 /*--------------------------------------
 	rnd::PortalDescent::Push
 
@@ -127,119 +742,117 @@ unsigned rnd::PortalDescent::IncFullDrawCode()
 }
 
 /*--------------------------------------
-	rnd::FloodVisible
+	rnd::RunVisJobs
 
-Floods zones thru portals starting from active camera's position to populate vis arrays. After
-calling, visible zones have a drawCode equal to zoneCode.
+Like wrp::RunJobs, but runs the jobs in order on the main thread if any vis line option is set
+since drawing lines isn't thread safe.
 --------------------------------------*/
-void rnd::FloodVisible(unsigned& zoneCode)
+void rnd::RunVisJobs(wrp::job_func func, void* data, size_t numJobs)
 {
-	numVisZones = numVisEnts = numVisCloudEnts = numVisGlassEnts = numVisBulbs = numVisSpots = 0;
-	static scn::Camera cam(0.0f, com::QUA_IDENTITY, 1.0f);
-
-	if(!lockCullCam.Bool())
-		cam = *scn::ActiveCamera();
-
-	com::Vec3 camPos = cam.FinalPos();
-	const scn::WorldNode* start = (scn::WorldNode*)scn::PosToLeaf(scn::WorldRoot(), camPos);
-
-	if(!start || !start->zone)
+	if(!VisLines())
+	{
+		wrp::RunJobs(func, data, numJobs);
 		return;
+	}
 
-	int lineColor = (int)portalColor.Float();
-	zoneCode = scn::IncZoneDrawCode();
-	unsigned entCode = scn::Entity::IncHitCode();
-	unsigned bulbCode = scn::Bulb::IncDrawCode();
-	pd.Push(start->zone, -1);
-	pd.PushPlanes(4);
-	CameraFrustum(cam, camHull, pd.planes.o, pd.Top().clip);
-
-	if(cameraColor.Float() >= 0.0f)
-		camHull.DrawWire(camPos, cam.FinalOri(), (int)cameraColor.Float(), false);
+	for(size_t i = 0; i < numJobs; i++)
+		func(data, i, 0);
+}
 
-	visZones.Ensure(numVisZones + 1);
-	visZones[numVisZones++] = start->zone;
-	start->zone->drawCode = zoneCode;
-	AddVisibleZoneObjects(*start->zone, pd.Top().clip, pd.planes.o, camPos, entCode, bulbCode);
+/*--------------------------------------
+	rnd::VisLines
+--------------------------------------*/
+bool rnd::VisLines()
+{
+	return portalColor.Float() >= 0.0f || entityColor.Float() >= 0.0f ||
+		bulbColor.Float() >= 0.0f || sunPortalColor.Float() >= 0.0f ||
+		sunEntityColor.Float() >= 0.0f;
+}
 
-	while(pd.NumStack())
-	{
-		size_t curIndex = pd.NumStack() - 1;
-		port_desc_elem* cur = &pd.stack[curIndex];
-		bool pushed = false;
+/*--------------------------------------
+	rnd::FloodVisible
 
-		for(; cur->set < cur->zone->numPortals; cur->set++, cur->poly = 0)
-		{
-			const scn::PortalSet& set = *cur->zone->portals[cur->set];
-			const scn::Zone* other = set.Other(*cur->zone);
+Floods zones thru portals starting from active camera's position to populate vis arrays. The
+sun's flood runs alongside if the sun moved.
+--------------------------------------*/
+void rnd::FloodVisible()
+{
+	PRF_ZONE("rnd::FloodVisible");
+	numVisZones = numVisEnts = numVisCloudEnts = numVisGlassEnts = numVisBulbs = numVisSpots = 0;
+	static scn::Camera cam(0.0f, com::QUA_IDENTITY, 1.0f);
+	static visible_jobs vj;
+	size_t numJobs = 0;
 
-			// Don't go into zone if it's already on the stack or portal is facing wrong way
-			if(!cur->poly)
-			{
-				if(PortalGap(set, camPos, other == set.front) < 0.0f)
-					continue;
+	if(!lockCullCam.Bool())
+		cam = *scn::ActiveCamera();
 
-				size_t i = 0;
-				for(; i < pd.NumStack() && pd.stack[i].zone != other; i++);
+	vj.pos = cam.FinalPos();
+	vj.lines = VisLines();
+	const scn::WorldNode* start = (scn::WorldNode*)scn::PosToLeaf(scn::WorldRoot(), vj.pos);
+	vj.start = start ? start->zone : 0;
 
-				if(i != pd.NumStack())
-					continue;
-			}
+	if(vj.start)
+	{
+		CameraFrustum(cam, camHull, vj.planes, vj.clip);
 
-			for(; cur->poly < set.numPolys; cur->poly++)
-			{
-				port_desc_elem& next = pd.Push(other, curIndex);
-				cur = &pd.stack[curIndex]; // Stack may have been reallocated
-				next.clip = set.polys[cur->poly];
+		if(cameraColor.Float() >= 0.0f)
+			camHull.DrawWire(vj.pos, cam.FinalOri(), (int)cameraColor.Float(), false);
 
-				if(!ClipPortal(next.clip, pd.planes.o + cur->planeStart, cur->clip.numVerts))
-				{
-					pd.Pop();
-					continue;
-				}
+		vj.kinds[numJobs++] = vj.CAMERA;
+	}
 
-				if(other == set.front)
-					next.clip.Flip(); // Make polygon face camera
+	vj.sunDir = scn::sun.FinalPos().Normalized();
 
-				DrawPortalLines(next.clip, lineColor, false);
+	if(!(vj.sunDir == prevSunDir))
+	{
+		prevSunDir = vj.sunDir;
+		vj.kinds[numJobs++] = vj.SUN;
+	}
 
-				if(other->drawCode != zoneCode)
-				{
-					visZones.Ensure(numVisZones + 1);
-					visZones[numVisZones++] = other;
-					other->drawCode = zoneCode;
-				}
-				
-				pd.PushPlanes(next.clip.numVerts);
-				GeneratePerspectivePlanes(camPos, next.clip, pd.planes.o + next.planeStart);
-				AddVisibleZoneObjects(*other, next.clip, pd.planes.o + next.planeStart, camPos,
-					entCode, bulbCode);
+	RunVisJobs(VisibleJob, &vj, numJobs);
 
-				cur->poly++;
-				pushed = true;
-				break;
-			}
+	if(!vj.start)
+		return;
 
-			if(pushed)
-			{
-				if(cur->poly == set.numPolys)
-				{
-					cur->set++;
-					cur->poly = 0;
-				}
+	// Zones are copied since the flood keeps them for its next call
+	visZones.Ensure(camFlood.numZones);
+	com::Copy(visZones.o, camFlood.zones.o, camFlood.numZones);
+	numVisZones = camFlood.numZones;
+
+	com::Swap(visEnts, camFlood.ents);
+	com::Swap(visCloudEnts, camFlood.cloudEnts);
+	com::Swap(visGlassEnts, camFlood.glassEnts);
+	com::Swap(visBulbs, camFlood.bulbs);
+	com::Swap(visSpots, camFlood.spots);
+	numVisEnts = camFlood.numEnts;
+	numVisCloudEnts = camFlood.numCloudEnts;
+	numVisGlassEnts = camFlood.numGlassEnts;
+	numVisBulbs = camFlood.numBulbs;
+	numVisSpots = camFlood.numSpots;
+}
 
-				break;
-			}
-		}
+/*--------------------------------------
+	rnd::VisibleJob
+--------------------------------------*/
+void rnd::VisibleJob(void* data, size_t job, size_t worker)
+{
+	const visible_jobs& vj = *(visible_jobs*)data;
 
-		if(!pushed)
-			pd.Pop();
-	}
+	if(vj.kinds[job] == vj.CAMERA)
+		camFlood.Flood(*vj.start, vj.pos, vj.planes, vj.clip, vj.lines);
+	else
+		FloodSunVisible(vj.sunDir);
+}
 
-	// Minimize model-pass state changes
-	qsort(visEnts.o, numVisEnts, sizeof(const scn::Entity*), CmpEntityModels);
-	qsort(visCloudEnts.o, numVisCloudEnts, sizeof(const scn::Entity*), CmpEntityModels);
-	qsort(visGlassEnts.o, numVisGlassEnts, sizeof(const scn::Entity*), CmpEntityModels);
+/*--------------------------------------
+	rnd::ResetVisibility
+
+Makes the next FloodVisible redo the camera and sun descents. Call when the world changes.
+--------------------------------------*/
+void rnd::ResetVisibility()
+{
+	camFlood.Invalidate();
+	prevSunDir = 0.0f;
 }
 
 /*--------------------------------------
@@ -247,14 +860,8 @@ void rnd::FloodVisible(unsigned& zoneCode)
 
 Floods zones thru portals starting from sun zones to clip portals to their visible portions.
 --------------------------------------*/
-void rnd::FloodSunVisible()
+void rnd::FloodSunVisible(const com::Vec3& dir)
 {
-	com::Vec3 dir = scn::sun.FinalPos().Normalized();
-
-	if(dir == prevSunDir)
-		return;
-
-	prevSunDir = dir;
 	spd.Clear();
 
 	for(uint32_t z = 0; z < scn::NumZones(); z++)
@@ -311,14 +918,17 @@ void rnd::FloodSunVisible()
 /*--------------------------------------
 	rnd::TrimVisibleSunBranches
 
-Marks which sun-portal-descent's elements are in zones or descend from zones with a drawCode
-equal to zoneVisCode. Returns false if no element is marked.
+Marks which sun-portal-descent's elements are in zones or descend from zones the camera sees.
+Returns false if no element is marked. Call after FloodVisible.
 --------------------------------------*/
-bool rnd::TrimVisibleSunBranches(unsigned zoneVisCode)
+bool rnd::TrimVisibleSunBranches()
 {
 	unsigned fullDrawCode = spd.IncFullDrawCode();
 	bool drawSun = false;
 
+	if(!numVisZones)
+		return false;
+
 	for(size_t i = 0; i < spd.NumStack(); i++)
 	{
 		port_desc_elem& cur = spd.stack[spd.NumStack() - 1 - i];
@@ -326,7 +936,7 @@ bool rnd::TrimVisibleSunBranches(unsigned zoneVisCode)
 		if(cur.fullDrawCode == fullDrawCode)
 			continue; // This element and ancestors already marked for full drawing
 
-		if(cur.zone->drawCode == zoneVisCode)
+		if(camFlood.marks.Zone(*cur.zone))
 		{
 			// Camera sees this sun-lit zone, mark this element for full drawing
 			cur.fullDrawCode = fullDrawCode;
@@ -351,19 +961,22 @@ bool rnd::TrimVisibleSunBranches(unsigned zoneVisCode)
 
 /*--------------------------------------
 	rnd::CascadeDrawLists
+
+Lists the zones and shadow-casting entities in the sun frustum given by c's pos, pitch, yaw,
+fMin and fMax. Only reads the sun descent, so cascades can be listed at the same time.
 --------------------------------------*/
-void rnd::CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const com::Vec3& fMin,
-	const com::Vec3& fMax, com::Arr<const scn::Zone*>& litZones, size_t& numLitZones,
-	com::Arr<const scn::Entity*>& litEnts, size_t& numLitEnts)
+void rnd::CascadeDrawLists(cascade_lists& c)
 {
-	static com::Arr<com::Plane> tempPlanes(8);
-	static com::Poly tempClip, frsClip;
 	int portalLineColor = (int)sunPortalColor.Float();
 	int entLineColor = (int)sunEntityColor.Float();
-	com::Vec3 fwd = com::VecFromPitchYaw(pitch, yaw);
-	com::Vec3 left = com::VecFromPitchYaw(0.0f, yaw + COM_HALF_PI);
-	com::Vec3 down = com::VecFromPitchYaw(pitch + COM_HALF_PI, yaw);
+	const com::Vec3& pos = c.pos;
+	const com::Vec3& fMin = c.fMin;
+	const com::Vec3& fMax = c.fMax;
+	com::Vec3 fwd = com::VecFromPitchYaw(c.pitch, c.yaw);
+	com::Vec3 left = com::VecFromPitchYaw(0.0f, c.yaw + COM_HALF_PI);
+	com::Vec3 down = com::VecFromPitchYaw(c.pitch + COM_HALF_PI, c.yaw);
 	com::Vec3 dir = -fwd;
+	float invDepthRange = 1.0f / (fMax.x - fMin.x);
 
 	com::Plane frs[6] = {
 		com::Plane(left, fMax.y + com::Dot(left, pos)), // left
@@ -379,14 +992,14 @@ void rnd::CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const c
 	com::Vec3 rightVec = left * fMin.y;
 	com::Vec3 downVec = down * -fMin.z;
 	com::Vec3 upVec = down * -fMax.z;
-	frsClip.SetVerts(0, 4);
-	frsClip.verts[0] = pos + nearVec + leftVec + upVec;
-	frsClip.verts[1] = pos + nearVec + leftVec + downVec;
-	frsClip.verts[2] = pos + nearVec + rightVec + downVec;
-	frsClip.verts[3] = pos + nearVec + rightVec + upVec;
-	unsigned zoneCode = scn::IncZoneDrawCode();
-	unsigned entCode = scn::Entity::IncHitCode();
-	numLitZones = numLitEnts = 0;
+	c.frsClip.SetVerts(0, 4);
+	c.frsClip.verts[0] = pos + nearVec + leftVec + upVec;
+	c.frsClip.verts[1] = pos + nearVec + leftVec + downVec;
+	c.frsClip.verts[2] = pos + nearVec + rightVec + downVec;
+	c.frsClip.verts[3] = pos + nearVec + rightVec + upVec;
+	c.marks.BeginZones();
+	c.marks.BeginObjs();
+	c.numZones = c.numEnts = 0;
 
 	for(size_t cur = 0; cur < spd.NumStack(); cur++)
 	{
@@ -399,30 +1012,29 @@ void rnd::CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const c
 		{
 			cullPlanes = frs;
 			numCullPlanes = 6;
-			cullPoly = &frsClip;
+			cullPoly = &c.frsClip;
 		}
 		else
 		{
-			tempClip = s.clip;
+			c.tempClip = s.clip;
 
-			if(!ClipPortal(tempClip, frs, 6))
+			if(!ClipPortal(c.tempClip, frs, 6))
 				continue;
 
-			tempPlanes.Ensure(tempClip.numVerts);
-			GenerateOrthographicPlanes(dir, tempClip, tempPlanes.o);
-			cullPlanes = tempPlanes.o;
-			numCullPlanes = tempClip.numVerts;
-			cullPoly = &tempClip;
+			c.tempPlanes.Ensure(c.tempClip.numVerts);
+			GenerateOrthographicPlanes(dir, c.tempClip, c.tempPlanes.o);
+			cullPlanes = c.tempPlanes.o;
+			numCullPlanes = c.tempClip.numVerts;
+			cullPoly = &c.tempClip;
 		}
 
 		DrawPortalLines(*cullPoly, portalLineColor, false);
 		const scn::Zone& zone = *s.zone;
 
-		if(zone.drawCode != zoneCode)
+		if(c.marks.MarkZone(zone))
 		{
-			zone.drawCode = zoneCode;
-			litZones.Ensure(numLitZones + 1);
-			litZones[numLitZones++] = s.zone;
+			c.zones.Ensure(c.numZones + 1);
+			c.zones[c.numZones++] = s.zone;
 		}
 
 		if(s.fullDrawCode != spd.FullDrawCode())
@@ -436,12 +1048,12 @@ void rnd::CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const c
 			{
 				const scn::Entity& ent = *chain;
 
-				if(ent.hitCode == entCode)
+				if(c.marks.Obj(&ent))
 					continue;
 
 				if(!(ent.flags & ent.SHADOW) || !ent.Mesh() || !ent.tex)
 				{
-					ent.hitCode = entCode;
+					c.marks.MarkObj(&ent);
 					continue;
 				}
 
@@ -449,29 +1061,43 @@ void rnd::CascadeDrawLists(const com::Vec3& pos, float pitch, float yaw, const c
 				cullPlanes, numCullPlanes, *cullPoly, &dir))
 					continue;
 
-				litEnts.Ensure(numLitEnts + 1);
-				litEnts[numLitEnts++] = &ent;
-				ent.hitCode = entCode;
+				float depth = com::Dot(ent.FinalPos() - pos, fwd) - fMin.x;
+				c.ents.Ensure(c.numEnts + 1);
+				c.keys.Ensure(c.numEnts + 1);
+				c.keys[c.numEnts] = ShadowDrawKey(ent, depth * invDepthRange);
+				c.ents[c.numEnts++] = &ent;
+				c.marks.MarkObj(&ent);
 				DrawEntityLines(ent, entLineColor, false);
 			} while(chain = chain->Child());
 		}
 	}
 
 	// Minimize state changes
-	qsort(litEnts.o, numLitEnts, sizeof(const scn::Entity*), CmpShadowEntities);
+	SortDrawKeys(c.ents.o, c.keys.o, c.numEnts, c.sortTemp);
+}
+
+/*--------------------------------------
+	rnd::CascadeDrawListsJob
+
+data is an array of cascade_lists pointers.
+--------------------------------------*/
+void rnd::CascadeDrawListsJob(void* data, size_t job, size_t worker)
+{
+	CascadeDrawLists(*((cascade_lists**)data)[job]);
 }
 
 /*--------------------------------------
 	rnd::BulbDrawList
 
-Makes list of entity shadows to draw for a bulb. overlays flags are OR'd if the bulb possibly
-lights an overlay entity.
+Makes list of entity shadows to draw for b.bulb. b.overlays is set to the flags of overlay
+entities the bulb possibly lights.
 --------------------------------------*/
-void rnd::BulbDrawList(const scn::Bulb& bulb, float radius, const com::Vec3& pos,
-	com::Arr<const scn::Entity*>& litEnts, size_t& numLitEnts, uint16_t& overlays)
+void rnd::BulbDrawList(bulb_lists& b)
 {
-	numLitEnts = 0;
-	unsigned entCode = scn::Entity::IncHitCode();
+	const scn::Bulb& bulb = *b.bulb;
+	b.numEnts = 0;
+	b.overlays = 0;
+	b.marks.BeginObjs();
 
 	for(size_t i = 0; i < bulb.NumZoneLinks(); i++)
 	{
@@ -481,10 +1107,9 @@ void rnd::BulbDrawList(const scn::Bulb& bulb, float radius, const com::Vec3& pos
 		{
 			const scn::Entity& top = *zone.entLinks[j].obj;
 
-			if(top.hitCode == entCode)
+			if(!b.marks.MarkObj(&top))
 				continue;
 
-			top.hitCode = entCode;
 			const scn::Entity* chain = &top;
 			
 			do
@@ -495,39 +1120,52 @@ void rnd::BulbDrawList(const scn::Bulb& bulb, float radius, const com::Vec3& pos
 				if(!msh || !ent.tex)
 					continue; // Entity has no model
 
-				float distSq = (ent.FinalPos() - pos).MagSq();
-				float comp = msh->Radius() + radius;
+				float distSq = (ent.FinalPos() - b.pos).MagSq();
+				float comp = msh->Radius() + b.radius;
 
 				if(distSq > comp * comp)
 					continue; // Mesh is not in bulb's radius
 
 				// The entity may be lit by this bulb
-				overlays |= ent.OverlayFlags();
+				b.overlays |= ent.OverlayFlags();
 
 				if(!(ent.flags & ent.SHADOW))
 					continue; // Entity has no shadow
 
 				// The entity may cast a shadow from this bulb
-				litEnts.Ensure(numLitEnts + 1);
-				litEnts[numLitEnts++] = &ent;
+				b.ents.Ensure(b.numEnts + 1);
+				b.keys.Ensure(b.numEnts + 1);
+				b.keys[b.numEnts] = ShadowDrawKey(ent, sqrt(distSq) / comp);
+				b.ents[b.numEnts++] = &ent;
 			} while(chain = chain->Child());
 		}
 	}
 
 	// Minimize state changes
-	qsort(litEnts.o, numLitEnts, sizeof(const scn::Entity*), CmpShadowEntities);
+	SortDrawKeys(b.ents.o, b.keys.o, b.numEnts, b.sortTemp);
+}
+
+/*--------------------------------------
+	rnd::BulbDrawListJob
+
+data is an array of bulb_lists pointers.
+--------------------------------------*/
+void rnd::BulbDrawListJob(void* data, size_t job, size_t worker)
+{
+	BulbDrawList(*((bulb_lists**)data)[job]);
 }
 
 /*--------------------------------------
 	rnd::BulbLitFlags
 
 Like BulbDrawLists but only checks if bulb lights any entities with special lighting flags. For
-bulbs that don't draw shadows.
+bulbs that don't draw shadows. Main thread only.
 --------------------------------------*/
 void rnd::BulbLitFlags(const scn::Bulb& bulb, float radius, const com::Vec3& pos,
 	uint16_t& overlays)
 {
-	unsigned entCode = scn::Entity::IncHitCode();
+	static VisMarks marks;
+	marks.BeginObjs();
 
 	for(size_t i = 0; i < bulb.NumZoneLinks(); i++)
 	{
@@ -537,10 +1175,9 @@ void rnd::BulbLitFlags(const scn::Bulb& bulb, float radius, const com::Vec3& pos
 		{
 			const scn::Entity& top = *zone.entLinks[j].obj;
 
-			if(top.hitCode == entCode)
+			if(!marks.MarkObj(&top))
 				continue;
 
-			top.hitCode = entCode;
 			const scn::Entity* chain = &top;
 			
 			do
@@ -595,25 +1232,34 @@ FIXME: need to support infinite far plane
 void rnd::CameraFrustum(const scn::Camera& cam, hit::Frustum& frs, com::Plane* plns,
 	com::Poly& clipOut)
 {
-	com::Vec3 camPos = cam.FinalPos();
-	com::Qua camOri = cam.FinalOri();
 	float camFOV = cam.FinalFOV();
 	float vAngle = camFOV * 0.5f;
 	float aspect = (float)wrp::VideoWidth() / wrp::VideoHeight();
 	float hAngle = com::HorizontalFOV(camFOV, aspect) * 0.5f;
 	frs.Set(hAngle, vAngle, nearClip.Float(), farClip.Float());
+	FrustumPlanes(frs, cam.FinalPos(), cam.FinalOri(), plns, clipOut);
+}
+
+/*--------------------------------------
+	rnd::FrustumPlanes
+
+Sets plns to frs's four side planes and clipOut to its near polygon when placed at pos and ori.
+--------------------------------------*/
+void rnd::FrustumPlanes(const hit::Frustum& frs, const com::Vec3& pos, const com::Qua& ori,
+	com::Plane* plns, com::Poly& clipOut)
+{
 	const com::Vec3* axes = frs.Axes();
 
 	for(size_t i = 0; i < 4; i++)
-		plns[i] = com::PointPlane(com::VecRot(axes[i], camOri).Normalized(), camPos);
+		plns[i] = com::PointPlane(com::VecRot(axes[i], ori).Normalized(), pos);
 
 	const com::ClimbVertex* fVerts = frs.Vertices();
 	clipOut.SetVerts(0, 4);
-	clipOut.verts[0] = com::VecRot(fVerts[5].pos, camOri) + camPos;
-	clipOut.verts[1] = com::VecRot(fVerts[7].pos, camOri) + camPos;
-	clipOut.verts[2] = com::VecRot(fVerts[3].pos, camOri) + camPos;
-	clipOut.verts[3] = com::VecRot(fVerts[1].pos, camOri) + camPos;
-	clipOut.pln.normal = com::VecRot(com::Vec3(-1.0f, 0.0f, 0.0f), camOri);
+	clipOut.verts[0] = com::VecRot(fVerts[5].pos, ori) + pos;
+	clipOut.verts[1] = com::VecRot(fVerts[7].pos, ori) + pos;
+	clipOut.verts[2] = com::VecRot(fVerts[3].pos, ori) + pos;
+	clipOut.verts[3] = com::VecRot(fVerts[1].pos, ori) + pos;
+	clipOut.pln.normal = com::VecRot(com::Vec3(-1.0f, 0.0f, 0.0f), ori);
 	clipOut.pln.offset = com::Dot(clipOut.pln.normal, clipOut.verts[0]);
 }
 
@@ -754,127 +1400,6 @@ bool rnd::ClipSphere(const com::Vec3& pos, float radius, const com::Plane* plns,
 	return true;
 }
 
-/*--------------------------------------
-	rnd::AddVisibleZoneObjects
---------------------------------------*/
-void rnd::AddVisibleZoneObjects(const scn::Zone& zone, const com::Poly& clip,
-	const com::Plane* plns, const com::Vec3& cam, unsigned entCode, unsigned bulbCode)
-{
-	int entLineColor = (int)entityColor.Float();
-	static com::Arr<com::Vec3> dirs(8);
-	dirs.Ensure(clip.numVerts);
-
-	for(size_t i = 0; i < clip.numVerts; i++)
-		dirs[i] = (cam - clip.verts[i]).Normalized();
-
-	for(size_t i = 0; i < zone.numEntLinks; i++)
-	{
-		const scn::Entity* chain = zone.entLinks[i].obj;
-
-		do
-		{
-			const scn::Entity& ent = *chain;
-
-			if(ent.hitCode == entCode)
-				continue;
-
-			if(((ent.flags & (ent.VISIBLE | ent.WORLD_VISIBLE)) !=
-			(ent.VISIBLE | ent.WORLD_VISIBLE)) || !ent.Mesh() || !ent.tex)
-			{
-				ent.hitCode = entCode;
-				continue;
-			}
-
-			if(!ClipSphere<false>(ent.FinalPos(), ent.Mesh()->Radius() * ent.FinalScale(), plns,
-			clip.numVerts, clip, dirs.o))
-				continue;
-
-			AddVisibleEntity(ent);
-			ent.hitCode = entCode;
-			DrawEntityLines(ent, entLineColor, false);
-		} while(chain = chain->Child());
-	}
-
-	for(size_t i = 0; i < zone.numBulbLinks; i++)
-	{
-		const scn::Bulb& bulb = *zone.bulbLinks[i].obj;
-
-		if(bulb.drawCode == bulbCode)
-			continue;
-
-		float radius = bulb.FinalRadius();
-		float outer;
-
-		if(!radius || !bulb.FinalIntensity() || !(outer = bulb.FinalOuter()))
-		{
-			bulb.drawCode = bulbCode;
-			continue;
-		}
-		
-		com::Vec3 spherePos = bulb.FinalPos();
-		float sphereRadius = radius;
-
-		if(!ClipSphere<false>(spherePos, sphereRadius, plns, clip.numVerts, clip, dirs.o))
-			continue;
-
-		if(outer < COM_PI && tighterSpotCull.Bool())
-		{
-			// Clip a second, smaller but forward-offset sphere for spot lights
-			float sphereOffset;
-			MinConeSphere(radius, outer, sphereRadius, sphereOffset);
-			spherePos += bulb.FinalOri().Dir() * sphereOffset;
-
-			if(!ClipSphere<false>(spherePos, sphereRadius, plns, clip.numVerts, clip, dirs.o))
-				continue;
-		}
-
-		AddVisibleBulb(bulb);
-		bulb.drawCode = bulbCode;
-
-		DrawSphereLines(spherePos, com::QUA_IDENTITY, sphereRadius, (int)bulbColor.Float(),
-			false);
-	}
-}
-
-/*--------------------------------------
-	rnd::AddVisibleEntity
---------------------------------------*/
-void rnd::AddVisibleEntity(const scn::Entity& ent)
-{
-	if(ent.Glass())
-	{
-		visGlassEnts.Ensure(numVisGlassEnts + 1);
-		visGlassEnts[numVisGlassEnts++] = &ent;
-	}
-	else if((ent.flags & ent.CLOUD) && (ent.Mesh()->Flags() & Mesh::VOXELS))
-	{
-		visCloudEnts.Ensure(numVisCloudEnts + 1);
-		visCloudEnts[numVisCloudEnts++] = &ent;
-	}
-	else if(ent.FinalOpacity() != 0.0f)
-	{
-		visEnts.Ensure(numVisEnts + 1);
-		visEnts[numVisEnts++] = &ent;
-	}
-}
-
-/*--------------------------------------
-	rnd::AddVisibleBulb
---------------------------------------*/
-void rnd::AddVisibleBulb(const scn::Bulb& bulb)
-{
-	if(bulb.FinalOuter() >= COM_PI)
-	{
-		visBulbs.Ensure(numVisBulbs + 1);
-		visBulbs[numVisBulbs++] = &bulb;
-	}
-	else
-	{
-		visSpots.Ensure(numVisSpots + 1);
-		visSpots[numVisSpots++] = &bulb;
-	}
-}
-
 /*--------------------------------------
 	rnd::MinConeSphere
 --------------------------------------*/
@@ -900,31 +1425,6 @@ void rnd::MinConeSphere(float origRadius, float angle, float& radius, float& off
 		offset = radius = origRadius * 0.5f;
 }
 
-/*--------------------------------------
-	rnd::CmpEntityModels
-
-Sort by mesh then texture.
---------------------------------------*/
-int rnd::CmpEntityModels(const void* av, const void* bv)
-{
-	const scn::Entity* a = *(const scn::Entity**)av;
-	const MeshGL* aMsh = (MeshGL*)a->Mesh();
-	const TextureGL* aTex = (TextureGL*)a->tex.Value();
-	const scn::Entity* b = *(const scn::Entity**)bv;
-	const MeshGL* bMsh = (MeshGL*)b->Mesh();
-	const TextureGL* bTex = (TextureGL*)b->tex.Value();
-
-	if(aMsh->vBufName == bMsh->vBufName)
-	{
-		if(aTex->texName == bTex->texName)
-			return 0;
-
-		return aTex->texName < bTex->texName ? -1 : 1;
-	}
-	else
-		return aMsh->vBufName < bMsh->vBufName ? -1 : 1;
-}
-
 /*--------------------------------------
 	rnd::DrawPortalLines
 --------------------------------------*/
@@ -966,4 +1466,174 @@ void rnd::DrawBulbLines(const scn::Bulb& bulb, float time)
 		return;
 
 	DrawSphereLines(bulb.FinalPos(), com::QUA_IDENTITY, bulb.FinalRadius(), color, time);
-}
\ No newline at end of file
+}
+/*
+################################################################################################
+
+
+	VIS LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	rnd::BenchVisJob
+--------------------------------------*/
+void rnd::BenchVisJob(void* data, size_t job, size_t worker)
+{
+	const bench_vis& b = *(bench_vis*)data;
+	const bench_pose& pose = b.poses[job];
+	CameraFlood& flood = b.floods[worker];
+	flood.Flood(*pose.start, pose.pos, pose.planes, pose.clip, false);
+	bench_result& result = b.results[job];
+	result.numZones = flood.numZones;
+
+	result.numObjs = flood.numEnts + flood.numCloudEnts + flood.numGlassEnts + flood.numBulbs +
+		flood.numSpots;
+
+	result.reused = flood.Reused();
+}
+
+/*--------------------------------------
+LUA	rnd::BenchVis (rnd_bench_vis)
+
+IN	[iNumPoses = 4000, iSeed = 1]
+
+Floods the loaded world from random camera poses with the active camera's field of view. Logs
+the time per flood when flooding in order on the main thread, when spread over the job workers,
+and when flooding each pose again so the previous descent is reused. Alerts if the parallel or
+reused results don't match the serial results.
+--------------------------------------*/
+int rnd::BenchVis(lua_State* l)
+{
+	size_t numPoses = luaL_optinteger(l, 1, 4000);
+	uint32_t seed = luaL_optinteger(l, 2, 1);
+
+	if(!scn::WorldRoot() || !numPoses)
+	{
+		CON_ERROR("No world loaded or no poses");
+		return 0;
+	}
+
+	scn::FlushLinks();
+	static hit::Frustum frs;
+	const scn::Camera& cam = *scn::ActiveCamera();
+	float aspect = (float)wrp::VideoWidth() / wrp::VideoHeight();
+
+	frs.Set(com::HorizontalFOV(cam.FinalFOV(), aspect) * 0.5f, cam.FinalFOV() * 0.5f,
+		nearClip.Float(), farClip.Float());
+
+	// Pick random poses whose position is in a zone
+	bench_pose* poses = new bench_pose[numPoses];
+	const com::Vec3& wMin = scn::WorldMin();
+	const com::Vec3& wMax = scn::WorldMax();
+	size_t numTries = 0, maxTries = numPoses * 100;
+
+	for(size_t i = 0; i < numPoses && numTries < maxTries; numTries++)
+	{
+		bench_pose& pose = poses[i];
+		pose.pos.x = COM_LERP(wMin.x, wMax.x, com::BenchRandF(seed));
+		pose.pos.y = COM_LERP(wMin.y, wMax.y, com::BenchRandF(seed));
+		pose.pos.z = COM_LERP(wMin.z, wMax.z, com::BenchRandF(seed));
+		const scn::WorldNode* leaf = (scn::WorldNode*)scn::PosToLeaf(scn::WorldRoot(), pose.pos);
+
+		if(!leaf || !leaf->zone)
+			continue;
+
+		pose.start = leaf->zone;
+		float pitch = (com::BenchRandF(seed) - 0.5f) * COM_PI * 0.9f;
+		float yaw = com::BenchRandF(seed) * COM_PI * 2.0f;
+		FrustumPlanes(frs, pose.pos, com::QuaEulerPitchYaw(pitch, yaw), pose.planes, pose.clip);
+		i++;
+	}
+
+	if(numTries == maxTries)
+	{
+		CON_ERROR("Could not find enough positions inside zones");
+		delete[] poses;
+		return 0;
+	}
+
+	size_t numWorkers = wrp::NumWorkers();
+	CameraFlood* floods = new CameraFlood[numWorkers];
+	bench_result* serial = new bench_result[numPoses];
+	bench_result* parallel = new bench_result[numPoses];
+	bench_result* again = new bench_result[numPoses];
+	bench_vis b = {poses, floods, serial};
+
+	// Warm up allocations so they aren't timed
+	for(size_t i = 0; i < numWorkers; i++)
+	{
+		BenchVisJob(&b, i % numPoses, i);
+		floods[i].Invalidate();
+	}
+
+	unsigned long long start = wrp::Ticks();
+
+	for(size_t i = 0; i < numPoses; i++)
+		BenchVisJob(&b, i, 0);
+
+	unsigned long long serialTicks = wrp::Ticks() - start;
+	floods[0].Invalidate();
+	b.results = parallel;
+	start = wrp::Ticks();
+	wrp::RunJobs(BenchVisJob, &b, numPoses);
+	unsigned long long parallelTicks = wrp::Ticks() - start;
+	b.results = again;
+	unsigned long long againTicks = 0;
+
+	for(size_t i = 0; i < numPoses; i++)
+	{
+		BenchVisJob(&b, i, 0);
+		start = wrp::Ticks();
+		BenchVisJob(&b, i, 0);
+		againTicks += wrp::Ticks() - start;
+	}
+
+	size_t numMismatches = 0, numNotReused = 0;
+	double totalZones = 0.0, totalObjs = 0.0;
+
+	for(size_t i = 0; i < numPoses; i++)
+	{
+		const bench_result& s = serial[i];
+		const bench_result& p = parallel[i];
+		const bench_result& a = again[i];
+		totalZones += s.numZones;
+		totalObjs += s.numObjs;
+
+		if(p.numZones != s.numZones || p.numObjs != s.numObjs || a.numZones != s.numZones ||
+		a.numObjs != s.numObjs)
+			numMismatches++;
+
+		if(!a.reused)
+			numNotReused++;
+	}
+
+	double usPerTick = 1e6 / wrp::TicksPerSecond() / numPoses;
+	double serialUS = serialTicks * usPerTick;
+	double parallelUS = parallelTicks * usPerTick;
+
+	con::LogF("%u poses, %g zones and %g objects per flood", (unsigned)numPoses,
+		totalZones / numPoses, totalObjs / numPoses);
+
+	con::LogF("Serial: %g us/flood", serialUS);
+
+	con::LogF("%u workers: %g us/flood (%.2fx)", (unsigned)numWorkers, parallelUS,
+		parallelUS ? serialUS / parallelUS : 0.0);
+
+	con::LogF("Reused descent: %g us/flood", againTicks * usPerTick);
+
+	if(numMismatches || numNotReused)
+	{
+		con::AlertF("%u floods did not match serial results, %u did not reuse descent",
+			(unsigned)numMismatches, (unsigned)numNotReused);
+	}
+
+	delete[] poses;
+	delete[] floods;
+	delete[] serial;
+	delete[] parallel;
+	delete[] again;
+	return 0;
+}
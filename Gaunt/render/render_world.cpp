@@ -163,8 +163,8 @@ void rnd::RegisterWorld(const scn::TriBatch* batches, uint32_t numBatches, scn::
 		}
 	}
 
-	// Reset last sun direction so sun visibility is calculated
-	prevSunDir = 0.0f;
+	// Reset last camera view and sun direction so visibility is calculated
+	ResetVisibility();
 }
 
 /*--------------------------------------
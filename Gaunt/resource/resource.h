@@ -10,6 +10,7 @@
 #include "../../GauntCommon/io.h"
 #include "../../GauntCommon/link.h"
 #include "../record/pairs.h"
+#include "../record/record.h"
 #include "../script/script.h"
 #include "../wrap/wrap.h"
 
@@ -420,6 +421,7 @@ public:
 		if(!r->transcript)
 			luaL_argerror(l, 1, "resource has no transcript");
 
+		rec::EditTranscripts();
 		rec::LuaToJSVar(l, 2, *r->transcript);
 		return 0;
 	}
@@ -5,6 +5,7 @@
 #include "scene_lua.h"
 #include "scene_private.h"
 #include "../../GauntCommon/json_ext.h"
+#include "../profile/profile.h"
 #include "../render/render.h"
 
 /*
@@ -26,6 +27,8 @@ FIXME: probably a lot of cache misses here with lots of entities
 --------------------------------------*/
 void scn::SaveSpace()
 {
+	TickLinkStats(); // Stats are per tick
+
 	// Cameras
 	for(const com::linker<Camera>* it = Camera::List().f; it; it = it->next)
 		it->o->SaveOld();
@@ -452,18 +455,24 @@ void scn::Init()
 	fog.LuaPush(); // gscn.fog = gscn.GetFog()
 
 	scr::RegisterLibrary(scr::state, "gscn", regs, 0, NUM_FIELDS, metas, prefixes);
+
+	// Console commands
+	lua_pushcfunction(scr::state, BenchRelink); con::CreateCommand("scn_bench_relink");
+	lua_pushcfunction(scr::state, BenchLinkChurn); con::CreateCommand("scn_bench_link_churn");
 }
 
 /*--------------------------------------
 	scn::CallEntityFunctions
 
-Calls the specified function type for every entity.
+Calls the specified function type for every entity. Ticks are profiled per entity type.
 
 FIXME: entities have function called twice if an entity is Prioritize()'d during iteration
 --------------------------------------*/
 void scn::CallEntityFunctions(ent_func func)
 {
+	PRF_ZONE("scn::CallEntityFunctions");
 	scr::EnsureStack(scr::state, 2);
+	bool profileTypes = prf::active && func == ENT_FUNC_TICK;
 
 	for(const com::linker<Entity>* reg = Entity::List().f, *next; reg; reg = next)
 	{
@@ -472,7 +481,15 @@ void scn::CallEntityFunctions(ent_func func)
 		if(ent.Alive() && ent.type && ent.type->HasRef(func))
 		{
 			ent.AddLock(); // Delay potential delete so next ent can be retrieved after call
-			ent.UnsafeCall(func);
+
+			if(profileTypes)
+			{
+				PRF_ZONE(prf::Name("tick ", ent.type->Name()));
+				ent.UnsafeCall(func);
+			}
+			else
+				ent.UnsafeCall(func);
+
 			next = reg->next;
 			ent.RemoveLock();
 		}
@@ -21,6 +21,11 @@
 #include "../render/texture.h"
 #include "../resource/resource.h"
 
+namespace hit
+{
+	class Descent;
+}
+
 namespace scn
 {
 
@@ -40,6 +45,70 @@ typedef obj_link<Bulb>		bulb_link;
 typedef obj_link<WorldNode>	leaf_link;
 typedef obj_link<Zone>		zone_link;
 
+void*	AllocLinks(size_t& numInOut);
+void	FreeLinks(void* links, size_t num);
+
+/*======================================
+	scn::link_arr
+
+Array of obj_links allocated from the shared link slabs instead of the heap. n is the capacity,
+which is always a power of two.
+======================================*/
+template <class T> class link_arr
+{
+public:
+	obj_link<T>*	o;
+	size_t			n;
+
+						link_arr() : o(0), n(0) {}
+	obj_link<T>&		operator[](size_t i) {return o[i];}
+	const obj_link<T>&	operator[](size_t i) const {return o[i];}
+
+	void Init(size_t num)
+	{
+		n = num;
+		o = (obj_link<T>*)AllocLinks(n);
+	}
+
+	void Free()
+	{
+		if(o)
+			FreeLinks(o, n);
+
+		o = 0;
+		n = 0;
+	}
+
+	void Ensure(size_t num)
+	{
+		if(num <= n)
+			return;
+
+		obj_link<T>* newO = (obj_link<T>*)AllocLinks(num);
+
+		for(size_t i = 0; i < n; i++)
+			newO[i] = o[i];
+
+		Free();
+		o = newO;
+		n = num;
+	}
+};
+
+/*======================================
+	scn::link_pool_stats
+
+Current state of the link slabs. Blocks bigger than a slab come from the heap.
+======================================*/
+struct link_pool_stats
+{
+	size_t	numBlocks, numLargeBlocks; // In use
+	size_t	numSlabs;
+	size_t	usedBytes, reservedBytes;
+};
+
+extern link_pool_stats linkPoolStats;
+
 /*
 ################################################################################################
 	CAMERA
@@ -214,7 +283,7 @@ public:
 	int						Overlay() const;
 	uint16_t				OverlayFlags() const {return (pFlags & (P_OVERLAY_0 | P_OVERLAY_1)) >> 5;}
 	void					SetOverlay(int overlay);
-	const leaf_link*		LeafLinks() const {return leafLinks.o;}
+	const leaf_link*		LeafLinks() const {return leafLinks.o;} // Call FlushLinks first
 	size_t					NumLeafLinks() const {return numLeafLinks;}
 	Entity*					Child() {return child;}
 	const Entity*			Child() const {return child;}
@@ -243,20 +312,22 @@ private:
 		P_POINT_LINK = 1 << 3, // Link entity as a point if it has no mesh or hull
 		P_SKY_OVERLAY = 1 << 4,
 		P_OVERLAY_0 = 1 << 5, // Update OverlayFlags if these constants change
-		P_OVERLAY_1 = 1 << 6
+		P_OVERLAY_1 = 1 << 6,
+		P_DIRTY_LINK = 1 << 7 // In the dirty list, relinked by FlushLinks
 	};
 
 	com::Vec3				pos;
 	com::Qua				ori;
 	float					scale; // Only affects mesh
-	com::Arr<leaf_link>		leafLinks;
+	link_arr<WorldNode>		leafLinks;
 	size_t					numLeafLinks;
-	com::Arr<zone_link>		zoneLinks;
+	link_arr<Zone>			zoneLinks;
 	size_t					numZoneLinks;
 	res::Ptr<rnd::Mesh>		msh;
 	res::Ptr<hit::Hull>		hull;
 	res::Ptr<hit::Hull>		linkHull; // Prioritized hull for linking, never oriented
 	res::Ptr<Entity>		child; // child does not link to world
+	uint32_t				treeLeaf; // ENT_TREE_NONE if not in entity tree
 	// FIXME: save + load animation stuff
 	res::Ptr<const rnd::Animation> anim; // Currently played or transition target
 	float					frame; // Relative; shown at start of tick if not in transition
@@ -271,17 +342,79 @@ private:
 							~Entity();
 	void					LinkWorld();
 	void					UnlinkWorld();
+	void					UnlinkLeaves();
+	void					RelinkWorld();
+	bool					GatherLinks(hit::Descent& d, hit::Hull& box, com::Vec3& minOut,
+							com::Vec3& maxOut, com::Arr<WorldNode*>& leavesIO,
+							size_t& numLeavesIO) const;
+	void					ApplyLinks(const com::Vec3& min, const com::Vec3& max,
+							WorldNode* const* leaves, size_t numLeaves);
+	void					LinkTree(const com::Vec3& min, const com::Vec3& max);
+	void					UnlinkTree();
 
 public:
 	friend Entity*			CreateEntity(EntityType* et, const com::Vec3& pos,
 							const com::Qua& ori);
 	friend void				KillEntity(Entity& ent);
+	friend void				FlushLinks();
+	friend void				GatherLinkJob(void* data, size_t index, size_t worker);
 	friend class			res::LicenseToDelete<Entity, true>;
 };
 
+Entity*			CreateEntity(EntityType* et, const com::Vec3& pos, const com::Qua& ori);
+void			KillEntity(Entity& ent);
 void			ClearEntities();
+void			FlushLinks();
 void			InterpretEntities(com::PairMap<com::JSVar>& entities);
 
+/*
+################################################################################################
+	ENTITY TREE
+################################################################################################
+*/
+
+const uint32_t ENT_TREE_NONE = -1;
+
+/*======================================
+	scn::ent_tree_node
+
+Node of the dynamic bounding box tree linked entities are kept in for hit tests. A leaf's box is
+its entity's bounds grown by scn_tree_margin so small moves don't need a reinsert. A branch's box
+contains its children's.
+======================================*/
+struct ent_tree_node
+{
+	com::Vec3	min, max;
+	uint32_t	parent; // Next free node if unused
+	uint32_t	left, right; // ENT_TREE_NONE for leaves
+	uint32_t	height; // 0 for leaves
+	Entity*		ent; // 0 for branches
+};
+
+/*======================================
+	scn::link_stats
+
+Counted since the start of the tick. Hit tests only count queries done with the main thread's
+hit::Context.
+======================================*/
+struct link_stats
+{
+	unsigned			numLinks, numUnlinks; // Leaf and zone link passes
+	unsigned			numTreeInserts, numTreeRemoves;
+	unsigned			numTreeKeeps; // Moves that stayed inside the fat box
+	unsigned			numTreeQueries;
+	unsigned long long	treeQueryMicro;
+	unsigned			numRelinksAvoided; // Moves of entities that were already dirty
+	unsigned			numFlushedRelinks, numFlushes;
+	unsigned long long	flushMicro;
+	unsigned			numLinkAllocs, numLinkFrees; // Link array blocks
+};
+
+extern link_stats linkStats;
+
+size_t	SweepEntityTree(const com::Vec3& a, const com::Vec3& b, const com::Vec3& min,
+		const com::Vec3& max, com::Arr<uint32_t>& stackIO, com::Arr<Entity*>& entsIO);
+
 /*
 ################################################################################################
 	WORLD
@@ -337,9 +470,9 @@ public:
 	PortalSet**			portals;
 	uint32_t			numPortals;
 
-	com::Arr<ent_link>	entLinks;
+	link_arr<Entity>	entLinks;
 	size_t				numEntLinks;
-	com::Arr<bulb_link>	bulbLinks;
+	link_arr<Bulb>		bulbLinks;
 	size_t				numBulbLinks;
 
 	rnd::zone_reg*		rndReg; // FIXME: renderer can align its array with scene's
@@ -349,7 +482,17 @@ public:
 	Zone() : id(0), flags(0), leaves(0), numLeaves(0), portals(0), numPortals(0),
 		numEntLinks(0), numBulbLinks(0), rndReg(0), drawCode(0) {}
 
-	~Zone() {if(leaves) delete[] leaves; if(portals) delete[] portals;}
+	~Zone()
+	{
+		if(leaves)
+			delete[] leaves;
+
+		if(portals)
+			delete[] portals;
+
+		entLinks.Free();
+		bulbLinks.Free();
+	}
 };
 
 /*======================================
@@ -397,7 +540,7 @@ public:
 	leaf_triangle*		triangles;
 	uint32_t			numTriangles;
 
-	com::Arr<ent_link>	entLinks; // FIXME: links should share memory pool; com::Pool?
+	link_arr<Entity>	entLinks;
 	size_t				numEntLinks; // FIXME: links should be const to other systems
 
 	WorldNode() : solid(0), zone(0), planeExits(0), hull(0), bevels(0), numBevels(0), pvls(0),
@@ -599,7 +742,7 @@ public:
 private:
 	com::Vec3			pos;
 	float				radius;
-	com::Arr<zone_link>	zoneLinks;
+	link_arr<Zone>		zoneLinks;
 	size_t				numZoneLinks;
 
 	static const size_t	DEF_NUM_ZONE_LINKS_ALLOC = 1;
@@ -5,8 +5,42 @@
 #include "scene_lua.h"
 #include "scene_private.h"
 #include "../../GauntCommon/json_ext.h"
+#include "../console/console.h"
 #include "../hit/hit.h"
 #include "../render/render.h"
+#include "../wrap/wrap.h"
+
+namespace scn
+{
+	con::Option
+		deferLinks("scn_defer_links", true),
+		parallelLinks("scn_parallel_links", true);
+
+	// Entities whose RelinkWorld was deferred, each locked until FlushLinks
+	com::Arr<Entity*>	dirtyEnts(32);
+	size_t				numDirtyEnts = 0;
+
+	// Leaves gathered for one dirty entity by a worker
+	struct link_job
+	{
+		bool		link;
+		com::Vec3	min, max;
+		size_t		worker, firstLeaf, numLeaves;
+	};
+
+	const size_t MIN_PARALLEL_LINKS = 64;
+
+	// One of each per worker thread
+	com::Arr<link_job>		linkJobs;
+	hit::Descent*			linkDescents = 0;
+	hit::Hull**				linkBoxes = 0;
+	com::Arr<WorldNode*>*	linkLeaves = 0;
+	size_t*					numLinkLeaves = 0;
+	size_t					numLinkWorkers = 0;
+
+	void	EnsureLinkWorkers();
+	void	GatherLinkJob(void* data, size_t index, size_t worker);
+}
 
 /*
 ################################################################################################
@@ -50,6 +84,7 @@ scn::Entity::Entity(EntityType* et, const com::Vec3& p, const com::Qua& o)
 	midA = midB = 0;
 	midF = transTime = 0.0f;
 	hitCode = 0;
+	treeLeaf = ENT_TREE_NONE;
 	SetPlace(p, o);
 	gFlags.AddLock(); // Permanent lock
 	LuaPush(); // Create userdata
@@ -104,7 +139,7 @@ void scn::Entity::DummyCopy(const Entity& src)
 	msh = src.msh;
 	hull = src.hull;
 	linkHull = src.linkHull;
-	// Not copying child
+	// Not copying child, treeLeaf
 	anim = src.anim;
 	frame = src.frame;
 	midA = src.midA;
@@ -125,8 +160,7 @@ void scn::Entity::SetPos(const com::Vec3& p)
 		return;
 
 	pos = p;
-	UnlinkWorld();
-	LinkWorld();
+	RelinkWorld();
 }
 
 /*--------------------------------------
@@ -152,8 +186,7 @@ void scn::Entity::SetOri(const com::Qua& o)
 			return;
 
 		ori = o;
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 	else
 		ori = o;
@@ -185,8 +218,7 @@ void scn::Entity::SetPlace(const com::Vec3& p, const com::Qua& o)
 
 	pos = p;
 	ori = o;
-	UnlinkWorld();
-	LinkWorld();
+	RelinkWorld();
 }
 
 /*--------------------------------------
@@ -204,8 +236,7 @@ void scn::Entity::SetScale(float s)
 
 	if(!linkHull && !hull) // Relink if using mesh's hull
 	{
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 }
 
@@ -240,8 +271,7 @@ void scn::Entity::SetScaledPlace(const com::Vec3& p, const com::Qua& o, float s)
 	pos = p;
 	ori = o;
 	scale = s;
-	UnlinkWorld();
-	LinkWorld();
+	RelinkWorld();
 }
 
 /*--------------------------------------
@@ -253,8 +283,7 @@ void scn::Entity::SetOrientHull(bool o)
 
 	if(!linkHull && hull)
 	{
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 }
 
@@ -282,8 +311,7 @@ void scn::Entity::SetMesh(rnd::Mesh* m)
 
 	if(!linkHull && !hull)
 	{
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 }
 
@@ -299,8 +327,7 @@ void scn::Entity::SetHull(hit::Hull* h)
 
 	if(!linkHull)
 	{
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 }
 
@@ -313,8 +340,7 @@ void scn::Entity::SetLinkHull(hit::Hull* h)
 		return;
 
 	linkHull.Set(h);
-	UnlinkWorld();
-	LinkWorld();
+	RelinkWorld();
 }
 
 /*--------------------------------------
@@ -572,8 +598,7 @@ void scn::Entity::SetPointLink(bool point)
 
 	if(!linkHull && !hull && !msh)
 	{
-		UnlinkWorld();
-		LinkWorld();
+		RelinkWorld();
 	}
 }
 
@@ -665,14 +690,35 @@ void scn::Entity::Call(int func, int numArgs)
 /*--------------------------------------
 	scn::Entity::LinkWorld
 
-Links entity to leaves its hull or, if the entity has no hull, its mesh's hull is in.
+Links entity to leaves its hull or, if the entity has no hull, its mesh's hull is in. Puts the
+same bounds in the entity tree.
 --------------------------------------*/
 void scn::Entity::LinkWorld()
+{
+	static hit::Hull box(0.0f, 0.0f);
+	static com::Arr<WorldNode*> leaves(8);
+	size_t numLeaves = 0;
+	com::Vec3 min, max;
+
+	if(GatherLinks(hit::GlobalDescent(), box, min, max, leaves, numLeaves))
+		ApplyLinks(min, max, leaves.o, numLeaves);
+	else
+		UnlinkTree();
+}
+
+/*--------------------------------------
+	scn::Entity::GatherLinks
+
+Appends the non-solid leaves the entity should link to to leavesIO and sets the bounds to put in
+the entity tree. Returns false if the entity should not be linked at all. Only reads the entity
+and the world, so it can be called from worker threads as long as d and box are the worker's.
+--------------------------------------*/
+bool scn::Entity::GatherLinks(hit::Descent& d, hit::Hull& box, com::Vec3& min, com::Vec3& max,
+	com::Arr<WorldNode*>& leaves, size_t& numLeaves) const
 {
 	if((pFlags & P_CHILD) != 0)
-		return;
+		return false;
 
-	static hit::Hull box(0.0f, 0.0f);
 	const hit::Hull* actHull = 0;
 	com::Qua hullOri = com::QUA_IDENTITY;
 
@@ -692,8 +738,15 @@ void scn::Entity::LinkWorld()
 
 	if(actHull)
 	{
-		unsigned zoneCode = IncZoneDrawCode();
-		hit::Descent& d = hit::GlobalDescent();
+		for(int i = 0; i < 3; i++)
+		{
+			com::Vec3 axis(0.0f);
+			axis[i] = 1.0f;
+			hit::Span(*actHull, hullOri, axis, min[i], max[i]);
+		}
+
+		min += pos;
+		max += pos;
 		d.Begin(WorldRoot(), pos, pos);
 
 		while(d.numStacked)
@@ -702,18 +755,8 @@ void scn::Entity::LinkWorld()
 		
 			if(!topNode.left && !topNode.solid)
 			{
-				LinkObject<Entity, WorldNode>(*this, &Entity::leafLinks, &Entity::numLeafLinks,
-					topNode, &WorldNode::entLinks, &WorldNode::numEntLinks);
-
-				Zone& zone = *topNode.zone;
-
-				if(zone.drawCode != zoneCode)
-				{
-					LinkObject<Entity, Zone>(*this, &Entity::zoneLinks, &Entity::numZoneLinks,
-						zone, &Zone::entLinks, &Zone::numEntLinks);
-
-					zone.drawCode = zoneCode;
-				}
+				leaves.Ensure(numLeaves + 1);
+				leaves[numLeaves++] = &topNode;
 			}
 
 			d.Descend(*actHull, hullOri);
@@ -721,15 +764,48 @@ void scn::Entity::LinkWorld()
 	}
 	else if(pFlags & P_POINT_LINK)
 	{
+		min = max = pos;
 		WorldNode& leaf = (WorldNode&)*PosToLeaf(WorldRoot(), pos);
-			
+
 		if(!leaf.solid)
 		{
-			LinkObject<Entity, WorldNode>(*this, &Entity::leafLinks, &Entity::numLeafLinks,
-				leaf, &WorldNode::entLinks, &WorldNode::numEntLinks);
+			leaves.Ensure(numLeaves + 1);
+			leaves[numLeaves++] = &leaf;
+		}
+	}
+	else
+		return false;
+
+	return true;
+}
 
-			LinkObject<Entity, Zone>(*this, &Entity::zoneLinks, &Entity::numZoneLinks,
-				*leaf.zone, &Zone::entLinks, &Zone::numEntLinks);
+/*--------------------------------------
+	scn::Entity::ApplyLinks
+
+Links the entity to the gathered leaves and their zones and puts it in the entity tree. Main
+thread only.
+--------------------------------------*/
+void scn::Entity::ApplyLinks(const com::Vec3& min, const com::Vec3& max,
+	WorldNode* const* leaves, size_t numLeaves)
+{
+	LinkTree(min, max);
+	linkStats.numLinks++;
+	unsigned zoneCode = IncZoneDrawCode();
+
+	for(size_t i = 0; i < numLeaves; i++)
+	{
+		WorldNode& leaf = *leaves[i];
+		LinkObject<Entity, WorldNode>(*this, &Entity::leafLinks, &Entity::numLeafLinks, leaf,
+			&WorldNode::entLinks, &WorldNode::numEntLinks);
+
+		Zone& zone = *leaf.zone;
+
+		if(zone.drawCode != zoneCode)
+		{
+			LinkObject<Entity, Zone>(*this, &Entity::zoneLinks, &Entity::numZoneLinks, zone,
+				&Zone::entLinks, &Zone::numEntLinks);
+
+			zone.drawCode = zoneCode;
 		}
 	}
 }
@@ -737,10 +813,25 @@ void scn::Entity::LinkWorld()
 /*--------------------------------------
 	scn::Entity::UnlinkWorld
 
-FIXME: corrupts heap if world is cleared without deleting entities
+Unlinks from leaves and zones and takes the entity out of the entity tree.
 --------------------------------------*/
 void scn::Entity::UnlinkWorld()
 {
+	pFlags &= ~P_DIRTY_LINK;
+	UnlinkLeaves();
+	UnlinkTree();
+}
+
+/*--------------------------------------
+	scn::Entity::UnlinkLeaves
+
+FIXME: corrupts heap if world is cleared without deleting entities
+--------------------------------------*/
+void scn::Entity::UnlinkLeaves()
+{
+	if(numLeafLinks || numZoneLinks)
+		linkStats.numUnlinks++;
+
 	UnlinkObjects<Entity, WorldNode>(*this, &Entity::leafLinks, &Entity::numLeafLinks,
 		&WorldNode::entLinks, &WorldNode::numEntLinks);
 
@@ -748,6 +839,35 @@ void scn::Entity::UnlinkWorld()
 		&Zone::entLinks, &Zone::numEntLinks);
 }
 
+/*--------------------------------------
+	scn::Entity::RelinkWorld
+
+Call after the entity's placement or linking objects change. Keeps the entity's tree leaf if it
+still fits. If scn_defer_links is on, only marks the entity dirty; it's relinked once by the next
+FlushLinks no matter how many times it moves before then.
+--------------------------------------*/
+void scn::Entity::RelinkWorld()
+{
+	if(!deferLinks.Bool())
+	{
+		pFlags &= ~P_DIRTY_LINK;
+		UnlinkLeaves();
+		LinkWorld();
+		return;
+	}
+
+	if(pFlags & P_DIRTY_LINK)
+	{
+		linkStats.numRelinksAvoided++;
+		return;
+	}
+
+	pFlags |= P_DIRTY_LINK;
+	dirtyEnts.Ensure(numDirtyEnts + 1);
+	dirtyEnts[numDirtyEnts++] = this;
+	AddLock(); // Removed by FlushLinks
+}
+
 /*--------------------------------------
 	scn::Entity::Transcribe
 
@@ -943,6 +1063,147 @@ void scn::ClearEntities()
 		next = it->next;
 		ent.RemoveLock(); // ~Entity might be called here
 	}
+
+	FlushLinks(); // Drop dirty list's locks
+}
+
+/*--------------------------------------
+	scn::FlushLinks
+
+Relinks every entity that moved since the last flush. Call before anything reads entity links or
+the entity tree. If there are enough dirty entities, workers gather the leaves while the main
+thread only links them.
+--------------------------------------*/
+void scn::FlushLinks()
+{
+	if(!numDirtyEnts)
+		return;
+
+	unsigned long long startTime = wrp::MicroTime();
+
+	// ~Entity can relink other entities while the list is being unlocked, so repeat until no more
+	// were added
+	while(numDirtyEnts)
+	{
+		size_t num = numDirtyEnts;
+
+		if(parallelLinks.Bool() && num >= MIN_PARALLEL_LINKS && wrp::NumWorkers() > 1)
+		{
+			EnsureLinkWorkers();
+			linkJobs.Ensure(num);
+
+			for(size_t i = 0; i < numLinkWorkers; i++)
+			{
+				linkDescents[i].FitLargestTree();
+				numLinkLeaves[i] = 0;
+			}
+
+			wrp::RunJobs(GatherLinkJob, 0, num);
+
+			for(size_t i = 0; i < num; i++)
+			{
+				Entity& ent = *dirtyEnts[i];
+
+				if(!(ent.pFlags & Entity::P_DIRTY_LINK))
+					continue;
+
+				const link_job& job = linkJobs[i];
+				ent.pFlags &= ~Entity::P_DIRTY_LINK;
+				ent.UnlinkLeaves();
+
+				if(job.link)
+				{
+					ent.ApplyLinks(job.min, job.max, linkLeaves[job.worker].o + job.firstLeaf,
+						job.numLeaves);
+				}
+				else
+					ent.UnlinkTree();
+
+				linkStats.numFlushedRelinks++;
+			}
+		}
+		else
+		{
+			for(size_t i = 0; i < num; i++)
+			{
+				Entity& ent = *dirtyEnts[i];
+
+				if(!(ent.pFlags & Entity::P_DIRTY_LINK))
+					continue;
+
+				ent.pFlags &= ~Entity::P_DIRTY_LINK;
+				ent.UnlinkLeaves();
+				ent.LinkWorld();
+				linkStats.numFlushedRelinks++;
+			}
+		}
+
+		// Unlock after linking so no entity in the list is deleted early
+		for(size_t i = 0; i < num; i++)
+			dirtyEnts[i]->RemoveLock(); // ~Entity might be called here
+
+		// Keep entities added during the unlocks
+		numDirtyEnts -= num;
+
+		for(size_t i = 0; i < numDirtyEnts; i++)
+			dirtyEnts[i] = dirtyEnts[num + i];
+	}
+
+	linkStats.numFlushes++;
+	linkStats.flushMicro += wrp::MicroTime() - startTime;
+}
+
+/*--------------------------------------
+	scn::EnsureLinkWorkers
+--------------------------------------*/
+void scn::EnsureLinkWorkers()
+{
+	size_t numWorkers = wrp::NumWorkers();
+
+	if(numWorkers <= numLinkWorkers)
+		return;
+
+	for(size_t i = 0; i < numLinkWorkers; i++)
+	{
+		delete linkBoxes[i];
+		linkLeaves[i].Free();
+	}
+
+	if(linkDescents)
+	{
+		delete[] linkDescents;
+		delete[] linkBoxes;
+		delete[] linkLeaves;
+		delete[] numLinkLeaves;
+	}
+
+	numLinkWorkers = numWorkers;
+	linkDescents = new hit::Descent[numLinkWorkers];
+	linkBoxes = new hit::Hull*[numLinkWorkers];
+	linkLeaves = new com::Arr<WorldNode*>[numLinkWorkers];
+	numLinkLeaves = new size_t[numLinkWorkers];
+
+	for(size_t i = 0; i < numLinkWorkers; i++)
+	{
+		linkBoxes[i] = new hit::Hull(0.0f, 0.0f);
+		linkLeaves[i].Init(64);
+	}
+}
+
+/*--------------------------------------
+	scn::GatherLinkJob
+--------------------------------------*/
+void scn::GatherLinkJob(void*, size_t index, size_t worker)
+{
+	const Entity& ent = *dirtyEnts[index];
+	link_job& job = linkJobs[index];
+	job.worker = worker;
+	job.firstLeaf = numLinkLeaves[worker];
+
+	job.link = (ent.pFlags & Entity::P_DIRTY_LINK) && ent.GatherLinks(linkDescents[worker],
+		*linkBoxes[worker], job.min, job.max, linkLeaves[worker], numLinkLeaves[worker]);
+
+	job.numLeaves = numLinkLeaves[worker] - job.firstLeaf;
 }
 
 /*--------------------------------------
@@ -970,4 +1231,100 @@ void scn::InterpretEntities(com::PairMap<com::JSVar>& entities)
 		ent.InterpretTranscript();
 		ent.Call(ENT_FUNC_INIT);
 	}
-}
\ No newline at end of file
+}
+
+/*
+################################################################################################
+
+
+	RELINK BENCH
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	scn::BenchRelink (scn_bench_relink)
+
+IN	[iNumEnts = 2000], [iNumTicks = 30], [iSeed = 1]
+
+Creates box hull entities at random points in the world and, every tick, moves and turns each
+one like a script would, then flushes links like a frame would. Runs once with immediate
+relinking, once deferred, and once deferred with parallel gathering, and logs each run's time
+and link counts. Meant to be run with horse.wld loaded.
+--------------------------------------*/
+int scn::BenchRelink(lua_State* l)
+{
+	lua_Integer numEnts = luaL_optinteger(l, 1, 2000);
+	lua_Integer numTicks = luaL_optinteger(l, 2, 30);
+	uint32_t seed = luaL_optinteger(l, 3, 1);
+
+	if(!WorldRoot() || numEnts <= 0 || numTicks <= 0)
+		return 0;
+
+	FlushLinks(); // Don't count other entities' moves
+
+	const com::Vec3& min = WorldMin();
+	com::Vec3 size = WorldMax() - min;
+	hit::Hull box(com::Vec3(-16.0f), com::Vec3(16.0f));
+	com::Arr<Entity*> ents(numEnts);
+	com::Arr<com::Vec3> starts(numEnts), vels(numEnts);
+
+	for(size_t i = 0; i < ents.n; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+		{
+			starts[i][j] = min[j] + size[j] * com::BenchRandF(seed);
+			vels[i][j] = (com::BenchRandF(seed) - 0.5f) * 16.0f;
+		}
+
+		ents[i] = CreateEntity(0, starts[i], com::QUA_IDENTITY);
+		ents[i]->SetHull(&box);
+		ents[i]->SetOrientHull(true);
+	}
+
+	float oldDefer = deferLinks.Float(), oldParallel = parallelLinks.Float();
+	const char* names[3] = {"Immediate", "Deferred", "Deferred parallel"};
+
+	for(size_t i = 0; i < 3; i++)
+	{
+		deferLinks.SetValue(i != 0, false);
+		parallelLinks.SetValue(i == 2, false);
+
+		for(size_t j = 0; j < ents.n; j++)
+			ents[j]->SetPlace(starts[j], com::QUA_IDENTITY);
+
+		FlushLinks();
+		link_stats before = linkStats;
+		unsigned long long startTime = wrp::MicroTime();
+
+		for(lua_Integer t = 1; t <= numTicks; t++)
+		{
+			for(size_t j = 0; j < ents.n; j++)
+			{
+				ents[j]->SetPos(starts[j] + vels[j] * (float)t);
+				ents[j]->SetOri(com::QuaAxisAngle(com::Vec3(0.0f, 0.0f, 1.0f), t * 0.1f));
+			}
+
+			FlushLinks();
+		}
+
+		unsigned long long micro = wrp::MicroTime() - startTime;
+
+		con::LogF("%s: %g ms/tick, %u links, %u relinks avoided", names[i],
+			micro * 0.001 / numTicks, linkStats.numLinks - before.numLinks,
+			linkStats.numRelinksAvoided - before.numRelinksAvoided);
+	}
+
+	deferLinks.SetValue(oldDefer, false);
+	parallelLinks.SetValue(oldParallel, false);
+
+	for(size_t i = 0; i < ents.n; i++)
+		KillEntity(*ents[i]);
+
+	FlushLinks(); // Unlock killed entities so they release box
+	ents.Free();
+	starts.Free();
+	vels.Free();
+	return 0;
+}
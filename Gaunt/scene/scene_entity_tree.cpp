@@ -0,0 +1,475 @@
+// scene_entity_tree.cpp
+// Martynas Ceicys
+
+#include "scene.h"
+#include "scene_private.h"
+#include "../console/console.h"
+
+namespace scn
+{
+	con::Option
+		treeMargin("scn_tree_margin", 4.0f), // Added to each side of a leaf's box on insert
+		showLinkStats("scn_show_link_stats", false);
+
+	link_stats linkStats = {0};
+
+	// ENTITY TREE
+	com::Arr<ent_tree_node>	treeNodes;
+	uint32_t				numTreeNodes = 0; // Including free nodes
+	uint32_t				treeRoot = ENT_TREE_NONE, freeTreeNode = ENT_TREE_NONE;
+
+	uint32_t	AllocTreeNode();
+	void		FreeTreeNode(uint32_t index);
+	void		InsertTreeLeaf(uint32_t leaf);
+	void		RemoveTreeLeaf(uint32_t leaf);
+	void		RefitTreeUp(uint32_t index);
+	uint32_t	BalanceTree(uint32_t index);
+	uint32_t	RotateTree(uint32_t iA, uint32_t iB, uint32_t iC);
+	void		FitTreeNode(ent_tree_node& n);
+	void		UnionBox(const com::Vec3& minA, const com::Vec3& maxA, const com::Vec3& minB,
+				const com::Vec3& maxB, com::Vec3& minOut, com::Vec3& maxOut);
+	float		BoxArea(const com::Vec3& min, const com::Vec3& max);
+	float		UnionArea(const ent_tree_node& n, const com::Vec3& min, const com::Vec3& max);
+}
+
+/*
+################################################################################################
+
+
+	ENTITY TREE
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	scn::Entity::LinkTree
+
+Puts the entity in the entity tree with bounds min and max. Does nothing if the bounds are still
+inside the entity's fat box and the box isn't much larger than them.
+--------------------------------------*/
+void scn::Entity::LinkTree(const com::Vec3& min, const com::Vec3& max)
+{
+	float margin = treeMargin.Float();
+
+	if(treeLeaf != ENT_TREE_NONE)
+	{
+		const ent_tree_node& n = treeNodes[treeLeaf];
+		bool keep = true;
+
+		for(size_t i = 0; i < 3 && keep; i++)
+		{
+			keep = n.min[i] <= min[i] && max[i] <= n.max[i] &&
+				min[i] - n.min[i] <= margin * 4.0f && n.max[i] - max[i] <= margin * 4.0f;
+		}
+
+		if(keep)
+		{
+			linkStats.numTreeKeeps++;
+			return;
+		}
+
+		RemoveTreeLeaf(treeLeaf);
+	}
+	else
+	{
+		treeLeaf = AllocTreeNode();
+		ent_tree_node& n = treeNodes[treeLeaf];
+		n.left = n.right = ENT_TREE_NONE;
+		n.height = 0;
+		n.ent = this;
+	}
+
+	ent_tree_node& n = treeNodes[treeLeaf];
+	n.min = min - margin;
+	n.max = max + margin;
+	InsertTreeLeaf(treeLeaf);
+	linkStats.numTreeInserts++;
+}
+
+/*--------------------------------------
+	scn::Entity::UnlinkTree
+--------------------------------------*/
+void scn::Entity::UnlinkTree()
+{
+	if(treeLeaf == ENT_TREE_NONE)
+		return;
+
+	RemoveTreeLeaf(treeLeaf);
+	FreeTreeNode(treeLeaf);
+	treeLeaf = ENT_TREE_NONE;
+	linkStats.numTreeRemoves++;
+}
+
+/*--------------------------------------
+	scn::SweepEntityTree
+
+Puts every entity whose fat box is touched by the box [min, max] moving from a to b in entsIO.
+Returns the number of entities found. stackIO is scratch memory, so threads can query at the
+same time with their own arrays as long as the tree isn't changed meanwhile.
+--------------------------------------*/
+size_t scn::SweepEntityTree(const com::Vec3& a, const com::Vec3& b, const com::Vec3& min,
+	const com::Vec3& max, com::Arr<uint32_t>& stack, com::Arr<Entity*>& ents)
+{
+	if(treeRoot == ENT_TREE_NONE)
+		return 0;
+
+	com::Vec3 dir = b - a;
+	float inv[3];
+
+	for(size_t i = 0; i < 3; i++)
+		inv[i] = dir[i] ? 1.0f / dir[i] : 0.0f;
+
+	stack.Ensure(1);
+	stack[0] = treeRoot;
+	size_t numStacked = 1, numEnts = 0;
+
+	while(numStacked)
+	{
+		const ent_tree_node& n = treeNodes[stack[--numStacked]];
+
+		// Slab test against the node's box grown by the swept box
+		float tEnter = 0.0f, tExit = 1.0f;
+		size_t i = 0;
+
+		for(; i < 3; i++)
+		{
+			float lo = n.min[i] - max[i], hi = n.max[i] - min[i];
+
+			if(!dir[i])
+			{
+				if(a[i] < lo || a[i] > hi)
+					break;
+
+				continue;
+			}
+
+			float t0 = (lo - a[i]) * inv[i], t1 = (hi - a[i]) * inv[i];
+
+			if(t0 > t1)
+				com::Swap(t0, t1);
+
+			tEnter = COM_MAX(tEnter, t0);
+			tExit = COM_MIN(tExit, t1);
+
+			if(tEnter > tExit)
+				break;
+		}
+
+		if(i != 3)
+			continue; // Missed
+
+		if(n.left == ENT_TREE_NONE)
+		{
+			ents.Ensure(numEnts + 1);
+			ents[numEnts++] = n.ent;
+			continue;
+		}
+
+		stack.Ensure(numStacked + 2);
+		stack[numStacked++] = n.left;
+		stack[numStacked++] = n.right;
+	}
+
+	return numEnts;
+}
+
+/*--------------------------------------
+	scn::AllocTreeNode
+--------------------------------------*/
+uint32_t scn::AllocTreeNode()
+{
+	uint32_t index;
+
+	if(freeTreeNode != ENT_TREE_NONE)
+	{
+		index = freeTreeNode;
+		freeTreeNode = treeNodes[index].parent;
+	}
+	else
+	{
+		treeNodes.Ensure(numTreeNodes + 1);
+		index = numTreeNodes++;
+	}
+
+	ent_tree_node& n = treeNodes[index];
+	n.parent = n.left = n.right = ENT_TREE_NONE;
+	n.height = 0;
+	n.ent = 0;
+	return index;
+}
+
+/*--------------------------------------
+	scn::FreeTreeNode
+--------------------------------------*/
+void scn::FreeTreeNode(uint32_t index)
+{
+	treeNodes[index].parent = freeTreeNode;
+	treeNodes[index].ent = 0;
+	freeTreeNode = index;
+}
+
+/*--------------------------------------
+	scn::InsertTreeLeaf
+
+Pairs leaf with the node whose box grows the tree's total area the least, then refits and
+rebalances the ancestors. leaf's box must be set.
+--------------------------------------*/
+void scn::InsertTreeLeaf(uint32_t leaf)
+{
+	if(treeRoot == ENT_TREE_NONE)
+	{
+		treeRoot = leaf;
+		treeNodes[leaf].parent = ENT_TREE_NONE;
+		return;
+	}
+
+	com::Vec3 min = treeNodes[leaf].min, max = treeNodes[leaf].max;
+	uint32_t sibling = treeRoot;
+
+	while(treeNodes[sibling].left != ENT_TREE_NONE)
+	{
+		const ent_tree_node& n = treeNodes[sibling];
+		float combined = UnionArea(n, min, max);
+		float cost = 2.0f * combined; // Cost of making a new parent for this node and leaf
+		float inherit = 2.0f * (combined - BoxArea(n.min, n.max)); // Pushing leaf further down
+		float childCosts[2];
+		uint32_t children[2] = {n.left, n.right};
+
+		for(size_t i = 0; i < 2; i++)
+		{
+			const ent_tree_node& child = treeNodes[children[i]];
+			childCosts[i] = UnionArea(child, min, max) + inherit;
+
+			if(child.left != ENT_TREE_NONE)
+				childCosts[i] -= BoxArea(child.min, child.max);
+		}
+
+		if(cost < childCosts[0] && cost < childCosts[1])
+			break;
+
+		sibling = childCosts[0] <= childCosts[1] ? children[0] : children[1];
+	}
+
+	uint32_t oldParent = treeNodes[sibling].parent;
+	uint32_t newParent = AllocTreeNode(); // Might move treeNodes
+	ent_tree_node& p = treeNodes[newParent];
+	p.parent = oldParent;
+	p.left = sibling;
+	p.right = leaf;
+	treeNodes[sibling].parent = newParent;
+	treeNodes[leaf].parent = newParent;
+	FitTreeNode(p);
+
+	if(oldParent == ENT_TREE_NONE)
+		treeRoot = newParent;
+	else
+	{
+		ent_tree_node& op = treeNodes[oldParent];
+		(op.left == sibling ? op.left : op.right) = newParent;
+	}
+
+	RefitTreeUp(oldParent);
+}
+
+/*--------------------------------------
+	scn::RemoveTreeLeaf
+
+Takes leaf out of the tree and frees its parent. leaf itself stays allocated.
+--------------------------------------*/
+void scn::RemoveTreeLeaf(uint32_t leaf)
+{
+	if(leaf == treeRoot)
+	{
+		treeRoot = ENT_TREE_NONE;
+		return;
+	}
+
+	uint32_t parent = treeNodes[leaf].parent;
+	const ent_tree_node& p = treeNodes[parent];
+	uint32_t grandParent = p.parent;
+	uint32_t sibling = p.left == leaf ? p.right : p.left;
+	treeNodes[sibling].parent = grandParent;
+	FreeTreeNode(parent);
+
+	if(grandParent == ENT_TREE_NONE)
+		treeRoot = sibling;
+	else
+	{
+		ent_tree_node& gp = treeNodes[grandParent];
+		(gp.left == parent ? gp.left : gp.right) = sibling;
+		RefitTreeUp(grandParent);
+	}
+}
+
+/*--------------------------------------
+	scn::RefitTreeUp
+
+Rebalances and refits index and its ancestors.
+--------------------------------------*/
+void scn::RefitTreeUp(uint32_t index)
+{
+	while(index != ENT_TREE_NONE)
+	{
+		index = BalanceTree(index);
+		FitTreeNode(treeNodes[index]);
+		index = treeNodes[index].parent;
+	}
+}
+
+/*--------------------------------------
+	scn::BalanceTree
+
+If one of index's subtrees is more than one level taller than the other, rotates the taller
+child up. Returns the index of the node now in index's place.
+--------------------------------------*/
+uint32_t scn::BalanceTree(uint32_t index)
+{
+	const ent_tree_node& a = treeNodes[index];
+
+	if(a.height < 2)
+		return index;
+
+	int balance = (int)treeNodes[a.right].height - (int)treeNodes[a.left].height;
+
+	if(balance > 1)
+		return RotateTree(index, a.left, a.right);
+	else if(balance < -1)
+		return RotateTree(index, a.right, a.left);
+
+	return index;
+}
+
+/*--------------------------------------
+	scn::RotateTree
+
+Puts iC, a child of iA, in iA's place. iA takes iC's shorter child and keeps iB. Returns iC.
+--------------------------------------*/
+uint32_t scn::RotateTree(uint32_t iA, uint32_t iB, uint32_t iC)
+{
+	ent_tree_node& a = treeNodes[iA];
+	ent_tree_node& c = treeNodes[iC];
+	uint32_t iF = c.left, iG = c.right;
+	ent_tree_node& f = treeNodes[iF];
+	ent_tree_node& g = treeNodes[iG];
+
+	c.parent = a.parent;
+	a.parent = iC;
+
+	if(c.parent == ENT_TREE_NONE)
+		treeRoot = iC;
+	else
+	{
+		ent_tree_node& p = treeNodes[c.parent];
+		(p.left == iA ? p.left : p.right) = iC;
+	}
+
+	// a's slot that held c gets c's shorter child
+	uint32_t& slot = a.left == iC ? a.left : a.right;
+	c.left = iA;
+
+	if(f.height > g.height)
+	{
+		c.right = iF;
+		slot = iG;
+		g.parent = iA;
+	}
+	else
+	{
+		c.right = iG;
+		slot = iF;
+		f.parent = iA;
+	}
+
+	FitTreeNode(a);
+	FitTreeNode(c);
+	return iC;
+}
+
+/*--------------------------------------
+	scn::FitTreeNode
+
+Sets branch n's box and height from its children.
+--------------------------------------*/
+void scn::FitTreeNode(ent_tree_node& n)
+{
+	const ent_tree_node& l = treeNodes[n.left];
+	const ent_tree_node& r = treeNodes[n.right];
+	UnionBox(l.min, l.max, r.min, r.max, n.min, n.max);
+	n.height = 1 + COM_MAX(l.height, r.height);
+}
+
+/*--------------------------------------
+	scn::UnionBox
+--------------------------------------*/
+void scn::UnionBox(const com::Vec3& minA, const com::Vec3& maxA, const com::Vec3& minB,
+	const com::Vec3& maxB, com::Vec3& minOut, com::Vec3& maxOut)
+{
+	for(size_t i = 0; i < 3; i++)
+	{
+		minOut[i] = COM_MIN(minA[i], minB[i]);
+		maxOut[i] = COM_MAX(maxA[i], maxB[i]);
+	}
+}
+
+/*--------------------------------------
+	scn::BoxArea
+
+Half of the box's surface area.
+--------------------------------------*/
+float scn::BoxArea(const com::Vec3& min, const com::Vec3& max)
+{
+	com::Vec3 d = max - min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+/*--------------------------------------
+	scn::UnionArea
+--------------------------------------*/
+float scn::UnionArea(const ent_tree_node& n, const com::Vec3& min, const com::Vec3& max)
+{
+	com::Vec3 uMin, uMax;
+	UnionBox(n.min, n.max, min, max, uMin, uMax);
+	return BoxArea(uMin, uMax);
+}
+
+/*
+################################################################################################
+
+
+	LINK STATS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	scn::TickLinkStats
+
+Logs the last tick's link stats if scn_show_link_stats is on, then resets them. Call before a
+tick.
+--------------------------------------*/
+void scn::TickLinkStats()
+{
+	if(showLinkStats.Bool())
+	{
+		con::LogF("Links: %u, unlinks: %u, tree inserts: %u, removes: %u, kept: %u",
+			linkStats.numLinks, linkStats.numUnlinks, linkStats.numTreeInserts,
+			linkStats.numTreeRemoves, linkStats.numTreeKeeps);
+
+		con::LogF("Entity tree queries: %u in %.3f ms", linkStats.numTreeQueries,
+			linkStats.treeQueryMicro * 0.001);
+
+		con::LogF("Deferred relinks: %u in %u flushes, %.3f ms, %u avoided",
+			linkStats.numFlushedRelinks, linkStats.numFlushes, linkStats.flushMicro * 0.001,
+			linkStats.numRelinksAvoided);
+
+		con::LogF("Link blocks: %u allocs, %u frees, %u in use, %u slabs, %u/%u KB",
+			linkStats.numLinkAllocs, linkStats.numLinkFrees, (unsigned)linkPoolStats.numBlocks,
+			(unsigned)linkPoolStats.numSlabs, (unsigned)(linkPoolStats.usedBytes / 1024),
+			(unsigned)(linkPoolStats.reservedBytes / 1024));
+	}
+
+	link_stats zero = {0};
+	linkStats = zero;
+}
@@ -0,0 +1,236 @@
+// scene_link.cpp
+// Martynas Ceicys
+
+#include "scene.h"
+#include "scene_lua.h"
+#include "scene_private.h"
+#include "../console/console.h"
+#include "../hit/hit.h"
+#include "../wrap/wrap.h"
+
+namespace scn
+{
+	// All obj_link types have the same layout
+	const size_t LINK_SIZE = sizeof(obj_link<Entity>);
+	const size_t NUM_LINK_CLASSES = 13; // Block sizes 1, 2, 4, ..., LINKS_PER_SLAB
+	const size_t LINKS_PER_SLAB = (size_t)1 << (NUM_LINK_CLASSES - 1);
+
+	link_pool_stats linkPoolStats = {0};
+
+	com::Arr<char*>	linkSlabs;
+	char*			curLinkSlab = 0;
+	size_t			numCurSlabLinks = LINKS_PER_SLAB; // Used links in curLinkSlab
+	void*			freeLinkBlocks[NUM_LINK_CLASSES] = {0}; // First pointer-size of each is next
+
+	size_t	LinkClass(size_t num);
+	void	NewLinkSlab();
+	void	PushLinkBlock(void* block, size_t c);
+}
+
+/*
+################################################################################################
+
+
+	LINK SLABS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	scn::AllocLinks
+
+Rounds numInOut up to a power of two and returns a block of that many links. Blocks come from
+per-size free lists, then from the current slab. Only call from the main thread.
+--------------------------------------*/
+void* scn::AllocLinks(size_t& num)
+{
+	size_t c = LinkClass(num);
+	num = (size_t)1 << c;
+	linkStats.numLinkAllocs++;
+	linkPoolStats.numBlocks++;
+	linkPoolStats.usedBytes += num * LINK_SIZE;
+
+	if(c >= NUM_LINK_CLASSES)
+	{
+		linkPoolStats.numLargeBlocks++;
+		return new char[num * LINK_SIZE];
+	}
+
+	if(void* block = freeLinkBlocks[c])
+	{
+		freeLinkBlocks[c] = *(void**)block;
+		return block;
+	}
+
+	if(numCurSlabLinks + num > LINKS_PER_SLAB)
+		NewLinkSlab();
+
+	void* block = curLinkSlab + numCurSlabLinks * LINK_SIZE;
+	numCurSlabLinks += num;
+	return block;
+}
+
+/*--------------------------------------
+	scn::FreeLinks
+
+num must be the block's size set by AllocLinks. Slab blocks are kept for reuse.
+--------------------------------------*/
+void scn::FreeLinks(void* links, size_t num)
+{
+	size_t c = LinkClass(num);
+	linkStats.numLinkFrees++;
+	linkPoolStats.numBlocks--;
+	linkPoolStats.usedBytes -= num * LINK_SIZE;
+
+	if(c >= NUM_LINK_CLASSES)
+	{
+		linkPoolStats.numLargeBlocks--;
+		delete[] (char*)links;
+		return;
+	}
+
+	PushLinkBlock(links, c);
+}
+
+/*--------------------------------------
+	scn::LinkClass
+
+Returns the power of two num rounds up to.
+--------------------------------------*/
+size_t scn::LinkClass(size_t num)
+{
+	size_t c = 0;
+
+	while(((size_t)1 << c) < num)
+		c++;
+
+	return c;
+}
+
+/*--------------------------------------
+	scn::NewLinkSlab
+
+Splits the rest of the current slab into free blocks and starts a new one.
+--------------------------------------*/
+void scn::NewLinkSlab()
+{
+	for(size_t c = NUM_LINK_CLASSES; c-- > 0;)
+	{
+		size_t size = (size_t)1 << c;
+
+		if(numCurSlabLinks + size <= LINKS_PER_SLAB)
+		{
+			PushLinkBlock(curLinkSlab + numCurSlabLinks * LINK_SIZE, c);
+			numCurSlabLinks += size;
+		}
+	}
+
+	curLinkSlab = new char[LINKS_PER_SLAB * LINK_SIZE];
+	numCurSlabLinks = 0;
+	linkSlabs.Ensure(linkPoolStats.numSlabs + 1);
+	linkSlabs[linkPoolStats.numSlabs++] = curLinkSlab;
+	linkPoolStats.reservedBytes += LINKS_PER_SLAB * LINK_SIZE;
+}
+
+/*--------------------------------------
+	scn::PushLinkBlock
+--------------------------------------*/
+void scn::PushLinkBlock(void* block, size_t c)
+{
+	*(void**)block = freeLinkBlocks[c];
+	freeLinkBlocks[c] = block;
+}
+
+/*
+################################################################################################
+
+
+	LINK LUA
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+LUA	scn::BenchLinkChurn (scn_bench_link_churn)
+
+IN	[iNumEnts = 2000], [iNumTicks = 60], [nTurnover = 0.25], [iSeed = 1]
+
+Keeps iNumEnts box hull entities at random points in the world. Every tick, kills nTurnover of
+them, spawns as many replacements, moves the rest, and flushes links. Logs the time, the spawns
+and kills per second, and how many link blocks and slabs were allocated. Meant to be run with
+horse.wld loaded.
+--------------------------------------*/
+int scn::BenchLinkChurn(lua_State* l)
+{
+	lua_Integer numEnts = luaL_optinteger(l, 1, 2000);
+	lua_Integer numTicks = luaL_optinteger(l, 2, 60);
+	float turnover = com::Clamp((float)luaL_optnumber(l, 3, 0.25), 0.0f, 1.0f);
+	uint32_t seed = luaL_optinteger(l, 4, 1);
+
+	if(!WorldRoot() || numEnts <= 0 || numTicks <= 0)
+		return 0;
+
+	FlushLinks();
+
+	const com::Vec3& min = WorldMin();
+	com::Vec3 size = WorldMax() - min;
+	hit::Hull box(com::Vec3(-16.0f), com::Vec3(16.0f));
+	com::Arr<Entity*> ents(numEnts);
+
+	for(size_t i = 0; i < ents.n; i++)
+	{
+		ents[i] = CreateEntity(0, 0.0f, com::QUA_IDENTITY);
+		ents[i]->SetHull(&box);
+	}
+
+	link_stats before = linkStats;
+	link_pool_stats poolBefore = linkPoolStats;
+	size_t numChurn = (size_t)(numEnts * turnover), numSpawns = 0;
+	unsigned long long startTime = wrp::MicroTime();
+
+	for(lua_Integer t = 0; t < numTicks; t++)
+	{
+		for(size_t i = 0; i < numChurn; i++)
+		{
+			Entity*& ent = ents[com::BenchRand(seed) % ents.n];
+			KillEntity(*ent);
+			ent = CreateEntity(0, 0.0f, com::QUA_IDENTITY);
+			ent->SetHull(&box);
+			numSpawns++;
+		}
+
+		for(size_t i = 0; i < ents.n; i++)
+		{
+			com::Vec3 pos;
+
+			for(size_t j = 0; j < 3; j++)
+				pos[j] = min[j] + size[j] * com::BenchRandF(seed);
+
+			ents[i]->SetPos(pos);
+		}
+
+		FlushLinks();
+	}
+
+	unsigned long long micro = wrp::MicroTime() - startTime;
+
+	con::LogF("%d ticks: %g ms/tick, %g spawns and kills/s", (int)numTicks,
+		micro * 0.001 / numTicks, micro ? numSpawns * 1000000.0 / micro : 0.0);
+
+	con::LogF("Link blocks: %u allocs, %u frees, %u large, %u new slabs (%u total, %u/%u KB)",
+		linkStats.numLinkAllocs - before.numLinkAllocs,
+		linkStats.numLinkFrees - before.numLinkFrees,
+		(unsigned)linkPoolStats.numLargeBlocks,
+		(unsigned)(linkPoolStats.numSlabs - poolBefore.numSlabs),
+		(unsigned)linkPoolStats.numSlabs, (unsigned)(linkPoolStats.usedBytes / 1024),
+		(unsigned)(linkPoolStats.reservedBytes / 1024));
+
+	for(size_t i = 0; i < ents.n; i++)
+		KillEntity(*ents[i]);
+
+	FlushLinks(); // Unlock killed entities so they release box
+	ents.Free();
+	return 0;
+}
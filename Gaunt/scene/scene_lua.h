@@ -194,6 +194,8 @@ int EntMimicMesh(lua_State* l);
 int EntMimicScaledPlace(lua_State* l);
 int EntFlagSet(lua_State* l);
 int EntPrioritize(lua_State* l);
+int BenchRelink(lua_State* l);
+int BenchLinkChurn(lua_State* l);
 
 /*
 ################################################################################################
@@ -9,14 +9,17 @@
 namespace scn
 {
 
+// ENTITY TREE
+void TickLinkStats();
+
 // FIXME: doing obj_links with macros is probably faster and easier to read
 
 /*--------------------------------------
 	scn::LinkObject
 --------------------------------------*/
 template <class This, class Other>
-void LinkObject(This& t, com::Arr<obj_link<Other>> (This::*links), size_t (This::*numLinks),
-	Other& o, com::Arr<obj_link<This>> (Other::*otherLinks), size_t (Other::*otherNum))
+void LinkObject(This& t, link_arr<Other> (This::*links), size_t (This::*numLinks), Other& o,
+	link_arr<This> (Other::*otherLinks), size_t (Other::*otherNum))
 {
 	(t.*links).Ensure(t.*numLinks + 1);
 	(o.*otherLinks).Ensure(o.*otherNum + 1);
@@ -35,8 +38,8 @@ void LinkObject(This& t, com::Arr<obj_link<Other>> (This::*links), size_t (This:
 	scn::UnlinkObjects
 --------------------------------------*/
 template <class This, class Other>
-void UnlinkObjects(This& t, com::Arr<obj_link<Other>> (This::*links), size_t (This::*numLinks),
-	com::Arr<obj_link<This>> (Other::*otherLinks), size_t (Other::*otherNum))
+void UnlinkObjects(This& t, link_arr<Other> (This::*links), size_t (This::*numLinks),
+	link_arr<This> (Other::*otherLinks), size_t (Other::*otherNum))
 {
 	for(obj_link<Other>* it = (t.*links).o; it < (t.*links).o + t.*numLinks; it++)
 	{
@@ -550,6 +550,7 @@ bool scn::LoadWorld(const char* const fileName)
 	}
 
 	hit::GlobalDescent().FitLargestTree();
+	hit::BuildHotTree();
 
 	/*
 		DONE
@@ -703,6 +704,8 @@ FIXME: found heap corruption when this was called during reload of horse.sav; us
 void scn::ClearWorld()
 {
 	// Nodes
+	hit::ClearHotTree();
+
 	if(nodes)
 		delete[] nodes;
 
@@ -166,6 +166,7 @@ OUT	iNumEnts
 --------------------------------------*/
 int scn::NodeNumEntities(lua_State* l)
 {
+	FlushLinks();
 	lua_pushinteger(l, CheckLuaToWorldNode(l, 1)->numEntLinks);
 	return 1;
 }
@@ -180,6 +181,7 @@ int scn::NodeEntity(lua_State* l)
 {
 	WorldNode* node = CheckLuaToWorldNode(l, 1);
 	size_t ent = (size_t)lua_tointeger(l, 2);
+	FlushLinks();
 
 	if(ent >= node->numEntLinks)
 		luaL_argerror(l, 2, "Entity link index out of bounds");
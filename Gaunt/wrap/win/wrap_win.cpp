@@ -4,6 +4,8 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <MMSystem.h> //Winmm.lib
+#include <intrin.h>
+#include <io.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -18,6 +20,7 @@
 #include "../../input/input.h"
 #include "../../mod/mod.h"
 #include "../../path/path.h"
+#include "../../profile/profile.h"
 #include "../../quaternion/qua_lua.h"
 #include "../../record/record.h"
 #include "../../render/render.h"
@@ -74,6 +77,26 @@ namespace wrp
 	int			NumFrames(lua_State* l);
 	int			NumTicks(lua_State* l);
 
+	// WORKERS
+	void		SetWorkerThreads(con::Option& optIO, float set);
+	void		StartWorkers(size_t num);
+	void		StopWorkers();
+	void		DoJobs(size_t worker);
+	DWORD WINAPI	WorkerProc(LPVOID param);
+
+	// THREADS
+	struct thread_start
+	{
+		thread_func	func;
+		void*		data;
+	};
+
+	DWORD WINAPI	ThreadProc(LPVOID param);
+
+	// FILES
+	typedef BOOL (WINAPI *query_working_set_ex)(HANDLE process, PVOID info, DWORD size);
+	typedef BOOL (WINAPI *get_process_memory_info)(HANDLE process, PVOID counters, DWORD size);
+
 	// INPUT
 	void		InitRawInput();
 	void		SetLockCursor(bool lock);
@@ -135,7 +158,11 @@ namespace wrp
 		/* Clamp value of tick ms when it's tied to frame rate so a low frame rate slows the
 		game down instead of simulating massive time spans */
 		// FIXME: use this to limit number of fixed ticks simulated in one frame, too?
-		maxTickMS("wrp_max_tick_ms", 10000, con::PositiveIntegerOnly);
+		maxTickMS("wrp_max_tick_ms", 10000, con::PositiveIntegerOnly),
+
+		/* Number of threads, besides the main thread, that RunJobs spreads jobs over; -1 uses
+		one less than the number of processors */
+		workerThreads("wrp_worker_threads", -1, SetWorkerThreads);
 		
 		/* FIXME: add option to lock time step to what frame limiter's time span is supposed to
 		be; game will slow down for user if framerate ever goes under but simulation
@@ -178,6 +205,20 @@ static struct
 	float				simTimeFraction; // Partial milliseconds for small time-step factors
 } loop = {0};
 
+static struct
+{
+	HANDLE*			threads;
+	size_t			numThreads;
+	HANDLE			wake; // Semaphore; one count per thread that should look for jobs
+	HANDLE			done; // Set when the last woken thread runs out of jobs
+	wrp::job_func	func;
+	void*			data;
+	LONG			numJobs;
+	volatile LONG	nextJob;
+	volatile LONG	numAwake; // Woken threads that haven't run out of jobs yet
+	volatile LONG	quit;
+} workers = {0};
+
 static size_t			resArraySize		= 0;
 static unsigned int*	resArray			= 0;
 
@@ -246,6 +287,56 @@ unsigned long long wrp::Time()
 	return loop.time;
 }
 
+/*--------------------------------------
+	wrp::MicroTime
+
+Microseconds since an arbitrary point. High resolution, meant for measuring code.
+--------------------------------------*/
+unsigned long long wrp::MicroTime()
+{
+	static LARGE_INTEGER freq = {0};
+
+	if(!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	unsigned long long sec = count.QuadPart / freq.QuadPart;
+	unsigned long long rem = count.QuadPart % freq.QuadPart;
+	return sec * 1000000 + rem * 1000000 / freq.QuadPart;
+}
+
+/*--------------------------------------
+	wrp::Ticks
+
+Reads the CPU's time-stamp counter. Assumes it's invariant, which holds for CPUs made in the last
+decade or so.
+--------------------------------------*/
+unsigned long long wrp::Ticks()
+{
+	return __rdtsc();
+}
+
+/*--------------------------------------
+	wrp::TicksPerSecond
+
+Measured against MicroTime since the first call, which sleeps briefly to get a first estimate.
+--------------------------------------*/
+double wrp::TicksPerSecond()
+{
+	static unsigned long long startMicro = 0, startTicks = 0;
+
+	if(!startMicro)
+	{
+		startMicro = MicroTime();
+		startTicks = Ticks();
+		Sleep(20);
+	}
+
+	unsigned long long micro = MicroTime() - startMicro;
+	return micro ? (Ticks() - startTicks) * 1000000.0 / micro : 1000000.0;
+}
+
 /*--------------------------------------
 	wrp::SystemClock
 
@@ -951,6 +1042,452 @@ int wrp::NumTicks(lua_State* l)
 	return 1;
 }
 
+/*
+################################################################################################
+
+
+	WORKERS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	wrp::SetWorkerThreads
+--------------------------------------*/
+void wrp::SetWorkerThreads(con::Option& opt, float set)
+{
+	int num = set;
+
+	if(num < -1)
+	{
+		con::AlertF("Worker threads cannot be %d, must be >= -1", num);
+		return;
+	}
+
+	opt.ForceValue(num);
+
+	if(num == -1)
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		num = info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors - 1 : 0;
+	}
+
+	StopWorkers();
+	StartWorkers(num);
+}
+
+/*--------------------------------------
+	wrp::StartWorkers
+--------------------------------------*/
+void wrp::StartWorkers(size_t num)
+{
+	if(!workers.wake)
+	{
+		workers.wake = CreateSemaphore(0, 0, LONG_MAX, 0);
+		workers.done = CreateEvent(0, FALSE, FALSE, 0);
+
+		if(!workers.wake || !workers.done)
+			WRP_FATAL("Could not create worker sync objects");
+	}
+
+	workers.quit = 0;
+
+	if(!num)
+		return;
+
+	workers.threads = new HANDLE[num];
+
+	for(size_t i = 0; i < num; i++)
+	{
+		if(!(workers.threads[workers.numThreads] = CreateThread(0, 0, WorkerProc,
+		(LPVOID)(workers.numThreads + 1), 0, 0)))
+		{
+			con::AlertF("Could not create worker thread %u", (unsigned)i);
+			break;
+		}
+
+		workers.numThreads++;
+	}
+}
+
+/*--------------------------------------
+	wrp::StopWorkers
+--------------------------------------*/
+void wrp::StopWorkers()
+{
+	if(!workers.numThreads)
+		return;
+
+	workers.quit = 1;
+	ReleaseSemaphore(workers.wake, workers.numThreads, 0);
+
+	for(size_t i = 0; i < workers.numThreads; i++)
+	{
+		WaitForSingleObject(workers.threads[i], INFINITE);
+		CloseHandle(workers.threads[i]);
+	}
+
+	delete[] workers.threads;
+	workers.threads = 0;
+	workers.numThreads = 0;
+	workers.quit = 0;
+}
+
+/*--------------------------------------
+	wrp::NumWorkers
+
+Number of threads that run jobs, including the main thread.
+--------------------------------------*/
+size_t wrp::NumWorkers()
+{
+	return workers.numThreads + 1;
+}
+
+/*--------------------------------------
+	wrp::RunJobs
+
+Calls func once for each job index in [0, numJobs) and returns when all calls are done. Calls
+are spread over the worker threads and the calling thread, so func must be safe to run
+concurrently with itself. Only call from the main thread; jobs may not call RunJobs.
+--------------------------------------*/
+void wrp::RunJobs(job_func func, void* data, size_t numJobs)
+{
+	LONG numWake = com::Min<size_t>(numJobs ? numJobs - 1 : 0, workers.numThreads);
+
+	if(!numWake)
+	{
+		for(size_t i = 0; i < numJobs; i++)
+			func(data, i, 0);
+
+		return;
+	}
+
+	workers.func = func;
+	workers.data = data;
+	workers.numJobs = numJobs;
+	workers.nextJob = 0;
+	workers.numAwake = numWake;
+	ReleaseSemaphore(workers.wake, numWake, 0);
+	DoJobs(0);
+
+	// Every woken thread must check in so none are left to grab jobs from the next run
+	WaitForSingleObject(workers.done, INFINITE);
+}
+
+/*--------------------------------------
+	wrp::DoJobs
+--------------------------------------*/
+void wrp::DoJobs(size_t worker)
+{
+	LONG job;
+
+	while((job = InterlockedIncrement(&workers.nextJob) - 1) < workers.numJobs)
+		workers.func(workers.data, job, worker);
+}
+
+/*--------------------------------------
+	wrp::WorkerProc
+--------------------------------------*/
+DWORD WINAPI wrp::WorkerProc(LPVOID param)
+{
+	size_t worker = (size_t)param;
+
+	while(1)
+	{
+		WaitForSingleObject(workers.wake, INFINITE);
+
+		if(workers.quit)
+		{
+			prf::ReleaseThread();
+			return 0;
+		}
+
+		{
+			PRF_ZONE("wrp::DoJobs");
+			DoJobs(worker);
+		}
+
+		if(!InterlockedDecrement(&workers.numAwake))
+			SetEvent(workers.done);
+	}
+}
+
+/*
+################################################################################################
+
+
+	THREADS
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	wrp::StartThread
+--------------------------------------*/
+void* wrp::StartThread(thread_func func, void* data)
+{
+	thread_start* start = new thread_start;
+	start->func = func;
+	start->data = data;
+	HANDLE thread = CreateThread(0, 0, ThreadProc, start, 0, 0);
+
+	if(!thread)
+		delete start;
+
+	return thread;
+}
+
+/*--------------------------------------
+	wrp::JoinThread
+
+Waits for the thread to return and frees its handle.
+--------------------------------------*/
+void wrp::JoinThread(void* thread)
+{
+	WaitForSingleObject((HANDLE)thread, INFINITE);
+	CloseHandle((HANDLE)thread);
+}
+
+/*--------------------------------------
+	wrp::SleepMS
+--------------------------------------*/
+void wrp::SleepMS(unsigned ms)
+{
+	Sleep(ms);
+}
+
+/*--------------------------------------
+	wrp::ThreadProc
+--------------------------------------*/
+DWORD WINAPI wrp::ThreadProc(LPVOID param)
+{
+	thread_start start = *(thread_start*)param;
+	delete (thread_start*)param;
+	start.func(start.data);
+	prf::ReleaseThread();
+	return 0;
+}
+
+/*--------------------------------------
+	wrp::AtomicLoad
+--------------------------------------*/
+uint32_t wrp::AtomicLoad(const volatile uint32_t& a)
+{
+	return InterlockedCompareExchange((volatile LONG*)&a, 0, 0);
+}
+
+/*--------------------------------------
+	wrp::AtomicStore
+--------------------------------------*/
+void wrp::AtomicStore(volatile uint32_t& a, uint32_t val)
+{
+	InterlockedExchange((volatile LONG*)&a, val);
+}
+
+/*--------------------------------------
+	wrp::AtomicAdd
+--------------------------------------*/
+uint32_t wrp::AtomicAdd(volatile uint32_t& a, uint32_t add)
+{
+	return InterlockedExchangeAdd((volatile LONG*)&a, add) + add;
+}
+
+/*
+################################################################################################
+
+
+	FILES
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	wrp::MapFile
+
+Maps the whole file at path into memory for reading. Pages are loaded as they're touched.
+--------------------------------------*/
+const void* wrp::MapFile(const char* path, size_t& sizeOut)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, 0);
+
+	if(file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = 0;
+	const void* view = 0;
+
+	if(GetFileSizeEx(file, &size) && size.QuadPart && size.HighPart == 0 &&
+	(mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0)))
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	// The view keeps the mapping and file open
+	if(mapping)
+		CloseHandle(mapping);
+
+	CloseHandle(file);
+	sizeOut = view ? size.LowPart : 0;
+	return view;
+}
+
+/*--------------------------------------
+	wrp::UnmapFile
+--------------------------------------*/
+void wrp::UnmapFile(const void* view)
+{
+	UnmapViewOfFile(view);
+}
+
+/*--------------------------------------
+	wrp::ResidentBytes
+
+Returns how many bytes of the pages overlapping [view, view + size) are in the process's working
+set. Falls back to size if the OS can't be asked.
+--------------------------------------*/
+size_t wrp::ResidentBytes(const void* view, size_t size)
+{
+	static query_working_set_ex query = 0;
+	static bool loaded = false;
+
+	if(!loaded)
+	{
+		loaded = true;
+		HMODULE psapi = LoadLibraryA("psapi.dll");
+
+		if(psapi)
+			query = (query_working_set_ex)GetProcAddress(psapi, "QueryWorkingSetEx");
+	}
+
+	if(!query || !size)
+		return size;
+
+	SYSTEM_INFO sys;
+	GetSystemInfo(&sys);
+	uintptr_t page = sys.dwPageSize;
+	uintptr_t first = (uintptr_t)view / page * page, end = (uintptr_t)view + size;
+	size_t resident = 0;
+
+	// PSAPI_WORKING_SET_EX_INFORMATION: address, then flags with the valid bit first
+	const size_t BATCH = 256;
+	struct {PVOID address; ULONG_PTR flags;} infos[BATCH];
+
+	for(uintptr_t addr = first; addr < end;)
+	{
+		size_t num = 0;
+
+		for(; num < BATCH && addr < end; num++, addr += page)
+			infos[num].address = (PVOID)addr;
+
+		if(!query(GetCurrentProcess(), infos, (DWORD)(num * sizeof(infos[0]))))
+			return size;
+
+		for(size_t i = 0; i < num; i++)
+		{
+			if(infos[i].flags & 1)
+				resident += page;
+		}
+	}
+
+	return com::Min(resident, size);
+}
+
+/*--------------------------------------
+	wrp::PrivateBytes
+--------------------------------------*/
+size_t wrp::PrivateBytes()
+{
+	static get_process_memory_info query = 0;
+	static bool loaded = false;
+
+	if(!loaded)
+	{
+		loaded = true;
+		HMODULE psapi = LoadLibraryA("psapi.dll");
+
+		if(psapi)
+			query = (get_process_memory_info)GetProcAddress(psapi, "GetProcessMemoryInfo");
+	}
+
+	if(!query)
+		return 0;
+
+	// PROCESS_MEMORY_COUNTERS_EX: cb, fault count, then nine sizes ending with PrivateUsage
+	struct {DWORD cb, pageFaultCount; SIZE_T sizes[9];} counters;
+	counters.cb = sizeof(counters);
+
+	if(!query(GetCurrentProcess(), &counters, counters.cb))
+		return 0;
+
+	return counters.sizes[8];
+}
+
+/*--------------------------------------
+	wrp::SyncFile
+
+Returns false if file couldn't be flushed or committed. Call before renaming a freshly written
+file over an old one so a crash can't leave the new name pointing at unwritten data.
+--------------------------------------*/
+bool wrp::SyncFile(FILE* file)
+{
+	return !fflush(file) && !_commit(_fileno(file));
+}
+
+/*--------------------------------------
+	wrp::RenameFile
+
+Moves from to to, replacing to if it exists. Both must be on the same volume for the replacement
+to be atomic.
+--------------------------------------*/
+bool wrp::RenameFile(const char* from, const char* to)
+{
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+/*--------------------------------------
+	wrp::ForEachFile
+
+Calls func with the path of every file under directory, recursively, whose name ends with
+extension (e.g. ".wav"). Paths use forward slashes.
+--------------------------------------*/
+void wrp::ForEachFile(const char* directory, const char* extension, file_func func, void* data)
+{
+	char pattern[MAX_PATH];
+	com::SNPrintF(pattern, MAX_PATH, 0, "%s/*", directory);
+	WIN32_FIND_DATAA find;
+	HANDLE h = FindFirstFileA(pattern, &find);
+
+	if(h == INVALID_HANDLE_VALUE)
+		return;
+
+	size_t extLen = strlen(extension);
+
+	do
+	{
+		if(!strcmp(find.cFileName, ".") || !strcmp(find.cFileName, ".."))
+			continue;
+
+		char path[MAX_PATH];
+		com::SNPrintF(path, MAX_PATH, 0, "%s/%s", directory, find.cFileName);
+
+		if(find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			ForEachFile(path, extension, func, data);
+		else
+		{
+			size_t len = strlen(find.cFileName);
+
+			if(len >= extLen && !_stricmp(find.cFileName + len - extLen, extension))
+				func(path, data);
+		}
+	} while(FindNextFileA(h, &find));
+
+	FindClose(h);
+}
+
 /*
 ################################################################################################
 
@@ -1204,6 +1741,7 @@ void wrp::Init()
 	LoadGL();
 	InitRawInput();
 	tickMS.SetValue(tickMS.Integer());
+	workerThreads.SetValue(workerThreads.Integer(), false);
 	wnd.hCursor = LoadCursor(0, IDC_ARROW);
 
 	// Register lua functions
@@ -1262,6 +1800,7 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		con::LogF("Audio is disabled");
 
 	rec::Init();
+	prf::Init();
 	mod::Init(lpCmdLine);
 	con::InitUI();
 	gui::QuickDrawInit();
@@ -1328,6 +1867,7 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
 				while(loop.tickAccumTime >= updateMSU)
 				{
+					PRF_ZONE("tick");
 					loop.tickAccumTime -= updateMSU;
 
 					if(!cursorUpdated)
@@ -1380,6 +1920,8 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 				if(loop.frameAccumTime > 1010.0f)
 					loop.frameAccumTime = 0.0f;
 
+				PRF_ZONE("frame");
+
 				if(wrp::showFPS.Bool())
 				{
 					loop.avgMSPerFrame = loop.frameWaitTime * 0.05f + loop.avgMSPerFrame * 0.95f;
@@ -1406,6 +1948,7 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 				gui::QuickDrawAdvance();
 				SwapBuffers(wnd.hDC);
 				rec::Update();
+				prf::Update();
 				in::ClearFrame();
 				loop.numFrames++;
 			}
@@ -1416,7 +1959,10 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 	ClipCursor(0);
 	wglMakeCurrent(wnd.hDC, 0);
 	wglDeleteContext(wnd.hGLContext);
+	wrp::StopWorkers();
+	rec::CleanUp();
 	aud::CleanUp();
+	prf::CleanUp();
 	con::CloseLog();
 	//_CrtDumpMemoryLeaks(); //FIXME TEMP
 }
@@ -313,6 +313,7 @@ PFNGLGENERATEMIPMAPPROC glGenerateMipmap;
 PFNGLBLITFRAMEBUFFERPROC glBlitFramebuffer;
 PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC glRenderbufferStorageMultisample;
 PFNGLFRAMEBUFFERTEXTURELAYERPROC glFramebufferTextureLayer;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
 PFNGLFLUSHMAPPEDBUFFERRANGEPROC glFlushMappedBufferRange;
 PFNGLBINDVERTEXARRAYPROC glBindVertexArray;
 PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays;
@@ -3453,6 +3454,7 @@ void LoadGL()
 	LOAD_GL(PFNGLBLITFRAMEBUFFERPROC, glBlitFramebuffer, REQ_GL_VERSION_3_0);
 	LOAD_GL(PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC, glRenderbufferStorageMultisample, REQ_GL_VERSION_3_0);
 	LOAD_GL(PFNGLFRAMEBUFFERTEXTURELAYERPROC, glFramebufferTextureLayer, REQ_GL_VERSION_3_0);
+	LOAD_GL(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange, REQ_GL_VERSION_3_0);
 	LOAD_GL(PFNGLFLUSHMAPPEDBUFFERRANGEPROC, glFlushMappedBufferRange, REQ_GL_VERSION_3_0);
 	LOAD_GL(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray, REQ_GL_VERSION_3_0);
 	LOAD_GL(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays, REQ_GL_VERSION_3_0);
@@ -5,6 +5,7 @@
 #define WRAPPER_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "../console/option.h"
 #include "../../GauntCommon/io.h"
@@ -26,6 +27,9 @@ extern con::Option showFPS;
 void				Quit();
 void				FatalF(const char* format, ...);
 unsigned long long	Time();
+unsigned long long	MicroTime();
+unsigned long long	Ticks(); // Cheaper than MicroTime, convert with TicksPerSecond
+double				TicksPerSecond();
 unsigned long long	SystemClock();
 const char*			RestrictedPath(const char* path);
 
@@ -75,6 +79,54 @@ bool				ForceFrame();
 bool				ForceFrameStart();
 void				ForceFrameEnd();
 
+/*
+################################################################################################
+	WORKERS
+################################################################################################
+*/
+
+extern con::Option workerThreads;
+
+// worker is in [0, NumWorkers()); 0 is the thread that called RunJobs
+typedef void (*job_func)(void* data, size_t job, size_t worker);
+
+size_t	NumWorkers();
+void	RunJobs(job_func func, void* data, size_t numJobs);
+
+/*
+################################################################################################
+	THREADS
+################################################################################################
+*/
+
+typedef void (*thread_func)(void* data);
+
+void*		StartThread(thread_func func, void* data); // Returns 0 on failure
+void		JoinThread(void* thread);
+void		SleepMS(unsigned ms);
+
+// Full memory barriers; a must be 4-byte aligned
+uint32_t	AtomicLoad(const volatile uint32_t& a);
+void		AtomicStore(volatile uint32_t& a, uint32_t val);
+uint32_t	AtomicAdd(volatile uint32_t& a, uint32_t add); // Returns new value
+
+/*
+################################################################################################
+	FILES
+################################################################################################
+*/
+
+typedef void (*file_func)(const char* path, void* data);
+
+const void*	MapFile(const char* path, size_t& sizeOut); // Read-only; returns 0 on failure
+void		UnmapFile(const void* view);
+size_t		ResidentBytes(const void* view, size_t size);
+size_t		PrivateBytes(); // Process's committed private memory; 0 if unknown
+bool		SyncFile(FILE* file); // Flushes file's buffers all the way to disk
+bool		RenameFile(const char* from, const char* to); // Atomically replaces to if it exists
+void		ForEachFile(const char* directory, const char* extension, file_func func,
+			void* data);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,170 @@
+// arena.h
+// Martynas Ceicys
+
+#ifndef COM_ARENA_H
+#define COM_ARENA_H
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace com
+{
+
+#define COM_ARENA_ALIGN 8
+#define COM_ARENA_BLOCK_SIZE 65536
+
+/*======================================
+	com::Arena
+
+Bump allocator. Memory can't be freed individually; Free releases every block at once.
+Allocations are aligned to COM_ARENA_ALIGN bytes. Objects put in an arena do not get their
+destructors called. Alloc, Grow, and Copy return 0 if the heap can't supply a block.
+======================================*/
+class Arena
+{
+public:
+	Arena(size_t blockSize = COM_ARENA_BLOCK_SIZE) : blocks(0), top(0), end(0), lastAlloc(0),
+		blockSize(blockSize), numBytes(0), numUsed(0) {}
+
+	~Arena()
+	{
+		Free();
+	}
+
+	void* Alloc(size_t size)
+	{
+		if(size > (size_t)-1 - BLOCK_HEADER - COM_ARENA_ALIGN)
+			return 0;
+
+		size = AlignUp(size);
+
+		if(size > (size_t)(end - top))
+		{
+			if(size > blockSize / 4)
+			{
+				// Big allocations get their own block so the current one isn't wasted
+				char* block = NewBlock(size, false);
+
+				if(!block)
+					return 0;
+
+				lastAlloc = 0;
+				numUsed += size;
+				return block + BLOCK_HEADER;
+			}
+
+			if(!NewBlock(blockSize, true))
+				return 0;
+		}
+
+		numUsed += size;
+		lastAlloc = top;
+		top += size;
+		return lastAlloc;
+	}
+
+	// ptr must be from this arena, oldSize must be its allocated size. Extends in place if ptr
+	// was the last allocation and there's room, otherwise copies to a new allocation.
+	void* Grow(void* ptr, size_t oldSize, size_t newSize)
+	{
+		if(!ptr)
+			return Alloc(newSize);
+
+		oldSize = AlignUp(oldSize);
+		newSize = AlignUp(newSize);
+
+		if(newSize <= oldSize)
+			return ptr;
+
+		if(ptr == lastAlloc && newSize - oldSize <= (size_t)(end - top))
+		{
+			top += newSize - oldSize;
+			numUsed += newSize - oldSize;
+			return ptr;
+		}
+
+		void* grown = Alloc(newSize);
+
+		if(grown)
+			memcpy(grown, ptr, oldSize);
+
+		return grown;
+	}
+
+	char* Copy(const char* str, size_t len)
+	{
+		char* c = (char*)Alloc(len + 1);
+
+		if(!c)
+			return 0;
+
+		memcpy(c, str, len);
+		c[len] = 0;
+		return c;
+	}
+
+	void Free()
+	{
+		while(blocks)
+		{
+			char* prev = *(char**)blocks;
+			free(blocks);
+			blocks = prev;
+		}
+
+		top = end = lastAlloc = 0;
+		numBytes = numUsed = 0;
+	}
+
+	size_t NumBytes() const {return numBytes;} // Reserved from the heap
+	size_t NumUsed() const {return numUsed;}
+
+private:
+	static const size_t BLOCK_HEADER = COM_ARENA_ALIGN; // Holds previous block pointer
+
+	char	*blocks, *top, *end, *lastAlloc;
+	size_t	blockSize, numBytes, numUsed;
+
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	static size_t AlignUp(size_t size)
+	{
+		return (size + COM_ARENA_ALIGN - 1) & ~(size_t)(COM_ARENA_ALIGN - 1);
+	}
+
+	// Returns 0 and leaves the arena as it was if malloc fails
+	char* NewBlock(size_t size, bool current)
+	{
+		char* block = (char*)malloc(BLOCK_HEADER + size);
+
+		if(!block)
+			return 0;
+
+		numBytes += BLOCK_HEADER + size;
+
+		if(current || !blocks)
+		{
+			*(char**)block = blocks;
+			blocks = block;
+		}
+		else
+		{
+			// Keep the current block at the head of the list
+			*(char**)block = *(char**)blocks;
+			*(char**)blocks = block;
+		}
+
+		if(current)
+		{
+			top = block + BLOCK_HEADER;
+			end = top + size;
+		}
+
+		return block;
+	}
+};
+
+}
+
+#endif
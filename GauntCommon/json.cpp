@@ -8,20 +8,22 @@
 namespace com
 {
 	// PARSE
+	bool		ParseTree(const char* json, JSVar& rootOut, unsigned* lineOut, Arena* arena);
 	void		SkipWhitespace(const char*& cIO, unsigned& lineIO);
 	void		NextChar(const char*& cIO, unsigned& lineIO);
 	bool		FinishParseJSON(bool success, Arr<char>& bufIO, Arr<JSVar*>& stackIO,
 				unsigned line, unsigned* lineOut);
-	const char*	DecodeUntilQuote(const char* src, Arr<char>& bufIO, unsigned* lineIO);
+	const char*	DecodeUntilQuote(const char* src, Arr<char>& bufIO, unsigned* lineIO,
+				Arena* arena, const char*& strOut);
 	bool		ParseValue(const char*& cIO, unsigned& lineIO, Arr<char>& bufIO,
-				Arr<JSVar*>& stackIO, size_t& numNodesIO, JSVar& valOut);
+				Arr<JSVar*>& stackIO, size_t& numNodesIO, Arena* arena, JSVar& valOut);
 	bool		GoodComma(const char*& cIO, unsigned& lineIO);
 
 	// WRITE
 	struct write_node;
 
 	bool		WriteValue(const JSVar& val, FILE* file, bool newLineContainer,
-				Arr<write_node>& stackIO, size_t& numNodesIO);
+				Arr<write_node>& stackIO, size_t& numNodesIO, volatile size_t* numWrittenIO);
 
 	// FREE
 	bool		FreeIfEmpty(JSVar& varIO, Arr<JSVar*>& stackIO, size_t& numNodesIO);
@@ -45,9 +47,20 @@ namespace com
 Returns true if all of json was parsed successfully. Does not FreeJSON on failure. "inf" and
 "nan" values are valid, though that breaks from the standard.
 --------------------------------------*/
+bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
+{
+	return ParseTree(json, rootOut, lineOut, 0);
+}
+
+/*--------------------------------------
+	com::ParseTree
+
+If arena is given, containers and escaped strings are allocated from it, and unescaped strings
+and keys are terminated in place and used as is; json must then be writable and outlive the tree.
+--------------------------------------*/
 #define FINISH_PARSE_JSON(success) FinishParseJSON(success, buf, stack, line, lineOut)
 
-bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
+bool com::ParseTree(const char* json, JSVar& rootOut, unsigned* lineOut, Arena* arena)
 {
 	const char* c = json;
 	unsigned line = 1;
@@ -60,7 +73,11 @@ bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
 	Arr<JSVar*> stack(DEFAULT_JSVAR_STACK_SIZE);
 	size_t numNodes = 0;
 
-	rootOut.SetObject();
+	if(arena)
+		rootOut.SetArenaObject(*arena);
+	else
+		rootOut.SetObject();
+
 	stack[numNodes] = &rootOut;
 	numNodes++;
 
@@ -81,8 +98,14 @@ bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
 			}
 			else if(*c == '"')
 			{
-				const char* endKey = DecodeUntilQuote(c + 1, buf, &line);
-				Pair<JSVar>& pair = *var.Object()->Ensure(buf.o);
+				const char* key;
+				const char* endKey = DecodeUntilQuote(c + 1, buf, &line, arena, key);
+
+				if(!endKey)
+					return FINISH_PARSE_JSON(false);
+
+				Pair<JSVar>& pair = arena ? *var.Object()->EnsureBorrowed(key) :
+					*var.Object()->Ensure(key);
 
 				c = endKey;
 				NextChar(c, line);
@@ -90,7 +113,7 @@ bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
 					return FINISH_PARSE_JSON(false);
 				NextChar(c, line);
 
-				if(!ParseValue(c, line, buf, stack, numNodes, pair.Value()))
+				if(!ParseValue(c, line, buf, stack, numNodes, arena, pair.Value()))
 					return FINISH_PARSE_JSON(false);
 			}
 			else
@@ -107,10 +130,14 @@ bool com::ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut)
 			}
 			else
 			{
+				if(arena)
+					var.EnsureArenaElems(*arena, var.NumElems() + 1);
+				else
+					var.Array()->Ensure(var.NumElems() + 1);
+
 				Arr<JSVar>& arr = *var.Array();
-				arr.Ensure(var.NumElems() + 1);
 
-				if(ParseValue(c, line, buf, stack, numNodes, arr[var.NumElems()]))
+				if(ParseValue(c, line, buf, stack, numNodes, arena, arr[var.NumElems()]))
 					var.SetNumElems(var.NumElems() + 1);
 				else
 					return FINISH_PARSE_JSON(false);
@@ -172,14 +199,39 @@ bool com::FinishParseJSON(bool success, Arr<char>& bufIO, Arr<JSVar*>& stackIO,
 /*--------------------------------------
 	com::DecodeUntilQuote
 
-Returns end quote. If given, increments lineIO every real newline.
+Returns end quote, or 0 if there isn't one. If given, increments lineIO every real newline.
+Without an arena, strOut is set to bufIO. With one, strOut is src terminated at the quote if src
+has no escapes, or a decoded copy in the arena.
 --------------------------------------*/
-const char* com::DecodeUntilQuote(const char* src, Arr<char>& bufIO, unsigned* lineIO)
+const char* com::DecodeUntilQuote(const char* src, Arr<char>& bufIO, unsigned* lineIO,
+	Arena* arena, const char*& strOut)
 {
 	const char* end = StrChrUnescaped(src, '"');
+
+	if(!end)
+		return 0;
+
 	size_t len = end - src;
-	bufIO.Ensure(JSONDecodedStringLength(src, len, lineIO) + 1);
-	DecodeJSONString(src, bufIO.o, len);
+	size_t decodedLen = JSONDecodedStringLength(src, len, lineIO);
+
+	if(!arena)
+	{
+		bufIO.Ensure(decodedLen + 1);
+		DecodeJSONString(src, bufIO.o, len);
+		strOut = bufIO.o;
+	}
+	else if(decodedLen == len)
+	{
+		*(char*)end = 0;
+		strOut = src;
+	}
+	else
+	{
+		char* decoded = (char*)arena->Alloc(decodedLen + 1);
+		DecodeJSONString(src, decoded, len);
+		strOut = decoded;
+	}
+
 	return end;
 }
 
@@ -190,7 +242,7 @@ Returns true if value was parsed and appropriately has or lacks a comma. If succ
 set to the character after the value (and comma if it exists). May reallocate bufIO and stackIO.
 --------------------------------------*/
 bool com::ParseValue(const char*& cIO, unsigned& lineIO, Arr<char>& bufIO, Arr<JSVar*>& stackIO,
-	size_t& numNodesIO, JSVar& valOut)
+	size_t& numNodesIO, Arena* arena, JSVar& valOut)
 {
 	bool maybeComma = false;
 
@@ -205,22 +257,39 @@ bool com::ParseValue(const char*& cIO, unsigned& lineIO, Arr<char>& bufIO, Arr<J
 	}
 	else if(*cIO == '{')
 	{
-		valOut.SetObject();
+		if(arena)
+			valOut.SetArenaObject(*arena);
+		else
+			valOut.SetObject();
+
 		stackIO.Ensure(numNodesIO + 1);
 		stackIO[numNodesIO] = &valOut;
 		numNodesIO++;
 	}
 	else if(*cIO == '[')
 	{
-		valOut.SetArray();
+		if(arena)
+			valOut.SetArenaArray(*arena);
+		else
+			valOut.SetArray();
+
 		stackIO.Ensure(numNodesIO + 1);
 		stackIO[numNodesIO] = &valOut;
 		numNodesIO++;
 	}
 	else if(*cIO == '"')
 	{
-		end = DecodeUntilQuote(cIO + 1, bufIO, &lineIO);
-		valOut.SetString(bufIO.o);
+		const char* str;
+		end = DecodeUntilQuote(cIO + 1, bufIO, &lineIO, arena, str);
+
+		if(!end)
+			return false;
+
+		if(arena)
+			valOut.SetArenaString((char*)str);
+		else
+			valOut.SetString(str);
+
 		cIO = end;
 		maybeComma = true;
 	}
@@ -298,13 +367,17 @@ struct com::write_node
 
 If indent is 0, the tree is written on one line. If postSpace is true, a space is written after
 the colon following a key and after commas not followed by a new line.
+
+If numWrittenIO is given, it's incremented as each value is started so another thread can poll
+the progress.
 --------------------------------------*/
-void com::WriteJSON(const JSVar& root, FILE* file, const char* indent, bool postSpace)
+void com::WriteJSON(const JSVar& root, FILE* file, const char* indent, bool postSpace,
+	volatile size_t* numWrittenIO)
 {
 	Arr<write_node> stack(DEFAULT_JSVAR_STACK_SIZE);
 	size_t numNodes = 0;
 
-	WriteValue(root, file, indent, stack, numNodes);
+	WriteValue(root, file, indent, stack, numNodes, numWrittenIO);
 
 	while(numNodes)
 	{
@@ -377,13 +450,14 @@ void com::WriteJSON(const JSVar& root, FILE* file, const char* indent, bool post
 			WriteJSONEncodedString(pair.Key(), file);
 			fprintf(file, "%s", postSpace ? "\": " : "\":");
 
-			WriteValue(pair.Value(), file, indent, stack, numNodes);
+			WriteValue(pair.Value(), file, indent, stack, numNodes, numWrittenIO);
 		}
 		else if(type == JSVar::ARRAY)
 		{
 			size_t i = stack[curNode].i;
 			stack[curNode].i++;
-			WriteValue(parent.Array()->o[i], file, indent, stack, numNodes);
+			WriteValue(parent.Array()->o[i], file, indent, stack, numNodes,
+				numWrittenIO);
 		}
 		else
 			break; // error
@@ -400,8 +474,11 @@ If val is not a container, writes it and returns true. Otherwise, pushes val ont
 writes its starting bracket, and returns false. May reallocate stackIO if false is returned.
 --------------------------------------*/
 bool com::WriteValue(const JSVar& val, FILE* file, bool newLineContainer,
-	Arr<write_node>& stackIO, size_t& numNodesIO)
+	Arr<write_node>& stackIO, size_t& numNodesIO, volatile size_t* numWrittenIO)
 {
+	if(numWrittenIO)
+		(*numWrittenIO)++;
+
 	if(val.Type() == JSVar::OBJECT || val.Type() == JSVar::ARRAY)
 	{
 		stackIO.Ensure(numNodesIO + 1);
@@ -524,6 +601,109 @@ bool com::FreeIfEmpty(JSVar& varIO, Arr<JSVar*>& stackIO, size_t& numNodesIO)
 	}
 }
 
+/*
+################################################################################################
+
+
+	DOCUMENT
+
+
+################################################################################################
+*/
+
+/*--------------------------------------
+	com::JSDoc::Parse
+
+Frees the document, copies json into its arena, and parses it into root. Same rules as ParseJSON.
+--------------------------------------*/
+bool com::JSDoc::Parse(const char* json, unsigned* lineOut)
+{
+	Free();
+	return ParseText(arena.Copy(json, strlen(json)), lineOut);
+}
+
+/*--------------------------------------
+	com::JSDoc::ParseFile
+
+Reads the rest of file straight into the arena and parses it.
+--------------------------------------*/
+bool com::JSDoc::ParseFile(FILE* file, unsigned* lineOut)
+{
+	Free();
+
+	// Text mode may read fewer chars than the file size, never more
+	size_t size = 0;
+	long start = ftell(file);
+
+	if(start >= 0 && !fseek(file, 0, SEEK_END))
+	{
+		long end = ftell(file);
+
+		if(end > start)
+			size = end - start;
+
+		fseek(file, start, SEEK_SET);
+	}
+
+	size_t cap = size + 1, len = 0;
+	char* text = (char*)arena.Alloc(cap);
+
+	while(text)
+	{
+		len += fread(text + len, sizeof(char), cap - len - 1, file);
+
+		if(len < cap - 1)
+			break;
+
+		int ch = fgetc(file);
+
+		if(ch == EOF)
+			break;
+
+		ungetc(ch, file);
+		text = (char*)arena.Grow(text, cap, cap * 2);
+		cap *= 2;
+	}
+
+	if(!text)
+	{
+		if(lineOut)
+			*lineOut = 0;
+
+		return false;
+	}
+
+	text[len] = 0;
+	return ParseText(text, lineOut);
+}
+
+/*--------------------------------------
+	com::JSDoc::ParseText
+--------------------------------------*/
+bool com::JSDoc::ParseText(char* text, unsigned* lineOut)
+{
+	return ParseTree(text, root, lineOut, &arena);
+}
+
+/*--------------------------------------
+	com::JSDoc::Free
+--------------------------------------*/
+void com::JSDoc::Free()
+{
+	if(edited || !root.arena)
+		FreeJSON(root); // Heap storage may have been put in the tree
+	else
+	{
+		root.str = 0;
+		root.t = JSVar::NONE;
+		root.arena = false;
+		root.n = 0;
+	}
+
+	arena.Free();
+	edited = false;
+}
+
 /*
 ################################################################################################
 
@@ -12,6 +12,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "array.h"
 #include "fp.h"
 #include "io.h"
@@ -20,6 +21,7 @@
 namespace com
 {
 
+class JSDoc;
 class JSVar;
 
 typedef Arr<JSVar> JSArr;
@@ -30,7 +32,7 @@ bool	ParseJSON(const char* json, JSVar& rootOut, unsigned* lineOut = 0);
 
 // WRITE
 void	WriteJSON(const JSVar& root, FILE* file, const char* indent = "\t",
-		bool postSpace = true);
+		bool postSpace = true, volatile size_t* numWrittenIO = 0);
 
 // FREE
 void	FreeJSON(JSVar& rootInOut);
@@ -52,6 +54,9 @@ int name(type& valOut) const \
 	com::JSVar
 
 Must be Freed manually before deleting. Assignment operator does not make a copy of the value.
+
+A var set by one of the Arena functions doesn't own its storage; Free only frees the heap
+storage of its descendants. Arrays in an arena move to the heap if they need to grow.
 ======================================*/
 class JSVar
 {
@@ -66,7 +71,7 @@ public:
 		OBJECT
 	};
 
-	JSVar() : str(0), t(NONE), n(0) {}
+	JSVar() : str(0), t(NONE), arena(false), n(0) {}
 
 	bool Free()
 	{
@@ -77,21 +82,26 @@ public:
 			for(size_t i = 0; i < n; i++)
 				arr->o[i].Free();
 
-			arr->Free();
-			delete arr;
+			if(!arena)
+			{
+				arr->Free();
+				delete arr;
+			}
 		}
 		else if(t == OBJECT)
 		{
 			for(Pair<JSVar>* it = obj->First(); it; it = it->Next())
 				it->Value().Free();
 
-			delete obj;
+			if(!arena)
+				delete obj;
 		}
-		else if(t == STRING)
+		else if(t == STRING && !arena)
 			free(str);
 
 		str = 0;
 		t = NONE;
+		arena = false;
 		n = 0;
 		return true;
 	}
@@ -99,6 +109,7 @@ public:
 	void Steal(JSVar& jsv)
 	{
 		t = jsv.t;
+		arena = jsv.arena;
 		n = jsv.n;
 
 		switch(t)
@@ -122,6 +133,7 @@ public:
 
 		jsv.str = 0;
 		jsv.t = NONE;
+		jsv.arena = false;
 		jsv.n = 0;
 	}
 
@@ -198,7 +210,63 @@ public:
 		return obj;
 	}
 
-	type Type() const {return t;}
+	// s is not copied and must outlive the var
+	void SetArenaString(char* s)
+	{
+		Free();
+		str = s;
+		t = STRING;
+		arena = true;
+	}
+
+	Arr<JSVar>* SetArenaArray(Arena& a)
+	{
+		Free();
+		arr = new(a.Alloc(sizeof(Arr<JSVar>))) Arr<JSVar>;
+		t = ARRAY;
+		arena = true;
+		return arr;
+	}
+
+	PairMap<JSVar>* SetArenaObject(Arena& a)
+	{
+		Free();
+		obj = new(a.Alloc(sizeof(PairMap<JSVar>))) PairMap<JSVar>(&a);
+		t = OBJECT;
+		arena = true;
+		return obj;
+	}
+
+	// Makes room for num elements without changing NumElems
+	void EnsureArenaElems(Arena& a, size_t num)
+	{
+		if(t != ARRAY)
+			return;
+
+		if(!arena)
+		{
+			arr->Ensure(num);
+			return;
+		}
+
+		if(num <= arr->n)
+			return;
+
+		size_t size = arr->n ? arr->n : 4;
+
+		while(size < num)
+			size *= COM_ENSURE_FACTOR;
+
+		arr->o = (JSVar*)a.Grow(arr->o, sizeof(JSVar) * arr->n, sizeof(JSVar) * size);
+
+		for(size_t i = arr->n; i < size; i++)
+			new(arr->o + i) JSVar;
+
+		arr->n = size;
+	}
+
+	type Type() const {return (type)t;}
+	bool InArena() const {return arena;}
 
 	double Double(int* errOut = 0) const
 	{
@@ -348,6 +416,18 @@ public:
 		if(t != ARRAY)
 			return 0;
 
+		if(arena && num > arr->n)
+		{
+			// Arena storage can't be reallocated
+			Arr<JSVar>* heapArr = new Arr<JSVar>(num);
+
+			for(size_t i = 0; i < n; i++)
+				heapArr->o[i] = arr->o[i];
+
+			arr = heapArr;
+			arena = false;
+		}
+
 		n = num;
 		arr->Ensure(n);
 		return n;
@@ -424,8 +504,56 @@ private:
 		Arr<JSVar>*		arr;
 	};
 
-	type	t;
-	size_t	n; // Number of array elements
+	unsigned char	t; // type
+	bool			arena; // Storage belongs to an arena
+	size_t			n; // Number of array elements
+
+	friend class JSDoc;
+};
+
+/*======================================
+	com::JSDoc
+
+JSON tree parsed into an arena. Nodes, keys and decoded strings come from the arena, and strings
+and keys without escapes point straight into the document's copy of the text. The tree can still
+be modified like any other.
+
+Free releases everything at once without visiting nodes, unless EditRoot was called since the
+last Free. Heap storage may only be put in the tree, whether by a Set function, Steal, or the
+assignment operator, after calling EditRoot; Free then walks the tree first.
+======================================*/
+class JSDoc
+{
+public:
+	JSDoc() : edited(false) {}
+	~JSDoc() {Free();}
+
+	bool	Parse(const char* json, unsigned* lineOut = 0);
+	bool	ParseFile(FILE* file, unsigned* lineOut = 0);
+	void	Free();
+
+	const JSVar&	Root() const {return root;}
+	JSVar&			EditRoot() {edited = true; return root;}
+	bool			Edited() const {return edited;}
+
+	// The tree can be changed in place through this without EditRoot, as long as nothing in it
+	// gets heap storage
+	JSVar&			ArenaRoot() {return root;}
+
+	// Frees the document so rootOut can be built by hand with the JSVar Arena functions
+	// Vars given heap storage through rootOut are not freed with the document; use EditRoot
+	Arena&	Reset(JSVar*& rootOut) {Free(); rootOut = &root; return arena;}
+	size_t	NumBytes() const {return arena.NumBytes();}
+
+private:
+	JSVar	root;
+	Arena	arena;
+	bool	edited; // EditRoot was called since the last Free
+
+	JSDoc(const JSDoc&);
+	JSDoc& operator=(const JSDoc&);
+
+	bool	ParseText(char* text, unsigned* lineOut);
 };
 
 }
@@ -185,6 +185,28 @@ template <typename t> t NextPow2(t n)
 	return n;
 }
 
+/*--------------------------------------
+	com::BenchRand
+
+Steps seedIO's linear congruential generator and returns its top 24 bits. The sequence only
+depends on the seed, so benchmarks and checks can rebuild the same data. Not for gameplay.
+--------------------------------------*/
+inline uint32_t BenchRand(uint32_t& seedIO)
+{
+	seedIO = seedIO * 1664525 + 1013904223;
+	return seedIO >> 8;
+}
+
+/*--------------------------------------
+	com::BenchRandF
+
+Returns a number in [0, 1) from BenchRand.
+--------------------------------------*/
+inline float BenchRandF(uint32_t& seedIO)
+{
+	return BenchRand(seedIO) * (1.0f / 16777216.0f);
+}
+
 /*--------------------------------------
 	com::FixedBits
 --------------------------------------*/
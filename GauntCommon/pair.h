@@ -4,8 +4,10 @@
 #ifndef COM_PAIR_H
 #define COM_PAIR_H
 
+#include <new>
 #include <string.h>
 
+#include "arena.h"
 #include "link.h"
 
 namespace com
@@ -13,15 +15,26 @@ namespace com
 
 template <class T> class PairMap;
 
+// FNV-1a
+inline unsigned PairKeyHash(const char* key)
+{
+	unsigned h = 2166136261u;
+
+	for(; *key; key++)
+		h = (h ^ (unsigned char)*key) * 16777619u;
+
+	return h;
+}
+
 /*======================================
 	com::Pair
 ======================================*/
 template <class T> class Pair
 {
 public:
-	Pair() : key(0), prev(0), next(0) {}
+	Pair() : key(0), hash(0), prev(0), next(0) {}
 
-	Pair(const char* k) : key(0), prev(0), next(0)
+	Pair(const char* k) : key(0), hash(0), prev(0), next(0)
 	{
 		SetKey(k);
 	}
@@ -40,9 +53,10 @@ public:
 	const Pair<T>*	Next() const {return next;}
 
 private:
-	char*	key;
-	T		value;
-	Pair<T>	*prev, *next;
+	char*		key;
+	unsigned	hash;
+	T			value;
+	Pair<T>		*prev, *next;
 
 	void SetKey(const char* k)
 	{
@@ -53,6 +67,7 @@ private:
 		{
 			key = new char[strlen(k) + 1];
 			strcpy(key, k);
+			hash = PairKeyHash(k);
 		}
 	}
 
@@ -61,30 +76,62 @@ private:
 
 /*======================================
 	com::PairMap
+
+Once a map has more than indexThreshold pairs, key lookups go through an open-addressing hash
+index instead of walking the list. The list stays in insertion order either way.
+
+A map given an arena takes its pairs, keys and index from it. Those are never deleted, not even
+by the destructor; they go away when the arena is freed.
 ======================================*/
 template <class T> class PairMap
 {
 public:
-	PairMap() : first(0), last(0), n(0) {}
+	static size_t indexThreshold;
 
-	PairMap(PairMap<T>&& pm) : first(pm.first), last(pm.last), n(pm.n)
+	PairMap() : first(0), last(0), n(0), table(0), tableSize(0), arena(0) {}
+	PairMap(Arena* a) : first(0), last(0), n(0), table(0), tableSize(0), arena(a) {}
+
+	PairMap(PairMap<T>&& pm) : first(pm.first), last(pm.last), n(pm.n), table(pm.table),
+		tableSize(pm.tableSize), arena(pm.arena)
 	{
 		pm.first = pm.last = 0;
 		pm.n = 0;
+		pm.table = 0;
+		pm.tableSize = 0;
 	}
 
 	~PairMap()
 	{
+		if(arena)
+			return;
+
 		while(first)
 		{
 			Pair<T>* save = first;
 			COM_UNLINK_F(first, last, first);
 			delete save;
 		}
+
+		if(table)
+			delete[] table;
 	}
 
 	const Pair<T>* Find(const char* key) const
 	{
+		if(table)
+		{
+			unsigned h = PairKeyHash(key);
+			size_t mask = tableSize - 1;
+
+			for(size_t i = h & mask; table[i]; i = (i + 1) & mask)
+			{
+				if(table[i]->hash == h && !strcmp(table[i]->key, key))
+					return table[i];
+			}
+
+			return 0;
+		}
+
 		Pair<T>* p = first;
 
 		while(p && strcmp(p->Key(), key))
@@ -135,21 +182,27 @@ public:
 	// Returned pair's value is unknown; do not read until setting it
 	Pair<T>* Ensure(const char* key)
 	{
-		if(Pair<T>* found = Find(key))
-			return found;
+		return Ensure(key, false);
+	}
 
-		Pair<T>* p = new Pair<T>(key);
-		COM_LINK_F(first, last, p);
-		n++;
-		return p;
+	// Arena maps only; key is not copied and must stay unchanged while the arena is alive
+	Pair<T>* EnsureBorrowed(const char* key)
+	{
+		return Ensure(key, true);
 	}
 
 	// Nullifies the pair's key, making it inaccessible
 	// When and whether pair and its value are deleted is undefined; do not access after calling
 	void UnsetKey(Pair<T>& pair)
 	{
+		if(table)
+			Unindex(&pair);
+
 		COM_UNLINK_F(first, last, &pair);
-		delete &pair;
+
+		if(!arena)
+			delete &pair;
+
 		n--;
 	}
 
@@ -174,11 +227,102 @@ public:
 private:
 	Pair<T>	*first, *last;
 	size_t n;
+	Pair<T>** table; // Power-of-two size, linear probing, at most half full
+	size_t tableSize;
+	Arena* arena;
 
 	PairMap(const PairMap<T>&);
 	PairMap<T>& operator=(const PairMap<T>&);
+
+	Pair<T>* Ensure(const char* key, bool borrow)
+	{
+		if(Pair<T>* found = Find(key))
+			return found;
+
+		Pair<T>* p;
+
+		if(arena)
+		{
+			p = new(arena->Alloc(sizeof(Pair<T>))) Pair<T>;
+			p->key = borrow ? (char*)key : arena->Copy(key, strlen(key));
+			p->hash = PairKeyHash(key);
+		}
+		else
+			p = new Pair<T>(key);
+
+		COM_LINK_F(first, last, p);
+		n++;
+
+		if(table)
+		{
+			if(n * 2 > tableSize)
+				Rehash(tableSize * 2);
+			else
+				Index(p);
+		}
+		else if(n > indexThreshold)
+			Rehash(IndexSizeFor(n));
+
+		return p;
+	}
+
+	static size_t IndexSizeFor(size_t num)
+	{
+		size_t size = 64;
+		for(; size < num * 4; size *= 2);
+		return size;
+	}
+
+	void Rehash(size_t size)
+	{
+		if(arena)
+			table = (Pair<T>**)arena->Alloc(sizeof(Pair<T>*) * size);
+		else
+		{
+			if(table)
+				delete[] table;
+
+			table = new Pair<T>*[size];
+		}
+
+		tableSize = size;
+		memset(table, 0, sizeof(Pair<T>*) * size);
+
+		for(Pair<T>* p = first; p; p = p->next)
+			Index(p);
+	}
+
+	void Index(Pair<T>* p)
+	{
+		size_t mask = tableSize - 1, i = p->hash & mask;
+		for(; table[i]; i = (i + 1) & mask);
+		table[i] = p;
+	}
+
+	// Backward-shift deletion so no tombstones are needed
+	void Unindex(Pair<T>* p)
+	{
+		size_t mask = tableSize - 1, i = p->hash & mask;
+		for(; table[i] != p; i = (i + 1) & mask);
+
+		for(size_t j = (i + 1) & mask; table[j]; j = (j + 1) & mask)
+		{
+			size_t home = table[j]->hash & mask;
+
+			// Move j into the hole if its probe sequence passes through the hole
+			if(((j - home) & mask) >= ((j - i) & mask))
+			{
+				table[i] = table[j];
+				i = j;
+			}
+		}
+
+		table[i] = 0;
+	}
 };
 
+template <class T> size_t PairMap<T>::indexThreshold = 16;
+
 }
 
 #endif
\ No newline at end of file